@@ -0,0 +1,102 @@
+/* ===========================================================
+   GATEWAY CONFIG IMAGE
+   Binary form of the bootstrap config, written once on import
+   and read at boot without a JSON parse:
+
+     CfgImageHeader | CfgGatewayRec | CfgNodeRec * nodeCount
+
+   The header CRC covers header + gateway record, every node
+   record carries its own CRC, so boot reads and checks only
+   the records it keeps. Shared by gateway.cpp and the host
+   benchmark in sim/, so no Arduino dependencies here.
+   =========================================================== */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CFG_IMAGE_MAGIC   0x46435747UL  // "GWCF"
+#define CFG_IMAGE_VERSION 1
+
+struct __attribute__((packed)) CfgImageHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t headerSize;      // sizeof(CfgImageHeader) + sizeof(CfgGatewayRec)
+  uint16_t nodeRecordSize;
+  uint16_t reserved;
+  uint32_t nodeCount;
+  uint32_t crc;             // over header (crc = 0) and gateway record
+};
+
+struct __attribute__((packed)) CfgGatewayRec {
+  char     gatewayId[24];
+  char     apn[32];
+  char     broker[64];
+  uint16_t port;
+  int32_t  configVersion;
+  uint8_t  encoding;        // WireEncoding
+  uint8_t  statusBatch;
+  uint8_t  perNodeTopics;
+  uint8_t  batchSize;
+  uint32_t batchWindowMs;
+  uint32_t loraFreq;
+  uint32_t loraBw;
+  uint8_t  loraSf;
+  uint8_t  loraCr;
+  uint16_t dutyPermille;
+};
+
+struct __attribute__((packed)) CfgNodeRec {
+  char     nodeId[24];
+  uint8_t  onHour, onMin;
+  uint8_t  offHour, offMin;
+  uint8_t  configVersion;
+  uint32_t regIntervalMs;
+  uint32_t statusIntervalMs;
+  uint32_t crc;             // over the fields above
+};
+
+inline uint32_t cfgCrc32(const void* data, size_t len, uint32_t crc = 0) {
+  const uint8_t* p = (const uint8_t*)data;
+  crc = ~crc;
+  while (len--) {
+    crc ^= *p++;
+    for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xEDB88320UL & (0 - (crc & 1)));
+  }
+  return ~crc;
+}
+
+inline uint32_t cfgImageCrc(const CfgImageHeader &h, const CfgGatewayRec &g) {
+  CfgImageHeader tmp = h;
+  tmp.crc = 0;
+  return cfgCrc32(&g, sizeof(g), cfgCrc32(&tmp, sizeof(tmp)));
+}
+
+inline void cfgImageSeal(CfgImageHeader &h, const CfgGatewayRec &g, uint32_t nodeCount) {
+  h.magic = CFG_IMAGE_MAGIC;
+  h.version = CFG_IMAGE_VERSION;
+  h.headerSize = sizeof(CfgImageHeader) + sizeof(CfgGatewayRec);
+  h.nodeRecordSize = sizeof(CfgNodeRec);
+  h.reserved = 0;
+  h.nodeCount = nodeCount;
+  h.crc = cfgImageCrc(h, g);
+}
+
+inline bool cfgImageValid(const CfgImageHeader &h, const CfgGatewayRec &g) {
+  return h.magic == CFG_IMAGE_MAGIC && h.version == CFG_IMAGE_VERSION &&
+         h.headerSize == sizeof(CfgImageHeader) + sizeof(CfgGatewayRec) &&
+         h.nodeRecordSize == sizeof(CfgNodeRec) && h.crc == cfgImageCrc(h, g);
+}
+
+inline void cfgNodeSeal(CfgNodeRec &r) {
+  r.crc = cfgCrc32(&r, offsetof(CfgNodeRec, crc));
+}
+
+inline bool cfgNodeValid(const CfgNodeRec &r) {
+  return r.crc == cfgCrc32(&r, offsetof(CfgNodeRec, crc));
+}
+
+// Byte offset of node record i
+inline uint32_t cfgNodeOffset(uint32_t i) {
+  return sizeof(CfgImageHeader) + sizeof(CfgGatewayRec) + i * sizeof(CfgNodeRec);
+}
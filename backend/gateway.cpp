@@ -2,7 +2,8 @@
    Focus of this version:
    - Robust node control (ON/OFF) with ACKs
    - Non-blocking command queue
-   - Scalable up to 10 nodes
+   - Up to MAX_NODES (50) nodes per gateway, looked up through a hash index
+   - Radio and uplink (modem/MQTT) run as separate tasks on separate cores
 */
 
 #include <Arduino.h>
@@ -16,6 +17,7 @@
 #include <ArduinoJson.h>
 #include <Preferences.h>
 #include <WiFi.h> // optional (for MAC if needed)
+#include "config_image.h"
 
 // ---------------- LoRa Pins (adjust to your board) ----------------
 #define LORA_SCK  18
@@ -39,15 +41,56 @@
 String APN = DEFAULT_APN;
 
 // ---------------- Filesystem ----------------
-const char *CONFIG_PATH = "/gateway_config.json";
+const char *CONFIG_PATH = "/gateway_config.json";  // legacy, imported once into the config image
 
 // ---------------- MQTT default/fallback broker ----------------
 const char* DEFAULT_BROKER = "103.20.215.109";
 const int DEFAULT_PORT = 1883;
 
 // ---------------- Hardware objects ----------------
+// The modem UART as TinyGSM sees it. While the link is up, ModemLink's
+// CGATT? probe can read socket URCs (CLOSED, +CIPRXGET: 1,0) that belong to
+// TinyGSM; it hands those lines back here and they are replayed ahead of
+// the port. Both users run in the uplink task, so there is no locking.
+#define MODEM_HANDBACK_SIZE 128
+
+struct ModemPort : public Stream {
+  Stream &uart;
+  char back[MODEM_HANDBACK_SIZE];
+  uint8_t backHead = 0;
+  uint8_t backLen = 0;
+  uint32_t backDrops = 0;   // lines that did not fit, lost to TinyGSM
+
+  explicit ModemPort(Stream &u) : uart(u) {}
+
+  // Queues a line (without its CRLF) for TinyGSM
+  bool handBack(const char* s) {
+    size_t n = strlen(s);
+    if (backLen + n + 2 > sizeof(back)) { backDrops++; return false; }
+    for (size_t i = 0; i < n + 2; i++) {
+      char c = i < n ? s[i] : (i == n ? '\r' : '\n');
+      back[(backHead + backLen++) % sizeof(back)] = c;
+    }
+    return true;
+  }
+
+  int available() override { return backLen + uart.available(); }
+  int peek() override { return backLen ? (uint8_t)back[backHead] : uart.peek(); }
+  int read() override {
+    if (backLen == 0) return uart.read();
+    uint8_t c = (uint8_t)back[backHead];
+    backHead = (backHead + 1) % sizeof(back);
+    backLen--;
+    return c;
+  }
+  size_t write(uint8_t c) override { return uart.write(c); }
+  size_t write(const uint8_t* b, size_t n) override { return uart.write(b, n); }
+  void flush() override { uart.flush(); }
+};
+
 HardwareSerial sim900(1);
-TinyGsm modem(sim900);
+ModemPort modemPort(sim900);
+TinyGsm modem(modemPort);
 TinyGsmClient gsmClient(modem);
 PubSubClient mqtt(gsmClient);
 
@@ -63,18 +106,22 @@ unsigned long lastTelemetry = 0;
 const unsigned long TELEMETRY_INTERVAL = 60000UL; // 60s
 unsigned long lastMqttReconnect = 0;
 
-// ---------------- GPRS fail monitoring ----------------
-const unsigned long GPRS_CHECK_INTERVAL = 1000UL;     // Check every 1 second
-const unsigned long GPRS_RECONNECT_DELAY = 5000UL;    // Wait 5s before retrying after failure
-unsigned long lastGprsCheck = 0;
-unsigned long lastGprsAttempt = 0;
-unsigned long gprsFailStart = 0;
-bool gprsWasConnected = false;
-
 // ---------------- ACK / Command timing ----------------
-#define ACK_TIMEOUT_MS 800UL     // wait this long before retry
+#define ACK_TIMEOUT_MS 800UL     // initial RTO, until a node has RTT samples
 #define MAX_ATTEMPTS   3         // max tries per command
 #define MAX_PENDING    10        // max queued commands (up to 10 nodes)
+#define CMD_WINDOW     4         // max commands in flight at once (1 = stop-and-wait)
+#define CMD_ACK_GUARD_MS 30UL    // node GW_TURNAROUND_MS + loop latency before its ACK starts
+
+// Per-node retransmission timeout, RFC 6298 style: RTT is measured from the
+// end of our TX to the ACK's RxDone, SRTT/RTTVAR are smoothed with gains
+// 1/8 and 1/4, RTO = SRTT + max(G, 4*RTTVAR). Retries back off
+// exponentially from the RTO, plus random jitter so nodes that lost the
+// same frame don't collide again.
+#define RTO_MIN_MS        150UL
+#define RTO_MAX_MS        6000UL
+#define RTO_GRANULARITY_MS 10UL   // G: radio task period plus TxDone polling
+#define RTO_JITTER_DIV    4       // jitter up to timeout/4
 
 // ---------------- Config structures ----------------
 struct NodeInfo {
@@ -83,22 +130,64 @@ struct NodeInfo {
   uint8_t onMin;
   uint8_t offHour;
   uint8_t offMin;
-  uint8_t configVersion;
+  uint8_t configVersion;    // desired version (bootstrap config / node config message)
+  uint32_t regIntervalMs;
+  uint32_t statusIntervalMs;
+
+  uint8_t appliedVersion;   // last version the node ACKed, valid if versionKnown
+  bool versionKnown;
+  unsigned long configRetryAt; // no rollout push before this (after a failed one)
+
+  uint16_t shortAddr;       // compact on-air address, 0 = none
+  bool shortConfirmed;      // node has acknowledged / is using shortAddr
+  unsigned long lastAssign; // last AssignPkt sent to this node
+
+  uint16_t srtt;            // smoothed ACK RTT (ms), valid once rttSamples > 0
+  uint16_t rttvar;          // RTT variation (ms)
+  uint16_t rto;             // current retransmission timeout (ms)
+  uint16_t rttSamples;
+
+  float    snrAvg;          // smoothed uplink SNR at the gateway (dB), for ADR
+  uint8_t  snrSamples;      // frames since the last reset / power change
+  unsigned long lastHeard;  // RxDone of the last frame from this node, 0 = never
+  int8_t   txPower;         // TX power (dBm) we last told the node to use
+
+  int8_t   ackedLight;      // state of the last ACKed control (1/0), LIGHT_UNKNOWN = not known / AUTO
+
+  uint8_t  wire;            // frame format the node last used (1/2), we answer in it
+  uint8_t  upSeq;           // last v2 sequence number from the node, valid if upSeqKnown
+  bool     upSeqKnown;
+  uint8_t  downSeq;         // next v2 sequence number to the node
 };
 
+#define LIGHT_UNKNOWN -1
+
 #define MAX_NODES 50
 NodeInfo nodeList[MAX_NODES];
 size_t nodeCount = 0;
 
+// Short addresses are sticky per node (persisted in Preferences) and range
+// 1..MAX_NODES; the group-control index of a node is shortAddr - 1.
+#define NO_SHORT_ADDR    0
+#define NO_NODE_INDEX    0xFF
+#define ASSIGN_RETRY_MS  30000UL  // min gap between AssignPkt to the same node
+#define GROUP_MASK_BYTES 7  // wire format: GroupControlPkt mask (must match node)
+static_assert(GROUP_MASK_BYTES == (MAX_NODES + 7) / 8,
+              "one group mask bit per node: change GROUP_MASK_BYTES here and in node.cpp together");
+#define GROUP_ACK_GUARD_MS 30UL  // node loop latency + turnaround per group ACK slot (must match node)
+
 // Gateway-level config (populated from SPIFFS or backend)
 String GATEWAY_ID = ""; // logical id e.g. "GW-1" (empty => not yet provisioned)
 uint32_t LORA_FREQUENCY = DEFAULT_LORA_FREQ;
 uint8_t  LORA_SF = DEFAULT_LORA_SF;
 uint32_t LORA_BW = DEFAULT_LORA_BW;
 uint8_t  LORA_CR = DEFAULT_LORA_CR;
+uint8_t  activeSf = DEFAULT_LORA_SF;  // SF on air: LORA_SF unless ADR sped the network up
 String MQTT_BROKER = DEFAULT_BROKER;
 int MQTT_PORT = DEFAULT_PORT;
 String backendDeviceTopicBase; // iot/gateway/<deviceId>/
+#define DEVICE_ID_LEN 18          // "device" + 12 hex digits, see getDeviceId()
+#define DEVICE_TOPIC_BASE_MAX (sizeof("iot/gateway//") - 1 + DEVICE_ID_LEN)
 String backendGatewayTopicBase; // iot/gateway/<gatewayId>/
 
 int configVersion = 0;
@@ -115,11 +204,39 @@ String topic_gateway_status;      // iot/gateway/<gatewayId>/status
 String topic_gateway_control;     // iot/gateway/<gatewayId>/control
 String topic_generic_register = "iot/gateway/register"; // global backend listen
 String topic_node_control;        // iot/gateway/<gatewayId>/node/+/control
+String topic_gateway_nodes_status; // iot/gateway/<gatewayId>/nodes/status (batched)
+
+// Hot-path topics are built with snprintf into stack buffers from this
+// prefix instead of String concatenation, so the RX path never touches the heap.
+#define TOPIC_MAX 96
+#define GATEWAY_ID_MAX (sizeof(CfgGatewayRec::gatewayId) - 1)  // longer ids are refused at import
+char uplinkTopicPrefix[sizeof("iot/gateway//") + GATEWAY_ID_MAX];  // "iot/gateway/<gatewayId or deviceId>/"
+
+// ---------------- Node status uplink ----------------
+#define MQTT_BUFFER_SIZE 2048     // PubSubClient default (256) is too small for batches/config
+#define MQTT_PAYLOAD_MAX (MQTT_BUFFER_SIZE - 128)  // leaves room for MQTT header + topic
+#define STATUS_BATCH_MAX 16       // entries per aggregate message
+
+// Payload encoding for MQTT traffic, negotiated via device_config "encoding".
+// Downlink is auto-detected per message, so either works at any time.
+enum WireEncoding { ENC_JSON = 0, ENC_MSGPACK = 1 };
+WireEncoding WIRE_ENCODING = ENC_JSON;
+
+bool STATUS_BATCH_ENABLED = true;            // aggregate node statuses per gateway
+bool STATUS_PER_NODE_TOPICS = false;         // also publish .../node/<id>/status
+unsigned long STATUS_BATCH_WINDOW_MS = 5000; // flush after this long ...
+uint8_t STATUS_BATCH_SIZE = STATUS_BATCH_MAX; // ... or this many nodes
 
 // ---------------- Packed structs used over LoRa ----------------
 struct __attribute__((packed)) BeaconPkt {
   uint8_t pktType; // 0x01
   uint32_t uptime_s;
+  uint16_t seq;        // beacon counter, selects the round
+  uint16_t periodMs;   // beacon interval
+  uint16_t slotMs;     // status slot length, 0 = no slots
+  uint8_t  slotCount;  // slots after each beacon
+  uint8_t  rounds;     // beacons per full cycle of slots
+  uint8_t  wireVersion; // highest frame format we decode; older nodes stop reading before it
 };
 struct __attribute__((packed)) RegisterPkt {
   uint8_t pktType; // 0x02
@@ -130,6 +247,8 @@ struct __attribute__((packed)) RegisterPkt {
 struct __attribute__((packed)) AssignPkt {
   uint8_t pktType; // 0x03
   char nodeId[24];
+  uint16_t shortAddr;
+  uint8_t gwTag;       // gatewayTag() the node must carry with shortAddr
 };
 struct __attribute__((packed)) ConfigPkt {
   uint8_t pktType; // 0x04
@@ -142,6 +261,7 @@ struct __attribute__((packed)) ConfigPkt {
   uint8_t cfgVer;
   uint32_t regIntervalMs;
   uint32_t statusIntervalMs;
+  uint8_t nodeIndex;   // shortAddr - 1, NO_NODE_INDEX if unknown
 };
 struct __attribute__((packed)) PolePacket {
   char nodeId[24];
@@ -168,511 +288,3209 @@ struct __attribute__((packed)) AckPkt {
   char     nodeId[24];  // who is acking
 };
 
+// ---- Short-address variants, used once a node has confirmed its shortAddr ----
+// A short address is only unique per gateway, so it always travels with
+// the gateway's tag (see gatewayTag())
+struct __attribute__((packed)) ShortConfigPkt {
+  uint8_t  pktType;     // 0x14
+  uint16_t shortAddr;
+  uint8_t  gwTag;
+  uint8_t  onHour;
+  uint8_t  onMin;
+  uint8_t  offHour;
+  uint8_t  offMin;
+  uint8_t  cfgVer;
+  uint32_t regIntervalMs;
+  uint32_t statusIntervalMs;
+};
+
+struct __attribute__((packed)) ShortStatusPkt {
+  uint8_t  pktType;     // 0x15
+  uint16_t shortAddr;
+  uint8_t  gwTag;
+  uint8_t  flags;       // bit0 = lightState, bit1 = fault
+  uint8_t  hour;
+  uint8_t  minute;
+};
+
+struct __attribute__((packed)) ShortAckPkt {
+  uint8_t  pktType;     // 0x16
+  uint16_t cmdId;       // 0 = confirms AssignPkt
+  uint16_t shortAddr;
+  uint8_t  gwTag;
+};
+
+struct __attribute__((packed)) ShortControlPkt {
+  uint8_t  pktType;     // 0x17
+  uint16_t cmdId;
+  uint16_t shortAddr;
+  uint8_t  gwTag;
+  bool     lightOn;
+};
+
+// ---- Group control: one frame switches every node whose bit is set ----
+struct __attribute__((packed)) GroupControlPkt {
+  uint8_t  pktType;                    // 0x09
+  uint16_t cmdId;
+  uint8_t  gwTag;
+  bool     lightOn;
+  uint8_t  mask[GROUP_MASK_BYTES];     // bit i = node with shortAddr i + 1
+};
+
+struct __attribute__((packed)) GroupAckPkt {
+  uint8_t  pktType;     // 0x0A
+  uint16_t cmdId;
+  uint8_t  nodeIndex;   // who is acking
+  uint8_t  gwTag;
+};
+
 struct __attribute__((packed)) LoRaConfigPkt {
-  uint8_t pktType;  // 0x08
+  uint8_t pktType;     // 0x08
+  uint16_t shortAddr;  // target node, 0 = every node
+  uint8_t gwTag;
   uint32_t freq;
   uint8_t sf;
   uint32_t bw;
   uint8_t cr;
+  int8_t txPower;      // dBm, 0 = keep current
+  uint8_t seq;         // ADR generation, for logs
+};
+
+// ---- Wire format v2: status, control and ACK without fixed-width ids ----
+// Header byte: version in the top three bits, then the v1 type, with 0x10
+// meaning short address as in v1 (0x45/0x55 status, 0x46/0x56 ACK,
+// 0x47/0x57 control). Then the address (2-byte shortAddr and the gateway
+// tag, or the 6-byte efuse id behind "node%012llX"), a sequence number per node and
+// direction, and the body. The beacon advertises the highest version we
+// decode; a node answers in v2 while it hears that, and we send v2 to a
+// node only once it has. v1 frames stay valid both ways.
+#define WIRE_VERSION     2      // advertised in BeaconPkt
+#define WIRE_VER_MASK    0xE0
+#define WIRE_V2          0x40
+#define WIRE_SHORT       0x10
+#define WIRE_TYPE_MASK   0x0F
+#define WIRE_CHIP_BYTES  6
+#define WIRE_V2_MAX      (1 + WIRE_CHIP_BYTES + 1 + 3)  // long control, the largest
+#define WIRE_SEQ_MAX_GAP 16     // a longer jump is a restart, not loss
+
+#define V2_LIGHT        0x0800  // V2StatusBody.state
+#define V2_FAULT        0x1000
+#define V2_MINUTE_MASK  0x07FF
+#define V2_LOST_SHIFT   13
+#define V2_CTRL_LIGHT_ON 0x01   // V2ControlBody.flags
+
+struct __attribute__((packed)) V2StatusBody {
+  uint16_t state;  // bits 0-10 minute of day, 11 light, 12 fault, 13-15 downlink frames lost since the last status (saturates)
+};
+
+struct __attribute__((packed)) V2ControlBody {
+  uint16_t cmdId;
+  uint8_t  flags;
+};
+
+struct __attribute__((packed)) V2AckBody {
+  uint16_t cmdId;  // 0 = confirms AssignPkt
 };
 
+struct V2Frame {
+  uint8_t  type;       // v1 type, short bit cleared (0x05, 0x06, 0x07)
+  bool     shortForm;
+  uint16_t shortAddr;  // valid if shortForm
+  uint8_t  gwTag;      // valid if shortForm
+  uint64_t chipId;     // valid if !shortForm
+  uint8_t  seq;
+  const uint8_t* body;
+  uint8_t  bodyLen;
+};
+
+enum CmdKind : uint8_t {
+  CMD_CONTROL = 0,  // ControlPkt, cmdId from the backend
+  CMD_CONFIG        // ConfigPkt from nodeList, cmdId = CMD_ID_CONFIG | configVersion
+};
+
+// Nodes ACK a config with this bit set on top of cfgVer, so a config ACK
+// can't complete a control command and vice versa; backend cmdIds stay below
+// it (must match node)
+#define CMD_ID_CONFIG 0x8000
+
+inline uint8_t ackKind(uint16_t cmdId) { return (cmdId & CMD_ID_CONFIG) ? CMD_CONFIG : CMD_CONTROL; }
+
 struct PendingCommand {
   uint16_t cmdId;
   char     nodeId[24];
   bool     lightOn;
+  uint8_t  kind;
 
-  unsigned long lastSend;  // millis of last TX
+  unsigned long lastSend;  // millis of last TX (queued)
+  unsigned long txEnd;     // TxDone of the last send, 0 while still queued
+  unsigned long deadline;  // retry/give-up time, set once txEnd is known
+  uint32_t enqSeq;         // enqueue order, keeps per-node commands FIFO
   uint8_t attempts;        // how many times sent
   bool active;             // has a valid command
+  bool inFlight;           // sent at least once, waiting for ACK
   bool done;               // completed (ACKed or failed)
 };
 
+struct GroupCommand {
+  uint16_t cmdId;
+  bool     lightOn;
+  uint8_t  pending[GROUP_MASK_BYTES];  // members that have not ACKed yet
+  uint8_t  unicast[GROUP_MASK_BYTES];  // members (by nodeList index) waiting for a unicast slot
+
+  unsigned long lastSend;
+  unsigned long txEnd;     // TxDone of the last send, 0 while still queued
+  uint8_t attempts;
+  bool active;
+};
+
 PendingCommand cmdQueue[MAX_PENDING];
-int currentCmdIndex = -1;
+GroupCommand groupCmd;
+uint32_t nextEnqSeq = 1;
+uint32_t coalescedCmds = 0;   // controls merged away or skipped instead of sent
+bool cmdTxQueued = false;         // a command frame waits in the TX queue or is on air
+unsigned long cmdChannelFreeAt = 0; // TxDone of the last command + room for its ACK
 uint16_t nextCmdId = 1;
 
 // ---------------- Helpers ----------------
+unsigned long dataLedOffAt = 0;
+
+// Non-blocking: serviceDataLED() in loop() turns it off again
 void blinkDataLED(int duration = 50) {
   digitalWrite(LED_DATA, HIGH);
-  delay(duration);
-  digitalWrite(LED_DATA, LOW);
+  dataLedOffAt = millis() + duration;
+  if (dataLedOffAt == 0) dataLedOffAt = 1;
 }
 
-volatile bool isLoRaBusy = false;  // global TX flag
-
-void sendLoRaPacket(const uint8_t* data, size_t len, bool silent = false) {
-  if (isLoRaBusy) {
-    Serial.println("[WARN] LoRa TX requested while busy, skipping...");
-    return;
+void serviceDataLED() {
+  if (dataLedOffAt != 0 && (long)(millis() - dataLedOffAt) >= 0) {
+    digitalWrite(LED_DATA, LOW);
+    dataLedOffAt = 0;
   }
-
-  isLoRaBusy = true;
-  LoRa.idle();        // ensure chip ready for TX
-  LoRa.beginPacket();
-  LoRa.write(data, len);
-  LoRa.endPacket(true);  // blocking until TX done (hardware)
-  delay(30);             // small guard
-  LoRa.receive();        // back to RX
-  if (!silent) Serial.println("[LORA] Back to RX mode");
-
-  blinkDataLED(20);
-  isLoRaBusy = false;
 }
 
-// --- GPRS management (unchanged) ---
-bool connectGPRS(bool fullRestart = false) {
-  static uint8_t retries = 0;
-  const uint8_t MAX_RETRIES = 10;
+// ---------------- Airtime ----------------
+// Time on air per Semtech AN1200.13 for the current SF/BW/CR, explicit
+// header, CRC on, 8-symbol preamble (LoRa library default).
+#define LORA_PREAMBLE_SYMBOLS 8
+
+uint32_t airtimeUs(uint8_t payloadLen) {
+  uint32_t tSymUs = (uint32_t)(((uint64_t)1000000 << activeSf) / LORA_BW);
+  int de = tSymUs > 16000 ? 1 : 0;  // low data rate optimize (SF11/12 @125k)
+  int num = 8 * payloadLen - 4 * activeSf + 28 + 16;
+  int den = 4 * (activeSf - 2 * de);
+  int nPayload = 8 + (num > 0 ? ((num + den - 1) / den) * LORA_CR : 0);
+  // (preamble + 4.25) symbols, in quarter symbols to stay in integers
+  uint32_t preambleUs = (tSymUs * (4 * LORA_PREAMBLE_SYMBOLS + 17)) / 4;
+  return preambleUs + (uint32_t)nPayload * tSymUs;
+}
 
-  if (fullRestart || retries >= MAX_RETRIES) {
-    Serial.println("[SIM900A] Full modem restart...");
-    modem.restart();
-    delay(3000);
-    retries = 0;
-  }
+// How long after a command's TxDone its node's ACK can still be on air.
+// The next command waits that long; a TX over the ACK would lose it.
+unsigned long cmdAckGapMs() {
+  return CMD_ACK_GUARD_MS + airtimeUs(sizeof(AckPkt)) / 1000 + 1;
+}
 
-  if (!modem.isNetworkConnected()) {
-    Serial.println("[SIM900A] Waiting for network...");
-    if (!modem.waitForNetwork(30000L)) {
-      retries++;
-      return false;
-    }
-  }
+bool cmdChannelBusy(unsigned long now) {
+  return cmdTxQueued || (long)(now - cmdChannelFreeAt) < 0;
+}
 
-  if (modem.isGprsConnected()) modem.gprsDisconnect();
-  delay(1000);
+// ---------------- Status slots ----------------
+// Nodes with a short address send their periodic status in a TDMA slot
+// timed from the end of the last beacon, instead of on free-running timers
+// (pure ALOHA). Slot i belongs to shortAddr i + 1. When more nodes are
+// addressed than fit in one beacon interval the slots repeat over several
+// rounds; a node reports in its slot of round (index / slotCount) once its
+// status interval is up. Everything else (commands, ACKs, registers,
+// unslotted nodes) stays in contention, and at least SLOT_CONTENTION_PCT of
+// each beacon interval is kept free for it. While the slots run only
+// command frames may leave the gateway, which is deaf while it transmits.
+#define SLOT_GUARD_MS       30UL   // node loop latency + timestamp jitter, must exceed node SLOT_LATE_MS
+#define SLOT_CONTENTION_PCT 40
+
+struct SlotPlan {
+  uint16_t slotMs;
+  uint8_t  slotCount;
+  uint8_t  rounds;
+};
 
-  Serial.printf("[SIM900A] Connecting GPRS (APN=%s)...\n", APN.c_str());
-  if (modem.gprsConnect(APN.c_str(), "", "")) {
-    Serial.println("[SIM900A] GPRS connected!");
-    retries = 0;
-    return true;
-  } else {
-    Serial.println("[SIM900A] GPRS connect failed.");
-    retries++;
-    return false;
-  }
+SlotPlan slotPlan = { 0, 0, 0 };      // plan carried by the last queued beacon
+unsigned long slotsEndAt = 0;         // end of the slot region after the last beacon
+uint16_t beaconSeq = 0;
+
+SlotPlan planSlots(uint16_t addressed) {
+  SlotPlan p = { 0, 0, 0 };
+  uint32_t slotMs = airtimeUs(sizeof(ShortStatusPkt)) / 1000 + 1 + SLOT_GUARD_MS;
+  uint32_t fit = BEACON_INTERVAL * (100 - SLOT_CONTENTION_PCT) / 100 / slotMs;
+  if (addressed == 0 || fit == 0) return p;
+  if (fit > 255) fit = 255;
+  uint32_t count = addressed < fit ? addressed : fit;
+  uint32_t rounds = (addressed + count - 1) / count;
+  p.slotMs = (uint16_t)slotMs;
+  p.slotCount = (uint8_t)count;
+  p.rounds = (uint8_t)(rounds > 255 ? 255 : rounds);
+  return p;
 }
 
-bool ensureGprsConnection() {
-  if (modem.isNetworkConnected() && modem.isGprsConnected()) return true;
-  Serial.println("[SIM900A] GPRS not connected, attempting recovery...");
-  return connectGPRS();
-}
+// ---------------- LoRa TX queue ----------------
+// sendLoRaPacket() only queues the frame. pumpLoRaTx() starts an async TX
+// when the radio is free; the TxDone interrupt wakes the radio task, which
+// puts the radio back into RX at once (finishLoRaTx), without fixed sleeps.
+//
+// Frames leave in priority order and only while the duty-cycle budget
+// allows: a token bucket refilled at the configured duty cycle and capped
+// at DUTY_WINDOW_MS worth of it. Lower classes must leave a reserve in the
+// bucket so control traffic can still go out when the channel is busy.
+// Within a class the node served longest ago goes first (FIFO for frames
+// not tied to a node), so one node's retries or pushes can't crowd out the
+// rest. Config and beacons also wait while a command's ACK is due, so they
+// don't talk over it.
+#define TX_QUEUE_SIZE 8
+#define TX_FRAME_MAX  64
+#define TX_TIMEOUT_MS 2000UL    // safety net past the frame's airtime if TxDone never fires
+
+enum TxPriority : uint8_t {
+  TX_PRIO_CONTROL = 0,  // first send of an operator command
+  TX_PRIO_RETRY,        // command retries, their ACK timers are running
+  TX_PRIO_CONFIG,       // config pushes, address assignment
+  TX_PRIO_BEACON,       // periodic beacons
+  TX_PRIO_COUNT
+};
+const uint8_t TX_RESERVE_PCT[TX_PRIO_COUNT] = { 0, 0, 25, 50 };  // bucket left untouched per class
+const char* const TX_PRIO_NAME[TX_PRIO_COUNT] = { "control", "retry", "config", "beacon" };
+#define TX_ACK_HOLD_MAX_MS 3000UL  // longest config/beacon frames wait out ACK windows
 
-String getDeviceId() {
-  uint64_t chipid = ESP.getEfuseMac();
-  char id[13];
-  snprintf(id, sizeof(id), "%012llX", (unsigned long long)chipid);
-  return String("device") + String(id);
-}
+#define DEFAULT_DUTY_CYCLE_PERMILLE 100    // 10 %, ETSI 433.05-434.79 MHz
+#define DUTY_WINDOW_MS              60000UL
 
-void applyLoRaParamsAndStart() {
-  LoRa.end();
-  delay(200);
-  if (!LoRa.begin(LORA_FREQUENCY)) {
-    Serial.println("[LORA] init FAILED");
-    return;
-  }
-  LoRa.setSpreadingFactor(LORA_SF);
-  LoRa.setSignalBandwidth(LORA_BW);
-  LoRa.setCodingRate4(LORA_CR);
-  LoRa.enableCrc();
-  LoRa.receive();
-  Serial.printf("[LORA] Started (Freq=%lu Hz, SF=%d, BW=%lu Hz, CR=4/%d)\n",
-                (unsigned long)LORA_FREQUENCY, LORA_SF, (unsigned long)LORA_BW, LORA_CR);
-}
+uint16_t DUTY_CYCLE_PERMILLE = DEFAULT_DUTY_CYCLE_PERMILLE;
 
-// ---- ACK event bus (ring buffer) ----
-struct AckEvent {
+struct TxFrame {
+  bool     used;
+  uint8_t  prio;
+  uint32_t seq;      // queue order within a class
+  uint8_t  len;
+  int8_t   cmdSlot;  // cmdQueue slot this frame belongs to, -1 = none, TX_CMD_GROUP = groupCmd
   uint16_t cmdId;
-  char     nodeId[24];
-  bool     success;  // true = matched a PendingCommand, false = stale/unmatched
+  uint8_t  node;     // nodeList index for fairness, NO_NODE_INDEX = none
+  unsigned long queuedAt;
+  uint8_t  data[TX_FRAME_MAX];
 };
 
-const uint8_t ACK_QUEUE_SIZE = 8;
-AckEvent ackQueue[ACK_QUEUE_SIZE];
-uint8_t ackHead = 0;  // next to read
-uint8_t ackTail = 0;  // next to write
-
-bool ackQueueIsEmpty() {
-  return ackHead == ackTail;
+TxFrame txQueue[TX_QUEUE_SIZE];
+uint8_t txQueued[TX_PRIO_COUNT];  // frames waiting per class
+uint32_t txSeq = 0;
+uint32_t txDrops = 0;
+uint32_t txTurn[MAX_NODES];       // txTurnSeq when the node last had a frame sent
+uint32_t txTurnSeq = 0;
+
+// Queue wait per class. The pump owns the counters; telemetry reads them
+// and bumps txWaitEpoch, which makes the pump restart the max.
+uint32_t txSent[TX_PRIO_COUNT];
+uint32_t txWaitSumMs[TX_PRIO_COUNT];
+uint32_t txWaitMaxMs[TX_PRIO_COUNT];
+volatile uint32_t txWaitEpoch = 0;
+uint32_t txWaitSeenEpoch = 0;
+
+uint32_t dutyTokensUs = 0;        // airtime we may still spend
+unsigned long dutyRefillAt = 0;
+uint32_t txDeferred = 0;          // pump passes that held a frame back for budget
+volatile uint32_t txAirtimeMs = 0;  // cumulative, for utilization in telemetry
+volatile uint32_t rxAirtimeMs = 0;
+uint32_t txAirtimeRemUs = 0;      // sub-ms remainders of the counters above
+uint32_t rxAirtimeRemUs = 0;
+
+volatile bool isLoRaBusy = false;  // TX in progress
+volatile bool dio0Pending = false;  // DIO0 edge not yet handled by serviceLoRaIrq()
+volatile unsigned long dio0At = 0;   // millis() of the last DIO0 edge
+unsigned long txStartedAt = 0;
+unsigned long txTimeoutMs = TX_TIMEOUT_MS;
+bool txSilent = false;
+int8_t txCmdSlot = -1;
+uint16_t txCmdId = 0;
+#define TX_CMD_GROUP -2
+
+uint32_t dutyCapacityUs() {
+  return DUTY_WINDOW_MS * DUTY_CYCLE_PERMILLE;  // ms * permille = us
 }
 
-bool ackQueueIsFull() {
-  return ((ackTail + 1) % ACK_QUEUE_SIZE) == ackHead;
+void refillDutyBudget() {
+  unsigned long now = millis();
+  uint32_t elapsed = now - dutyRefillAt;
+  if (elapsed == 0) return;
+  dutyRefillAt = now;
+  uint32_t cap = dutyCapacityUs();
+  uint64_t t = (uint64_t)dutyTokensUs + (uint64_t)elapsed * DUTY_CYCLE_PERMILLE;
+  dutyTokensUs = t > cap ? cap : (uint32_t)t;
 }
 
-void pushAckEvent(uint16_t cmdId, const char* nodeId, bool success) {
-  if (ackQueueIsFull()) {
-    Serial.println("[ACKQ] Queue full, dropping ACK event");
-    return;
-  }
-
-  AckEvent &e = ackQueue[ackTail];
-  e.cmdId = cmdId;
-  e.success = success;
-  memset(e.nodeId, 0, sizeof(e.nodeId));
-  strncpy(e.nodeId, nodeId, sizeof(e.nodeId) - 1);
+void addAirtime(volatile uint32_t &totalMs, uint32_t &remUs, uint32_t us) {
+  remUs += us;
+  totalMs += remUs / 1000;
+  remUs %= 1000;
+}
 
-  ackTail = (ackTail + 1) % ACK_QUEUE_SIZE;
+int txFreeSlots() {
+  int n = 0;
+  for (int i = 0; i < TX_QUEUE_SIZE; i++) if (!txQueue[i].used) n++;
+  return n;
 }
 
-bool popAckEvent(AckEvent &out) {
-  if (ackQueueIsEmpty()) return false;
-  out = ackQueue[ackHead];
-  ackHead = (ackHead + 1) % ACK_QUEUE_SIZE;
+bool sendLoRaPacket(const uint8_t* data, size_t len, uint8_t prio = TX_PRIO_CONTROL,
+                    int8_t cmdSlot = -1, uint16_t cmdId = 0, uint8_t node = NO_NODE_INDEX) {
+  int slot = -1;
+  for (int i = 0; i < TX_QUEUE_SIZE && slot < 0; i++) if (!txQueue[i].used) slot = i;
+  if (slot < 0 || len > TX_FRAME_MAX) {
+    txDrops++;
+    Serial.printf("[WARN] LoRa TX queue full, dropping frame type=%02X\n", data[0]);
+    return false;
+  }
+  TxFrame &f = txQueue[slot];
+  memcpy(f.data, data, len);
+  f.len = (uint8_t)len;
+  f.prio = prio < TX_PRIO_COUNT ? prio : TX_PRIO_COUNT - 1;
+  f.seq = txSeq++;
+  f.cmdSlot = cmdSlot;
+  f.cmdId = cmdId;
+  f.node = node < MAX_NODES ? node : NO_NODE_INDEX;
+  f.queuedAt = millis();
+  f.used = true;
+  txQueued[f.prio]++;
   return true;
 }
 
+uint32_t frameTurn(const TxFrame &f) {
+  return f.node != NO_NODE_INDEX ? txTurn[f.node] : 0;
+}
 
-// ---------------- Command queue (NEW LOGIC) ----------------
+// Most urgent non-empty class; within it the least recently served node,
+// then the oldest frame. -1 if none
+int nextTxFrame() {
+  int best = -1;
+  for (int i = 0; i < TX_QUEUE_SIZE; i++) {
+    const TxFrame &f = txQueue[i];
+    if (!f.used) continue;
+    if (best < 0 || f.prio < txQueue[best].prio) {
+      best = i;
+      continue;
+    }
+    if (f.prio != txQueue[best].prio) continue;
+    uint32_t ft = frameTurn(f), bt = frameTurn(txQueue[best]);
+    if (ft < bt || (ft == bt && (int32_t)(f.seq - txQueue[best].seq) < 0)) best = i;
+  }
+  return best;
+}
 
-void initPendingQueue() {
+// A sent command whose ACK may be on its way right now
+bool ackWindowOpen(unsigned long now) {
   for (int i = 0; i < MAX_PENDING; i++) {
-    cmdQueue[i].active = false;
-    cmdQueue[i].done = false;
-    cmdQueue[i].attempts = 0;
-    cmdQueue[i].lastSend = 0;
-    cmdQueue[i].cmdId = 0;
-    memset(cmdQueue[i].nodeId, 0, sizeof(cmdQueue[i].nodeId));
+    const PendingCommand &c = cmdQueue[i];
+    if (!c.active || c.done || !c.inFlight || c.txEnd == 0) continue;
+    if (c.deadline == 0 || (long)(now - c.deadline) < 0) return true;
   }
-  currentCmdIndex = -1;
+  return false;
 }
 
-// Called from MQTT handler
-void enqueuePendingCommand(const JsonDocument& doc) {
-  
-  const char* nodeId = doc["nodeId"] | "";
-  const char* action = doc["action"] | "";
+void noteTxWait(const TxFrame &f, unsigned long now) {
+  if (txWaitSeenEpoch != txWaitEpoch) {
+    txWaitSeenEpoch = txWaitEpoch;
+    memset(txWaitMaxMs, 0, sizeof(txWaitMaxMs));
+  }
+  uint32_t w = now - f.queuedAt;
+  txSent[f.prio]++;
+  txWaitSumMs[f.prio] += w;
+  if (w > txWaitMaxMs[f.prio]) txWaitMaxMs[f.prio] = w;
+  if (f.node != NO_NODE_INDEX) txTurn[f.node] = ++txTurnSeq;
+}
 
-  if (!nodeId[0] || !action[0]) {
-    Serial.println("[QUEUE] Invalid control payload, cannot enqueue");
-    return;
+// Back to RX the moment a TX ends: a node answers within a few ms
+// (its GW_TURNAROUND_MS), so this must not wait for the next pump pass
+void finishLoRaTx(unsigned long endedAt) {
+  isLoRaBusy = false;
+  LoRa.receive();    // back to RX
+  if (!txSilent) Serial.println("[LORA] Back to RX mode");
+
+  if (txSilent) slotsEndAt = endedAt + (unsigned long)slotPlan.slotMs * slotPlan.slotCount;
+
+  // The command's ACK timer runs from the end of its TX, not from queueing
+  if (txCmdSlot >= 0) {
+    cmdTxQueued = false;
+    cmdChannelFreeAt = endedAt + cmdAckGapMs();
+    PendingCommand &c = cmdQueue[txCmdSlot];
+    if (c.active && c.cmdId == txCmdId && c.txEnd == 0) c.txEnd = endedAt ? endedAt : 1;
+    txCmdSlot = -1;
+  } else if (txCmdSlot == TX_CMD_GROUP) {
+    // Members count their ACK slots from their RxDone, i.e. from here
+    if (groupCmd.active && groupCmd.cmdId == txCmdId && groupCmd.txEnd == 0) groupCmd.txEnd = endedAt ? endedAt : 1;
+    txCmdSlot = -1;
   }
+}
 
-  for (int i = 0; i < MAX_PENDING; i++) {
-    if (!cmdQueue[i].active) {
-      PendingCommand &c = cmdQueue[i];
-      c.active = true;
-      c.done = false;
-      c.cmdId = doc["cmdId"]; 
-      memset(c.nodeId, 0, sizeof(c.nodeId));
-      strncpy(c.nodeId, nodeId, sizeof(c.nodeId)-1);
-      c.lightOn = (strcasecmp(action, "ON") == 0);
+void pumpLoRaTx() {
+  if (isLoRaBusy) {
+    if (millis() - txStartedAt < txTimeoutMs) return;
+    Serial.println("[WARN] LoRa TX done not signalled, forcing RX");
+    finishLoRaTx(millis());
+  }
 
-      c.attempts = 0;
-      c.lastSend = 0;
+  int i = nextTxFrame();
+  if (i < 0) return;
+  TxFrame &f = txQueue[i];
 
-      Serial.printf("[QUEUE] Enqueued cmdId=%u for %s [%s]\n",
-                    c.cmdId, c.nodeId, c.lightOn ? "ON" : "OFF");
-      return;
-    }
+  // Keep the status slots clear of everything but first sends of commands.
+  // Their ACKs can still land on a slotted status; a retry, sent into the
+  // same run of slots, would mostly meet the same fate, so it waits.
+  unsigned long now = millis();
+  if (f.prio > TX_PRIO_CONTROL && (long)(now - slotsEndAt) < 0) return;
+
+  // A node ACKing while we transmit is deaf to us and we to it
+  if (f.prio > TX_PRIO_RETRY && now - f.queuedAt < TX_ACK_HOLD_MAX_MS && ackWindowOpen(now)) return;
+
+  // Strict priority: if the head of the best class can't afford its
+  // airtime yet, nothing behind it goes either
+  refillDutyBudget();
+  uint32_t cost = airtimeUs(f.len);
+  uint32_t reserve = (uint32_t)((uint64_t)dutyCapacityUs() * TX_RESERVE_PCT[f.prio] / 100);
+  if (dutyTokensUs < cost || dutyTokensUs - cost < reserve) {
+    txDeferred++;
+    return;
   }
-  Serial.println("[QUEUE] FULL — cannot enqueue new command");
+  dutyTokensUs -= cost;
+  addAirtime(txAirtimeMs, txAirtimeRemUs, cost);
+
+  f.used = false;
+  txQueued[f.prio]--;
+  noteTxWait(f, now);
+
+  isLoRaBusy = true;
+  txSilent = (f.prio == TX_PRIO_BEACON);
+  txCmdSlot = f.cmdSlot;
+  txCmdId = f.cmdId;
+  txStartedAt = millis();
+  txTimeoutMs = cost / 1000 + TX_TIMEOUT_MS;
+  dio0Pending = false;  // an unserviced RxDone is dropped by idle(), not a TxDone
+  LoRa.idle();        // ensure chip ready for TX
+  LoRa.beginPacket();
+  LoRa.write(f.data, f.len);
+  LoRa.endPacket(true);  // async, completion via DIO0 (serviceLoRaIrq)
+
+  blinkDataLED(20);
 }
 
-void sendCommand(PendingCommand &c) {
-  ControlPkt pkt;
-  pkt.pktType = 0x07;
-  pkt.cmdId   = c.cmdId;
-  memset(pkt.nodeId, 0, sizeof(pkt.nodeId));
-  strncpy(pkt.nodeId, c.nodeId, sizeof(pkt.nodeId)-1);
-  pkt.lightOn = c.lightOn;
+// ---------------- LoRa RX ring (filled from the radio task) ----------------
+// DIO0 rises on RxDone in RX and on TxDone in TX. Its interrupt only notes
+// the time and wakes the radio task: the SPI transfers (FIFO, RSSI/SNR)
+// are not IRAM-safe and would race the task for the bus. The task then
+// copies the frame out in serviceLoRaIrq(), before the next one can
+// overwrite it, and handleLoRaReceive() drains the ring.
+#define RX_RING_SIZE 8      // power of two
+#define RX_FRAME_MAX 64     // largest frame we accept (ConfigPkt = 62)
+
+struct RxFrame {
+  unsigned long at;   // millis() at RxDone
+  uint8_t len;
+  int16_t rssi;
+  float   snr;
+  uint8_t data[RX_FRAME_MAX];
+};
 
-  sendLoRaPacket((uint8_t*)&pkt, sizeof(pkt));
+RxFrame rxRing[RX_RING_SIZE];
+volatile uint8_t rxHead = 0;       // next to read (consumer)
+volatile uint8_t rxTail = 0;       // next to write (producer)
+volatile uint32_t rxOverruns = 0;  // frames lost because the ring was full
+volatile uint32_t rxOversize = 0;  // frames longer than RX_FRAME_MAX
 
-  c.lastSend = millis();
-  c.attempts++;
+extern TaskHandle_t radioTaskHandle;
 
-  Serial.printf("[CMD] Sent cmdId=%u → node=%s try=%d\n", c.cmdId, c.nodeId, c.attempts);
+void IRAM_ATTR onLoRaDio0() {
+  dio0At = millis();
+  dio0Pending = true;
+  BaseType_t woken = pdFALSE;
+  if (radioTaskHandle) vTaskNotifyGiveFromISR(radioTaskHandle, &woken);
+  if (woken) portYIELD_FROM_ISR();
 }
 
-// Called from LoRa receive path when ACK is parsed
-void handleAck(const AckPkt &ack) {
-  Serial.printf("[ACK] Received ack cmdId=%u from %s\n", ack.cmdId, ack.nodeId);
-  bool matched = false;
-
-  // 1) First prefer the current in-flight command
-  if (currentCmdIndex >= 0) {
-    PendingCommand &c = cmdQueue[currentCmdIndex];
-    if (c.active && !c.done && c.cmdId == ack.cmdId  && strncmp(c.nodeId, ack.nodeId, sizeof(c.nodeId)) == 0) {
-      Serial.printf("[CMD] ACK matched in-flight cmdId=%u (node=%s)\n", c.cmdId, c.nodeId);
-      c.done = true; 
-      c.active = false;
-      currentCmdIndex = -1;
-      matched = true;
-    }
+// Copies the received frame out of the FIFO; parsePacket() also clears the
+// IRQ flags (a CRC error reads as 0) and leaves continuous RX, so re-arm
+void readLoRaFrame(unsigned long at) {
+  int packetSize = LoRa.parsePacket();
+  if (packetSize <= 0) {
+    LoRa.receive();
+    return;
   }
 
-   // 2) Fallback scan in case timing was weird
-  if (!matched) {
-    for (int i = 0; i < MAX_PENDING; i++) {
-      PendingCommand &c = cmdQueue[i];
-      if (c.active && !c.done &&
-          c.cmdId == ack.cmdId &&
-          strncmp(c.nodeId, ack.nodeId, sizeof(c.nodeId)) == 0) {
+  uint8_t next = (rxTail + 1) & (RX_RING_SIZE - 1);
+  if (next == rxHead || packetSize > RX_FRAME_MAX) {
+    if (next == rxHead) rxOverruns++;
+    else rxOversize++;
+    while (LoRa.available()) LoRa.read();
+    LoRa.receive();
+    return;
+  }
 
-        Serial.printf("[CMD] ACK matched queued cmdId=%u (node=%s)\n",
-                      c.cmdId, c.nodeId);
+  RxFrame &f = rxRing[rxTail];
+  uint8_t n = 0;
+  while (LoRa.available() && n < RX_FRAME_MAX) f.data[n++] = (uint8_t)LoRa.read();
+  f.at   = at;
+  f.len  = n;
+  f.rssi = (int16_t)LoRa.packetRssi();
+  f.snr  = LoRa.packetSnr();
+  LoRa.receive();
 
-        c.done   = true;
-        c.active = false;
-        if (currentCmdIndex == i) currentCmdIndex = -1;
-        matched = true;
-        break;
-      }
-    }
-  }
+  __sync_synchronize();  // frame contents visible before publishing the slot
+  rxTail = next;
+}
 
-  if (!matched) {
-    Serial.println("[ACK] No matching command found for this ACK (stale/duplicate?)");
+// Acts on a DIO0 edge: TxDone while we transmit, RxDone otherwise
+void serviceLoRaIrq() {
+  if (!dio0Pending) return;
+  dio0Pending = false;
+  __sync_synchronize();
+  unsigned long at = dio0At;
+  if (isLoRaBusy) {
+    finishLoRaTx(at);
+  } else {
+    readLoRaFrame(at);
   }
+}
 
-  // 3) Emit event into the ring buffer (for backend / higher layers)
-  pushAckEvent(ack.cmdId, ack.nodeId, matched);
+bool popRxFrame(RxFrame &out) {
+  if (rxHead == rxTail) return false;
+  __sync_synchronize();
+  out = rxRing[rxHead];
+  __sync_synchronize();
+  rxHead = (rxHead + 1) & (RX_RING_SIZE - 1);
+  return true;
 }
 
-// Called from loop()
-void processPendingCommands() {
-  unsigned long now = millis();
+// ---------------- SIM900 link state machine ----------------
+// Brings the GPRS bearer up and watches it without ever blocking: step()
+// sends at most one AT command per call and otherwise just consumes the
+// bytes that have arrived, parsing responses and URCs a line at a time.
+// Once the link is up TinyGSM/PubSubClient own the socket traffic again;
+// ownsUart() tells the uplink task when to keep its hands off the port.
+// Lines read during the up-state probe that are not the probe's answer are
+// handed back to TinyGSM through the ModemPort. Only a Stream and millis()
+// are used, so a scripted fake stream can drive it off-target (see
+// sim/modem-link-test.cpp).
+#define AT_LINE_MAX             96
+#define AT_TIMEOUT_MS           2000UL
+#define MODEM_SYNC_TRIES        20
+#define MODEM_SYNC_GAP_MS       500UL
+#define MODEM_REG_POLL_MS       2000UL
+#define MODEM_REG_TIMEOUT_MS    60000UL
+#define MODEM_PROBE_INTERVAL_MS 5000UL   // CGATT? health probe while up
+#define MODEM_PROBE_MAX_MISSES  3        // unanswered probes before the link counts as lost
+#define MODEM_RETRY_DELAY_MS    5000UL   // wait before retrying a failed bring-up
+#define MODEM_MAX_FAILS         10       // failed bring-ups before a full modem reset
+#define MODEM_RESET_SETTLE_MS   5000UL   // boot time after AT+CFUN=1,1
+
+enum ModemLinkState : uint8_t {
+  LINK_RESET,     // AT+CFUN=1,1, then let the modem boot
+  LINK_SYNC,      // ATE0 until the modem answers
+  LINK_SIM,       // AT+CPIN? == READY
+  LINK_REGISTER,  // poll AT+CREG? until home/roaming
+  LINK_ATTACH,    // run ATTACH_SCRIPT
+  LINK_UP,        // bearer up, periodic AT+CGATT? probe
+  LINK_BACKOFF    // wait, then retry (or reset after too many failures)
+};
 
-  // If we have an in-flight command, check timeout/retry
-  if (currentCmdIndex >= 0) {
-    PendingCommand &c = cmdQueue[currentCmdIndex];
+enum ModemLinkEvent : uint8_t { MODEM_EVT_UP = 1, MODEM_EVT_DOWN };
 
-    // If it got completed or deactivated from handleAck
-    if (!c.active || c.done) {
-      currentCmdIndex = -1;
-      return;
-    }
+enum AtResult : uint8_t { AT_PENDING, AT_OK, AT_ERROR, AT_TIMEOUT };
 
-    // Check for retry timeout
-    if (now - c.lastSend >= ACK_TIMEOUT_MS) {
-      if (c.attempts >= MAX_ATTEMPTS) {
-        Serial.printf("[CMD] FAILED cmdId=%u node=%s after %d attempts\n",
-                      c.cmdId, c.nodeId, c.attempts);
-        c.done = true;
-        c.active = false;
-        currentCmdIndex = -1;
-      } else {
-        Serial.printf("[CMD] Timeout, retrying cmdId=%u...\n", c.cmdId);
-        sendCommand(c);
-      }
-    }
-    return;
+#define AT_WITH_APN   0x01  // cmd is a format string taking the APN
+#define AT_ENDS_ON_IP 0x02  // no final OK; the IP address line ends the command
+
+struct AtStep {
+  const char* cmd;
+  uint32_t    timeoutMs;
+  uint8_t     flags;
+};
+
+// Bearer bring-up, in the socket modes TinyGSM's SIM900 driver expects
+const AtStep ATTACH_SCRIPT[] = {
+  { "+CIPSHUT",                         65000UL,       0 },
+  { "+CGATT=1",                         60000UL,       0 },
+  { "+CIPMUX=1",                        AT_TIMEOUT_MS, 0 },
+  { "+CIPQSEND=1",                      AT_TIMEOUT_MS, 0 },
+  { "+CIPRXGET=1",                      AT_TIMEOUT_MS, 0 },
+  { "+CSTT=\"%s\",\"\",\"\"",           60000UL,       AT_WITH_APN },
+  { "+CIICR",                           60000UL,       0 },
+  { "+CIFSR;E0",                        10000UL,       AT_ENDS_ON_IP },
+  { "+CDNSCFG=\"8.8.8.8\",\"8.8.4.4\"", 10000UL,       0 },
+};
+#define ATTACH_STEPS (sizeof(ATTACH_SCRIPT) / sizeof(ATTACH_SCRIPT[0]))
+
+struct ModemLink {
+  Stream* io = nullptr;         // the raw UART
+  ModemPort* port = nullptr;    // where foreign lines go back while up
+  void (*onEvent)(uint8_t evt) = nullptr;
+  char apn[48] = "";
+
+  uint8_t state = LINK_RESET;
+  uint8_t stepIdx = 0;          // sync tries / script position
+  uint8_t fails = 0;            // consecutive failed bring-ups
+  uint8_t probeMisses = 0;
+  unsigned long stateAt = 0;    // when the current state was entered
+  unsigned long nextAt = 0;     // earliest time for the next command
+  uint32_t linkDrops = 0;
+
+  // Outstanding command
+  bool cmdActive = false;
+  uint8_t cmdFlags = 0;
+  uint8_t result = AT_PENDING;
+  unsigned long cmdAt = 0;
+  uint32_t cmdTimeout = 0;
+
+  // Parsed from responses and URCs
+  int8_t regStat = -1;
+  int8_t attached = -1;
+  bool simReady = false;
+  bool linkFault = false;       // +PDP: DEACT / power-down seen
+
+  char line[AT_LINE_MAX];
+  uint8_t lineLen = 0;
+
+  void begin(ModemPort &p, void (*cb)(uint8_t), bool reset) {
+    port = &p;
+    io = &p.uart;
+    onEvent = cb;
+    enter(reset ? LINK_RESET : LINK_SYNC, 0);
   }
 
-  // No in-flight command, pick next active one
-  for (int i = 0; i < MAX_PENDING; i++) {
-    PendingCommand &c = cmdQueue[i];
-    if (c.active && !c.done) {
-      currentCmdIndex = i;
-      sendCommand(c);
-      return;
-    }
+  void setApn(const char* a) {
+    strncpy(apn, a, sizeof(apn) - 1);
+    apn[sizeof(apn) - 1] = '\0';
   }
 
-  // No pending commands
-}
+  bool isUp() const { return state == LINK_UP; }
+  bool ownsUart() const { return state != LINK_UP || cmdActive; }
 
-// ---------------- Storage: save/load JSON config ----------------
-bool loadConfigFromSPIFFS() {
-  if (!SPIFFS.exists(CONFIG_PATH)) {
-    Serial.println("[CONFIG] no config file in SPIFFS");
-    return false;
-  }
-  File f = SPIFFS.open(CONFIG_PATH, FILE_READ);
-  if (!f) {
-    Serial.println("[SPIFFS] failed open config");
-    return false;
+  void enter(uint8_t s, unsigned long delayMs) {
+    state = s;
+    stepIdx = 0;
+    stateAt = millis();
+    nextAt = stateAt + delayMs;
+    if (s == LINK_SYNC || s == LINK_UP) linkFault = false;
   }
-  StaticJsonDocument<4096> doc;
-  DeserializationError err = deserializeJson(doc, f);
-  f.close();
-  if (err) {
-    Serial.print("[CONFIG] deserialize error: ");
-    Serial.println(err.c_str());
-    return false;
+
+  void send(const char* cmd, uint32_t timeoutMs, uint8_t flags = 0) {
+    // Anything left over is a URC, not part of this answer. Once the link
+    // is up, pending bytes are TinyGSM's and stay in the UART.
+    if (state != LINK_UP) readLines();
+    io->print("AT");
+    io->print(cmd);
+    io->print("\r");
+    cmdActive = true;
+    cmdFlags = flags;
+    result = AT_PENDING;
+    cmdAt = millis();
+    cmdTimeout = timeoutMs;
   }
 
-  GATEWAY_ID = String(doc["gatewayId"] | "");
-  LORA_FREQUENCY = doc["lora"]["frequency"] | LORA_FREQUENCY;
-  LORA_SF = doc["lora"]["spreadingFactor"] | LORA_SF;
-  LORA_BW = doc["lora"]["bandwidth"] | LORA_BW;
-  LORA_CR = doc["lora"]["codingRate"] | LORA_CR;
-  APN = String(doc["apn"] | APN);
-  MQTT_BROKER = String(doc["mqtt"]["broker"] | MQTT_BROKER);
-  MQTT_PORT = doc["mqtt"]["port"] | MQTT_PORT;
-  configVersion = doc["configVersion"] | configVersion;
-
-  nodeCount = 0;
-  if (doc.containsKey("nodes") && doc["nodes"].is<JsonArray>()) {
-    JsonArray nodes = doc["nodes"].as<JsonArray>();
-    for (JsonObject n : nodes) {
-      if (nodeCount >= MAX_NODES) break;
-      String nid = String(n["nodeId"] | "");
-      strncpy(nodeList[nodeCount].nodeId, nid.c_str(), sizeof(nodeList[nodeCount].nodeId)-1);
-      nodeList[nodeCount].onHour = n["config"]["onHour"] | 0;
-      nodeList[nodeCount].onMin  = n["config"]["onMin"]  | 0;
-      nodeList[nodeCount].offHour = n["config"]["offHour"] | 0;
-      nodeList[nodeCount].offMin  = n["config"]["offMin"] | 0;
-      nodeList[nodeCount].configVersion = n["configVersion"] | 0;
-      nodeCount++;
+  void sendStep(const AtStep &st) {
+    if (st.flags & AT_WITH_APN) {
+      char cmd[AT_LINE_MAX];
+      snprintf(cmd, sizeof(cmd), st.cmd, apn);
+      send(cmd, st.timeoutMs, st.flags);
+    } else {
+      send(st.cmd, st.timeoutMs, st.flags);
     }
   }
 
-  if (GATEWAY_ID.length() > 0) {
-    backendGatewayTopicBase = "iot/gateway/" + GATEWAY_ID + "/";
-    topic_gateway_config_set = backendGatewayTopicBase + "config/set";
-    topic_gateway_config_get = backendGatewayTopicBase + "config/get";
-    topic_gateway_node_assign = backendGatewayTopicBase + "node/assign";
-    topic_gateway_node_config = backendGatewayTopicBase + "node/+/config/set";
-    topic_gateway_status = backendGatewayTopicBase + "status";
-    topic_gateway_control = backendGatewayTopicBase + "control";
-    topic_node_control = backendGatewayTopicBase + "node/+/control";
+  void parseLine() {
+    if (strncmp(line, "AT", 2) == 0) return;  // command echo
+    if (strcmp(line, "OK") == 0 || strcmp(line, "SHUT OK") == 0) {
+      if (cmdActive) result = AT_OK;
+    } else if (strcmp(line, "ERROR") == 0 || strncmp(line, "+CME ERROR", 10) == 0) {
+      if (cmdActive) result = AT_ERROR;
+    } else if (strncmp(line, "+CREG: ", 7) == 0) {
+      // "+CREG: <n>,<stat>" answer or "+CREG: <stat>" URC
+      const char* comma = strchr(line, ',');
+      regStat = (int8_t)atoi(comma ? comma + 1 : line + 7);
+    } else if (strncmp(line, "+CGATT: ", 8) == 0) {
+      attached = (int8_t)atoi(line + 8);
+    } else if (strncmp(line, "+CPIN: ", 7) == 0) {
+      simReady = strcmp(line + 7, "READY") == 0;
+    } else if (strcmp(line, "+PDP: DEACT") == 0 || strstr(line, "POWER DOWN")) {
+      linkFault = true;
+    } else if (cmdActive && (cmdFlags & AT_ENDS_ON_IP) && isdigit((unsigned char)line[0]) && strchr(line, '.')) {
+      result = AT_OK;
+    } else if (state == LINK_UP && port) {
+      port->handBack(line);  // a socket URC, TinyGSM's to handle
+    }
   }
 
-  Serial.printf("[CONFIG] loaded gatewayId=%s nodes=%d freq=%lu broker=%s:%d\n",
-                GATEWAY_ID.c_str(), nodeCount, (unsigned long)LORA_FREQUENCY, MQTT_BROKER.c_str(), MQTT_PORT);
-  return true;
-}
+  // While up, stops at the probe's final line: what follows is TinyGSM's
+  void readLines() {
+    while (io->available() && !(state == LINK_UP && result != AT_PENDING)) {
+      char c = (char)io->read();
+      if (c == '\n') {
+        line[lineLen] = '\0';
+        if (lineLen > 0) parseLine();
+        lineLen = 0;
+      } else if (c != '\r' && lineLen < AT_LINE_MAX - 1) {
+        line[lineLen++] = c;
+      }
+    }
+  }
 
-bool saveConfigToSPIFFS(const JsonDocument& doc) {
-  SPIFFS.remove(CONFIG_PATH);
-  File f = SPIFFS.open(CONFIG_PATH, FILE_WRITE);
-  if (!f) {
-    Serial.println("[SPIFFS] failed to open config for writing");
-    return false;
+  void fail(const char* why) {
+    fails++;
+    Serial.printf("[SIM900A] Bring-up failed (%s), attempt %u\n", why, fails);
+    enter(LINK_BACKOFF, MODEM_RETRY_DELAY_MS);
   }
-  if (serializeJson(doc, f) == 0) {
-    Serial.println("[SPIFFS] failed to write config");
-    f.close();
-    return false;
+
+  void lost(const char* why) {
+    linkDrops++;
+    Serial.printf("[SIM900A] GPRS lost (%s)\n", why);
+    enter(LINK_SYNC, 0);
+    if (onEvent) onEvent(MODEM_EVT_DOWN);  // before we touch the UART again
   }
-  f.close();
-  Serial.println("[CONFIG] saved config to SPIFFS");
-  return true;
+
+  void step() {
+    unsigned long now = millis();
+    uint8_t r = AT_PENDING;
+
+    if (cmdActive) {
+      readLines();
+      if (result == AT_PENDING && now - cmdAt >= cmdTimeout) result = AT_TIMEOUT;
+      if (result == AT_PENDING) return;
+      r = result;
+      cmdActive = false;
+    } else {
+      if (state != LINK_UP) readLines();  // the port is ours until the link is up
+      if (state == LINK_UP && linkFault) { lost("URC"); return; }
+      if ((long)(now - nextAt) < 0) return;
+    }
+
+    // r == AT_PENDING: time to issue this state's command; else handle its result
+    switch (state) {
+      case LINK_RESET:
+        if (r == AT_PENDING) { send("+CFUN=1,1", 10000UL); return; }
+        Serial.println("[SIM900A] Modem reset");
+        fails = 0;
+        enter(LINK_SYNC, MODEM_RESET_SETTLE_MS);
+        break;
+
+      case LINK_SYNC:
+        if (r == AT_PENDING) { send("E0", 1000UL); return; }
+        if (r == AT_OK) enter(LINK_SIM, 0);
+        else if (++stepIdx >= MODEM_SYNC_TRIES) fail("no response");
+        else nextAt = now + MODEM_SYNC_GAP_MS;
+        break;
+
+      case LINK_SIM:
+        if (r == AT_PENDING) { simReady = false; send("+CPIN?", 5000UL); return; }
+        if (r == AT_OK && simReady) enter(LINK_REGISTER, 0);
+        else fail("SIM not ready");
+        break;
+
+      case LINK_REGISTER:
+        if (r == AT_PENDING) { regStat = -1; send("+CREG?", AT_TIMEOUT_MS); return; }
+        if (r == AT_OK && (regStat == 1 || regStat == 5)) {
+          Serial.printf("[SIM900A] Registered (%s)\n", regStat == 1 ? "home" : "roaming");
+          enter(LINK_ATTACH, 0);
+        } else if (now - stateAt >= MODEM_REG_TIMEOUT_MS) {
+          fail("not registered");
+        } else {
+          nextAt = now + MODEM_REG_POLL_MS;
+        }
+        break;
+
+      case LINK_ATTACH:
+        if (r == AT_PENDING) {
+          if (stepIdx == 0) Serial.printf("[SIM900A] Connecting GPRS (APN=%s)...\n", apn);
+          sendStep(ATTACH_SCRIPT[stepIdx]);
+          return;
+        }
+        if (r != AT_OK) { fail(ATTACH_SCRIPT[stepIdx].cmd); break; }
+        if (++stepIdx < ATTACH_STEPS) break;
+        fails = 0;
+        probeMisses = 0;
+        enter(LINK_UP, MODEM_PROBE_INTERVAL_MS);
+        if (onEvent) onEvent(MODEM_EVT_UP);
+        break;
+
+      case LINK_UP:
+        if (r == AT_PENDING) { attached = -1; send("+CGATT?", AT_TIMEOUT_MS); return; }
+        if (linkFault) lost("URC");
+        else if (r == AT_OK && attached == 1) { probeMisses = 0; nextAt = now + MODEM_PROBE_INTERVAL_MS; }
+        else if (r == AT_OK) lost("detached");
+        else if (++probeMisses >= MODEM_PROBE_MAX_MISSES) lost("no answer");
+        else nextAt = now + MODEM_SYNC_GAP_MS;
+        break;
+
+      case LINK_BACKOFF:
+        enter(fails >= MODEM_MAX_FAILS ? LINK_RESET : LINK_SYNC, 0);
+        break;
+    }
+  }
+};
+
+ModemLink modemLink;
+
+void updateUplinkTopicPrefix() {
+  snprintf(uplinkTopicPrefix, sizeof(uplinkTopicPrefix), "iot/gateway/%.*s/", (int)GATEWAY_ID_MAX,
+           GATEWAY_ID.length() > 0 ? GATEWAY_ID.c_str() : deviceIdStr.c_str());
+}
+
+String getDeviceId() {
+  uint64_t chipid = ESP.getEfuseMac();
+  char id[13];
+  snprintf(id, sizeof(id), "%012llX", (unsigned long long)chipid);
+  return String("device") + String(id);
+}
+
+// ---------------- Node / command index ----------------
+// Fixed-capacity open-addressing hash (linear probing), keyed by the 48-bit
+// efuse id embedded in the node name. One slot per node links its nodeList
+// entry and its in-flight command, so RX-path lookups are O(1) and nothing
+// is allocated at runtime. Deletion uses backward shift, no tombstones.
+constexpr uint16_t nextPow2(uint16_t v) { return v <= 1 ? 1 : 2 * nextPow2((v + 1) / 2); }
+constexpr uint16_t NODE_HASH_CAP = nextPow2(2 * (MAX_NODES + MAX_PENDING));
+
+struct NodeHashSlot {
+  uint64_t key;   // 0 = empty
+  int16_t  node;  // index in nodeList, -1 = not a configured node
+  int16_t  cmd;   // index in cmdQueue of the in-flight command, -1 = none
+};
+
+// CAP must be a power of two (sim/gateway-bench sizes it for larger networks)
+template <uint16_t CAP>
+struct NodeHash {
+  NodeHashSlot slots[CAP];
+
+  NodeHashSlot& operator[](int i) { return slots[i]; }
+  void clear() { memset(slots, 0, sizeof(slots)); }
+
+  static uint16_t home(uint64_t key) {
+    return (uint16_t)((key * 0x9E3779B97F4A7C15ULL) >> 48) & (CAP - 1);
+  }
+
+  int find(uint64_t key) const {
+    uint16_t i = home(key);
+    for (uint16_t n = 0; n < CAP; n++, i = (i + 1) & (CAP - 1)) {
+      if (slots[i].key == key) return i;
+      if (slots[i].key == 0) return -1;
+    }
+    return -1;
+  }
+
+  int insert(uint64_t key) {
+    uint16_t i = home(key);
+    for (uint16_t n = 0; n < CAP; n++, i = (i + 1) & (CAP - 1)) {
+      if (slots[i].key == key) return i;
+      if (slots[i].key == 0) {
+        slots[i].key = key;
+        slots[i].node = -1;
+        slots[i].cmd = -1;
+        return i;
+      }
+    }
+    Serial.println("[INDEX] Node index full");
+    return -1;
+  }
+
+  void erase(int slot) {
+    uint16_t hole = slot;
+    uint16_t i = (hole + 1) & (CAP - 1);
+    while (slots[i].key != 0) {
+      uint16_t h = home(slots[i].key);
+      // move i into the hole unless its home lies cyclically in (hole, i]
+      bool stays = (hole <= i) ? (hole < h && h <= i) : (hole < h || h <= i);
+      if (!stays) {
+        slots[hole] = slots[i];
+        hole = i;
+      }
+      i = (i + 1) & (CAP - 1);
+    }
+    slots[hole].key = 0;
+  }
+};
+
+NodeHash<NODE_HASH_CAP> nodeHash;
+int16_t shortAddrMap[MAX_NODES + 1];  // shortAddr -> nodeList index
+
+// "nodeCC29490B65F4" -> 0xCC29490B65F4. Names without a 12-digit hex tail
+// fall back to an FNV-1a hash tagged in the upper bits.
+uint64_t nodeKey(const char* nodeId) {
+  size_t len = strnlen(nodeId, 24);
+  if (len >= 12) {
+    uint64_t key = 0;
+    bool hex = true;
+    for (size_t i = len - 12; i < len && hex; i++) {
+      char ch = nodeId[i];
+      uint8_t v;
+      if (ch >= '0' && ch <= '9') v = ch - '0';
+      else if (ch >= 'A' && ch <= 'F') v = ch - 'A' + 10;
+      else if (ch >= 'a' && ch <= 'f') v = ch - 'a' + 10;
+      else { hex = false; break; }
+      key = (key << 4) | v;
+    }
+    if (hex && key != 0) return key;
+  }
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < len; i++) { h ^= (uint8_t)nodeId[i]; h *= 0x100000001b3ULL; }
+  return (h & 0x0000FFFFFFFFFFFFULL) | 0x0001000000000000ULL;
+}
+
+void rebuildNodeIndex() {
+  nodeHash.clear();
+  for (int i = 0; i <= MAX_NODES; i++) shortAddrMap[i] = -1;
+
+  for (size_t i = 0; i < nodeCount; i++) {
+    int slot = nodeHash.insert(nodeKey(nodeList[i].nodeId));
+    if (slot >= 0) nodeHash[slot].node = (int16_t)i;
+    uint16_t a = nodeList[i].shortAddr;
+    if (a != NO_SHORT_ADDR && a <= MAX_NODES) shortAddrMap[a] = (int16_t)i;
+  }
+  for (int i = 0; i < MAX_PENDING; i++) {
+    if (!cmdQueue[i].active || !cmdQueue[i].inFlight) continue;
+    int slot = nodeHash.insert(nodeKey(cmdQueue[i].nodeId));
+    if (slot >= 0) nodeHash[slot].cmd = (int16_t)i;
+  }
+}
+
+int findNodeIndex(const char* nodeId) {
+  int slot = nodeHash.find(nodeKey(nodeId));
+  if (slot < 0 || nodeHash[slot].node < 0) return -1;
+  int idx = nodeHash[slot].node;
+  if (strncmp(nodeList[idx].nodeId, nodeId, sizeof(nodeList[idx].nodeId)) != 0) return -1;
+  return idx;
+}
+
+int findNodeByShortAddr(uint16_t addr) {
+  if (addr == NO_SHORT_ADDR || addr > MAX_NODES) return -1;
+  return shortAddrMap[addr];
+}
+
+// In-flight command for a node, -1 if none
+int findInFlightCommand(const char* nodeId) {
+  int slot = nodeHash.find(nodeKey(nodeId));
+  if (slot < 0 || nodeHash[slot].cmd < 0) return -1;
+  int idx = nodeHash[slot].cmd;
+  if (strncmp(cmdQueue[idx].nodeId, nodeId, sizeof(cmdQueue[idx].nodeId)) != 0) return -1;
+  return idx;
+}
+
+void linkInFlightCommand(int cmdIdx) {
+  int slot = nodeHash.insert(nodeKey(cmdQueue[cmdIdx].nodeId));
+  if (slot >= 0) nodeHash[slot].cmd = (int16_t)cmdIdx;
+}
+
+void unlinkInFlightCommand(int cmdIdx) {
+  int slot = nodeHash.find(nodeKey(cmdQueue[cmdIdx].nodeId));
+  if (slot < 0 || nodeHash[slot].cmd != cmdIdx) return;
+  nodeHash[slot].cmd = -1;
+  if (nodeHash[slot].node < 0) nodeHash.erase(slot);
+}
+
+// ---------------- Short address table ----------------
+Preferences addrPrefs;
+
+// 8-bit FNV-1a fold of the gatewayId we send in ConfigPkt. Short-address
+// frames (both ways, v1 and v2 short form) and group frames carry it, so
+// a node in range of two gateways, or a neighbour's node that happens to
+// share a short address, is not mistaken for one of ours. The node takes
+// it from AssignPkt and recomputes it from ConfigPkt.gatewayId; must match
+// node.cpp. Never 0, so a zeroed frame doesn't match.
+uint8_t gatewayTag(const char* gatewayId) {
+  uint32_t h = 2166136261u;
+  for (const char* c = gatewayId; *c; c++) {
+    h ^= (uint8_t)*c;
+    h *= 16777619u;
+  }
+  uint8_t t = (uint8_t)(h ^ (h >> 8) ^ (h >> 16) ^ (h >> 24));
+  return t ? t : 1;
+}
+
+uint8_t gwTag = gatewayTag("");
+uint32_t foreignDrops = 0;  // short-address frames tagged for another gateway
+
+bool ownGatewayTag(uint8_t tag) {
+  if (tag == gwTag) return true;
+  foreignDrops++;
+  return false;
+}
+
+// Preferences keys are limited to 15 chars; the efuse hex tail is unique
+const char* shortAddrKey(const char* nodeId) {
+  size_t len = strlen(nodeId);
+  return (len > 12) ? nodeId + len - 12 : nodeId;
+}
+
+// An address freed by a config reload is held for a full status cycle
+// (one beacon epoch per round) before another node gets it, so a removed
+// node still sending with it isn't read as the new owner. Nodes left
+// without an address meanwhile get one from serviceAddressHolds().
+// RAM only: a reboot forgets the holds.
+uint64_t addrOwner[MAX_NODES + 1];         // nodeKey of the last owner, 0 = never used
+unsigned long addrHeldAt[MAX_NODES + 1];   // when the owner left, 0 = not held
+
+unsigned long addrHoldMs() {
+  return BEACON_INTERVAL * (slotPlan.rounds > 1 ? slotPlan.rounds : 1);
+}
+
+bool addrHeld(uint16_t a, unsigned long now) {
+  return addrHeldAt[a] != 0 && now - addrHeldAt[a] < addrHoldMs();
+}
+
+// First free, unheld address for n, stored in prefs (addrPrefs must be open)
+bool giveFreeAddress(NodeInfo &n, bool used[], unsigned long now) {
+  for (uint16_t a = 1; a <= MAX_NODES; a++) {
+    if (used[a] || addrHeld(a, now)) continue;
+    n.shortAddr = a;
+    used[a] = true;
+    addrOwner[a] = nodeKey(n.nodeId);
+    addrHeldAt[a] = 0;
+    addrPrefs.putUShort(shortAddrKey(n.nodeId), a);
+    return true;
+  }
+  return false;
+}
+
+// Gives every node in nodeList a short address, keeping the one it had
+// before so nodes don't need to be re-assigned after a config reload.
+void assignShortAddresses() {
+  bool used[MAX_NODES + 1] = {false};
+  unsigned long now = millis();
+
+  for (uint16_t a = 1; a <= MAX_NODES; a++) {
+    if (addrOwner[a] == 0 || addrHeldAt[a] != 0) continue;
+    bool stays = false;
+    for (size_t i = 0; i < nodeCount && !stays; i++) stays = nodeKey(nodeList[i].nodeId) == addrOwner[a];
+    if (!stays) addrHeldAt[a] = now ? now : 1;
+  }
+
+  addrPrefs.begin("saddr", false);
+  for (size_t i = 0; i < nodeCount; i++) {
+    NodeInfo &n = nodeList[i];
+    n.shortConfirmed = false;
+    n.lastAssign = 0;
+    uint64_t key = nodeKey(n.nodeId);
+    uint16_t a = addrPrefs.getUShort(shortAddrKey(n.nodeId), NO_SHORT_ADDR);
+    if (a >= 1 && a <= MAX_NODES && !used[a] && (addrOwner[a] == key || !addrHeld(a, now))) {
+      n.shortAddr = a;
+      used[a] = true;
+      addrOwner[a] = key;
+      addrHeldAt[a] = 0;
+    } else {
+      n.shortAddr = NO_SHORT_ADDR;
+    }
+  }
+  for (size_t i = 0; i < nodeCount; i++) {
+    if (nodeList[i].shortAddr == NO_SHORT_ADDR) giveFreeAddress(nodeList[i], used, now);
+  }
+  addrPrefs.end();
+}
+
+// Called before each beacon: nodes waiting on a held address get one
+// as soon as a hold runs out
+void serviceAddressHolds() {
+  bool used[MAX_NODES + 1] = {false};
+  bool waiting = false;
+  for (size_t i = 0; i < nodeCount; i++) {
+    uint16_t a = nodeList[i].shortAddr;
+    if (a == NO_SHORT_ADDR) waiting = true;
+    else if (a <= MAX_NODES) used[a] = true;
+  }
+  if (!waiting) return;
+
+  unsigned long now = millis();
+  bool gave = false;
+  addrPrefs.begin("saddr", false);
+  for (size_t i = 0; i < nodeCount; i++) {
+    if (nodeList[i].shortAddr != NO_SHORT_ADDR) continue;
+    if (!giveFreeAddress(nodeList[i], used, now)) break;
+    gave = true;
+  }
+  addrPrefs.end();
+  if (gave) rebuildNodeIndex();
+}
+
+void applyLoRaParamsAndStart() {
+  LoRa.end();
+  delay(200);
+  if (!LoRa.begin(LORA_FREQUENCY)) {
+    Serial.println("[LORA] init FAILED");
+    return;
+  }
+  LoRa.setSpreadingFactor(activeSf);
+  LoRa.setSignalBandwidth(LORA_BW);
+  LoRa.setCodingRate4(LORA_CR);
+  LoRa.enableCrc();
+  isLoRaBusy = false;
+  dio0Pending = false;
+  LoRa.receive();
+  Serial.printf("[LORA] Started (Freq=%lu Hz, SF=%d, BW=%lu Hz, CR=4/%d)\n",
+                (unsigned long)LORA_FREQUENCY, activeSf, (unsigned long)LORA_BW, LORA_CR);
+}
+
+// ---------------- Wire format v2 ----------------
+// Codec for the v2 frames (see "Wire format v2" with the packed structs).
+// Sequence numbers: a repeat of the last uplink number is dropped, a jump
+// of up to WIRE_SEQ_MAX_GAP counts the frames in between as lost; nodes
+// report the downlink frames they missed in their status.
+uint32_t wireDupDrops = 0;  // repeated v2 uplink frames dropped
+uint32_t wireUpLost = 0;    // uplink frames missing from v2 sequence gaps
+uint32_t wireDownLost = 0;  // downlink frames nodes reported missing
+
+// Efuse id back from a node id of the "node%012llX" form, false otherwise
+bool nodeIdChip(const char* nodeId, uint64_t &chip) {
+  if (strncmp(nodeId, "node", 4) != 0 || strlen(nodeId) != 4 + 2 * WIRE_CHIP_BYTES) return false;
+  chip = 0;
+  for (const char* p = nodeId + 4; *p; p++) {
+    char c = *p;
+    uint8_t d;
+    if (c >= '0' && c <= '9') d = c - '0';
+    else if (c >= 'A' && c <= 'F') d = c - 'A' + 10;
+    else return false;
+    chip = (chip << 4) | d;
+  }
+  return true;
+}
+
+// "node%012llX", without printf on the RX path; out holds 17 chars
+void chipNodeId(uint64_t chip, char* out) {
+  static const char hex[] = "0123456789ABCDEF";
+  memcpy(out, "node", 4);
+  for (int i = 2 * WIRE_CHIP_BYTES - 1; i >= 0; i--, chip >>= 4) out[4 + i] = hex[chip & 0xF];
+  out[4 + 2 * WIRE_CHIP_BYTES] = '\0';
+}
+
+// Writes header, address and sequence number; returns where the body goes
+size_t beginV2(uint8_t* buf, uint8_t type, bool shortForm, uint16_t shortAddr, uint64_t chip, uint8_t seq) {
+  size_t n = 0;
+  buf[n++] = WIRE_V2 | (shortForm ? WIRE_SHORT : 0) | (type & WIRE_TYPE_MASK);
+  if (shortForm) {
+    memcpy(buf + n, &shortAddr, sizeof(shortAddr));
+    n += sizeof(shortAddr);
+    buf[n++] = gwTag;
+  } else {
+    memcpy(buf + n, &chip, WIRE_CHIP_BYTES);  // little-endian, low 48 bits
+    n += WIRE_CHIP_BYTES;
+  }
+  buf[n++] = seq;
+  return n;
+}
+
+bool parseV2(const uint8_t* data, size_t len, V2Frame &v) {
+  if (len < 1 || (data[0] & WIRE_VER_MASK) != WIRE_V2) return false;
+  v.type = data[0] & WIRE_TYPE_MASK;
+  v.shortForm = data[0] & WIRE_SHORT;
+  size_t n = 1;
+  size_t addrLen = v.shortForm ? sizeof(v.shortAddr) + 1 : WIRE_CHIP_BYTES;
+  if (len < n + addrLen + 1) return false;
+  v.shortAddr = NO_SHORT_ADDR;
+  v.gwTag = 0;
+  v.chipId = 0;
+  if (v.shortForm) {
+    memcpy(&v.shortAddr, data + n, sizeof(v.shortAddr));
+    v.gwTag = data[n + sizeof(v.shortAddr)];
+  } else {
+    memcpy(&v.chipId, data + n, addrLen);
+  }
+  n += addrLen;
+  v.seq = data[n++];
+  v.body = data + n;
+  v.bodyLen = (uint8_t)(len - n);
+  return true;
+}
+
+// False for a repeat of the last frame from this node
+bool noteUplinkSeq(NodeInfo &n, uint8_t seq) {
+  if (n.upSeqKnown) {
+    if (seq == n.upSeq) {
+      wireDupDrops++;
+      return false;
+    }
+    uint8_t gap = (uint8_t)(seq - n.upSeq - 1);
+    if (gap <= WIRE_SEQ_MAX_GAP) wireUpLost += gap;
+  }
+  n.upSeq = seq;
+  n.upSeqKnown = true;
+  return true;
+}
+
+// v1 frames from a node that spoke v2 mean it lost the beacon or runs
+// older firmware again; either way it is answered in v1 from now on
+void noteNodeWire(int idx, uint8_t wire) {
+  if (idx >= 0) nodeList[idx].wire = wire;
+}
+
+// v2 control needs a node that has spoken v2, addressed short or by efuse id
+bool canSendV2(const NodeInfo &n) {
+  uint64_t chip;
+  return n.wire >= 2 && (n.shortConfirmed || nodeIdChip(n.nodeId, chip));
+}
+
+bool sendV2Control(NodeInfo &n, const PendingCommand &c, uint8_t prio, int8_t slot, uint8_t node) {
+  uint8_t buf[WIRE_V2_MAX];
+  uint64_t chip = 0;
+  if (!n.shortConfirmed) nodeIdChip(n.nodeId, chip);
+  size_t len = beginV2(buf, 0x07, n.shortConfirmed, n.shortAddr, chip, n.downSeq);
+  V2ControlBody b;
+  b.cmdId = c.cmdId;
+  b.flags = c.lightOn ? V2_CTRL_LIGHT_ON : 0;
+  memcpy(buf + len, &b, sizeof(b));
+  len += sizeof(b);
+  if (!sendLoRaPacket(buf, len, prio, slot, c.cmdId, node)) return false;
+  n.downSeq++;
+  return true;
+}
+
+// ---------------- Inter-task queues ----------------
+// The gateway runs as two FreeRTOS tasks: the radio task (LoRa RX/TX, command
+// queue, ACK matching) and the uplink task (modem, MQTT, outbox). They share
+// no state except through these queues, so a slow AT round-trip or a 30 s
+// waitForNetwork() never delays an ACK or a retry.
+
+// Bounded single-producer/single-consumer ring. Only the producer writes
+// tail and only the consumer writes head, so no lock is needed.
+template <typename T, uint8_t N>
+struct SpscQueue {
+  T items[N];
+  volatile uint8_t head = 0;   // next to read (consumer)
+  volatile uint8_t tail = 0;   // next to write (producer)
+  volatile uint32_t drops = 0; // pushes refused because the ring was full
+
+  bool push(const T &v) {
+    uint8_t next = (tail + 1) % N;
+    if (next == head) { drops++; return false; }
+    items[tail] = v;
+    __sync_synchronize();  // item visible before publishing the slot
+    tail = next;
+    return true;
+  }
+
+  // Producer side, for large items: fill reserve() in place, then commit()
+  T* reserve() {
+    if ((uint8_t)((tail + 1) % N) == head) { drops++; return nullptr; }
+    return &items[tail];
+  }
+  void commit() {
+    __sync_synchronize();
+    tail = (tail + 1) % N;
+  }
+
+  // Consumer side: peek() the oldest item in place, pop() when done with it
+  T* peek() {
+    if (head == tail) return nullptr;
+    __sync_synchronize();
+    return &items[head];
+  }
+  void pop() {
+    __sync_synchronize();
+    head = (head + 1) % N;
+  }
+
+  uint8_t size() const { return (uint8_t)((tail + N - head) % N); }
+};
+
+// Radio -> uplink: everything the backend needs to hear about
+enum UplinkEventKind : uint8_t {
+  EVT_ACK = 1,          // command ACKed (or stale ACK)
+  EVT_NODE_STATUS,      // status frame from a node
+  EVT_NODE_REGISTER,    // register frame from a node
+  EVT_CONFIG_APPLIED,   // bootstrap config saved and applied on the radio side
+  EVT_CONFIG_ACK,       // rollout push to a node ACKed or given up
+  EVT_CONFIG_PAGE       // page of a paged bootstrap config stored (or refused)
+};
+
+struct UplinkEvent {
+  uint8_t  kind;
+  char     nodeId[24];
+  uint16_t cmdId;
+  bool     success;     // EVT_ACK: true = matched a PendingCommand
+  bool     lightState;
+  bool     fault;
+  uint8_t  hour;
+  uint8_t  minute;
+  int16_t  rssi;
+  float    snr;
+  uint16_t rttMs;       // EVT_ACK: this command's RTT sample, 0 = none (retried)
+  uint16_t srttMs;      // EVT_ACK: node's smoothed RTT after the sample
+  uint16_t rtoMs;       // EVT_ACK: node's current RTO
+  uint8_t  outcome;     // EVT_ACK: CmdOutcome
+  uint16_t byCmdId;     // EVT_ACK: command that made this one unnecessary
+  uint8_t  cfgTotal;    // EVT_CONFIG_ACK: rollout progress over nodeList
+  uint8_t  cfgCurrent;
+  uint8_t  cfgFailed;
+  uint32_t pageId;      // EVT_CONFIG_PAGE: transfer id; cmdId = seq
+  uint16_t pageNext;    // EVT_CONFIG_PAGE: seq expected next
+  uint16_t pageTotal;
+};
+
+// Uplink -> radio: raw MQTT messages, decoded and handled in the radio task
+#define DOWNLINK_PAYLOAD_MAX MQTT_BUFFER_SIZE
+
+struct DownlinkMsg {
+  char     topic[TOPIC_MAX];
+  uint16_t len;
+  uint8_t  payload[DOWNLINK_PAYLOAD_MAX];
+};
+
+#define UPLINK_QUEUE_SIZE   64  // covers a 30 s modem stall at full status rate
+#define DOWNLINK_QUEUE_SIZE 8   // ~2 KB each; a full ring answers control with "busy"
+
+SpscQueue<UplinkEvent, UPLINK_QUEUE_SIZE> uplinkQueue;
+SpscQueue<DownlinkMsg, DOWNLINK_QUEUE_SIZE> downlinkQueue;
+
+bool postUplinkEvent(uint8_t kind, const char* nodeId, UplinkEvent &e) {
+  e.kind = kind;
+  memset(e.nodeId, 0, sizeof(e.nodeId));
+  if (nodeId) strncpy(e.nodeId, nodeId, sizeof(e.nodeId) - 1);
+  if (!uplinkQueue.push(e)) {
+    Serial.printf("[UPQ] Queue full, dropping event kind=%u\n", kind);
+    return false;
+  }
+  return true;
+}
+
+enum CmdOutcome : uint8_t {
+  CMD_ACKED = 0,    // node ACKed (success) or stale ACK
+  CMD_SUPERSEDED,   // replaced by a newer command for the node before it was sent
+  CMD_UNCHANGED     // node's last ACKed state already matched, nothing sent
+};
+
+// Commands that never go on air are still answered, so the backend can close them
+void postCmdOutcome(uint16_t cmdId, const char* nodeId, uint8_t outcome, uint16_t byCmdId = 0) {
+  UplinkEvent e = {};
+  e.cmdId = cmdId;
+  e.success = outcome == CMD_UNCHANGED;
+  e.outcome = outcome;
+  e.byCmdId = byCmdId;
+  postUplinkEvent(EVT_ACK, nodeId, e);
+  Serial.printf("[QUEUE] cmdId=%u for %s %s\n", cmdId, nodeId,
+                outcome == CMD_UNCHANGED ? "skipped, already in state" : "superseded");
+}
+
+void pushAckEvent(uint16_t cmdId, const char* nodeId, bool success,
+                  const NodeInfo* n = nullptr, uint16_t rttMs = 0) {
+  UplinkEvent e = {};
+  e.cmdId = cmdId;
+  e.success = success;
+  e.rttMs = rttMs;
+  if (n && n->rttSamples > 0) {
+    e.srttMs = n->srtt;
+    e.rtoMs = n->rto;
+  }
+  postUplinkEvent(EVT_ACK, nodeId, e);
+}
+
+void postNodeStatus(const char* nodeId, bool lightState, bool fault,
+                    uint8_t hour, uint8_t minute, int rssi, float snr) {
+  UplinkEvent e = {};
+  e.lightState = lightState;
+  e.fault = fault;
+  e.hour = hour;
+  e.minute = minute;
+  e.rssi = (int16_t)rssi;
+  e.snr = snr;
+  postUplinkEvent(EVT_NODE_STATUS, nodeId, e);
+}
+
+void postNodeRegister(const char* nodeId, int rssi, float snr) {
+  UplinkEvent e = {};
+  e.rssi = (int16_t)rssi;
+  e.snr = snr;
+  postUplinkEvent(EVT_NODE_REGISTER, nodeId, e);
+}
+
+
+// ---------------- Config rollout ----------------
+// Each node in nodeList has a desired configVersion and the version it last
+// ACKed (persisted per node). Out-of-date nodes get their config through the
+// command queue as CMD_CONFIG, so pushes share the per-node RTO, retries and
+// one-in-flight rule with control commands; the node ACKs with
+// cmdId = CMD_ID_CONFIG | cfgVer. serviceConfigRollout() paces the pushes, keeps at most
+// ROLLOUT_MAX_QUEUED of them in the queue so control traffic always finds
+// room, and waits while the previous config frame is held for airtime.
+#define ROLLOUT_GAP_MS      2000UL    // min gap between two pushes
+#define ROLLOUT_MAX_QUEUED  2
+#define ROLLOUT_RETRY_MS    300000UL  // back off a node whose push ran out of attempts
+
+Preferences cfgPrefs;
+char nodeGatewayId[24] = "";   // gatewayId sent in ConfigPkt (radio task copy)
+size_t rolloutCursor = 0;
+unsigned long lastRolloutPush = 0;
+uint32_t rolloutPushes = 0;
+uint32_t rolloutFailures = 0;
+
+bool nodeConfigCurrent(const NodeInfo &n) {
+  return n.versionKnown && n.appliedVersion == n.configVersion;
+}
+
+void loadAppliedVersions() {
+  cfgPrefs.begin("cfgver", true);
+  for (size_t i = 0; i < nodeCount; i++) {
+    NodeInfo &n = nodeList[i];
+    int v = cfgPrefs.getShort(shortAddrKey(n.nodeId), -1);
+    n.versionKnown = v >= 0;
+    n.appliedVersion = v >= 0 ? (uint8_t)v : 0;
+    n.configRetryAt = 0;
+  }
+  cfgPrefs.end();
+}
+
+bool sendConfigFrame(const NodeInfo &n, int8_t cmdSlot) {
+  uint8_t node = (&n >= nodeList && &n < nodeList + nodeCount) ? (uint8_t)(&n - nodeList) : NO_NODE_INDEX;
+  if (n.shortConfirmed) {
+    ShortConfigPkt sp;
+    sp.pktType = 0x14;
+    sp.shortAddr = n.shortAddr;
+    sp.gwTag = gwTag;
+    sp.onHour = n.onHour;
+    sp.onMin = n.onMin;
+    sp.offHour = n.offHour;
+    sp.offMin = n.offMin;
+    sp.cfgVer = n.configVersion;
+    sp.regIntervalMs = n.regIntervalMs;
+    sp.statusIntervalMs = n.statusIntervalMs;
+    return sendLoRaPacket((uint8_t*)&sp, sizeof(sp), TX_PRIO_CONFIG, cmdSlot, n.configVersion, node);
+  }
+
+  ConfigPkt pkt;
+  memset(&pkt, 0, sizeof(pkt));
+  pkt.pktType = 0x04;
+  snprintf(pkt.nodeId, sizeof(pkt.nodeId), "%s", n.nodeId);
+  snprintf(pkt.gatewayId, sizeof(pkt.gatewayId), "%s", nodeGatewayId);
+  pkt.onHour = n.onHour;
+  pkt.onMin = n.onMin;
+  pkt.offHour = n.offHour;
+  pkt.offMin = n.offMin;
+  pkt.cfgVer = n.configVersion;
+  pkt.regIntervalMs = n.regIntervalMs;
+  pkt.statusIntervalMs = n.statusIntervalMs;
+  pkt.nodeIndex = n.shortAddr != NO_SHORT_ADDR ? (uint8_t)(n.shortAddr - 1) : NO_NODE_INDEX;
+  return sendLoRaPacket((uint8_t*)&pkt, sizeof(pkt), TX_PRIO_CONFIG, cmdSlot, n.configVersion, node);
+}
+
+// Records the outcome of a push and reports it with the rollout progress
+void configPushDone(NodeInfo &n, bool ok) {
+  unsigned long now = millis();
+  if (ok) {
+    n.appliedVersion = n.configVersion;
+    n.versionKnown = true;
+    n.configRetryAt = 0;
+    n.ackedLight = LIGHT_UNKNOWN;  // a config puts the node back in AUTO
+    cfgPrefs.begin("cfgver", false);
+    cfgPrefs.putShort(shortAddrKey(n.nodeId), n.appliedVersion);
+    cfgPrefs.end();
+  } else {
+    n.configRetryAt = now + ROLLOUT_RETRY_MS;
+    rolloutFailures++;
+  }
+
+  UplinkEvent e = {};
+  e.cmdId = n.configVersion;
+  e.success = ok;
+  e.cfgTotal = (uint8_t)nodeCount;
+  for (size_t i = 0; i < nodeCount; i++) {
+    if (nodeConfigCurrent(nodeList[i])) e.cfgCurrent++;
+    else if (nodeList[i].configRetryAt && (long)(now - nodeList[i].configRetryAt) < 0) e.cfgFailed++;
+  }
+  postUplinkEvent(EVT_CONFIG_ACK, n.nodeId, e);
+  Serial.printf("[ROLLOUT] %s v%u %s (%u/%u current)\n", n.nodeId, n.configVersion,
+                ok ? "applied" : "FAILED", e.cfgCurrent, e.cfgTotal);
+}
+
+// ---------------- Command queue (NEW LOGIC) ----------------
+
+void initPendingQueue() {
+  for (int i = 0; i < MAX_PENDING; i++) {
+    cmdQueue[i].active = false;
+    cmdQueue[i].inFlight = false;
+    cmdQueue[i].done = false;
+    cmdQueue[i].attempts = 0;
+    cmdQueue[i].lastSend = 0;
+    cmdQueue[i].txEnd = 0;
+    cmdQueue[i].deadline = 0;
+    cmdQueue[i].enqSeq = 0;
+    cmdQueue[i].cmdId = 0;
+    cmdQueue[i].kind = CMD_CONTROL;
+    memset(cmdQueue[i].nodeId, 0, sizeof(cmdQueue[i].nodeId));
+  }
+  rebuildNodeIndex();
+}
+
+// Queued (not yet sent) control command for a node, -1 = none
+int findQueuedControl(const char* nodeId) {
+  for (int i = 0; i < MAX_PENDING; i++) {
+    const PendingCommand &c = cmdQueue[i];
+    if (c.active && !c.done && !c.inFlight && c.kind == CMD_CONTROL &&
+        strncmp(c.nodeId, nodeId, sizeof(c.nodeId)) == 0) return i;
+  }
+  return -1;
+}
+
+// Drops a node's queued control command in favour of byCmdId
+void supersedeQueuedControl(const char* nodeId, uint16_t byCmdId) {
+  int q = findQueuedControl(nodeId);
+  if (q < 0) return;
+  cmdQueue[q].active = false;
+  postCmdOutcome(cmdQueue[q].cmdId, cmdQueue[q].nodeId, CMD_SUPERSEDED, byCmdId);
+}
+
+// Last writer wins: a node has at most one control command waiting, and
+// only the latest desired state goes on air. The in-flight command can't be
+// recalled (the node may already have it), so a new one queues behind it
+// unless it asks for the same state. Returns true if the command was
+// queued or answered without a send.
+bool coalesceControl(uint16_t cmdId, const char* nodeId, bool lightOn) {
+  int f = findInFlightCommand(nodeId);
+  if (f >= 0 && cmdQueue[f].kind != CMD_CONTROL) f = -1;
+  int q = findQueuedControl(nodeId);
+
+  int idx = findNodeIndex(nodeId);
+  int8_t base = f >= 0 ? (int8_t)cmdQueue[f].lightOn
+                       : (idx >= 0 ? nodeList[idx].ackedLight : LIGHT_UNKNOWN);
+  if (base == (int8_t)lightOn) {
+    if (q >= 0) supersedeQueuedControl(nodeId, cmdId);
+    if (f >= 0) postCmdOutcome(cmdId, nodeId, CMD_SUPERSEDED, cmdQueue[f].cmdId);
+    else postCmdOutcome(cmdId, nodeId, CMD_UNCHANGED);
+    coalescedCmds++;
+    return true;
+  }
+  if (q >= 0) {
+    PendingCommand &c = cmdQueue[q];
+    postCmdOutcome(c.cmdId, c.nodeId, CMD_SUPERSEDED, cmdId);
+    c.cmdId = cmdId;  // keeps its place in the queue
+    c.lightOn = lightOn;
+    coalescedCmds++;
+    return true;
+  }
+  return false;
+}
+
+bool enqueueCommand(uint16_t cmdId, const char* nodeId, bool lightOn, uint8_t kind = CMD_CONTROL) {
+  if (kind == CMD_CONTROL && coalesceControl(cmdId, nodeId, lightOn)) return true;
+  for (int i = 0; i < MAX_PENDING; i++) {
+    if (!cmdQueue[i].active) {
+      PendingCommand &c = cmdQueue[i];
+      c.active = true;
+      c.inFlight = false;
+      c.done = false;
+      c.enqSeq = nextEnqSeq++;
+      c.cmdId = cmdId;
+      memset(c.nodeId, 0, sizeof(c.nodeId));
+      strncpy(c.nodeId, nodeId, sizeof(c.nodeId)-1);
+      c.lightOn = lightOn;
+      c.kind = kind;
+
+      c.attempts = 0;
+      c.lastSend = 0;
+      c.txEnd = 0;
+      c.deadline = 0;
+
+      Serial.printf("[QUEUE] Enqueued cmdId=%u for %s [%s]\n",
+                    c.cmdId, c.nodeId, kind == CMD_CONFIG ? "CONFIG" : (c.lightOn ? "ON" : "OFF"));
+      return true;
+    }
+  }
+  Serial.printf("[QUEUE] FULL — cannot enqueue cmdId=%u for %s\n", cmdId, nodeId);
+  return false;
+}
+
+bool cmdQueueHasSlot() {
+  for (int i = 0; i < MAX_PENDING; i++) {
+    if (!cmdQueue[i].active) return true;
+  }
+  return false;
+}
+
+// Called from MQTT handler
+void enqueuePendingCommand(const JsonDocument& doc) {
+  
+  const char* nodeId = doc["nodeId"] | "";
+  const char* action = doc["action"] | "";
+
+  if (!nodeId[0] || !action[0]) {
+    Serial.println("[QUEUE] Invalid control payload, cannot enqueue");
+    return;
+  }
+
+  enqueueCommand(doc["cmdId"], nodeId, strcasecmp(action, "ON") == 0);
+}
+
+// ---------------- Group commands ----------------
+#define GROUP_MASK_BITS (GROUP_MASK_BYTES * 8)
+inline bool maskTest(const uint8_t* mask, uint8_t idx) { return idx < GROUP_MASK_BITS && (mask[idx >> 3] & (1 << (idx & 7))); }
+inline void maskSet(uint8_t* mask, uint8_t idx)        { if (idx < GROUP_MASK_BITS) mask[idx >> 3] |= (1 << (idx & 7)); }
+inline void maskClear(uint8_t* mask, uint8_t idx)      { if (idx < GROUP_MASK_BITS) mask[idx >> 3] &= ~(1 << (idx & 7)); }
+
+// A node's bit in a group mask (short address - 1); -1 while it has no
+// address, e.g. waiting for a held one to be released
+int groupBit(const NodeInfo &n) {
+  return (n.shortAddr == NO_SHORT_ADDR || n.shortAddr > GROUP_MASK_BITS) ? -1 : n.shortAddr - 1;
+}
+
+uint8_t maskCount(const uint8_t* mask) {
+  uint8_t n = 0;
+  for (int i = 0; i < GROUP_MASK_BYTES; i++) n += __builtin_popcount(mask[i]);
+  return n;
+}
+
+// One member's ACK slot: its GroupAckPkt's airtime at the current SF
+// plus a guard. The node computes the same from its own parameters.
+unsigned long groupAckSlotMs() {
+  return airtimeUs(sizeof(GroupAckPkt)) / 1000 + 1 + GROUP_ACK_GUARD_MS;
+}
+
+// ACK slots are laid out after the frame's TxDone, one per pending member
+unsigned long groupAckWindow(const GroupCommand &g) {
+  return ACK_TIMEOUT_MS + (unsigned long)maskCount(g.pending) * groupAckSlotMs();
+}
+
+// The group frame overrides anything still queued for a member; members
+// already in the state (and with nothing in flight) are left out, and
+// members that don't know their short address yet are sent individually
+// (the node finds its bit from the address it has confirmed)
+void addGroupMember(const NodeInfo &n, uint16_t cmdId, bool lightOn) {
+  supersedeQueuedControl(n.nodeId, cmdId);
+  if (n.ackedLight == (int8_t)lightOn && findInFlightCommand(n.nodeId) < 0) {
+    postCmdOutcome(cmdId, n.nodeId, CMD_UNCHANGED);
+    coalescedCmds++;
+    return;
+  }
+  int bit = groupBit(n);
+  if (!n.shortConfirmed || bit < 0) {
+    maskSet(groupCmd.unicast, (uint8_t)(&n - nodeList));
+    return;
+  }
+  maskSet(groupCmd.pending, (uint8_t)bit);
+}
+
+// Moves members waiting for unicast into the command queue as slots free
+// up, in nodeList order; a full queue is retried on the next loop
+void serviceGroupUnicast() {
+  for (size_t i = 0; i < nodeCount; i++) {
+    if (!maskTest(groupCmd.unicast, (uint8_t)i)) continue;
+    if (!cmdQueueHasSlot()) return;
+    if (!enqueueCommand(groupCmd.cmdId, nodeList[i].nodeId, groupCmd.lightOn)) return;
+    maskClear(groupCmd.unicast, (uint8_t)i);
+  }
+}
+
+bool groupPending(const NodeInfo &n) {
+  int bit = groupBit(n);
+  return bit >= 0 && maskTest(groupCmd.pending, (uint8_t)bit);
+}
+
+// Group command builder: begin, add targets, commit
+void beginGroupCommand(uint16_t cmdId, bool lightOn) {
+  if (groupCmd.active) {
+    Serial.printf("[GROUP] cmdId=%u superseded by cmdId=%u\n", groupCmd.cmdId, cmdId);
+    for (size_t i = 0; i < nodeCount; i++) {
+      if (groupPending(nodeList[i])) {
+        postCmdOutcome(groupCmd.cmdId, nodeList[i].nodeId, CMD_SUPERSEDED, cmdId);
+      }
+    }
+  }
+  for (size_t i = 0; i < nodeCount; i++) {
+    if (maskTest(groupCmd.unicast, (uint8_t)i)) {
+      postCmdOutcome(groupCmd.cmdId, nodeList[i].nodeId, CMD_SUPERSEDED, cmdId);
+    }
+  }
+
+  memset(groupCmd.pending, 0, sizeof(groupCmd.pending));
+  memset(groupCmd.unicast, 0, sizeof(groupCmd.unicast));
+  groupCmd.active = false;
+  groupCmd.cmdId = cmdId;
+  groupCmd.lightOn = lightOn;
+  groupCmd.attempts = 0;
+  groupCmd.lastSend = 0;
+  groupCmd.txEnd = 0;
+}
+
+// Nodes the gateway has no index for are sent individually
+void addGroupTarget(const char* nodeId) {
+  int idx = findNodeIndex(nodeId);
+  if (idx >= 0) addGroupMember(nodeList[idx], groupCmd.cmdId, groupCmd.lightOn);
+  else enqueueCommand(groupCmd.cmdId, nodeId, groupCmd.lightOn);
+}
+
+void commitGroupCommand() {
+  groupCmd.active = maskCount(groupCmd.pending) > 0;
+  serviceGroupUnicast();
+  Serial.printf("[GROUP] Enqueued cmdId=%u for %u nodes [%s], %u unicast\n",
+                groupCmd.cmdId, maskCount(groupCmd.pending), groupCmd.lightOn ? "ON" : "OFF",
+                maskCount(groupCmd.unicast));
+}
+
+// Payload: {"type":"node_control","cmdId":..,"action":"ON","nodes":["node..",..]}
+// or nodeId "*" for every node in nodeList. Nodes the gateway has no index
+// for are sent individually through the unicast queue.
+void enqueueGroupCommand(const JsonDocument& doc) {
+  const char* action = doc["action"] | "";
+  if (!action[0]) {
+    Serial.println("[GROUP] Invalid group payload, cannot enqueue");
+    return;
+  }
+
+  uint16_t cmdId = doc["cmdId"];
+  bool lightOn = (strcasecmp(action, "ON") == 0);
+
+  beginGroupCommand(cmdId, lightOn);
+  if (doc["nodes"].is<JsonArrayConst>()) {
+    for (JsonVariantConst v : doc["nodes"].as<JsonArrayConst>()) {
+      const char* nodeId = v | "";
+      if (nodeId[0]) addGroupTarget(nodeId);
+    }
+  } else {
+    for (size_t i = 0; i < nodeCount; i++) addGroupMember(nodeList[i], cmdId, lightOn);
+  }
+  commitGroupCommand();
+}
+
+void sendGroupCommand(GroupCommand &g) {
+  GroupControlPkt pkt;
+  pkt.pktType = 0x09;
+  pkt.cmdId   = g.cmdId;
+  pkt.gwTag   = gwTag;
+  pkt.lightOn = g.lightOn;
+  memcpy(pkt.mask, g.pending, sizeof(pkt.mask));  // retries only address the missing nodes
+
+  bool queued = sendLoRaPacket((uint8_t*)&pkt, sizeof(pkt), g.attempts > 0 ? TX_PRIO_RETRY : TX_PRIO_CONTROL,
+                               TX_CMD_GROUP, g.cmdId);
+
+  g.lastSend = millis();
+  g.txEnd = queued ? 0 : g.lastSend;  // a dropped frame times out like a lost one
+  g.attempts++;
+
+  Serial.printf("[GROUP] Sent cmdId=%u → %u nodes try=%d\n", g.cmdId, maskCount(g.pending), g.attempts);
+}
+
+void handleGroupAck(const GroupAckPkt &ack) {
+  int idx = findNodeByShortAddr((uint16_t)ack.nodeIndex + 1);
+  if (!groupCmd.active || ack.cmdId != groupCmd.cmdId ||
+      idx < 0 || !maskTest(groupCmd.pending, ack.nodeIndex)) {
+    Serial.printf("[GROUP] Stale/duplicate ack cmdId=%u idx=%u\n", ack.cmdId, ack.nodeIndex);
+    return;
+  }
+
+  maskClear(groupCmd.pending, ack.nodeIndex);
+  nodeList[idx].ackedLight = groupCmd.lightOn;
+  pushAckEvent(ack.cmdId, nodeList[idx].nodeId, true);
+
+  if (maskCount(groupCmd.pending) == 0) {
+    Serial.printf("[GROUP] cmdId=%u fully acknowledged\n", groupCmd.cmdId);
+    groupCmd.active = false;
+  }
+}
+
+// Returns true while the group frame or its ACK slots own the channel
+bool processGroupCommand(unsigned long now) {
+  serviceGroupUnicast();
+  if (!groupCmd.active) return false;
+
+  if (groupCmd.attempts > 0 &&
+      (groupCmd.txEnd == 0 || now - groupCmd.txEnd < groupAckWindow(groupCmd))) return true;
+
+  if (groupCmd.attempts >= MAX_ATTEMPTS) {
+    // Members that never answered (e.g. no index yet) fall back to unicast
+    Serial.printf("[GROUP] cmdId=%u: %u nodes silent, falling back to unicast\n",
+                  groupCmd.cmdId, maskCount(groupCmd.pending));
+    for (size_t i = 0; i < nodeCount; i++) {
+      if (groupPending(nodeList[i])) maskSet(groupCmd.unicast, (uint8_t)i);
+    }
+    groupCmd.active = false;
+    serviceGroupUnicast();
+    return false;
+  }
+
+  if (cmdChannelBusy(now)) return true;
+  sendGroupCommand(groupCmd);
+  return true;
+}
+
+// ---- Adaptive ACK timeout ----
+uint32_t rttSampleCount = 0;
+uint32_t ackTimeouts = 0;
+
+void resetNodeRtt(NodeInfo &n) {
+  n.srtt = 0;
+  n.rttvar = 0;
+  n.rto = ACK_TIMEOUT_MS;
+  n.rttSamples = 0;
+}
+
+void updateNodeRtt(NodeInfo &n, uint32_t r) {
+  if (r > RTO_MAX_MS) r = RTO_MAX_MS;
+  if (n.rttSamples == 0) {
+    n.srtt = r;
+    n.rttvar = r / 2;
+  } else {
+    int32_t err = (int32_t)r - (int32_t)n.srtt;
+    int32_t absErr = err < 0 ? -err : err;
+    n.rttvar = (uint16_t)((int32_t)n.rttvar + (absErr - (int32_t)n.rttvar) / 4);
+    n.srtt = (uint16_t)((int32_t)n.srtt + err / 8);
+  }
+  uint32_t k = 4 * (uint32_t)n.rttvar;
+  uint32_t rto = n.srtt + (k > RTO_GRANULARITY_MS ? k : RTO_GRANULARITY_MS);
+  if (rto < RTO_MIN_MS) rto = RTO_MIN_MS;
+  if (rto > RTO_MAX_MS) rto = RTO_MAX_MS;
+  n.rto = (uint16_t)rto;
+  if (n.rttSamples < 0xFFFF) n.rttSamples++;
+  rttSampleCount++;
+}
+
+// Time to wait for the ACK of the c.attempts-th send: RTO doubled per
+// retry, capped, plus jitter
+unsigned long commandTimeout(const PendingCommand &c) {
+  int idx = findNodeIndex(c.nodeId);
+  uint32_t t = (idx >= 0) ? nodeList[idx].rto : ACK_TIMEOUT_MS;
+  uint8_t shift = c.attempts > 1 ? c.attempts - 1 : 0;
+  t = (shift >= 8) ? RTO_MAX_MS : t << shift;
+  if (t > RTO_MAX_MS) t = RTO_MAX_MS;
+  return t + (unsigned long)random(0, t / RTO_JITTER_DIV + 1);
+}
+
+void sendCommand(PendingCommand &c) {
+  int8_t slot = (int8_t)(&c - cmdQueue);
+  bool queued;
+  int idx = findNodeIndex(c.nodeId);
+  uint8_t prio = c.attempts > 0 ? TX_PRIO_RETRY : TX_PRIO_CONTROL;
+  uint8_t node = idx >= 0 ? (uint8_t)idx : NO_NODE_INDEX;
+  if (c.kind == CMD_CONFIG) {
+    queued = idx >= 0 && sendConfigFrame(nodeList[idx], slot);
+  } else if (idx >= 0 && canSendV2(nodeList[idx])) {
+    queued = sendV2Control(nodeList[idx], c, prio, slot, node);
+  } else if (idx >= 0 && nodeList[idx].shortConfirmed) {
+    ShortControlPkt pkt;
+    pkt.pktType   = 0x17;
+    pkt.cmdId     = c.cmdId;
+    pkt.shortAddr = nodeList[idx].shortAddr;
+    pkt.gwTag     = gwTag;
+    pkt.lightOn   = c.lightOn;
+    queued = sendLoRaPacket((uint8_t*)&pkt, sizeof(pkt), prio, slot, c.cmdId, node);
+  } else {
+    ControlPkt pkt;
+    pkt.pktType = 0x07;
+    pkt.cmdId   = c.cmdId;
+    memset(pkt.nodeId, 0, sizeof(pkt.nodeId));
+    snprintf(pkt.nodeId, sizeof(pkt.nodeId), "%s", c.nodeId);
+    pkt.lightOn = c.lightOn;
+    queued = sendLoRaPacket((uint8_t*)&pkt, sizeof(pkt), prio, slot, c.cmdId, node);
+  }
+
+  c.lastSend = millis();
+  c.txEnd = queued ? 0 : c.lastSend;  // a dropped frame times out like a lost one
+  c.deadline = 0;
+  c.attempts++;
+  if (!c.inFlight) linkInFlightCommand(&c - cmdQueue);
+  c.inFlight = true;
+  if (queued) cmdTxQueued = true;
+
+  Serial.printf("[CMD] Sent cmdId=%u → node=%s try=%d\n", c.cmdId, c.nodeId, c.attempts);
+}
+
+// Called from LoRa receive path when ACK is parsed.
+// Several commands can be in flight, so ACKs may arrive in any order;
+// each node has at most one in flight, found through the node index.
+void handleAck(const AckPkt &ack, unsigned long rxAt) {
+  Serial.printf("[ACK] Received ack cmdId=%u from %s\n", ack.cmdId, ack.nodeId);
+  bool matched = false;
+  uint16_t rtt = 0;
+  int nodeIdx = findNodeIndex(ack.nodeId);
+
+  uint8_t kind = ackKind(ack.cmdId);
+
+  int i = findInFlightCommand(ack.nodeId);
+  if (i >= 0 && cmdQueue[i].active && !cmdQueue[i].done &&
+      cmdQueue[i].kind == kind && cmdQueue[i].cmdId == ack.cmdId) {
+    PendingCommand &c = cmdQueue[i];
+    Serial.printf("[CMD] ACK matched in-flight cmdId=%u (node=%s)\n", c.cmdId, c.nodeId);
+
+    // Karn: a retried command's ACK can't be tied to one TX, so no sample
+    if (nodeIdx >= 0 && c.attempts == 1 && c.txEnd != 0 && (long)(rxAt - c.txEnd) >= 0) {
+      unsigned long r = rxAt - c.txEnd;
+      rtt = (uint16_t)(r > RTO_MAX_MS ? RTO_MAX_MS : (r == 0 ? 1 : r));
+      updateNodeRtt(nodeList[nodeIdx], rtt);
+      Serial.printf("[RTT] %s rtt=%u srtt=%u rttvar=%u rto=%u\n", c.nodeId, rtt,
+                    nodeList[nodeIdx].srtt, nodeList[nodeIdx].rttvar, nodeList[nodeIdx].rto);
+    }
+
+    unlinkInFlightCommand(i);
+    c.done     = true;
+    c.active   = false;
+    c.inFlight = false;
+    matched = true;
+
+    if (c.kind == CMD_CONFIG) {
+      if (nodeIdx >= 0) configPushDone(nodeList[nodeIdx], true);
+      return;
+    }
+    if (nodeIdx >= 0) nodeList[nodeIdx].ackedLight = c.lightOn;
+  }
+
+  if (!matched) {
+    Serial.println("[ACK] No matching command found for this ACK (stale/duplicate?)");
+    if (kind == CMD_CONFIG) return;  // a repeated config ACK isn't a control outcome
+  }
+
+  // Emit event into the ring buffer (for backend / higher layers)
+  pushAckEvent(ack.cmdId, ack.nodeId, matched, nodeIdx >= 0 ? &nodeList[nodeIdx] : nullptr, rtt);
+}
+
+bool nodeHasCommandInFlight(const char* nodeId) {
+  return findInFlightCommand(nodeId) >= 0;
+}
+
+// Called from loop()
+// Sliding window: up to CMD_WINDOW commands to different nodes are in flight,
+// each with its own retry timer. At most one frame goes out per call and
+// the next one waits for the previous frame's TxDone plus cmdAckGapMs(), so
+// the previous node can ACK. The gap scales with the SF instead of a fixed
+// time from queueing, which was too long at SF7 and too short at SF12.
+void processPendingCommands() {
+  unsigned long now = millis();
+  int inFlight = 0;
+
+  if (processGroupCommand(now)) return;
+  int retryIdx = -1;
+
+  // 1) Expire / pick a retry among in-flight commands
+  for (int i = 0; i < MAX_PENDING; i++) {
+    PendingCommand &c = cmdQueue[i];
+    if (!c.active || c.done || !c.inFlight) continue;
+
+    if (c.txEnd != 0 && c.deadline == 0) c.deadline = c.txEnd + commandTimeout(c);
+
+    if (c.deadline != 0 && (long)(now - c.deadline) >= 0) {
+      if (c.attempts >= MAX_ATTEMPTS) {
+        Serial.printf("[CMD] FAILED cmdId=%u node=%s after %d attempts\n",
+                      c.cmdId, c.nodeId, c.attempts);
+        unlinkInFlightCommand(i);
+        c.done = true;
+        c.active = false;
+        c.inFlight = false;
+        int n = findNodeIndex(c.nodeId);
+        if (c.kind == CMD_CONFIG) {
+          if (n >= 0) configPushDone(nodeList[n], false);
+        } else if (n >= 0) {
+          nodeList[n].ackedLight = LIGHT_UNKNOWN;  // it may or may not have switched
+        }
+        continue;
+      }
+      // oldest timed-out command goes first
+      if (retryIdx < 0 || c.lastSend < cmdQueue[retryIdx].lastSend) retryIdx = i;
+    }
+    inFlight++;
+  }
+
+  if (cmdChannelBusy(now)) return;
+
+  // 2) By class: new operator commands, then retries, then config pushes.
+  // New ones fill the window, oldest first, for nodes with nothing outstanding.
+  int nextIdx = -1, configIdx = -1;
+  if (inFlight < CMD_WINDOW) {
+    for (int i = 0; i < MAX_PENDING; i++) {
+      PendingCommand &c = cmdQueue[i];
+      if (!c.active || c.done || c.inFlight) continue;
+      int &pick = (c.kind == CMD_CONFIG) ? configIdx : nextIdx;
+      if (pick >= 0 && c.enqSeq >= cmdQueue[pick].enqSeq) continue;
+      if (nodeHasCommandInFlight(c.nodeId)) continue;
+      pick = i;
+    }
+  }
+
+  if (nextIdx >= 0) {
+    sendCommand(cmdQueue[nextIdx]);
+  } else if (retryIdx >= 0) {
+    ackTimeouts++;
+    Serial.printf("[CMD] Timeout, retrying cmdId=%u...\n", cmdQueue[retryIdx].cmdId);
+    sendCommand(cmdQueue[retryIdx]);
+  } else if (configIdx >= 0) {
+    sendCommand(cmdQueue[configIdx]);
+  }
+}
+
+bool configQueuedFor(const char* nodeId) {
+  for (int i = 0; i < MAX_PENDING; i++) {
+    const PendingCommand &c = cmdQueue[i];
+    if (c.active && !c.done && c.kind == CMD_CONFIG && strcmp(c.nodeId, nodeId) == 0) return true;
+  }
+  return false;
+}
+
+// Called from the radio task: queues the next out-of-date node, round robin
+void serviceConfigRollout() {
+  unsigned long now = millis();
+  if (nodeCount == 0 || now - lastRolloutPush < ROLLOUT_GAP_MS) return;
+  if (txQueued[TX_PRIO_CONFIG] > 0) return;  // last config frame still waiting for budget
+
+  int queued = 0;
+  for (int i = 0; i < MAX_PENDING; i++) {
+    if (cmdQueue[i].active && !cmdQueue[i].done && cmdQueue[i].kind == CMD_CONFIG) queued++;
+  }
+  if (queued >= ROLLOUT_MAX_QUEUED) return;
+
+  for (size_t k = 0; k < nodeCount; k++) {
+    size_t i = (rolloutCursor + k) % nodeCount;
+    NodeInfo &n = nodeList[i];
+    if (nodeConfigCurrent(n)) continue;
+    if (n.configRetryAt && (long)(now - n.configRetryAt) < 0) continue;
+    if (configQueuedFor(n.nodeId)) continue;
+    if (!enqueueCommand(CMD_ID_CONFIG | n.configVersion, n.nodeId, false, CMD_CONFIG)) return;
+    rolloutCursor = i + 1;
+    lastRolloutPush = now;
+    rolloutPushes++;
+    return;
+  }
+}
+
+// ---------------- Adaptive data rate ----------------
+// The gateway has one SX127x and demodulates a single SF at a time, so the
+// SF is network-wide: the lowest one every active node clears with
+// ADR_MARGIN_DB to spare, never above the configured LORA_SF, which stays
+// the conservative base everyone falls back to. A node with margin left at
+// that SF is told to lower its TX power instead (unicast LoRaConfigPkt).
+//
+// An SF change is announced with a broadcast LoRaConfigPkt repeated
+// ADR_ANNOUNCE_REPEATS times, and the gateway follows once the last copy is
+// on air. If a node that was active at the switch then stays quiet for
+// ADR_SILENT_MS the network goes back to base; a node that hears nothing
+// from us for NODE_ADR_FALLBACK_MS (node.cpp) reverts to base on its own.
+#define ADR_INTERVAL_MS      600000UL   // re-evaluate this often
+#define ADR_MIN_SAMPLES      6          // frames from a node before its margin counts
+#define ADR_MARGIN_DB        8.0f       // kept above the demodulation floor
+#define ADR_SNR_GAIN         0.125f     // EWMA gain for per-node SNR
+#define ADR_SILENT_MS        180000UL   // active node unheard this long -> back to base
+#define ADR_HOLDOFF_MS       3600000UL  // no speed-up for this long after a fallback
+#define ADR_ANNOUNCE_REPEATS 3
+#define ADR_ANNOUNCE_GAP_MS  1000UL
+#define ADR_POWER_RETRY_MS   5000UL     // TX queue filled up mid power pass
+#define ADR_TX_HEADROOM      2          // TX slots a power pass leaves for commands
+#define ADR_TX_POWER_MAX     17         // dBm, LoRa library default (PA_BOOST)
+#define ADR_TX_POWER_MIN     2
+#define ADR_POWER_STEP_DB    3
+
+// SX1276 demodulation SNR floor per SF, index SF - 7
+const float ADR_SNR_FLOOR[6] = { -7.5f, -10.0f, -12.5f, -15.0f, -17.5f, -20.0f };
+
+uint8_t adrAnnounceSf = 0;        // SF being announced, 0 = none
+uint8_t adrAnnounceLeft = 0;
+unsigned long adrAnnounceAt = 0;
+unsigned long adrChangedAt = 0;   // last network SF change
+unsigned long adrHoldoffUntil = 0;
+unsigned long lastAdrEval = 0;
+uint8_t adrSeq = 0;
+uint32_t adrSwitches = 0;
+uint32_t adrFallbacks = 0;
+
+float snrFloor(uint8_t sf) {
+  if (sf < 7) sf = 7;
+  if (sf > 12) sf = 12;
+  return ADR_SNR_FLOOR[sf - 7];
+}
+
+void resetNodeLink(NodeInfo &n) {
+  n.snrAvg = 0;
+  n.snrSamples = 0;
+  n.lastHeard = 0;
+  n.txPower = ADR_TX_POWER_MAX;
+  n.wire = 1;
+  n.upSeqKnown = false;
+  n.downSeq = 0;
+}
+
+void resetAdr() {
+  activeSf = LORA_SF;
+  adrAnnounceSf = 0;
+  adrAnnounceLeft = 0;
+  adrChangedAt = millis();
+  lastAdrEval = adrChangedAt;
+}
+
+// Every frame we can attribute to a node feeds its link estimate
+void noteNodeLink(int idx, const RxFrame &f) {
+  if (idx < 0) return;
+  NodeInfo &n = nodeList[idx];
+  n.snrAvg = n.snrSamples ? n.snrAvg + ADR_SNR_GAIN * (f.snr - n.snrAvg) : f.snr;
+  if (n.snrSamples < 255) n.snrSamples++;
+  n.lastHeard = f.at ? f.at : 1;
+}
+
+// Lowest SF at which the node's link keeps ADR_MARGIN_DB
+uint8_t nodeMinSf(const NodeInfo &n) {
+  for (uint8_t sf = 7; sf < 12; sf++) {
+    if (n.snrAvg >= snrFloor(sf) + ADR_MARGIN_DB) return sf;
+  }
+  return 12;
+}
+
+bool sendLoRaConfig(uint16_t shortAddr, uint8_t sf, int8_t txPower) {
+  LoRaConfigPkt p;
+  p.pktType = 0x08;
+  p.shortAddr = shortAddr;
+  p.gwTag = gwTag;
+  p.freq = LORA_FREQUENCY;
+  p.sf = sf;
+  p.bw = LORA_BW;
+  p.cr = LORA_CR;
+  p.txPower = txPower;
+  p.seq = adrSeq;
+  return sendLoRaPacket((uint8_t*)&p, sizeof(p), TX_PRIO_CONFIG);
+}
+
+// True while a broadcast LoRaConfigPkt is still waiting in the TX queue
+bool adrAnnounceQueued() {
+  for (int i = 0; i < TX_QUEUE_SIZE; i++) {
+    const TxFrame &f = txQueue[i];
+    if (f.used && f.data[0] == 0x08 && f.data[1] == 0 && f.data[2] == 0) return true;
+  }
+  return false;
+}
+
+void startAdrAnnounce(uint8_t sf) {
+  adrSeq++;
+  adrAnnounceSf = sf;
+  adrAnnounceLeft = ADR_ANNOUNCE_REPEATS;
+  adrAnnounceAt = millis() - ADR_ANNOUNCE_GAP_MS;
+  // Slowing down means the links got worse: everyone back to full power
+  if (sf > activeSf) {
+    for (size_t i = 0; i < nodeCount; i++) nodeList[i].txPower = ADR_TX_POWER_MAX;
+  }
+  Serial.printf("[ADR] Announcing SF%u -> SF%u (seq=%u)\n", activeSf, sf, adrSeq);
+}
+
+void applyNetworkSf(uint8_t sf) {
+  LoRa.idle();
+  LoRa.setSpreadingFactor(sf);
+  LoRa.receive();
+  activeSf = sf;
+  adrChangedAt = millis();
+  adrSwitches++;
+  Serial.printf("[ADR] Network now on SF%u\n", sf);
+}
+
+// Node was active around the last switch and has not been heard since
+bool adrNodeLost(const NodeInfo &n, unsigned long now) {
+  if (n.lastHeard == 0) return false;
+  if ((long)(adrChangedAt - n.lastHeard) > (long)ADR_INTERVAL_MS) return false;  // idle before the switch
+  unsigned long since = (long)(n.lastHeard - adrChangedAt) > 0 ? n.lastHeard : adrChangedAt;
+  return now - since > ADR_SILENT_MS;
+}
+
+// Power the node should use so its surplus over the margin is spent, in
+// ADR_POWER_STEP_DB steps relative to what it uses now
+int8_t nodeTargetPower(const NodeInfo &n) {
+  float excess = n.snrAvg - snrFloor(activeSf) - ADR_MARGIN_DB;
+  int steps = (int)floorf(excess / ADR_POWER_STEP_DB);
+  int p = n.txPower - steps * ADR_POWER_STEP_DB;
+  if (p > ADR_TX_POWER_MAX) p = ADR_TX_POWER_MAX;
+  if (p < ADR_TX_POWER_MIN) p = ADR_TX_POWER_MIN;
+  return (int8_t)p;
+}
+
+// Called from the radio task
+void serviceAdr() {
+  unsigned long now = millis();
+
+  if (adrAnnounceSf) {
+    if (adrAnnounceLeft && now - adrAnnounceAt >= ADR_ANNOUNCE_GAP_MS) {
+      adrAnnounceAt = now;
+      adrAnnounceLeft--;
+      sendLoRaConfig(0, adrAnnounceSf, adrAnnounceSf > activeSf ? ADR_TX_POWER_MAX : 0);
+    }
+    if (adrAnnounceLeft == 0 && !isLoRaBusy && !adrAnnounceQueued()) {
+      applyNetworkSf(adrAnnounceSf);
+      adrAnnounceSf = 0;
+    }
+    return;
+  }
+
+  if (activeSf != LORA_SF) {
+    for (size_t i = 0; i < nodeCount; i++) {
+      if (!adrNodeLost(nodeList[i], now)) continue;
+      Serial.printf("[ADR] %s silent on SF%u, falling back to SF%u\n",
+                    nodeList[i].nodeId, activeSf, LORA_SF);
+      adrFallbacks++;
+      adrHoldoffUntil = now + ADR_HOLDOFF_MS;
+      startAdrAnnounce(LORA_SF);
+      return;
+    }
+  }
+
+  if (now - lastAdrEval < ADR_INTERVAL_MS) return;
+  lastAdrEval = now;
+
+  // Slowest node decides; nodes without enough samples pin the current SF
+  uint8_t target = 7;
+  bool any = false;
+  for (size_t i = 0; i < nodeCount; i++) {
+    const NodeInfo &n = nodeList[i];
+    if (n.lastHeard == 0 || now - n.lastHeard > ADR_INTERVAL_MS) continue;
+    uint8_t sf = n.snrSamples < ADR_MIN_SAMPLES ? activeSf : nodeMinSf(n);
+    if (sf > target) target = sf;
+    any = true;
+  }
+  if (!any) return;
+  if (target > LORA_SF) target = LORA_SF;
+  if (target < activeSf && (long)(now - adrHoldoffUntil) < 0) target = activeSf;
+  if (target != activeSf) {
+    startAdrAnnounce(target);
+    return;
+  }
+
+  for (size_t i = 0; i < nodeCount; i++) {
+    NodeInfo &n = nodeList[i];
+    if (!n.shortConfirmed || n.snrSamples < ADR_MIN_SAMPLES) continue;
+    if (now - n.lastHeard > ADR_INTERVAL_MS) continue;
+    int8_t p = nodeTargetPower(n);
+    if (p == n.txPower) continue;
+    // The queue holds a handful of frames; finish the pass shortly
+    // instead of recording a power the node never heard about
+    if (txFreeSlots() <= ADR_TX_HEADROOM || !sendLoRaConfig(n.shortAddr, activeSf, p)) {
+      lastAdrEval = now - ADR_INTERVAL_MS + ADR_POWER_RETRY_MS;
+      break;
+    }
+    Serial.printf("[ADR] %s snr=%.1f -> txPower %d dBm\n", n.nodeId, n.snrAvg, p);
+    n.txPower = p;
+    n.snrSamples = 0;  // re-measure at the new power
+  }
+}
+
+// ---------------- Storage: config image ----------------
+// The bootstrap config is imported once into a binary image (config_image.h)
+// and boot reads that back record by record, so load time and stack use
+// don't grow with the size of the original JSON. JSON stays the exchange
+// format: it is what the backend sends, and exportConfigJson() rebuilds it
+// from the image. A JSON file left by older firmware is imported on boot.
+//
+// The image feeds both tasks: the uplink task owns the gateway-level
+// settings (ids, broker, APN, topics, uplink options), the radio task owns
+// the LoRa parameters and the node list. Each loads only its own part.
+#define CFG_GATEWAY 0x01
+#define CFG_RADIO   0x02
+#define CFG_ALL     (CFG_GATEWAY | CFG_RADIO)
+
+const char *CONFIG_IMAGE_PATH = "/gateway_config.bin";
+const char *CONFIG_IMAGE_TMP  = "/gateway_config.tmp";
+const char *CONFIG_PART_PATH  = "/gateway_config.part";  // node records of an import in progress
+
+void copyField(char* dst, size_t size, const char* src) {
+  snprintf(dst, size, "%s", src ? src : "");
+}
+
+CfgNodeRec nodeRecFromJson(JsonObjectConst n) {
+  CfgNodeRec r;
+  memset(&r, 0, sizeof(r));
+  copyField(r.nodeId, sizeof(r.nodeId), n["nodeId"] | "");
+  r.onHour = n["config"]["onHour"] | 0;
+  r.onMin = n["config"]["onMin"] | 0;
+  r.offHour = n["config"]["offHour"] | 0;
+  r.offMin = n["config"]["offMin"] | 0;
+  r.configVersion = n["configVersion"] | 0;
+  r.regIntervalMs = n["intervals"]["register"] | 600000UL;
+  r.statusIntervalMs = n["intervals"]["status"] | 60000UL;
+  cfgNodeSeal(r);
+  return r;
+}
+
+// False if the gatewayId is missing or doesn't fit: a cut-off id would publish on
+// another gateway's topics
+bool gatewayRecFromJson(const JsonDocument& doc, CfgGatewayRec &g) {
+  memset(&g, 0, sizeof(g));
+  const char* gatewayId = doc["gatewayId"] | "";
+  if (!gatewayId[0]) {
+    Serial.println("[CONFIG] Missing gatewayId, config refused");
+    return false;
+  }
+  if (strlen(gatewayId) > GATEWAY_ID_MAX) {
+    Serial.printf("[CONFIG] gatewayId longer than %u chars, config refused\n", (unsigned)GATEWAY_ID_MAX);
+    return false;
+  }
+  copyField(g.gatewayId, sizeof(g.gatewayId), gatewayId);
+  copyField(g.apn, sizeof(g.apn), doc["apn"] | DEFAULT_APN);
+  copyField(g.broker, sizeof(g.broker), doc["mqtt"]["broker"] | DEFAULT_BROKER);
+  g.port = doc["mqtt"]["port"] | DEFAULT_PORT;
+  g.configVersion = doc["configVersion"] | 0;
+  g.encoding = (strcasecmp(doc["encoding"] | "json", "msgpack") == 0) ? ENC_MSGPACK : ENC_JSON;
+  g.statusBatch = doc["uplink"]["statusBatch"] | true;
+  g.perNodeTopics = doc["uplink"]["perNodeTopics"] | false;
+  g.batchWindowMs = doc["uplink"]["batchWindowMs"] | 5000UL;
+  g.batchSize = doc["uplink"]["batchSize"] | STATUS_BATCH_MAX;
+  g.loraFreq = doc["lora"]["frequency"] | DEFAULT_LORA_FREQ;
+  g.loraSf = doc["lora"]["spreadingFactor"] | DEFAULT_LORA_SF;
+  g.loraBw = doc["lora"]["bandwidth"] | DEFAULT_LORA_BW;
+  g.loraCr = doc["lora"]["codingRate"] | DEFAULT_LORA_CR;
+  float dutyPct = doc["lora"]["dutyCyclePct"] | (DEFAULT_DUTY_CYCLE_PERMILLE / 10.0f);
+  g.dutyPermille = (dutyPct <= 0 || dutyPct > 100) ? DEFAULT_DUTY_CYCLE_PERMILLE : (uint16_t)(dutyPct * 10);
+  return true;
+}
+
+// Node records of an import collect in the part file first
+bool appendNodeRecords(JsonArrayConst nodes, uint32_t &count) {
+  File f = SPIFFS.open(CONFIG_PART_PATH, FILE_APPEND);
+  if (!f) {
+    Serial.println("[SPIFFS] failed to open config part file");
+    return false;
+  }
+  bool ok = true;
+  for (JsonObjectConst n : nodes) {
+    CfgNodeRec r = nodeRecFromJson(n);
+    if (f.write((const uint8_t*)&r, sizeof(r)) != sizeof(r)) {
+      ok = false;
+      break;
+    }
+    count++;
+  }
+  f.close();
+  if (!ok) Serial.println("[SPIFFS] failed to write config part file");
+  return ok;
+}
+
+// Header + gateway record + the part file's node records, written aside
+// and renamed over the image
+bool installConfigImage(const CfgGatewayRec &g, uint32_t count) {
+  CfgImageHeader h;
+  cfgImageSeal(h, g, count);
+
+  File part = SPIFFS.open(CONFIG_PART_PATH, FILE_READ);
+  File f = SPIFFS.open(CONFIG_IMAGE_TMP, FILE_WRITE);
+  if (!f || (count && !part)) {
+    Serial.println("[SPIFFS] failed to open config image for writing");
+    if (f) f.close();
+    if (part) part.close();
+    return false;
+  }
+  bool ok = f.write((const uint8_t*)&h, sizeof(h)) == sizeof(h) &&
+            f.write((const uint8_t*)&g, sizeof(g)) == sizeof(g);
+  uint8_t buf[4 * sizeof(CfgNodeRec)];
+  size_t left = (size_t)count * sizeof(CfgNodeRec);
+  while (ok && left > 0) {
+    size_t n = part.read(buf, left < sizeof(buf) ? left : sizeof(buf));
+    ok = n > 0 && f.write(buf, n) == n;
+    left -= n;
+  }
+  f.close();
+  if (part) part.close();
+  SPIFFS.remove(CONFIG_PART_PATH);
+  if (!ok) {
+    Serial.println("[SPIFFS] failed to write config image");
+    SPIFFS.remove(CONFIG_IMAGE_TMP);
+    return false;
+  }
+  SPIFFS.remove(CONFIG_IMAGE_PATH);
+  if (!SPIFFS.rename(CONFIG_IMAGE_TMP, CONFIG_IMAGE_PATH)) {
+    Serial.println("[SPIFFS] failed to install config image");
+    return false;
+  }
+  Serial.printf("[CONFIG] saved config image (%lu nodes)\n", (unsigned long)count);
+  return true;
+}
+
+// Import of a single-message JSON bootstrap config
+bool saveConfigToSPIFFS(const JsonDocument& doc) {
+  CfgGatewayRec g;
+  if (!gatewayRecFromJson(doc, g)) return false;
+  SPIFFS.remove(CONFIG_PART_PATH);
+  uint32_t count = 0;
+  if (!appendNodeRecords(doc["nodes"].as<JsonArrayConst>(), count)) return false;
+  return installConfigImage(g, count);
+}
+
+// ---- Paged import ----
+// A device_config too big for one MQTT message comes as pages:
+//   { "type":"device_config", "page":{ "id":7, "seq":0, "total":40 }, ..., "nodes":[ … ] }
+// Page 0 carries the gateway settings, every page a slice of the nodes.
+// Each page's nodes are appended to the part file as it arrives, so memory
+// stays at one page (one MQTT buffer) however large the fleet. The image is
+// only built, and applied, once the last page is in, so the node table never
+// mixes an old and a half-received new list. Pages must arrive in order;
+// anything else is refused with the seq we expect next.
+#define CONFIG_PAGE_TIMEOUT_MS 120000UL  // a transfer idle this long is abandoned
+
+struct ConfigPaging {
+  bool active;
+  uint32_t id;
+  uint16_t next;      // seq expected next
+  uint16_t total;
+  uint32_t nodes;     // records in the part file
+  unsigned long lastPageAt;
+  CfgGatewayRec gw;   // from page 0
+};
+
+ConfigPaging paging = {};
+
+void postConfigPage(uint32_t id, uint16_t seq, bool ok) {
+  UplinkEvent e = {};
+  e.cmdId = seq;
+  e.success = ok;
+  e.pageId = id;
+  e.pageNext = paging.next;
+  e.pageTotal = paging.total;
+  postUplinkEvent(EVT_CONFIG_PAGE, nullptr, e);
+}
+
+// Returns true once the last page is in and the image is installed
+bool handleConfigPage(const JsonDocument& doc) {
+  uint32_t id = doc["page"]["id"] | 0UL;
+  uint16_t seq = doc["page"]["seq"] | 0;
+  uint16_t total = doc["page"]["total"] | 0;
+  unsigned long now = millis();
+
+  if (paging.active && now - paging.lastPageAt > CONFIG_PAGE_TIMEOUT_MS) {
+    Serial.printf("[BOOTSTRAP] Paged config %lu timed out at page %u/%u\n",
+                  (unsigned long)paging.id, paging.next, paging.total);
+    paging.active = false;
+  }
+
+  if (seq == 0 && total > 0) {
+    paging = {};
+    paging.active = true;
+    paging.id = id;
+    paging.total = total;
+    if (!gatewayRecFromJson(doc, paging.gw)) {
+      paging.active = false;
+      postConfigPage(id, seq, false);
+      return false;
+    }
+    SPIFFS.remove(CONFIG_PART_PATH);
+  } else if (!paging.active || id != paging.id || total != paging.total || seq != paging.next) {
+    Serial.printf("[BOOTSTRAP] Refusing config page %lu/%u (expecting %lu/%u)\n",
+                  (unsigned long)id, seq, (unsigned long)paging.id, paging.next);
+    postConfigPage(id, seq, false);
+    return false;
+  }
+
+  if (!appendNodeRecords(doc["nodes"].as<JsonArrayConst>(), paging.nodes)) {
+    paging.active = false;
+    postConfigPage(id, seq, false);
+    return false;
+  }
+  paging.next = seq + 1;
+  paging.lastPageAt = now;
+  Serial.printf("[BOOTSTRAP] Config page %u/%u (%lu nodes so far)\n",
+                seq + 1, total, (unsigned long)paging.nodes);
+
+  if (paging.next < paging.total) {
+    postConfigPage(id, seq, true);
+    return false;
+  }
+
+  paging.active = false;
+  bool ok = installConfigImage(paging.gw, paging.nodes);
+  postConfigPage(id, seq, ok);
+  return ok;
+}
+
+// Opens the image and reads the fixed part; false if missing or corrupt
+bool openConfigImage(File &f, CfgImageHeader &h, CfgGatewayRec &g) {
+  if (!SPIFFS.exists(CONFIG_IMAGE_PATH)) return false;
+  f = SPIFFS.open(CONFIG_IMAGE_PATH, FILE_READ);
+  if (!f) {
+    Serial.println("[SPIFFS] failed open config image");
+    return false;
+  }
+  if (f.read((uint8_t*)&h, sizeof(h)) != sizeof(h) ||
+      f.read((uint8_t*)&g, sizeof(g)) != sizeof(g) || !cfgImageValid(h, g)) {
+    Serial.println("[CONFIG] config image invalid (magic/version/CRC)");
+    f.close();
+    return false;
+  }
+  g.gatewayId[sizeof(g.gatewayId)-1] = '\0';
+  g.apn[sizeof(g.apn)-1] = '\0';
+  g.broker[sizeof(g.broker)-1] = '\0';
+  return true;
+}
+
+bool loadConfigFromSPIFFS(uint8_t parts = CFG_ALL) {
+  File f;
+  CfgImageHeader h;
+  CfgGatewayRec g;
+  if (!openConfigImage(f, h, g)) {
+    Serial.println("[CONFIG] no config image in SPIFFS");
+    return false;
+  }
+
+  if (parts & CFG_GATEWAY) {
+    GATEWAY_ID = String(g.gatewayId);
+    APN = String(g.apn);
+    MQTT_BROKER = String(g.broker);
+    MQTT_PORT = g.port;
+    configVersion = g.configVersion;
+    WIRE_ENCODING = g.encoding == ENC_MSGPACK ? ENC_MSGPACK : ENC_JSON;
+    STATUS_BATCH_ENABLED = g.statusBatch;
+    STATUS_PER_NODE_TOPICS = g.perNodeTopics;
+    STATUS_BATCH_WINDOW_MS = g.batchWindowMs;
+    STATUS_BATCH_SIZE = g.batchSize;
+    if (STATUS_BATCH_SIZE == 0 || STATUS_BATCH_SIZE > STATUS_BATCH_MAX) STATUS_BATCH_SIZE = STATUS_BATCH_MAX;
+    if (!STATUS_BATCH_ENABLED) STATUS_PER_NODE_TOPICS = true;  // never go silent
+
+    if (GATEWAY_ID.length() > 0) {
+      backendGatewayTopicBase = "iot/gateway/" + GATEWAY_ID + "/";
+      topic_gateway_config_set = backendGatewayTopicBase + "config/set";
+      topic_gateway_config_get = backendGatewayTopicBase + "config/get";
+      topic_gateway_node_assign = backendGatewayTopicBase + "node/assign";
+      topic_gateway_node_config = backendGatewayTopicBase + "node/+/config/set";
+      topic_gateway_status = backendGatewayTopicBase + "status";
+      topic_gateway_control = backendGatewayTopicBase + "control";
+      topic_node_control = backendGatewayTopicBase + "node/+/control";
+      topic_gateway_nodes_status = backendGatewayTopicBase + "nodes/status";
+    }
+    updateUplinkTopicPrefix();
+
+    Serial.printf("[CONFIG] loaded gatewayId=%s broker=%s:%d\n",
+                  GATEWAY_ID.c_str(), MQTT_BROKER.c_str(), MQTT_PORT);
+  }
+
+  if (parts & CFG_RADIO) {
+    LORA_FREQUENCY = g.loraFreq;
+    LORA_SF = g.loraSf;
+    LORA_BW = g.loraBw;
+    LORA_CR = g.loraCr;
+    DUTY_CYCLE_PERMILLE = g.dutyPermille ? g.dutyPermille : DEFAULT_DUTY_CYCLE_PERMILLE;
+    copyField(nodeGatewayId, sizeof(nodeGatewayId), g.gatewayId);
+    gwTag = gatewayTag(nodeGatewayId);
+
+    // Only the records we keep are read and checked; deferred group
+    // members are nodeList indices and don't survive the reload
+    if (maskCount(groupCmd.unicast)) {
+      Serial.printf("[GROUP] cmdId=%u: dropping %u unicast members on node list reload\n",
+                    groupCmd.cmdId, maskCount(groupCmd.unicast));
+      memset(groupCmd.unicast, 0, sizeof(groupCmd.unicast));
+    }
+    nodeCount = 0;
+    uint32_t bad = 0;
+    for (uint32_t i = 0; i < h.nodeCount && nodeCount < MAX_NODES; i++) {
+      CfgNodeRec r;
+      if (f.read((uint8_t*)&r, sizeof(r)) != sizeof(r)) break;
+      if (!cfgNodeValid(r)) {
+        bad++;
+        continue;
+      }
+      NodeInfo &n = nodeList[nodeCount];
+      copyField(n.nodeId, sizeof(n.nodeId), r.nodeId);
+      n.onHour = r.onHour;
+      n.onMin = r.onMin;
+      n.offHour = r.offHour;
+      n.offMin = r.offMin;
+      n.configVersion = r.configVersion;
+      n.regIntervalMs = r.regIntervalMs;
+      n.statusIntervalMs = r.statusIntervalMs;
+      resetNodeRtt(n);
+      resetNodeLink(n);
+      n.ackedLight = LIGHT_UNKNOWN;
+      nodeCount++;
+    }
+    assignShortAddresses();
+    rebuildNodeIndex();
+    loadAppliedVersions();
+    resetAdr();  // new base parameters, start over from them
+
+    if (bad) Serial.printf("[CONFIG] skipped %lu corrupt node records\n", (unsigned long)bad);
+    if (h.nodeCount > MAX_NODES) {
+      Serial.printf("[CONFIG] image has %lu nodes, using the first %d\n", (unsigned long)h.nodeCount, MAX_NODES);
+    }
+    Serial.printf("[CONFIG] loaded nodes=%u freq=%lu\n", (unsigned)nodeCount, (unsigned long)LORA_FREQUENCY);
+  }
+  f.close();
+  return true;
+}
+
+// One-time import of the JSON file older firmware kept
+void migrateJsonConfig() {
+  if (!SPIFFS.exists(CONFIG_PATH)) return;
+  File f = SPIFFS.open(CONFIG_PATH, FILE_READ);
+  if (!f) return;
+  StaticJsonDocument<4096> doc;
+  DeserializationError err = deserializeJson(doc, f);
+  f.close();
+  if (err) {
+    Serial.print("[CONFIG] legacy JSON config unreadable: ");
+    Serial.println(err.c_str());
+    return;
+  }
+  if (saveConfigToSPIFFS(doc)) {
+    SPIFFS.remove(CONFIG_PATH);
+    Serial.println("[CONFIG] imported legacy JSON config");
+  }
+}
+
+// Export: rebuilds the bootstrap JSON from the image, one node at a time
+size_t exportConfigJson(Print &out) {
+  File f;
+  CfgImageHeader h;
+  CfgGatewayRec g;
+  if (!openConfigImage(f, h, g)) return 0;
+
+  StaticJsonDocument<512> doc;
+  doc["type"] = "device_config";
+  doc["gatewayId"] = (const char*)g.gatewayId;
+  doc["apn"] = (const char*)g.apn;
+  doc["configVersion"] = g.configVersion;
+  doc["encoding"] = g.encoding == ENC_MSGPACK ? "msgpack" : "json";
+  doc["mqtt"]["broker"] = (const char*)g.broker;
+  doc["mqtt"]["port"] = g.port;
+  doc["uplink"]["statusBatch"] = (bool)g.statusBatch;
+  doc["uplink"]["perNodeTopics"] = (bool)g.perNodeTopics;
+  doc["uplink"]["batchWindowMs"] = g.batchWindowMs;
+  doc["uplink"]["batchSize"] = g.batchSize;
+  doc["lora"]["frequency"] = g.loraFreq;
+  doc["lora"]["spreadingFactor"] = g.loraSf;
+  doc["lora"]["bandwidth"] = g.loraBw;
+  doc["lora"]["codingRate"] = g.loraCr;
+  doc["lora"]["dutyCyclePct"] = g.dutyPermille / 10.0f;
+
+  // Gateway object without its closing brace, then the nodes array
+  char head[512];
+  size_t n = serializeJson(doc, head, sizeof(head));
+  if (n == 0 || n >= sizeof(head)) {
+    f.close();
+    return 0;
+  }
+  size_t total = out.write((const uint8_t*)head, n - 1);
+  total += out.print(",\"nodes\":[");
+
+  bool first = true;
+  CfgNodeRec r;
+  for (uint32_t i = 0; i < h.nodeCount && f.read((uint8_t*)&r, sizeof(r)) == sizeof(r); i++) {
+    if (!cfgNodeValid(r)) continue;
+    r.nodeId[sizeof(r.nodeId)-1] = '\0';
+    StaticJsonDocument<256> nd;
+    nd["nodeId"] = (const char*)r.nodeId;
+    nd["configVersion"] = r.configVersion;
+    nd["config"]["onHour"] = r.onHour;
+    nd["config"]["onMin"] = r.onMin;
+    nd["config"]["offHour"] = r.offHour;
+    nd["config"]["offMin"] = r.offMin;
+    nd["intervals"]["register"] = r.regIntervalMs;
+    nd["intervals"]["status"] = r.statusIntervalMs;
+    if (!first) total += out.print(",");
+    total += serializeJson(nd, out);
+    first = false;
+  }
+  total += out.print("]}");
+  f.close();
+  return total;
+}
+
+// MQTT goes over the modem UART, so it may only run while the link state
+// machine is not using the port
+bool mqttReady() {
+  return !modemLink.ownsUart() && mqtt.connected();
+}
+
+// ---------------- Uplink outbox (store-and-forward) ----------------
+// Uplink messages that can't be published right now (GPRS/MQTT down) are
+// kept in a RAM byte ring; once that is full they spill to a flash log.
+// Everything drains strictly FIFO, so per-node ordering is preserved:
+// RAM holds the oldest records and, while the flash log is non-empty, new
+// records are appended there rather than jumping ahead in RAM.
+// The flash read offset is kept in NVS so a reboot resumes where the
+// drain stopped, and the log is compacted when sent records would push
+// it over its cap.
+#define OUTBOX_RAM_BYTES        8192
+#define OUTBOX_FLASH_MAX_BYTES  65536UL
+#define OUTBOX_TOPIC_MAX        96
+#define OUTBOX_DRAIN_BATCH      5        // messages per drain pass ...
+#define OUTBOX_DRAIN_INTERVAL_MS 1000UL  // ... at most this often
+#define OUTBOX_COPY_CHUNK       256
+
+const char *OUTBOX_PATH = "/outbox.log";
+const char *OUTBOX_TMP_PATH = "/outbox.tmp";  // compaction target
+
+struct __attribute__((packed)) OutboxHdr {
+  uint16_t topicLen;
+  uint16_t payloadLen;
+  uint8_t  retained;
+};
+
+uint8_t outboxRam[OUTBOX_RAM_BYTES];
+size_t  obHead = 0;          // oldest byte
+size_t  obUsed = 0;          // bytes in use
+uint32_t obRamCount = 0;     // records in RAM
+uint32_t obFlashCount = 0;   // records in flash not yet sent
+size_t  obFlashReadPos = 0;  // next record to send from flash
+size_t  obFlashSize = 0;     // bytes written to flash log
+size_t  obSavedReadPos = 0;  // obFlashReadPos as last stored in NVS
+Preferences outboxPrefs;
+uint32_t outboxDropped = 0;
+uint32_t outboxSpilled = 0;
+unsigned long lastOutboxDrain = 0;
+
+uint32_t outboxBacklog() {
+  return obRamCount + obFlashCount;
+}
+
+void obRamWrite(const void* src, size_t n) {
+  const uint8_t* p = (const uint8_t*)src;
+  size_t tail = (obHead + obUsed) % OUTBOX_RAM_BYTES;
+  for (size_t i = 0; i < n; i++) outboxRam[(tail + i) % OUTBOX_RAM_BYTES] = p[i];
+  obUsed += n;
+}
+
+void obRamPeek(size_t off, void* dst, size_t n) {
+  uint8_t* p = (uint8_t*)dst;
+  for (size_t i = 0; i < n; i++) p[i] = outboxRam[(obHead + off + i) % OUTBOX_RAM_BYTES];
+}
+
+// Stored once per drain pass rather than per record, to spare the NVS;
+// a reboot mid-pass replays at most OUTBOX_DRAIN_BATCH messages
+void obSaveReadPos() {
+  if (obFlashReadPos == obSavedReadPos) return;
+  outboxPrefs.begin("outbox", false);
+  outboxPrefs.putUInt("rd", (uint32_t)obFlashReadPos);
+  outboxPrefs.end();
+  obSavedReadPos = obFlashReadPos;
+}
+
+void obFlashReset() {
+  obFlashReadPos = 0;
+  obSaveReadPos();  // first, so a stale offset can never apply to a new log
+  SPIFFS.remove(OUTBOX_PATH);
+  obFlashCount = 0;
+  obFlashSize = 0;
+}
+
+// Rewrites the log without the records already sent. The offset goes to
+// 0 before the swap: a reboot part way replays sent records rather than
+// skipping unsent ones, and initOutbox() finishes an interrupted swap.
+bool obFlashCompact() {
+  File src = SPIFFS.open(OUTBOX_PATH, FILE_READ);
+  File dst = SPIFFS.open(OUTBOX_TMP_PATH, FILE_WRITE);
+  bool ok = src && dst && src.seek(obFlashReadPos);
+  uint8_t buf[OUTBOX_COPY_CHUNK];
+  for (size_t left = obFlashSize - obFlashReadPos; ok && left > 0;) {
+    size_t n = left < sizeof(buf) ? left : sizeof(buf);
+    ok = src.read(buf, n) == n && dst.write(buf, n) == n;
+    left -= n;
+  }
+  if (src) src.close();
+  if (dst) dst.close();
+  if (!ok) {
+    SPIFFS.remove(OUTBOX_TMP_PATH);
+    return false;
+  }
+
+  size_t sent = obFlashReadPos;
+  obFlashReadPos = 0;
+  obSaveReadPos();
+  SPIFFS.remove(OUTBOX_PATH);
+  SPIFFS.rename(OUTBOX_TMP_PATH, OUTBOX_PATH);
+  obFlashSize -= sent;
+  Serial.printf("[OUTBOX] Compacted flash log, %lu bytes freed\n", (unsigned long)sent);
+  return true;
+}
+
+// Recovers the flash backlog left over from before a reboot, resuming at
+// the stored read offset
+void initOutbox() {
+  obHead = obUsed = 0;
+  obRamCount = 0;
+  obFlashCount = 0;
+  obFlashReadPos = 0;
+  obFlashSize = 0;
+  outboxPrefs.begin("outbox", false);
+  obSavedReadPos = outboxPrefs.getUInt("rd", 0);
+  outboxPrefs.end();
+
+  if (SPIFFS.exists(OUTBOX_TMP_PATH)) {
+    // Compaction cut short: the copy is complete only once the old log is gone
+    if (SPIFFS.exists(OUTBOX_PATH)) SPIFFS.remove(OUTBOX_TMP_PATH);
+    else SPIFFS.rename(OUTBOX_TMP_PATH, OUTBOX_PATH);
+  }
+  if (!SPIFFS.exists(OUTBOX_PATH)) {
+    obFlashReset();
+    return;
+  }
+
+  File f = SPIFFS.open(OUTBOX_PATH, FILE_READ);
+  if (!f) return;
+  size_t size = f.size();
+  size_t pos = 0;
+  uint32_t total = 0, unsent = 0;
+  bool aligned = obSavedReadPos == 0;  // offset must fall on a record boundary
+  OutboxHdr h;
+  while (pos + sizeof(h) <= size) {
+    f.seek(pos);
+    if (f.read((uint8_t*)&h, sizeof(h)) != sizeof(h)) break;
+    size_t next = pos + sizeof(h) + h.topicLen + h.payloadLen;
+    if (next > size) break;  // torn write at the end
+    if (pos == obSavedReadPos) aligned = true;
+    if (pos >= obSavedReadPos) unsent++;
+    pos = next;
+    total++;
+  }
+  f.close();
+  obFlashSize = pos;
+  if (pos == obSavedReadPos) aligned = true;
+  if (aligned) {
+    obFlashReadPos = obSavedReadPos;
+    obFlashCount = unsent;
+  } else {
+    Serial.println("[OUTBOX] Stored read offset invalid, replaying the whole log");
+    obFlashCount = total;
+  }
+  if (obFlashCount == 0) obFlashReset();
+  Serial.printf("[OUTBOX] %lu messages pending from flash\n", (unsigned long)obFlashCount);
+}
+
+bool outboxPush(const char* topic, const uint8_t* payload, size_t len, bool retained) {
+  OutboxHdr h;
+  h.topicLen = (uint16_t)strnlen(topic, OUTBOX_TOPIC_MAX);
+  h.payloadLen = (uint16_t)len;
+  h.retained = retained;
+  size_t recLen = sizeof(h) + h.topicLen + h.payloadLen;
+
+  if (obFlashCount == 0 && obUsed + recLen <= OUTBOX_RAM_BYTES) {
+    obRamWrite(&h, sizeof(h));
+    obRamWrite(topic, h.topicLen);
+    obRamWrite(payload, h.payloadLen);
+    obRamCount++;
+    return true;
+  }
+
+  // Sent records still take up the log until it is compacted
+  if (obFlashSize + recLen > OUTBOX_FLASH_MAX_BYTES && obFlashReadPos > 0) obFlashCompact();
+  if (obFlashSize + recLen > OUTBOX_FLASH_MAX_BYTES) {
+    outboxDropped++;
+    Serial.printf("[OUTBOX] Full, dropping message for %s\n", topic);
+    return false;
+  }
+
+  File f = SPIFFS.open(OUTBOX_PATH, FILE_APPEND);
+  if (!f) {
+    outboxDropped++;
+    return false;
+  }
+  bool ok = f.write((const uint8_t*)&h, sizeof(h)) == sizeof(h) &&
+            f.write((const uint8_t*)topic, h.topicLen) == h.topicLen &&
+            f.write(payload, h.payloadLen) == h.payloadLen;
+  f.close();
+  if (!ok) {
+    outboxDropped++;
+    return false;
+  }
+  obFlashSize += recLen;
+  obFlashCount++;
+  outboxSpilled++;
+  return true;
+}
+
+// Publishes the oldest stored message; false if none or the publish failed
+bool outboxSendOne() {
+  static uint8_t payload[MQTT_PAYLOAD_MAX];
+  char topic[OUTBOX_TOPIC_MAX + 1];
+  OutboxHdr h;
+
+  if (obRamCount > 0) {
+    obRamPeek(0, &h, sizeof(h));
+    obRamPeek(sizeof(h), topic, h.topicLen);
+    topic[h.topicLen] = '\0';
+    obRamPeek(sizeof(h) + h.topicLen, payload, h.payloadLen);
+    if (!mqtt.publish(topic, payload, h.payloadLen, h.retained)) return false;
+    size_t recLen = sizeof(h) + h.topicLen + h.payloadLen;
+    obHead = (obHead + recLen) % OUTBOX_RAM_BYTES;
+    obUsed -= recLen;
+    obRamCount--;
+    return true;
+  }
+
+  if (obFlashCount == 0) return false;
+
+  File f = SPIFFS.open(OUTBOX_PATH, FILE_READ);
+  if (!f) return false;
+  f.seek(obFlashReadPos);
+  bool ok = f.read((uint8_t*)&h, sizeof(h)) == sizeof(h) &&
+            h.topicLen <= OUTBOX_TOPIC_MAX && h.payloadLen <= sizeof(payload) &&
+            f.read((uint8_t*)topic, h.topicLen) == h.topicLen &&
+            f.read(payload, h.payloadLen) == h.payloadLen;
+  f.close();
+  if (!ok) {
+    Serial.println("[OUTBOX] Corrupt flash log, discarding");
+    outboxDropped += obFlashCount;
+    obFlashReset();
+    return false;
+  }
+  topic[h.topicLen] = '\0';
+  if (!mqtt.publish(topic, payload, h.payloadLen, h.retained)) return false;
+
+  obFlashReadPos += sizeof(h) + h.topicLen + h.payloadLen;
+  obFlashCount--;
+  if (obFlashCount == 0) obFlashReset();
+  return true;
+}
+
+// Called from loop(): rate-limited drain while MQTT is up
+void serviceOutbox() {
+  if (outboxBacklog() == 0 || !mqttReady()) return;
+  if (millis() - lastOutboxDrain < OUTBOX_DRAIN_INTERVAL_MS) return;
+  lastOutboxDrain = millis();
+
+  uint8_t sent = 0;
+  while (sent < OUTBOX_DRAIN_BATCH && outboxSendOne()) sent++;
+  obSaveReadPos();
+  if (sent > 0) {
+    Serial.printf("[OUTBOX] Drained %u, backlog %lu\n", sent, (unsigned long)outboxBacklog());
+  }
+}
+
+// ---------------- MQTT / Backend handling ----------------
+size_t encodeDoc(const JsonDocument& doc, uint8_t* buf, size_t size) {
+  size_t n = (WIRE_ENCODING == ENC_MSGPACK) ? serializeMsgPack(doc, buf, size)
+                                             : serializeJson(doc, buf, size);
+  return (n >= size) ? 0 : n;
+}
+
+// Serializes in the negotiated encoding (same field schema either way) and publishes
+bool publishDoc(const char* topic, const JsonDocument& doc, bool retained = false) {
+  if (!mqttReady()) return false;
+  static uint8_t buf[MQTT_PAYLOAD_MAX];
+  size_t n = encodeDoc(doc, buf, sizeof(buf));
+  if (n == 0) {
+    Serial.printf("[MQTT] Payload too large for %s\n", topic);
+    return false;
+  }
+  return mqtt.publish(topic, buf, n, retained);
+}
+
+// Like publishDoc(), but goes through the outbox when offline or behind a
+// backlog, so nothing is lost and nothing overtakes older messages.
+bool publishOrStore(const char* topic, const JsonDocument& doc, bool retained = false) {
+  static uint8_t buf[MQTT_PAYLOAD_MAX];
+  size_t n = encodeDoc(doc, buf, sizeof(buf));
+  if (n == 0) {
+    Serial.printf("[MQTT] Payload too large for %s\n", topic);
+    outboxDropped++;
+    return false;
+  }
+  if (outboxBacklog() == 0 && mqttReady() && mqtt.publish(topic, buf, n, retained)) return true;
+  return outboxPush(topic, buf, n, retained);
+}
+
+// JSON objects start with '{' (maybe after whitespace); anything else is MessagePack
+bool isJsonPayload(const byte* payload, unsigned int length) {
+  unsigned int i = 0;
+  while (i < length && (payload[i] == ' ' || payload[i] == '\t' || payload[i] == '\r' || payload[i] == '\n')) i++;
+  return i < length && payload[i] == '{';
+}
+
+DeserializationError decodeDoc(JsonDocument& doc, const byte* payload, unsigned int length) {
+  if (isJsonPayload(payload, length)) return deserializeJson(doc, payload, length);
+  return deserializeMsgPack(doc, payload, length);
+}
+
+// Same, keeping only the fields set in filter
+DeserializationError decodeDoc(JsonDocument& doc, const byte* payload, unsigned int length,
+                               const JsonDocument& filter) {
+  if (isJsonPayload(payload, length)) {
+    return deserializeJson(doc, payload, length, DeserializationOption::Filter(filter));
+  }
+  return deserializeMsgPack(doc, payload, length, DeserializationOption::Filter(filter));
 }
 
-// ---------------- MQTT / Backend handling ----------------
-String extractNodeIdFromTopic(const char* topic) {
-  String t = String(topic);
-  int idx = t.indexOf("/node/");
-  if (idx == -1) return String("");
-  int start = idx + 6;
-  int next = t.indexOf('/', start);
-  if (next == -1) next = t.length();
-  return t.substring(start, next);
+// Copies the segment after "/node/" into out; empty if the topic has none
+void extractNodeIdFromTopic(const char* topic, char* out, size_t outSize) {
+  out[0] = '\0';
+  const char* p = strstr(topic, "/node/");
+  if (!p) return;
+  p += 6;
+  const char* end = strchr(p, '/');
+  size_t len = end ? (size_t)(end - p) : strlen(p);
+  if (len >= outSize) len = outSize - 1;
+  memcpy(out, p, len);
+  out[len] = '\0';
 }
 
+// Updates the node's desired config; the rollout engine pushes it if the
+// node is not on it yet. Nodes we don't know get a single push as before.
 void handleNodeConfig(const JsonDocument& doc, const char* topic) {
-  ConfigPkt pkt;
-  pkt.pktType = 0x04;
-
+  char nodeId[24] = "";
   const char* nodeIdPayload = doc["nodeId"] | "";
-  String nodeIdStr = nodeIdPayload;
-  if (nodeIdStr.length() == 0) {
-    nodeIdStr = extractNodeIdFromTopic(topic);
+  if (nodeIdPayload[0] == '\0') {
+    extractNodeIdFromTopic(topic, nodeId, sizeof(nodeId));
+  } else {
+    strncpy(nodeId, nodeIdPayload, sizeof(nodeId)-1);
   }
-  strncpy(pkt.nodeId, nodeIdStr.c_str(), sizeof(pkt.nodeId)-1);
-  pkt.nodeId[sizeof(pkt.nodeId)-1] = '\0';
 
   const char* gw = doc["gatewayId"] | "";
-  strncpy(pkt.gatewayId, gw, sizeof(pkt.gatewayId)-1);
-  pkt.gatewayId[sizeof(pkt.gatewayId)-1] = '\0';
+  if (gw[0]) {
+    strncpy(nodeGatewayId, gw, sizeof(nodeGatewayId)-1);
+    gwTag = gatewayTag(nodeGatewayId);
+  }
 
-  pkt.onHour = doc["schedule"]["onHour"] | 0;
-  pkt.onMin  = doc["schedule"]["onMin"]  | 0;
-  pkt.offHour = doc["schedule"]["offHour"] | 0;
-  pkt.offMin  = doc["schedule"]["offMin"] | 0;
-  pkt.cfgVer  = doc["configVersion"] | 1;
-  pkt.regIntervalMs = doc["intervals"]["register"] | 600000;
-  pkt.statusIntervalMs = doc["intervals"]["status"] | 60000;
+  NodeInfo want = {};
+  snprintf(want.nodeId, sizeof(want.nodeId), "%s", nodeId);
+  want.onHour = doc["schedule"]["onHour"] | 0;
+  want.onMin  = doc["schedule"]["onMin"]  | 0;
+  want.offHour = doc["schedule"]["offHour"] | 0;
+  want.offMin  = doc["schedule"]["offMin"] | 0;
+  want.configVersion = doc["configVersion"] | 1;
+  want.regIntervalMs = doc["intervals"]["register"] | 600000UL;
+  want.statusIntervalMs = doc["intervals"]["status"] | 60000UL;
+
+  int idx = findNodeIndex(nodeId);
+  if (idx < 0) {
+    want.shortAddr = NO_SHORT_ADDR;
+    sendConfigFrame(want, -1);
+    Serial.printf("[GATEWAY] Forwarded config to unknown node %s (from topic %s)\n", nodeId, topic);
+    return;
+  }
 
-  sendLoRaPacket((uint8_t*)&pkt, sizeof(pkt));
-  Serial.printf("[GATEWAY] Forwarded config to node %s (from topic %s)\n", pkt.nodeId, topic);
+  NodeInfo &n = nodeList[idx];
+  bool changed = n.onHour != want.onHour || n.onMin != want.onMin || n.offHour != want.offHour ||
+                 n.offMin != want.offMin || n.regIntervalMs != want.regIntervalMs ||
+                 n.statusIntervalMs != want.statusIntervalMs;
+  n.onHour = want.onHour;
+  n.onMin = want.onMin;
+  n.offHour = want.offHour;
+  n.offMin = want.offMin;
+  n.regIntervalMs = want.regIntervalMs;
+  n.statusIntervalMs = want.statusIntervalMs;
+  n.configVersion = want.configVersion;
+  // Same version with different content still has to reach the node
+  if (changed) n.versionKnown = false;
+  n.configRetryAt = 0;
+
+  Serial.printf("[ROLLOUT] %s wants v%u (%s)\n", nodeId, n.configVersion,
+                nodeConfigCurrent(n) ? "already current" : "queued for rollout");
 }
 
+// Radio task: persist the bootstrap config and apply the radio half of it.
+// The uplink task picks up the rest on EVT_CONFIG_APPLIED.
 void handleDeviceConfig(const JsonDocument& doc, const char* topic) {
-  Serial.println("[MQTT] Received bootstrap config");
+  Serial.printf("[MQTT] Received bootstrap config on %s\n", topic);
 
-  String gw = String(doc["gatewayId"] | "");
-  if (gw == "") {
-    Serial.println("[MQTT] Missing gatewayId in bootstrap config, ignoring");
+  // gatewayId is checked with the gateway settings: in the message itself,
+  // or in page 0 of a paged one (later pages carry only nodes)
+  if (doc.containsKey("page")) {
+    if (!handleConfigPage(doc)) return;  // more pages to come, or refused
+  } else if (!saveConfigToSPIFFS(doc)) {
+    Serial.println("[BOOTSTRAP] Failed to save config");
     return;
   }
 
-  if (!saveConfigToSPIFFS(doc)) {
-    Serial.println("[BOOTSTRAP] Failed to save config");
+  if (!loadConfigFromSPIFFS(CFG_RADIO)) {
+    Serial.println("[BOOTSTRAP] Failed to load config after save");
     return;
   }
 
-  if (!loadConfigFromSPIFFS()) {
+  applyLoRaParamsAndStart();
+
+  UplinkEvent e = {};
+  postUplinkEvent(EVT_CONFIG_APPLIED, nullptr, e);
+}
+
+// Uplink task: second half of the bootstrap, once the radio has applied it
+void finishDeviceConfig() {
+  if (!loadConfigFromSPIFFS(CFG_GATEWAY)) {
     Serial.println("[BOOTSTRAP] Failed to load config after save");
     return;
   }
 
-  mqtt.subscribe(topic_gateway_config_set.c_str());
-  mqtt.subscribe(topic_gateway_node_assign.c_str());
-  mqtt.subscribe(topic_gateway_node_config.c_str());
-  mqtt.subscribe(topic_gateway_control.c_str());
-
-  applyLoRaParamsAndStart();
+  modemLink.setApn(APN.c_str());
+  if (mqttReady()) {  // otherwise mqttConnect() subscribes on reconnect
+    mqtt.subscribe(topic_gateway_config_set.c_str());
+    mqtt.subscribe(topic_gateway_config_get.c_str());
+    mqtt.subscribe(topic_gateway_node_assign.c_str());
+    mqtt.subscribe(topic_gateway_node_config.c_str());
+    mqtt.subscribe(topic_gateway_control.c_str());
+  }
 
   StaticJsonDocument<256> resp;
   resp["type"] = "status";
   resp["status"] = "ONLINE";
-  resp["gatewayId"] = GATEWAY_ID;
-  String s; serializeJson(resp, s);
-  mqtt.publish(topic_gateway_status.c_str(), s.c_str(), true);
+  resp["gatewayId"] = GATEWAY_ID.c_str();
+  publishDoc(topic_gateway_status.c_str(), resp, true);
 
   Serial.printf("[BOOTSTRAP] Config applied successfully for gateway %s\n", GATEWAY_ID.c_str());
 }
 
-void handleAckEvents() {
-  AckEvent evt;
-  while (popAckEvent(evt)) {
-    StaticJsonDocument<256> doc;
-    doc["type"]      = "node_control_ack";
-    doc["gatewayId"] = GATEWAY_ID;
-    doc["deviceId"]  = deviceIdStr;
-    doc["nodeId"]    = evt.nodeId;
-    doc["cmdId"]     = evt.cmdId;
-    doc["success"]   = evt.success;
-    doc["ts"]        = millis();
-
-    String topic;
-    if (GATEWAY_ID.length() > 0) {
-      topic = "iot/gateway/" + GATEWAY_ID +
-              "/node/" + String(evt.nodeId) + "/control/ack";
-    } else {
-      topic = "iot/gateway/" + deviceIdStr +
-              "/node/" + String(evt.nodeId) + "/control/ack";
-    }
+void publishAckEvent(const UplinkEvent &evt) {
+  StaticJsonDocument<256> doc;
+  doc["type"]      = "node_control_ack";
+  doc["gatewayId"] = GATEWAY_ID.c_str();
+  doc["deviceId"]  = deviceIdStr.c_str();
+  doc["nodeId"]    = (const char*)evt.nodeId;
+  doc["cmdId"]     = evt.cmdId;
+  doc["success"]   = evt.success;
+  doc["ts"]        = millis();
+  if (evt.rttMs)  doc["rttMs"]  = evt.rttMs;
+  if (evt.srttMs) {
+    doc["srttMs"] = evt.srttMs;
+    doc["rtoMs"]  = evt.rtoMs;
+  }
+  if (evt.outcome == CMD_SUPERSEDED) {
+    doc["status"] = "superseded";
+    doc["supersededBy"] = evt.byCmdId;
+  } else if (evt.outcome == CMD_UNCHANGED) {
+    doc["status"] = "unchanged";
+  }
 
-    String payload;
-    serializeJson(doc, payload);
+  char topic[TOPIC_MAX];
+  snprintf(topic, sizeof(topic), "%snode/%s/control/ack", uplinkTopicPrefix, evt.nodeId);
 
-    if (mqtt.connected()) {
-      bool ok = mqtt.publish(topic.c_str(), payload.c_str());
-      Serial.printf("[ACK] Publish to backend cmdId=%u node=%s success=%d mqtt=%d\n",
-                    evt.cmdId, evt.nodeId, evt.success, ok);
-    } else {
-      Serial.println("[ACK] MQTT not connected, cannot publish ack event");
-      // Optionally: you could re-queue or count drops here
-    }
-  }
+  bool ok = publishOrStore(topic, doc);
+  Serial.printf("[ACK] Publish to backend cmdId=%u node=%s success=%d queued=%d\n",
+                evt.cmdId, evt.nodeId, evt.success, ok);
 }
 
 
 // ---- CONTROL ENTRY POINT from MQTT (uses queue) ----
+// Same topic the backend already listens on for node config ACKs; the
+// counters give the progress of the whole rollout
+void publishConfigAck(const UplinkEvent &evt) {
+  StaticJsonDocument<256> doc;
+  doc["type"]      = "node_config_ack";
+  doc["gatewayId"] = GATEWAY_ID.c_str();
+  doc["deviceId"]  = deviceIdStr.c_str();
+  doc["nodeId"]    = (const char*)evt.nodeId;
+  doc["cfgVer"]    = evt.cmdId;
+  doc["success"]   = evt.success;
+  JsonObject r = doc.createNestedObject("rollout");
+  r["total"]   = evt.cfgTotal;
+  r["current"] = evt.cfgCurrent;
+  r["failed"]  = evt.cfgFailed;
+
+  char topic[TOPIC_MAX];
+  snprintf(topic, sizeof(topic), "%snode/%s/config/ack", uplinkTopicPrefix, evt.nodeId);
+  publishOrStore(topic, doc);
+}
+
+// Bootstrap comes on the device topic, so page ACKs go back there. Stored
+// like the other replies while offline: the backend waits for each ACK
+// before sending the next page
+void publishConfigPageAck(const UplinkEvent &evt) {
+  StaticJsonDocument<192> doc;
+  doc["type"]     = "config_page_ack";
+  doc["deviceId"] = deviceIdStr.c_str();
+  doc["id"]       = evt.pageId;
+  doc["seq"]      = evt.cmdId;
+  doc["ok"]       = evt.success;
+  doc["next"]     = evt.pageNext;
+  doc["total"]    = evt.pageTotal;
+
+  char topic[DEVICE_TOPIC_BASE_MAX + sizeof("config/page")];
+  snprintf(topic, sizeof(topic), "%.*sconfig/page", (int)DEVICE_TOPIC_BASE_MAX, backendDeviceTopicBase.c_str());
+  publishOrStore(topic, doc);
+}
+
 void controlNode(const JsonDocument& doc) {
   const char* nodeId = doc["nodeId"] | "";
   const char* gwId   = doc["gatewayId"] | "";
   const char* action = doc["action"] | "";
   const char* mode   = doc["mode"] | "MANUAL";
 
+  if (ackKind(doc["cmdId"] | 0U) != CMD_CONTROL) {
+    Serial.printf("[GATEWAY] cmdId %u out of range (top bit is for config ACKs)\n", doc["cmdId"] | 0U);
+    return;
+  }
+
+  if (doc["nodes"].is<JsonArrayConst>() || strcmp(nodeId, "*") == 0) {
+    if (!gwId[0] || !action[0]) {
+      Serial.println("[GATEWAY] Invalid group control payload");
+      return;
+    }
+    Serial.printf("[GATEWAY] GROUP control [%s]\n", action);
+    enqueueGroupCommand(doc);
+    return;
+  }
+
   if (!nodeId[0] || !gwId[0] || !action[0]) {
     Serial.println("[GATEWAY] Invalid control payload");
     return;
@@ -693,11 +3511,123 @@ void controlNode(const JsonDocument& doc) {
   enqueuePendingCommand(doc);
 }
 
+// Uplink task (PubSubClient callback): hand the raw message to the radio task
+// Counts what exportConfigJson() would write, for the MQTT length header
+struct CountingPrint : public Print {
+  size_t n = 0;
+  size_t write(uint8_t) override { n++; return 1; }
+  size_t write(const uint8_t*, size_t size) override { n += size; return size; }
+};
+
+bool configExportRequested = false;
+
+// Control messages refused because downlinkQueue was full. The callback
+// only notes them; the uplink loop answers each with a "busy" ACK so the
+// backend can resend instead of waiting out its own timeout.
+#define BUSY_NACK_MAX 8
+
+struct BusyNack {
+  char     nodeId[24];  // "*" for group commands
+  uint16_t cmdId;
+};
+
+BusyNack busyNacks[BUSY_NACK_MAX];
+uint8_t busyNackCount = 0;
+uint32_t busyNacksSent = 0;
+
+void noteBusyControl(const char* topic, const byte* payload, unsigned int length) {
+  StaticJsonDocument<64> filter;
+  filter["type"] = true;
+  filter["cmdId"] = true;
+  filter["nodeId"] = true;
+  filter["nodes"] = true;
+  StaticJsonDocument<256> doc;
+  if (decodeDoc(doc, payload, length, filter)) return;
+  const char* type = doc["type"] | "";
+  if (strcmp(type, "node_control") != 0 || busyNackCount >= BUSY_NACK_MAX) return;
+
+  BusyNack &b = busyNacks[busyNackCount++];
+  b.cmdId = doc["cmdId"] | 0;
+  const char* nodeId = doc["nodeId"] | "";
+  if (doc["nodes"].is<JsonArrayConst>() || strcmp(nodeId, "*") == 0) {
+    strcpy(b.nodeId, "*");
+  } else if (nodeId[0]) {
+    copyField(b.nodeId, sizeof(b.nodeId), nodeId);
+  } else {
+    extractNodeIdFromTopic(topic, b.nodeId, sizeof(b.nodeId));
+  }
+}
+
+// Group refusals go to the gateway's control/ack, the rest to the node's
+void serviceBusyNacks() {
+  for (uint8_t i = 0; i < busyNackCount; i++) {
+    const BusyNack &b = busyNacks[i];
+    StaticJsonDocument<256> doc;
+    doc["type"]      = "node_control_ack";
+    doc["gatewayId"] = GATEWAY_ID.c_str();
+    doc["deviceId"]  = deviceIdStr.c_str();
+    doc["nodeId"]    = (const char*)b.nodeId;
+    doc["cmdId"]     = b.cmdId;
+    doc["success"]   = false;
+    doc["status"]    = "busy";
+    doc["ts"]        = millis();
+
+    char topic[TOPIC_MAX];
+    if (strcmp(b.nodeId, "*") == 0) snprintf(topic, sizeof(topic), "%scontrol/ack", uplinkTopicPrefix);
+    else snprintf(topic, sizeof(topic), "%snode/%s/control/ack", uplinkTopicPrefix, b.nodeId);
+    publishOrStore(topic, doc);
+    busyNacksSent++;
+    Serial.printf("[DNQ] Told backend busy for cmdId=%u node=%s\n", b.cmdId, b.nodeId);
+  }
+  busyNackCount = 0;
+}
+
+// Streams the exported config to <prefix>config without buffering it
+void publishConfigExport() {
+  CountingPrint count;
+  size_t len = exportConfigJson(count);
+  if (len == 0) {
+    Serial.println("[CONFIG] nothing to export");
+    return;
+  }
+  char topic[TOPIC_MAX];
+  snprintf(topic, sizeof(topic), "%sconfig", uplinkTopicPrefix);
+  if (!mqtt.beginPublish(topic, len, false)) return;
+  size_t sent = exportConfigJson(mqtt);
+  mqtt.endPublish();
+  Serial.printf("[CONFIG] exported %u bytes to %s%s\n", (unsigned)sent, topic,
+                sent == len ? "" : " (image changed mid-export)");
+}
+
 void onMqttMessage(char* topic, byte* payload, unsigned int length) {
+  // Export reads only the image, the uplink task answers it itself
+  if (topic_gateway_config_get.length() && strcmp(topic, topic_gateway_config_get.c_str()) == 0) {
+    configExportRequested = true;
+    return;
+  }
+  if (length > DOWNLINK_PAYLOAD_MAX || strlen(topic) >= TOPIC_MAX) {
+    Serial.printf("[MQTT] Message on %s too large (%u bytes), dropped\n", topic, length);
+    return;
+  }
+  DownlinkMsg* m = downlinkQueue.reserve();
+  if (!m) {
+    Serial.printf("[DNQ] Queue full, dropping message on %s\n", topic);
+    noteBusyControl(topic, payload, length);
+    return;
+  }
+  strcpy(m->topic, topic);
+  memcpy(m->payload, payload, length);
+  m->len = (uint16_t)length;
+  downlinkQueue.commit();
+}
+
+// Radio task: decode and dispatch one backend message
+void handleDownlinkMessage(const DownlinkMsg &m) {
+  const char* topic = m.topic;
   StaticJsonDocument<2048> doc;
-  DeserializationError err = deserializeJson(doc, payload, length);
+  DeserializationError err = decodeDoc(doc, m.payload, m.len);
   if (err) {
-    Serial.print("[MQTT] Invalid JSON received: ");
+    Serial.print("[MQTT] Invalid payload received: ");
     Serial.println(err.c_str());
     return;
   }
@@ -737,6 +3667,7 @@ bool mqttConnect() {
 
     if (GATEWAY_ID.length() > 0) {
       mqtt.subscribe(topic_gateway_config_set.c_str());
+      mqtt.subscribe(topic_gateway_config_get.c_str());
       mqtt.subscribe(topic_gateway_node_assign.c_str());
       mqtt.subscribe(topic_gateway_node_config.c_str());
       mqtt.subscribe(topic_gateway_control.c_str());
@@ -747,16 +3678,14 @@ bool mqttConnect() {
       doc["status"] = "ONLINE";
       doc["gatewayId"] = GATEWAY_ID;
       doc["nodeCount"] = (int)nodeCount;
-      String s; serializeJson(doc, s);
-      mqtt.publish(topic_gateway_status.c_str(), s.c_str(), true);
+      publishDoc(topic_gateway_status.c_str(), doc, true);
     } else {
       StaticJsonDocument<256> doc;
       doc["type"] = "device_register";
       doc["deviceId"] = deviceIdStr;
       doc["firmwareVersion"] = "1.0.0";
-      String s; serializeJson(doc, s);
-      mqtt.publish(topic_generic_register.c_str(), s.c_str());
-      mqtt.publish(topic_device_register.c_str(), s.c_str());
+      publishDoc(topic_generic_register.c_str(), doc);
+      publishDoc(topic_device_register.c_str(), doc);
     }
     return true;
   } else {
@@ -770,90 +3699,691 @@ bool mqttConnect() {
 void publishNodeRegister(const char* nodeId, int rssi, float snr) {
   StaticJsonDocument<256> doc;
   doc["type"] = "node_register";
-  doc["deviceId"] = deviceIdStr;
-  doc["gatewayId"] = GATEWAY_ID;
+  doc["deviceId"] = deviceIdStr.c_str();
+  doc["gatewayId"] = GATEWAY_ID.c_str();
   doc["nodeId"] = nodeId;
   doc["rssi"] = rssi;
   doc["snr"] = snr;
   doc["timestamp"] = millis();
-  String s; serializeJson(doc, s);
 
-  String topic;
-  if (GATEWAY_ID.length() > 0) topic = "iot/gateway/" + GATEWAY_ID + "/node/" + String(nodeId) + "/register";
-  else topic = "iot/gateway/" + deviceIdStr + "/node/" + String(nodeId) + "/register";
+  char topic[TOPIC_MAX];
+  snprintf(topic, sizeof(topic), "%snode/%s/register", uplinkTopicPrefix, nodeId);
+
+  publishOrStore(topic, doc);
+}
+
+// ---------------- Short address handshake ----------------
+void sendAssign(NodeInfo &n) {
+  AssignPkt pkt;
+  pkt.pktType = 0x03;
+  memset(pkt.nodeId, 0, sizeof(pkt.nodeId));
+  snprintf(pkt.nodeId, sizeof(pkt.nodeId), "%s", n.nodeId);
+  pkt.shortAddr = n.shortAddr;
+  pkt.gwTag = gwTag;
+  sendLoRaPacket((uint8_t*)&pkt, sizeof(pkt), TX_PRIO_CONFIG);
+  n.lastAssign = millis();
+  Serial.printf("[ADDR] Assigned shortAddr=%u to %s\n", n.shortAddr, n.nodeId);
+}
+
+// A known node still talking with its long id gets (re)offered its address
+void maybeAssignShortAddr(const char* nodeId) {
+  int idx = findNodeIndex(nodeId);
+  if (idx < 0) return;
+  NodeInfo &n = nodeList[idx];
+  if (n.shortConfirmed || n.shortAddr == NO_SHORT_ADDR) return;
+  if (n.lastAssign != 0 && millis() - n.lastAssign < ASSIGN_RETRY_MS) return;
+  sendAssign(n);
+}
+
+// ---- Status batching: one aggregate message per window instead of one per pole ----
+struct NodeStatusEntry {
+  char    nodeId[24];
+  bool    lightState;
+  bool    fault;
+  uint8_t hour;
+  uint8_t minute;
+  int16_t rssi;
+  int16_t snr;
+};
+
+NodeStatusEntry statusBatch[STATUS_BATCH_MAX];
+uint8_t statusBatchCount = 0;
+unsigned long statusBatchStart = 0;
+
+void flushStatusBatch() {
+  if (statusBatchCount == 0) return;
+
+  StaticJsonDocument<3072> doc;
+  doc["type"] = "node_status_batch";
+  doc["deviceId"] = deviceIdStr.c_str();
+  doc["gatewayId"] = GATEWAY_ID.c_str();
+  doc["ts"] = millis();
+  JsonArray nodes = doc.createNestedArray("nodes");
+  for (uint8_t i = 0; i < statusBatchCount; i++) {
+    const NodeStatusEntry &e = statusBatch[i];
+    JsonObject n = nodes.createNestedObject();
+    char timeStr[8];  // "255:255" for an out-of-range clock
+    snprintf(timeStr, sizeof(timeStr), "%u:%u", e.hour, e.minute);
+    n["nodeId"] = (const char*)e.nodeId;  // lives in statusBatch until publish
+    n["state"] = e.lightState ? "ON" : "OFF";
+    n["fault"] = e.fault;
+    n["time"] = timeStr;                  // char* is copied into the doc
+    n["rssi"] = e.rssi;
+    n["snr"] = e.snr;
+  }
+  bool ok = publishOrStore(topic_gateway_nodes_status.c_str(), doc);
+  Serial.printf("[STATUS] Batch of %u node statuses published ok=%d\n", statusBatchCount, ok);
+  statusBatchCount = 0;
+}
+
+// Called from loop(): flushes on window expiry
+void serviceStatusBatch() {
+  if (statusBatchCount > 0 && millis() - statusBatchStart >= STATUS_BATCH_WINDOW_MS) {
+    flushStatusBatch();
+  }
+}
+
+void queueNodeStatus(const char* nodeId, bool lightState, bool fault,
+                     uint8_t hour, uint8_t minute, int rssi, int snr) {
+  // A node reporting twice in one window only keeps its latest status
+  uint8_t i = 0;
+  while (i < statusBatchCount && strncmp(statusBatch[i].nodeId, nodeId, sizeof(statusBatch[i].nodeId)) != 0) i++;
+  if (i == statusBatchCount) {
+    if (statusBatchCount == 0) statusBatchStart = millis();
+    statusBatchCount++;
+  }
+
+  NodeStatusEntry &e = statusBatch[i];
+  memset(e.nodeId, 0, sizeof(e.nodeId));
+  strncpy(e.nodeId, nodeId, sizeof(e.nodeId)-1);
+  e.lightState = lightState;
+  e.fault = fault;
+  e.hour = hour;
+  e.minute = minute;
+  e.rssi = (int16_t)rssi;
+  e.snr = (int16_t)snr;
+
+  if (statusBatchCount >= STATUS_BATCH_SIZE) flushStatusBatch();
+}
+
+void publishNodeStatus(const char* nodeId, bool lightState, bool fault,
+                       uint8_t hour, uint8_t minute, int rssi, int snr) {
+  if (STATUS_BATCH_ENABLED && GATEWAY_ID.length() > 0) {
+    queueNodeStatus(nodeId, lightState, fault, hour, minute, rssi, snr);
+  }
+  if (!STATUS_PER_NODE_TOPICS && STATUS_BATCH_ENABLED && GATEWAY_ID.length() > 0) return;
+
+  StaticJsonDocument<256> doc;
+  char timeStr[8];  // "255:255" for an out-of-range clock
+  snprintf(timeStr, sizeof(timeStr), "%u:%u", hour, minute);
+
+  doc["type"] = "node_status";
+  doc["deviceId"] = deviceIdStr.c_str();
+  doc["gatewayId"] = GATEWAY_ID.c_str();
+  doc["nodeId"] = nodeId;
+  doc["state"] = lightState ? "ON" : "OFF";
+  doc["fault"] = fault;
+  doc["time"] = timeStr;
+  doc["rssi"] = rssi;
+  doc["snr"] = snr;
+
+  char topic[TOPIC_MAX];
+  snprintf(topic, sizeof(topic), "%snode/%s/status", uplinkTopicPrefix, nodeId);
+  publishOrStore(topic, doc);
+}
 
-  mqtt.publish(topic.c_str(), s.c_str());
+// Uplink task: publish everything the radio task has queued for the backend
+void handleUplinkEvents() {
+  UplinkEvent* e;
+  while ((e = uplinkQueue.peek()) != nullptr) {
+    switch (e->kind) {
+      case EVT_ACK:
+        publishAckEvent(*e);
+        break;
+      case EVT_NODE_STATUS:
+        publishNodeStatus(e->nodeId, e->lightState, e->fault,
+                          e->hour, e->minute, e->rssi, (int)e->snr);
+        break;
+      case EVT_NODE_REGISTER:
+        publishNodeRegister(e->nodeId, e->rssi, e->snr);
+        break;
+      case EVT_CONFIG_APPLIED:
+        finishDeviceConfig();
+        break;
+      case EVT_CONFIG_ACK:
+        publishConfigAck(*e);
+        break;
+      case EVT_CONFIG_PAGE:
+        publishConfigPageAck(*e);
+        break;
+    }
+    uplinkQueue.pop();
+  }
 }
 
 // ---------------- LoRa receive handling ----------------
-void handleLoRaReceive() {
-  int packetSize = LoRa.parsePacket();
-  if (packetSize <= 0) return;
+// Copies a fixed-size packet out of a frame; false (and logs) if too short.
+bool readFrame(const RxFrame &f, void* pkt, size_t size) {
+  if (f.len < size) {
+    Serial.printf("[LORA] Short frame type=%02X len=%u, expected %u\n", f.data[0], f.len, (unsigned)size);
+    return false;
+  }
+  memcpy(pkt, f.data, size);
+  return true;
+}
+
+void handleV2Frame(const RxFrame &f) {
+  V2Frame v;
+  if (!parseV2(f.data, f.len, v)) {
+    Serial.printf("[LORA] Bad v2 frame type=%02X len=%u\n", f.data[0], f.len);
+    return;
+  }
 
-  uint8_t pktType = LoRa.read();
-  Serial.printf("[LORA_RECEIVE] PktType=%02X packetSize=%d\n", pktType, packetSize);
+  char longId[24];
+  const char* nodeId = longId;
+  int idx;
+  if (v.shortForm) {
+    if (!ownGatewayTag(v.gwTag)) return;
+    idx = findNodeByShortAddr(v.shortAddr);
+    if (idx < 0) {
+      Serial.printf("[LORA] v2 frame from unknown shortAddr=%u\n", v.shortAddr);
+      return;
+    }
+    nodeId = nodeList[idx].nodeId;
+  } else {
+    chipNodeId(v.chipId, longId);
+    idx = findNodeIndex(nodeId);
+  }
+  if (idx >= 0) {
+    NodeInfo &n = nodeList[idx];
+    if (!noteUplinkSeq(n, v.seq)) {
+      Serial.printf("[LORA] Duplicate v2 frame seq=%u from %s\n", v.seq, nodeId);
+      return;
+    }
+    n.wire = 2;
+    if (v.shortForm) n.shortConfirmed = true;
+    noteNodeLink(idx, f);
+  }
+
+  if (v.type == 0x05 && v.bodyLen >= sizeof(V2StatusBody)) {
+    V2StatusBody s;
+    memcpy(&s, v.body, sizeof(s));
+    uint16_t minute = s.state & V2_MINUTE_MASK;
+    wireDownLost += s.state >> V2_LOST_SHIFT;
+    blinkDataLED();
+    postNodeStatus(nodeId, s.state & V2_LIGHT, s.state & V2_FAULT,
+                   minute / 60, minute % 60, f.rssi, f.snr);
+    if (!v.shortForm) maybeAssignShortAddr(nodeId);
+
+  } else if (v.type == 0x06 && v.bodyLen >= sizeof(V2AckBody)) {
+    V2AckBody b;
+    memcpy(&b, v.body, sizeof(b));
+    if (b.cmdId == 0 && v.shortForm) {
+      Serial.printf("[ADDR] %s confirmed shortAddr=%u\n", nodeId, v.shortAddr);
+      return;
+    }
+    AckPkt ack;
+    ack.pktType = 0x06;
+    ack.cmdId = b.cmdId;
+    memset(ack.nodeId, 0, sizeof(ack.nodeId));
+    snprintf(ack.nodeId, sizeof(ack.nodeId), "%s", nodeId);
+    handleAck(ack, f.at);
+
+  } else {
+    Serial.printf("[LORA] Unhandled v2 frame type=%02X len=%u\n", f.data[0], f.len);
+  }
+}
 
-  if (pktType == 0x02) { // RegisterPkt from a node
+void handleLoRaFrame(const RxFrame &f) {
+  if (f.len == 0) return;
+
+  uint8_t pktType = f.data[0];
+  Serial.printf("[LORA_RECEIVE] PktType=%02X packetSize=%d\n", pktType, f.len);
+
+  if ((pktType & WIRE_VER_MASK) == WIRE_V2) {
+    handleV2Frame(f);
+
+  } else if (pktType == 0x02) { // RegisterPkt from a node
     RegisterPkt reg;
-    reg.pktType = 0x02;
-    LoRa.readBytes(((uint8_t*)&reg) + 1, sizeof(reg)-1);
-    int rssi = LoRa.packetRssi();
-    float snr = LoRa.packetSnr();
-    if (mqtt.connected()) publishNodeRegister(reg.nodeId, rssi, snr);
-    Serial.printf("[LORA] Node register from %s rssi=%d snr=%.1f\n", reg.nodeId, rssi, snr);
+    if (!readFrame(f, &reg, sizeof(reg))) return;
+    reg.nodeId[sizeof(reg.nodeId)-1] = '\0';
+    int idx = findNodeIndex(reg.nodeId);
+    noteNodeLink(idx, f);
+    if (idx >= 0) nodeList[idx].versionKnown = false;  // only unconfigured nodes register
+    postNodeRegister(reg.nodeId, f.rssi, f.snr);
+    Serial.printf("[LORA] Node register from %s rssi=%d snr=%.1f\n", reg.nodeId, f.rssi, f.snr);
+    maybeAssignShortAddr(reg.nodeId);
 
   } else if (pktType == 0x05) { // STATUS
     const size_t expected = 1 + sizeof(PolePacket);  // 59
-    if (packetSize != expected) {
-      Serial.printf("[LORA] Bad packet size: %d, expected %d\n", packetSize, expected);
-      while (LoRa.available()) LoRa.read();
-      return;
-    }
-    uint8_t buffer[expected];
-    int bytesRead = LoRa.readBytes(buffer, expected);
-    if (bytesRead != expected) {
-      Serial.println("[LORA] Incomplete status packet");
-      while (LoRa.available()) LoRa.read();
+    if (f.len != expected) {
+      Serial.printf("[LORA] Bad packet size: %u, expected %u\n", f.len, (unsigned)expected);
       return;
     }
 
-    PolePacket* pkt = (PolePacket*)(buffer + 1);
+    PolePacket pkt;
+    memcpy(&pkt, f.data + 1, sizeof(pkt));
+    pkt.nodeId[sizeof(pkt.nodeId)-1] = '\0';
+    int idx = findNodeIndex(pkt.nodeId);
+    noteNodeLink(idx, f);
+    noteNodeWire(idx, 1);
 
-    StaticJsonDocument<256> doc;
-    doc["type"] = "node_status";
-    doc["deviceId"] = deviceIdStr;
-    doc["gatewayId"] = GATEWAY_ID;
-    doc["nodeId"] = pkt->nodeId;
-    doc["state"] = pkt->lightState ? "ON" : "OFF";
-    doc["fault"] = pkt->fault;
-    doc["time"] = String(pkt->hour) + ":" + String(pkt->minute);
-    doc["rssi"] = pkt->rssi;
-    doc["snr"] = pkt->snr;
-    String s; serializeJson(doc, s);
-
-    String topic = "iot/gateway/" + GATEWAY_ID + "/node/" + String(pkt->nodeId) + "/status";
-    mqtt.publish(topic.c_str(), s.c_str());
+    // Report the link as we measured it, like the short form does
+    blinkDataLED();
+    postNodeStatus(pkt.nodeId, pkt.lightState, pkt.fault,
+                   pkt.hour, pkt.minute, f.rssi, f.snr);
+    maybeAssignShortAddr(pkt.nodeId);
+
+  } else if (pktType == 0x15) { // STATUS (short address)
+    ShortStatusPkt pkt;
+    if (!readFrame(f, &pkt, sizeof(pkt)) || !ownGatewayTag(pkt.gwTag)) return;
+    int idx = findNodeByShortAddr(pkt.shortAddr);
+    if (idx < 0) {
+      Serial.printf("[LORA] Status from unknown shortAddr=%u\n", pkt.shortAddr);
+      return;
+    }
+    nodeList[idx].shortConfirmed = true;
+    noteNodeLink(idx, f);
+    noteNodeWire(idx, 1);
     blinkDataLED();
+    postNodeStatus(nodeList[idx].nodeId, pkt.flags & 0x01, pkt.flags & 0x02,
+                   pkt.hour, pkt.minute, f.rssi, f.snr);
 
   } else if (pktType == 0x06) { // ACK (NEW FORMAT)
     AckPkt ack;
-    ack.pktType = pktType;
-    LoRa.readBytes(((uint8_t*)&ack) + 1, sizeof(ack) - 1);
+    if (!readFrame(f, &ack, sizeof(ack))) return;
     ack.nodeId[sizeof(ack.nodeId)-1] = '\0';
-    handleAck(ack);
+    int idx = findNodeIndex(ack.nodeId);
+    noteNodeLink(idx, f);
+    noteNodeWire(idx, 1);
+    handleAck(ack, f.at);
+
+  } else if (pktType == 0x16) { // ACK (short address)
+    ShortAckPkt sack;
+    if (!readFrame(f, &sack, sizeof(sack)) || !ownGatewayTag(sack.gwTag)) return;
+    int idx = findNodeByShortAddr(sack.shortAddr);
+    if (idx < 0) {
+      Serial.printf("[LORA] ACK from unknown shortAddr=%u\n", sack.shortAddr);
+      return;
+    }
+    nodeList[idx].shortConfirmed = true;
+    noteNodeLink(idx, f);
+    noteNodeWire(idx, 1);
+    if (sack.cmdId == 0) {
+      Serial.printf("[ADDR] %s confirmed shortAddr=%u\n", nodeList[idx].nodeId, sack.shortAddr);
+      return;
+    }
+    AckPkt ack;
+    ack.pktType = 0x06;
+    ack.cmdId = sack.cmdId;
+    memset(ack.nodeId, 0, sizeof(ack.nodeId));
+    strncpy(ack.nodeId, nodeList[idx].nodeId, sizeof(ack.nodeId)-1);
+    handleAck(ack, f.at);
+
+  } else if (pktType == 0x0A) { // GROUP ACK
+    GroupAckPkt ack;
+    if (!readFrame(f, &ack, sizeof(ack)) || !ownGatewayTag(ack.gwTag)) return;
+    noteNodeLink(findNodeByShortAddr((uint16_t)ack.nodeIndex + 1), f);
+    handleGroupAck(ack);
+  }
+  // Unknown/other packets are ignored
+}
 
-  } else {
-    // Unknown/other packets: flush
-    while (LoRa.available()) LoRa.read();
+// Drains everything the ISR has queued since the last pass
+void handleLoRaReceive() {
+  static uint32_t reportedOverruns = 0;
+  RxFrame f;
+  while (popRxFrame(f)) {
+    addAirtime(rxAirtimeMs, rxAirtimeRemUs, airtimeUs(f.len));
+    handleLoRaFrame(f);
+  }
+
+  if (rxOverruns != reportedOverruns) {
+    Serial.printf("[LORA] RX ring overrun, %lu frames lost so far\n", (unsigned long)rxOverruns);
+    reportedOverruns = rxOverruns;
   }
 }
 
 // ---------------- Broadcast beacon over LoRa ----------------
 void broadcastBeacon() {
+  if (txQueued[TX_PRIO_BEACON] > 0) return;  // previous one still waiting for budget
+  serviceAddressHolds();
+  uint16_t addressed = 0;
+  for (size_t i = 0; i < nodeCount; i++) {
+    if (nodeList[i].shortAddr > addressed) addressed = nodeList[i].shortAddr;
+  }
+  slotPlan = planSlots(addressed);
+
   BeaconPkt b;
   b.pktType = 0x01;
   b.uptime_s = (uint32_t)(millis() / 1000);
-  sendLoRaPacket((uint8_t*)&b, sizeof(b), true);
+  b.seq = ++beaconSeq;
+  b.periodMs = (uint16_t)BEACON_INTERVAL;
+  b.slotMs = slotPlan.slotMs;
+  b.slotCount = slotPlan.slotCount;
+  b.rounds = slotPlan.rounds;
+  b.wireVersion = WIRE_VERSION;
+  sendLoRaPacket((uint8_t*)&b, sizeof(b), TX_PRIO_BEACON);
+}
+
+// ---------------- Loop profiler ----------------
+// Time spent in each phase of the two task loops, read from the CPU cycle
+// counter (per core; each task is pinned to its own). Every sample goes
+// into a log2 histogram of microseconds, so keeping max and p99 per phase
+// costs a counter read and a few adds per phase. Telemetry reports each
+// window and starts the next. Build with LOOP_PROFILE 0 to compile it out.
+#ifndef LOOP_PROFILE
+#define LOOP_PROFILE 1
+#endif
+
+#define PROF_BUCKETS 20  // [0,1) us, then [2^(b-1), 2^b) us; the last is open-ended
+
+enum ProfPhase : uint8_t {
+  // radio task
+  PROF_DOWNLINK = 0, PROF_RX, PROF_COMMANDS, PROF_ROLLOUT, PROF_ADR, PROF_TX_PUMP, PROF_BEACON, PROF_RADIO_PASS,
+  // uplink task
+  PROF_MODEM, PROF_MQTT, PROF_EVENTS, PROF_STATUS_BATCH, PROF_OUTBOX, PROF_TELEMETRY, PROF_UPLINK_PASS,
+  PROF_PHASE_COUNT
+};
+#define PROF_FIRST_UPLINK PROF_MODEM
+const char* const PROF_NAME[PROF_PHASE_COUNT] = {
+  "downlink", "rx", "commands", "rollout", "adr", "txPump", "beacon", "pass",
+  "modem", "mqtt", "events", "statusBatch", "outbox", "telemetry", "pass"
+};
+
+struct ProfHist {
+  uint32_t count;
+  uint32_t maxUs;
+  uint32_t bucket[PROF_BUCKETS];
+};
+
+// Each task writes only its own phases. Telemetry (uplink task) clears
+// the uplink ones itself and bumps profEpoch for the radio task to clear
+// its own at the start of its next pass, like txWaitEpoch.
+ProfHist profHist[PROF_PHASE_COUNT];
+volatile uint32_t profEpoch = 0;
+uint32_t profRadioEpoch = 0;
+uint32_t profCyclesPerUs = 240;
+
+#if LOOP_PROFILE
+inline uint32_t profMark() { return ESP.getCycleCount(); }
+
+// Records the time since mark under phase and moves mark to now
+void profLap(uint8_t phase, uint32_t &mark) {
+  uint32_t now = ESP.getCycleCount();
+  uint32_t us = (now - mark) / profCyclesPerUs;
+  mark = now;
+  ProfHist &h = profHist[phase];
+  h.count++;
+  if (us > h.maxUs) h.maxUs = us;
+  uint8_t b = us ? (uint8_t)(32 - __builtin_clz(us)) : 0;
+  h.bucket[b < PROF_BUCKETS ? b : PROF_BUCKETS - 1]++;
+}
+
+void profRadioWindow() {
+  if (profRadioEpoch == profEpoch) return;
+  profRadioEpoch = profEpoch;
+  memset(profHist, 0, PROF_FIRST_UPLINK * sizeof(ProfHist));
+}
+
+// Upper edge of the bucket holding the 99th percentile, capped at the max
+uint32_t profP99Us(const ProfHist &h) {
+  uint32_t want = h.count - h.count / 100, seen = 0;
+  for (uint8_t b = 0; b < PROF_BUCKETS; b++) {
+    seen += h.bucket[b];
+    if (seen >= want) {
+      uint32_t edge = 1UL << b;
+      return edge < h.maxUs ? edge : h.maxUs;
+    }
+  }
+  return h.maxUs;
+}
+
+// { "radio": { "<phase>": { n, p99, max } ... }, "uplink": { ... } }, in us
+void profReport(JsonObject out) {
+  JsonObject radio = out.createNestedObject("radio");
+  JsonObject uplink = out.createNestedObject("uplink");
+  for (uint8_t p = 0; p < PROF_PHASE_COUNT; p++) {
+    const ProfHist &h = profHist[p];
+    if (h.count == 0) continue;
+    JsonObject o = (p < PROF_FIRST_UPLINK ? radio : uplink).createNestedObject(PROF_NAME[p]);
+    o["n"] = h.count;
+    o["p99"] = profP99Us(h);
+    o["max"] = h.maxUs;
+  }
+  memset(&profHist[PROF_FIRST_UPLINK], 0, (PROF_PHASE_COUNT - PROF_FIRST_UPLINK) * sizeof(ProfHist));
+  profEpoch++;
+}
+#else
+inline uint32_t profMark() { return 0; }
+inline void profLap(uint8_t, uint32_t &) {}
+inline void profRadioWindow() {}
+#endif
+
+// ---------------- Telemetry ----------------
+void publishTelemetry() {
+  if (!mqttReady()) return;
+
+  StaticJsonDocument<2688> doc;
+  doc["type"] = "telemetry";
+  doc["deviceId"] = deviceIdStr.c_str();
+  doc["gatewayId"] = GATEWAY_ID.c_str();
+  doc["uptime_s"] = millis() / 1000;
+  doc["nodeCount"] = (int)nodeCount;
+  doc["rxOverruns"] = (uint32_t)rxOverruns;
+  doc["rxOversize"] = (uint32_t)rxOversize;
+  doc["txDrops"] = txDrops;
+
+  // Airtime since the last report, in permille of wall time; tx+rx together
+  // is a rough channel-load figure
+  static uint32_t lastTxAir = 0, lastRxAir = 0;
+  static unsigned long lastAirAt = 0;
+  uint32_t txAir = txAirtimeMs, rxAir = rxAirtimeMs;
+  unsigned long now = millis();
+  uint32_t span = now - lastAirAt;
+  JsonObject air = doc.createNestedObject("airtime");
+  air["txMs"] = txAir - lastTxAir;
+  air["rxMs"] = rxAir - lastRxAir;
+  air["txPermille"] = span ? (uint32_t)((uint64_t)(txAir - lastTxAir) * 1000 / span) : 0;
+  air["channelPermille"] = span ? (uint32_t)((uint64_t)(txAir - lastTxAir + rxAir - lastRxAir) * 1000 / span) : 0;
+  air["dutyLimitPermille"] = DUTY_CYCLE_PERMILLE;
+  air["budgetMs"] = dutyTokensUs / 1000;
+  air["deferred"] = txDeferred;
+  lastTxAir = txAir;
+  lastRxAir = rxAir;
+  lastAirAt = now;
+  doc["outboxBacklog"] = outboxBacklog();
+  doc["outboxDropped"] = outboxDropped;
+  doc["outboxSpilled"] = outboxSpilled;
+  doc["uplinkQDepth"] = uplinkQueue.size();
+  doc["uplinkQDrops"] = (uint32_t)uplinkQueue.drops;
+  doc["downlinkQDrops"] = (uint32_t)downlinkQueue.drops;
+  doc["downlinkBusyNacks"] = busyNacksSent;
+  doc["rttSamples"] = rttSampleCount;
+  doc["ackTimeouts"] = ackTimeouts;
+  doc["coalescedCmds"] = coalescedCmds;
+  doc["modemState"] = modemLink.state;
+  doc["linkDrops"] = modemLink.linkDrops;
+  doc["modemHandBackDrops"] = modemPort.backDrops;
+
+  JsonObject adr = doc.createNestedObject("adr");
+  adr["sf"] = activeSf;
+  adr["baseSf"] = LORA_SF;
+  adr["switches"] = adrSwitches;
+  adr["fallbacks"] = adrFallbacks;
+
+  JsonObject rollout = doc.createNestedObject("rollout");
+  uint8_t current = 0;
+  for (size_t i = 0; i < nodeCount; i++) if (nodeConfigCurrent(nodeList[i])) current++;
+  rollout["current"] = current;
+  rollout["pushes"] = rolloutPushes;
+  rollout["failures"] = rolloutFailures;
+
+  // Per TX class: frames waiting now, and sent / mean and max queue wait
+  // since the last report
+  static uint32_t lastSent[TX_PRIO_COUNT], lastWaitSum[TX_PRIO_COUNT];
+  JsonObject txc = doc.createNestedObject("txClasses");
+  for (int c = 0; c < TX_PRIO_COUNT; c++) {
+    uint32_t sent = txSent[c], waitSum = txWaitSumMs[c];
+    JsonObject o = txc.createNestedObject(TX_PRIO_NAME[c]);
+    o["depth"] = txQueued[c];
+    o["sent"] = sent - lastSent[c];
+    o["avgWaitMs"] = sent != lastSent[c] ? (waitSum - lastWaitSum[c]) / (sent - lastSent[c]) : 0;
+    o["maxWaitMs"] = txWaitMaxMs[c];
+    lastSent[c] = sent;
+    lastWaitSum[c] = waitSum;
+  }
+  txWaitEpoch++;
+
+  JsonObject wire = doc.createNestedObject("wire");
+  uint8_t v2Nodes = 0;
+  for (size_t i = 0; i < nodeCount; i++) if (nodeList[i].wire >= 2) v2Nodes++;
+  wire["v2Nodes"] = v2Nodes;
+  wire["dupDrops"] = wireDupDrops;
+  wire["upLost"] = wireUpLost;
+  wire["foreignDrops"] = foreignDrops;
+  wire["downLost"] = wireDownLost;
+
+  JsonObject slots = doc.createNestedObject("slots");
+  slots["slotMs"] = slotPlan.slotMs;
+  slots["count"] = slotPlan.slotCount;
+  slots["rounds"] = slotPlan.rounds;
+
+  // Heap health: low watermark and fragmentation (largest block vs free)
+  uint32_t heapFree = ESP.getFreeHeap();
+  uint32_t heapMaxBlock = ESP.getMaxAllocHeap();
+  JsonObject heap = doc.createNestedObject("heap");
+  heap["free"] = heapFree;
+  heap["minFree"] = ESP.getMinFreeHeap();
+  heap["maxBlock"] = heapMaxBlock;
+  heap["fragPct"] = heapFree ? 100 - (uint32_t)((uint64_t)heapMaxBlock * 100 / heapFree) : 0;
+
+#if LOOP_PROFILE
+  profReport(doc.createNestedObject("loopUs"));
+#endif
+
+  char topic[TOPIC_MAX];
+  snprintf(topic, sizeof(topic), "%sstatus", uplinkTopicPrefix);
+  publishDoc(topic, doc, true);
+}
+
+// ---------------- Tasks ----------------
+#define RADIO_TASK_CORE       1
+#define UPLINK_TASK_CORE      0
+#define RADIO_TASK_PRIO       3
+#define UPLINK_TASK_PRIO      2
+#define RADIO_TASK_STACK      12288  // decodeDoc (2 KB) + config import
+#define UPLINK_TASK_STACK     12288  // status batch (3 KB) + config export
+#define RADIO_TASK_PERIOD_MS  5
+#define UPLINK_TASK_PERIOD_MS 10
+
+TaskHandle_t radioTaskHandle = NULL;
+TaskHandle_t uplinkTaskHandle = NULL;
+
+// One pass of the radio task (sim/lora-sim drives this directly)
+void radioStep() {
+  profRadioWindow();
+  uint32_t mark = profMark(), pass = mark;
+
+  DownlinkMsg* m;
+  while ((m = downlinkQueue.peek()) != nullptr) {
+    handleDownlinkMessage(*m);
+    downlinkQueue.pop();
+  }
+  profLap(PROF_DOWNLINK, mark);
+
+  serviceLoRaIrq();
+  handleLoRaReceive();
+  profLap(PROF_RX, mark);
+  processPendingCommands();
+  profLap(PROF_COMMANDS, mark);
+  serviceConfigRollout();
+  profLap(PROF_ROLLOUT, mark);
+  serviceAdr();
+  profLap(PROF_ADR, mark);
+  pumpLoRaTx();
+  profLap(PROF_TX_PUMP, mark);
+
+  // Periodic beacon
+  if (millis() - lastBeacon >= BEACON_INTERVAL) {
+    lastBeacon = millis();
+    broadcastBeacon();
+  }
+
+  serviceDataLED();
+  profLap(PROF_BEACON, mark);
+  profLap(PROF_RADIO_PASS, pass);
+}
+
+// LoRa RX/TX, command queue, ACK matching, beacons. Never touches the modem.
+void radioTask(void*) {
+  for (;;) {
+    radioStep();
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(RADIO_TASK_PERIOD_MS));  // DIO0 wakes us early
+  }
+}
+
+// Modem link, MQTT, outbox and telemetry
+void onModemEvent(uint8_t evt) {
+  if (evt == MODEM_EVT_UP) {
+    Serial.println("[SIM900A] GPRS connected!");
+    digitalWrite(LED_CONN, HIGH);
+    lastMqttReconnect = 0;
+  } else {
+    digitalWrite(LED_CONN, LOW);
+    if (mqtt.connected()) mqtt.disconnect();
+  }
+}
+
+void uplinkTask(void*) {
+  modemLink.setApn(APN.c_str());
+  modemLink.begin(modemPort, onModemEvent, true);
+
+  for (;;) {
+    uint32_t mark = profMark(), pass = mark;
+    modemLink.step();
+    profLap(PROF_MODEM, mark);
+
+    // MQTT only while the link is up and the UART is free
+    if (!modemLink.ownsUart()) {
+      if (!mqtt.connected()) {
+        if (lastMqttReconnect == 0 || millis() - lastMqttReconnect > 3000) {
+          mqtt.setServer(MQTT_BROKER.c_str(), MQTT_PORT);
+          if (mqttConnect()) {
+            lastMqttReconnect = 0;
+          } else {
+            lastMqttReconnect = millis();
+          }
+        }
+      } else {
+        mqtt.loop();
+      }
+    }
+    profLap(PROF_MQTT, mark);
+
+    handleUplinkEvents();
+    profLap(PROF_EVENTS, mark);
+    serviceStatusBatch();
+    profLap(PROF_STATUS_BATCH, mark);
+    serviceOutbox();
+
+    if (configExportRequested && mqttReady()) {
+      configExportRequested = false;
+      publishConfigExport();
+    }
+    serviceBusyNacks();
+    profLap(PROF_OUTBOX, mark);
+
+    // Telemetry
+    if (millis() - lastTelemetry >= TELEMETRY_INTERVAL) {
+      lastTelemetry = millis();
+      publishTelemetry();
+    }
+    profLap(PROF_TELEMETRY, mark);
+    profLap(PROF_UPLINK_PASS, pass);
+
+    vTaskDelay(pdMS_TO_TICKS(UPLINK_TASK_PERIOD_MS));
+  }
 }
 
 // ---------------- Setup & Loop ----------------
@@ -876,111 +4406,50 @@ void setup() {
     Serial.println("[SPIFFS] mounted successfully");
   }
 
+  initOutbox();
+
   deviceIdStr = getDeviceId();
   Serial.printf("[BOOT] DeviceId=%s\n", deviceIdStr.c_str());
 
   backendDeviceTopicBase = "iot/gateway/" + deviceIdStr + "/";
+  updateUplinkTopicPrefix();
   topic_device_config_set = backendDeviceTopicBase + "config/set";
   topic_device_register = backendDeviceTopicBase + "register";
 
   Serial.println("[BOOT] Loading config (if exists)...");
+  migrateJsonConfig();
   bool ok = loadConfigFromSPIFFS();
   if (ok) Serial.println("[CONFIG] Existing configuration loaded");
   else Serial.println("[CONFIG] No config file found; entering bootstrap mode");
 
   LoRa.setPins(LORA_SS, LORA_RST, LORA_DIO0);
+  pinMode(LORA_DIO0, INPUT);
+  attachInterrupt(digitalPinToInterrupt(LORA_DIO0), onLoRaDio0, RISING);
   applyLoRaParamsAndStart();
 
   sim900.begin(9600, SERIAL_8N1, MODEM_RX, MODEM_TX);
-  modem.restart();
-  if (modem.gprsConnect(APN.c_str(), "", "")) {
-    Serial.println("[SIM900A] GPRS Connected");
-  } else {
-    Serial.println("[SIM900A] GPRS Failed (continuing)");
-  }
-
   mqtt.setServer(MQTT_BROKER.c_str(), MQTT_PORT);
   mqtt.setCallback(onMqttMessage);
+  mqtt.setBufferSize(MQTT_BUFFER_SIZE);
 
   initPendingQueue();
+  groupCmd.active = false;
+  memset(groupCmd.unicast, 0, sizeof(groupCmd.unicast));
+  dutyTokensUs = dutyCapacityUs();
+  dutyRefillAt = millis();
+  profCyclesPerUs = ESP.getCpuFreqMHz();
+
+  // Radio gets its own core and the higher priority; the modem's blocking
+  // AT calls only ever stall the uplink task.
+  xTaskCreatePinnedToCore(radioTask, "radio", RADIO_TASK_STACK, NULL,
+                          RADIO_TASK_PRIO, &radioTaskHandle, RADIO_TASK_CORE);
+  xTaskCreatePinnedToCore(uplinkTask, "uplink", UPLINK_TASK_STACK, NULL,
+                          UPLINK_TASK_PRIO, &uplinkTaskHandle, UPLINK_TASK_CORE);
 
   Serial.println("[BOOT] Setup complete.");
 }
 
+// All work happens in radioTask/uplinkTask
 void loop() {
-  // GPRS management
-  if (millis() - lastGprsCheck >= GPRS_CHECK_INTERVAL) {
-    lastGprsCheck = millis();
-    bool isConnected = modem.isNetworkConnected() && modem.isGprsConnected();
-
-    if (isConnected) {
-      if (!gprsWasConnected) {
-        Serial.println("[SIM900A] GPRS recovered!");
-        digitalWrite(LED_CONN, HIGH);
-      }
-      gprsWasConnected = true;
-      gprsFailStart = 0;
-      lastGprsAttempt = 0;
-    } else {
-      if (gprsWasConnected) {
-        Serial.println("[SIM900A] GPRS lost! Starting recovery...");
-        digitalWrite(LED_CONN, LOW);
-      }
-      gprsWasConnected = false;
-
-      if (lastGprsAttempt == 0 || (millis() - lastGprsAttempt >= GPRS_RECONNECT_DELAY)) {
-        lastGprsAttempt = millis();
-        connectGPRS();
-      }
-    }
-  }
-
-  // MQTT only if GPRS is up
-  if (modem.isGprsConnected()) {
-    if (!mqtt.connected()) {
-      if (millis() - lastMqttReconnect > 3000) {
-        mqtt.setServer(MQTT_BROKER.c_str(), MQTT_PORT);
-        if (mqttConnect()) {
-          lastMqttReconnect = 0;
-        } else {
-          lastMqttReconnect = millis();
-        }
-      }
-    } else {
-      mqtt.loop();
-    }
-  } else {
-    if (mqtt.connected()) {
-      mqtt.disconnect();
-    }
-  }
-
-  // Core LoRa + command processing
-  handleLoRaReceive();
-  processPendingCommands();
-  handleAckEvents(); // process event ack
-
-  // Periodic beacon
-  if (millis() - lastBeacon >= BEACON_INTERVAL) {
-    lastBeacon = millis();
-    broadcastBeacon();
-  }
-
-  // Telemetry
-  if (millis() - lastTelemetry >= TELEMETRY_INTERVAL) {
-    lastTelemetry = millis();
-    StaticJsonDocument<256> doc;
-    doc["type"] = "telemetry";
-    doc["deviceId"] = deviceIdStr;
-    doc["gatewayId"] = GATEWAY_ID;
-    doc["uptime_s"] = millis() / 1000;
-    doc["nodeCount"] = (int)nodeCount;
-    String s; serializeJson(doc, s);
-    if (mqtt.connected()) {
-      if (GATEWAY_ID.length() > 0) mqtt.publish(topic_gateway_status.c_str(), s.c_str(), true);
-      else mqtt.publish((String("iot/gateway/") + deviceIdStr + "/status").c_str(), s.c_str(), true);
-    }
-  }
-
-  delay(10);
+  vTaskDelete(NULL);
 }
@@ -8,6 +8,9 @@ HardwareSerial sim900(1);
 const int RELAY_PINS[10] = {5, 18, 19, 21, 22, 23, 25, 26, 27, 32};
 String serverURL = "http://a117-103-95-81-184.ngrok-free.app/api/v1/bulb/latest-command";
 
+void sendAT(String cmd, unsigned long timeoutMs = 3000);
+String readResponse(unsigned long timeoutMs = 3000, const char* until = nullptr);
+
 void setup() {
   Serial.begin(115200);
   sim900.begin(9600, SERIAL_8N1, SIM900_RX, SIM900_TX);
@@ -61,8 +64,7 @@ void loop() {
 bool checkGSMModule() {
   for (int i = 0; i < 5; i++) {
     sim900.println("AT");
-    delay(1000);
-    String res = readResponse();
+    String res = readResponse(1000);
     if (res.indexOf("OK") != -1) return true;
     Serial.println("⏳ Waiting for GSM...");
   }
@@ -75,8 +77,7 @@ void setupGPRS() {
   sendAT("AT+CGATT=1");
   sendAT("AT+SAPBR=3,1,\"Contype\",\"GPRS\"");
   sendAT("AT+SAPBR=3,1,\"APN\",\"airtelgprs.com\"");
-  sendAT("AT+SAPBR=1,1");
-  delay(3000);
+  sendAT("AT+SAPBR=1,1", 85000);
   sendAT("AT+SAPBR=2,1");
   sendAT("AT+CDNSCFG=\"8.8.8.8\",\"8.8.4.4\"");
 }
@@ -89,9 +90,9 @@ String getCommandFromServer() {
 
   Serial.println("📡 Sending: AT+HTTPACTION=0");
   sim900.println("AT+HTTPACTION=0");
-  delay(5000);
 
-  String actionResponse = readResponse();
+  // OK comes first; the result arrives later as a +HTTPACTION: URC
+  String actionResponse = readResponse(30000, "+HTTPACTION:");
   if (actionResponse.indexOf("601") != -1 || actionResponse.indexOf("+HTTPACTION:") == -1) {
     Serial.println("❌ HTTPACTION Error (601 or invalid)");
     return "";
@@ -99,8 +100,7 @@ String getCommandFromServer() {
 
   Serial.println("📡 Sending: AT+HTTPREAD");
   sim900.println("AT+HTTPREAD");
-  delay(2000);
-  String response = readResponse();
+  String response = readResponse(10000);
 
   sendAT("AT+HTTPTERM");
 
@@ -113,22 +113,32 @@ String getCommandFromServer() {
   return "";
 }
 
-void sendAT(String cmd) {
+void sendAT(String cmd, unsigned long timeoutMs) {
   Serial.println("📡 Sending: " + cmd);
   sim900.println(cmd);
-  delay(1000);
-  String res = readResponse();
+  String res = readResponse(timeoutMs);
   Serial.println(res);
 }
 
-String readResponse() {
+// Returns as soon as the modem has finished answering (final OK/ERROR, or
+// the awaited token once its line is complete) instead of always waiting
+// out the timeout.
+String readResponse(unsigned long timeoutMs, const char* until) {
   String res = "";
   unsigned long startTime = millis();
-  while (millis() - startTime < 3000) {
+  while (millis() - startTime < timeoutMs) {
     while (sim900.available()) {
       char c = sim900.read();
       res += c;
+      if (c != '\n') continue;
+      if (until) {
+        int at = res.indexOf(until);
+        if (at != -1 && res.indexOf('\n', at) != -1) return res;
+      } else if (res.endsWith("OK\r\n") || res.endsWith("ERROR\r\n")) {
+        return res;
+      }
     }
+    delay(1);
   }
   return res;
 }
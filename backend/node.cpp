@@ -16,6 +16,45 @@
 #define DEFAULT_LORA_SF   7
 #define DEFAULT_LORA_BW   125000UL
 #define DEFAULT_LORA_CR   5
+#define DEFAULT_LORA_TX_POWER 17   // dBm, LoRa library default (PA_BOOST)
+
+// The gateway may move us to a faster SF or lower TX power (LoRaConfigPkt).
+// If we then hear nothing from it for this long, go back to the defaults,
+// which are the gateway's configured base parameters.
+#define NODE_ADR_FALLBACK_MS 120000UL
+
+/* ------------------------ ADDRESSING ------------------------ */
+#define NO_SHORT_ADDR     0
+#define NO_NODE_INDEX     0xFF
+#define GROUP_MASK_BYTES  7      // must match gateway ((MAX_NODES + 7) / 8, checked there)
+#define GROUP_ACK_GUARD_MS 30UL  // must match gateway
+
+/* ------------------------ WIRE FORMAT ------------------------ */
+// v2 frames (see gateway "Wire format v2"): one header byte with the
+// version on top of the v1 type, short address or 6-byte efuse id, a
+// sequence number, then the body. We send v2 while the gateway's beacons
+// advertise it, v1 otherwise; both are always accepted.
+#define WIRE_VER_MASK    0xE0
+#define WIRE_V2          0x40
+#define WIRE_SHORT       0x10
+#define WIRE_TYPE_MASK   0x0F
+#define WIRE_CHIP_BYTES  6
+#define WIRE_V2_MAX      (1 + WIRE_CHIP_BYTES + 1 + 3)
+#define WIRE_SEQ_MAX_GAP 16      // must match gateway
+#define CMD_ID_CONFIG    0x8000  // top ACK cmdId bit: confirms a config, not a control (must match gateway)
+
+#define V2_LIGHT         0x0800
+#define V2_FAULT         0x1000
+#define V2_LOST_SHIFT    13
+#define V2_LOST_MAX      7
+#define V2_CTRL_LIGHT_ON 0x01
+
+/* ------------------------ STATUS SLOTS ------------------------ */
+// With a short address the periodic status goes out in our TDMA slot after
+// a beacon (see gateway "Status slots"); without one, or without a recent
+// beacon, we fall back to the free-running STATUS_INTERVAL timer.
+#define SLOT_LATE_MS      15UL   // give up on a slot this late, must stay below gateway SLOT_GUARD_MS
+#define SLOT_SYNC_BEACONS 3      // beacon periods a slot plan stays valid without a new beacon
 
 /* ------------------------ PINS ------------------------ */
 #define RELAY_PIN  27
@@ -45,6 +84,13 @@ unsigned long lastRegister = 0;
 unsigned long REGISTER_INTERVAL = 30000UL;   // 30s
 unsigned long STATUS_INTERVAL = 60000UL;     // 60s
 bool configured = false;
+uint16_t shortAddr = NO_SHORT_ADDR;  // assigned by gateway (AssignPkt / ConfigPkt)
+uint8_t gwTag = 0;                   // our gateway's tag, sent and checked with shortAddr
+
+// Group ACK is sent in our slot after the group frame, not immediately
+bool groupAckPending = false;
+uint16_t groupAckCmdId = 0;
+unsigned long groupAckAt = 0;
 
 enum ControlMode {
   AUTO = 0,
@@ -54,6 +100,16 @@ enum ControlMode {
 ControlMode controlMode = AUTO;
 
 /* ------------------------ PACKETS ------------------------ */
+struct __attribute__((packed)) BeaconPkt {
+  uint8_t pktType; // 0x01
+  uint32_t uptime_s;
+  uint16_t seq;
+  uint16_t periodMs;
+  uint16_t slotMs;     // 0 = no slots
+  uint8_t  slotCount;
+  uint8_t  rounds;
+};
+
 struct __attribute__((packed)) RegisterPkt {
   uint8_t pktType;
   char nodeId[24];
@@ -70,6 +126,14 @@ struct __attribute__((packed)) ConfigPkt {
   uint8_t cfgVer;
   uint32_t regIntervalMs;
   uint32_t statusIntervalMs;
+  uint8_t nodeIndex;   // shortAddr - 1
+};
+
+struct __attribute__((packed)) AssignPkt {
+  uint8_t pktType; // 0x03
+  char nodeId[24];
+  uint16_t shortAddr;
+  uint8_t gwTag;   // missing from older gateways
 };
 
 struct __attribute__((packed)) PolePacket {
@@ -97,9 +161,120 @@ struct __attribute__((packed)) AckPkt {
   char nodeId[24];
 };
 
+struct __attribute__((packed)) LoRaConfigPkt {
+  uint8_t pktType;     // 0x08
+  uint16_t shortAddr;  // target node, 0 = every node
+  uint8_t gwTag;
+  uint32_t freq;
+  uint8_t sf;
+  uint32_t bw;
+  uint8_t cr;
+  int8_t txPower;      // dBm, 0 = keep current
+  uint8_t seq;
+};
+
+/* ---- SHORT-ADDRESS VARIANTS ---- */
+// A short address is only unique per gateway; these carry its tag too
+struct __attribute__((packed)) ShortConfigPkt {
+  uint8_t pktType; // 0x14
+  uint16_t shortAddr;
+  uint8_t gwTag;
+  uint8_t onHour, onMin;
+  uint8_t offHour, offMin;
+  uint8_t cfgVer;
+  uint32_t regIntervalMs;
+  uint32_t statusIntervalMs;
+};
+
+struct __attribute__((packed)) ShortStatusPkt {
+  uint8_t pktType; // 0x15
+  uint16_t shortAddr;
+  uint8_t gwTag;
+  uint8_t flags;   // bit0 = lightState, bit1 = fault
+  uint8_t hour;
+  uint8_t minute;
+};
+
+struct __attribute__((packed)) ShortAckPkt {
+  uint8_t pktType; // 0x16
+  uint16_t cmdId;  // 0 = confirms AssignPkt
+  uint16_t shortAddr;
+  uint8_t gwTag;
+};
+
+struct __attribute__((packed)) ShortControlPkt {
+  uint8_t pktType; // 0x17
+  uint16_t cmdId;
+  uint16_t shortAddr;
+  uint8_t gwTag;
+  bool lightOn;
+};
+
+struct __attribute__((packed)) GroupControlPkt {
+  uint8_t pktType; // 0x09
+  uint16_t cmdId;
+  uint8_t gwTag;
+  bool lightOn;
+  uint8_t mask[GROUP_MASK_BYTES];
+};
+static_assert(sizeof(GroupControlPkt) == 12, "must match the gateway's GroupControlPkt (7 mask bytes for 50 nodes)");
+
+struct __attribute__((packed)) GroupAckPkt {
+  uint8_t pktType; // 0x0A
+  uint16_t cmdId;
+  uint8_t nodeIndex;
+  uint8_t gwTag;
+};
+
+struct __attribute__((packed)) V2StatusBody {
+  uint16_t state;  // bits 0-10 minute of day, 11 light, 12 fault, 13-15 downlink frames lost
+};
+
+struct __attribute__((packed)) V2ControlBody {
+  uint16_t cmdId;
+  uint8_t flags;   // bit0 = light on
+};
+
+struct __attribute__((packed)) V2AckBody {
+  uint16_t cmdId;  // 0 = confirms AssignPkt
+};
+
 /* ------------------------ HELPERS ------------------------ */
 volatile bool isLoRaBusy = false;
 
+// Radio parameters in use; start at the defaults on every boot
+uint32_t loraFreq = DEFAULT_LORA_FREQ;
+uint8_t  loraSf = DEFAULT_LORA_SF;
+uint32_t loraBw = DEFAULT_LORA_BW;
+uint8_t  loraCr = DEFAULT_LORA_CR;
+int8_t   loraTxPower = DEFAULT_LORA_TX_POWER;
+bool loraRetunePending = false;
+unsigned long lastGatewayHeard = 0;
+
+// Time on air at the current parameters; same formula as the gateway's
+// airtimeUs() (explicit header, CRC on, 8-symbol preamble)
+uint32_t airtimeUs(uint8_t payloadLen) {
+  uint32_t tSymUs = (uint32_t)(((uint64_t)1000000 << loraSf) / loraBw);
+  int de = tSymUs > 16000 ? 1 : 0;  // low data rate optimize
+  int num = 8 * payloadLen - 4 * loraSf + 28 + 16;
+  int den = 4 * (loraSf - 2 * de);
+  int nPayload = 8 + (num > 0 ? ((num + den - 1) / den) * loraCr : 0);
+  uint32_t preambleUs = (tSymUs * (4 * 8 + 17)) / 4;
+  return preambleUs + (uint32_t)nPayload * tSymUs;
+}
+
+// One member's group ACK slot, as the gateway lays them out
+unsigned long groupAckSlotMs() {
+  return airtimeUs(sizeof(GroupAckPkt)) / 1000 + 1 + GROUP_ACK_GUARD_MS;
+}
+
+// Copies an id into a fixed packet field, cut to fit and always terminated
+void copyField(char* dst, size_t size, const String& src) {
+  size_t n = src.length() < size ? src.length() : size - 1;
+  memcpy(dst, src.c_str(), n);
+  dst[n] = '\0';
+}
+
 String getDeviceId() {
   uint64_t chipId = ESP.getEfuseMac();
   char id[13];
@@ -107,21 +282,154 @@ String getDeviceId() {
   return "node" + String(id);
 }
 
-void sendLoRaPacket(const uint8_t* data, size_t len) {
-  if (isLoRaBusy) return;
-  isLoRaBusy = true;
+/* ------------------------ TX QUEUE ------------------------ */
+// Frames are queued and sent asynchronously; TxDone returns us to RX
+#define TX_QUEUE_SIZE 4
+#define TX_FRAME_MAX  64
+#define TX_TIMEOUT_MS 2000UL
+// The gateway re-arms RX from its radio task after TxDone: a task wake-up,
+// at worst one full radio period (5 ms) plus a long pass. Nothing we send
+// starts earlier than this after the end of a gateway frame.
+#define GW_TURNAROUND_MS 15UL
+
+struct TxFrame {
+  uint8_t len;
+  uint8_t data[TX_FRAME_MAX];
+};
 
+TxFrame txQueue[TX_QUEUE_SIZE];
+uint8_t txHead = 0;
+uint8_t txTail = 0;
+unsigned long txStartedAt = 0;
+unsigned long gatewayTxEndAt = 0;  // RxDone of the last gateway frame, 0 = none
+volatile bool dio0Pending = false;  // DIO0 edge not yet handled by serviceLoRaIrq()
+volatile unsigned long dio0At = 0;   // millis() of the last DIO0 edge
+
+void finishLoRaTx() {
+  isLoRaBusy = false;
+  LoRa.receive();
+}
+
+bool sendLoRaPacket(const uint8_t* data, size_t len) {
+  uint8_t next = (txTail + 1) % TX_QUEUE_SIZE;
+  if (next == txHead || len > TX_FRAME_MAX) {
+    Serial.println("[LORA] TX queue full, dropping frame");
+    return false;
+  }
+  memcpy(txQueue[txTail].data, data, len);
+  txQueue[txTail].len = (uint8_t)len;
+  txTail = next;
+  return true;
+}
+
+void pumpLoRaTx() {
+  if (isLoRaBusy) {
+    if (millis() - txStartedAt < TX_TIMEOUT_MS) return;
+    finishLoRaTx();  // TxDone never came
+  }
+
+  if (txHead == txTail) return;
+  if (gatewayTxEndAt != 0 && millis() - gatewayTxEndAt < GW_TURNAROUND_MS) return;
+
+  TxFrame &f = txQueue[txHead];
+  txHead = (txHead + 1) % TX_QUEUE_SIZE;
+
+  isLoRaBusy = true;
+  dio0Pending = false;  // an unserviced RxDone is dropped by idle(), not a TxDone
+  txStartedAt = millis();
   LoRa.idle();
   LoRa.beginPacket();
-  LoRa.write(data, len);
-  LoRa.endPacket(true);
-  delay(50);
+  LoRa.write(f.data, f.len);
+  LoRa.endPacket(true);  // async, completion via DIO0 (serviceLoRaIrq)
+}
+
+/* ------------------------ RX RING ------------------------ */
+// DIO0 rises on RxDone and on TxDone. The interrupt only notes the time:
+// FIFO and RSSI/SNR reads are SPI transfers, not IRAM-safe, so loop()
+// copies the frame out in serviceLoRaIrq() and handleLoRaReceive() drains
+// the ring. The library's onReceive()/onTxDone() are not used, their ISR
+// reads the IRQ flags over SPI.
+#define RX_RING_SIZE 4      // power of two
+#define RX_FRAME_MAX 64
+
+struct RxFrame {
+  unsigned long at;   // millis() at RxDone
+  uint8_t len;
+  int16_t rssi;
+  float   snr;
+  uint8_t data[RX_FRAME_MAX];
+};
+
+RxFrame rxRing[RX_RING_SIZE];
+volatile uint8_t rxHead = 0;
+volatile uint8_t rxTail = 0;
+volatile uint32_t rxOverruns = 0;
+
+
+void IRAM_ATTR onLoRaDio0() {
+  dio0At = millis();
+  dio0Pending = true;
+}
+
+// parsePacket() clears the IRQ flags (a CRC error reads as 0) and leaves
+// continuous RX, so re-arm after the copy
+void readLoRaFrame(unsigned long at) {
+  int packetSize = LoRa.parsePacket();
+  uint8_t next = (rxTail + 1) & (RX_RING_SIZE - 1);
+  if (packetSize <= 0 || next == rxHead || packetSize > RX_FRAME_MAX) {
+    if (packetSize > 0) rxOverruns++;
+    while (LoRa.available()) LoRa.read();
+    LoRa.receive();
+    return;
+  }
+
+  RxFrame &f = rxRing[rxTail];
+  uint8_t n = 0;
+  while (LoRa.available() && n < RX_FRAME_MAX) f.data[n++] = (uint8_t)LoRa.read();
+  f.at   = at;
+  f.len  = n;
+  f.rssi = (int16_t)LoRa.packetRssi();
+  f.snr  = LoRa.packetSnr();
   LoRa.receive();
+  rxTail = next;
+}
 
-  isLoRaBusy = false;
+// TxDone while we transmit, RxDone otherwise
+void serviceLoRaIrq() {
+  if (!dio0Pending) return;
+  dio0Pending = false;
+  if (isLoRaBusy) finishLoRaTx();
+  else readLoRaFrame(dio0At);
+}
+
+bool popRxFrame(RxFrame &out) {
+  if (rxHead == rxTail) return false;
+  __sync_synchronize();
+  out = rxRing[rxHead];
+  __sync_synchronize();
+  rxHead = (rxHead + 1) & (RX_RING_SIZE - 1);
+  return true;
+}
+
+// Copies a fixed-size packet out of a frame, false if the frame is too short
+bool readFrame(const RxFrame &f, void* pkt, size_t size) {
+  if (f.len < size) return false;
+  memcpy(pkt, f.data, size);
+  return true;
 }
 
 /* ------------------------ PERSISTENCE ------------------------ */
+// 8-bit FNV-1a fold of the gatewayId, never 0; must match gateway.cpp
+uint8_t gatewayTag(const char* gatewayId) {
+  uint32_t h = 2166136261u;
+  for (const char* c = gatewayId; *c; c++) {
+    h ^= (uint8_t)*c;
+    h *= 16777619u;
+  }
+  uint8_t t = (uint8_t)(h ^ (h >> 8) ^ (h >> 16) ^ (h >> 24));
+  return t ? t : 1;
+}
+
 void persistModeAndState() {
   preferences.begin("nodecfg", false);
   preferences.putInt("mode", controlMode);
@@ -135,12 +443,107 @@ void loadPreferences() {
   configured = preferences.getBool("configured", false);
   lightState = preferences.getBool("lightState", false);
   controlMode = (ControlMode)preferences.getInt("mode", AUTO);
+  shortAddr = preferences.getUShort("saddr", NO_SHORT_ADDR);
+  gwTag = preferences.getUChar("gwtag", gatewayTag(ASSIGNED_GATEWAY.c_str()));
   preferences.end();
 }
 
+uint8_t groupIndex() {
+  if (shortAddr == NO_SHORT_ADDR || shortAddr > GROUP_MASK_BYTES * 8) return NO_NODE_INDEX;
+  return (uint8_t)(shortAddr - 1);
+}
+
+void persistShortAddr() {
+  preferences.begin("nodecfg", false);
+  preferences.putUShort("saddr", shortAddr);
+  preferences.putUChar("gwtag", gwTag);
+  preferences.end();
+}
+
+/* ------------------------ WIRE V2 ------------------------ */
+uint8_t gatewayWire = 1;          // highest format the gateway's last beacon advertised
+unsigned long gatewayWireAt = 0;  // RxDone of that beacon, 0 = none yet
+unsigned long gatewayWireHoldMs = 0;
+uint8_t upSeq = 0;                // next uplink v2 sequence number
+uint8_t gwSeq = 0;                // last downlink v2 sequence number, valid if gwSeqKnown
+bool gwSeqKnown = false;
+uint8_t downLost = 0;             // downlink frames missed since the last status
+
+// v2 only while a recent beacon says the gateway decodes it
+bool wireV2() {
+  return gatewayWire >= 2 && gatewayWireAt != 0 && millis() - gatewayWireAt < gatewayWireHoldMs;
+}
+
+uint64_t chipId48() {
+  return ESP.getEfuseMac() & 0xFFFFFFFFFFFFULL;
+}
+
+// Header, short address and gateway tag (if we have one) or efuse id, sequence number
+size_t beginV2(uint8_t* buf, uint8_t type) {
+  size_t n = 0;
+  bool shortForm = shortAddr != NO_SHORT_ADDR;
+  buf[n++] = WIRE_V2 | (shortForm ? WIRE_SHORT : 0) | (type & WIRE_TYPE_MASK);
+  if (shortForm) {
+    memcpy(buf + n, &shortAddr, sizeof(shortAddr));
+    n += sizeof(shortAddr);
+    buf[n++] = gwTag;
+  } else {
+    uint64_t chip = chipId48();
+    memcpy(buf + n, &chip, WIRE_CHIP_BYTES);
+    n += WIRE_CHIP_BYTES;
+  }
+  buf[n++] = upSeq;
+  return n;
+}
+
+bool sendV2(uint8_t* buf, size_t len) {
+  if (!sendLoRaPacket(buf, len)) return false;
+  upSeq++;
+  return true;
+}
+
+// False for a repeat of the last downlink frame; gaps are counted as lost
+bool noteDownlinkSeq(uint8_t seq) {
+  if (gwSeqKnown) {
+    if (seq == gwSeq) return false;
+    uint8_t gap = (uint8_t)(seq - gwSeq - 1);
+    if (gap <= WIRE_SEQ_MAX_GAP) downLost = min(V2_LOST_MAX, downLost + gap);
+  }
+  gwSeq = seq;
+  gwSeqKnown = true;
+  return true;
+}
+
 /* ------------------------ CORE ------------------------ */
+// Short ACK once we have an address, long one otherwise
+void sendAck(uint16_t cmdId) {
+  if (wireV2()) {
+    uint8_t buf[WIRE_V2_MAX];
+    size_t len = beginV2(buf, 0x06);
+    V2AckBody b;
+    b.cmdId = cmdId;
+    memcpy(buf + len, &b, sizeof(b));
+    sendV2(buf, len + sizeof(b));
+  } else if (shortAddr != NO_SHORT_ADDR) {
+    ShortAckPkt ack;
+    ack.pktType = 0x16;
+    ack.cmdId = cmdId;
+    ack.shortAddr = shortAddr;
+    ack.gwTag = gwTag;
+    sendLoRaPacket((uint8_t*)&ack, sizeof(ack));
+  } else {
+    AckPkt ack;
+    ack.pktType = 0x06;
+    ack.cmdId = cmdId;
+    memset(ack.nodeId, 0, sizeof(ack.nodeId));
+    copyField(ack.nodeId, sizeof(ack.nodeId), NODE_ID);
+    sendLoRaPacket((uint8_t*)&ack, sizeof(ack));
+  }
+}
+
 void applyConfig(const ConfigPkt& cfg) {
   ASSIGNED_GATEWAY = cfg.gatewayId;
+  gwTag = gatewayTag(ASSIGNED_GATEWAY.c_str());
   lightOnHour = cfg.onHour;
   lightOnMin  = cfg.onMin;
   lightOffHour = cfg.offHour;
@@ -148,23 +551,21 @@ void applyConfig(const ConfigPkt& cfg) {
 
   REGISTER_INTERVAL = cfg.regIntervalMs ? cfg.regIntervalMs : REGISTER_INTERVAL;
   STATUS_INTERVAL   = cfg.statusIntervalMs ? cfg.statusIntervalMs : STATUS_INTERVAL;
+  if (cfg.nodeIndex != NO_NODE_INDEX) shortAddr = (uint16_t)cfg.nodeIndex + 1;
 
   preferences.begin("nodecfg", false);
   preferences.putBool("configured", true);
   preferences.putString("gw", ASSIGNED_GATEWAY);
+  preferences.putUShort("saddr", shortAddr);
+  preferences.putUChar("gwtag", gwTag);
   preferences.end();
 
   controlMode = AUTO;
   persistModeAndState();
 
-  Serial.printf("[NODE] Config updated (cfgVer=%d)\n", cfg.cfgVer);
-
-  AckPkt ack;
-  ack.pktType = 0x06;
-  ack.cmdId = cfg.cfgVer; // treating cfgVer same as cmdId for config ack
-  strncpy(ack.nodeId, NODE_ID.c_str(), sizeof(ack.nodeId)-1);
+  Serial.printf("[NODE] Config updated (cfgVer=%d, addr=%u)\n", cfg.cfgVer, shortAddr);
 
-  sendLoRaPacket((uint8_t*)&ack, sizeof(ack));
+  sendAck(CMD_ID_CONFIG | cfg.cfgVer);
   Serial.println("[NODE] ACK sent for config");
 }
 
@@ -179,6 +580,30 @@ void sendRegister() {
 
 void sendStatus() {
   DateTime now = rtc.now();
+
+  if (wireV2()) {
+    uint8_t buf[WIRE_V2_MAX];
+    size_t len = beginV2(buf, 0x05);
+    V2StatusBody b;
+    b.state = (uint16_t)(now.hour() * 60 + now.minute()) | (lightState ? V2_LIGHT : 0) |
+              ((uint16_t)downLost << V2_LOST_SHIFT);  // fault bit not wired yet
+    memcpy(buf + len, &b, sizeof(b));
+    if (sendV2(buf, len + sizeof(b))) downLost = 0;
+    return;
+  }
+
+  if (shortAddr != NO_SHORT_ADDR) {
+    ShortStatusPkt pkt;
+    pkt.pktType = 0x15;
+    pkt.shortAddr = shortAddr;
+    pkt.gwTag = gwTag;
+    pkt.flags = lightState ? 0x01 : 0x00; // fault bit (0x02) not wired yet
+    pkt.hour = now.hour();
+    pkt.minute = now.minute();
+    sendLoRaPacket((uint8_t*)&pkt, sizeof(pkt));
+    return;
+  }
+
   PolePacket pkt{};
   strncpy(pkt.nodeId, NODE_ID.c_str(), sizeof(pkt.nodeId)-1);
   strncpy(pkt.gatewayId, ASSIGNED_GATEWAY.c_str(), sizeof(pkt.gatewayId)-1);
@@ -197,53 +622,315 @@ void sendStatus() {
 }
 
 /* ------------------------ CONTROL ------------------------ */
-void handleControl(uint8_t header) {
+void applyControl(uint16_t cmdId, bool lightOn) {
+  lightState = lightOn;
+  controlMode = lightOn ? MANUAL_ON : MANUAL_OFF;
+  digitalWrite(RELAY_PIN, lightState ? RELAY_ON : RELAY_OFF);
+  persistModeAndState();
+
+  Serial.printf("[NODE] CMD %u → %s\n", cmdId, lightOn ? "ON" : "OFF");
+
+  sendAck(cmdId);
+
+  Serial.printf("[NODE] ACK sent for cmdId=%u\n", cmdId);
+}
+
+void handleControl(const RxFrame &f) {
   ControlPkt ctrl;
-  ctrl.pktType = header;
-  LoRa.readBytes(((uint8_t*)&ctrl) + 1, sizeof(ctrl) - 1);
+  if (!readFrame(f, &ctrl, sizeof(ctrl))) return;
 
   ctrl.nodeId[sizeof(ctrl.nodeId)-1] = '\0';
   if (strcmp(ctrl.nodeId, NODE_ID.c_str()) != 0) return;
 
-  lightState = ctrl.lightOn;
-  controlMode = ctrl.lightOn ? MANUAL_ON : MANUAL_OFF;
+  applyControl(ctrl.cmdId, ctrl.lightOn);
+}
+
+void handleShortControl(const RxFrame &f) {
+  ShortControlPkt ctrl;
+  if (!readFrame(f, &ctrl, sizeof(ctrl))) return;
+
+  if (shortAddr == NO_SHORT_ADDR || ctrl.shortAddr != shortAddr || ctrl.gwTag != gwTag) return;
+
+  applyControl(ctrl.cmdId, ctrl.lightOn);
+}
+
+void handleV2Frame(const RxFrame &f) {
+  uint8_t hdr = f.data[0];
+  bool shortForm = hdr & WIRE_SHORT;
+  size_t n = 1 + (shortForm ? sizeof(shortAddr) + 1 : WIRE_CHIP_BYTES);
+  if (f.len < n + 1) return;
+
+  if (shortForm) {
+    uint16_t addr;
+    memcpy(&addr, f.data + 1, sizeof(addr));
+    if (shortAddr == NO_SHORT_ADDR || addr != shortAddr || f.data[1 + sizeof(addr)] != gwTag) return;
+  } else {
+    uint64_t chip = 0;
+    memcpy(&chip, f.data + 1, WIRE_CHIP_BYTES);
+    if (chip != chipId48()) return;
+  }
+  if (!noteDownlinkSeq(f.data[n++])) return;  // heard it already
+
+  if ((hdr & WIRE_TYPE_MASK) == 0x07 && f.len >= n + sizeof(V2ControlBody)) {
+    V2ControlBody ctrl;
+    memcpy(&ctrl, f.data + n, sizeof(ctrl));
+    applyControl(ctrl.cmdId, ctrl.flags & V2_CTRL_LIGHT_ON);
+  }
+}
+
+void handleAssign(const RxFrame &f) {
+  AssignPkt as;
+  // Older gateways send it without gwTag: keep the one we have
+  if (f.len < offsetof(AssignPkt, gwTag)) return;
+  memset(&as, 0, sizeof(as));
+  memcpy(&as, f.data, min((size_t)f.len, sizeof(as)));
+  if (f.len < sizeof(as)) as.gwTag = gwTag;
+
+  as.nodeId[sizeof(as.nodeId)-1] = '\0';
+  if (strcmp(as.nodeId, NODE_ID.c_str()) != 0) return;
+
+  if (as.shortAddr != shortAddr || as.gwTag != gwTag) {
+    shortAddr = as.shortAddr;
+    gwTag = as.gwTag;
+    persistShortAddr();
+  }
+  Serial.printf("[NODE] Short address %u\n", shortAddr);
+
+  sendAck(0); // cmdId 0 confirms the address
+}
+
+void handleGroupControl(const RxFrame &f) {
+  GroupControlPkt grp;
+  if (!readFrame(f, &grp, sizeof(grp)) || grp.gwTag != gwTag) return;
+
+  uint8_t nodeIndex = groupIndex();
+  if (nodeIndex == NO_NODE_INDEX) return;
+  if (!(grp.mask[nodeIndex >> 3] & (1 << (nodeIndex & 7)))) return;
+
+  lightState = grp.lightOn;
+  controlMode = grp.lightOn ? MANUAL_ON : MANUAL_OFF;
   digitalWrite(RELAY_PIN, lightState ? RELAY_ON : RELAY_OFF);
   persistModeAndState();
 
-  Serial.printf("[NODE] CMD %u → %s\n", ctrl.cmdId, ctrl.lightOn ? "ON" : "OFF");
+  // Our ACK slot = number of addressed members before us
+  uint8_t rank = 0;
+  for (uint8_t i = 0; i < nodeIndex; i++) {
+    if (grp.mask[i >> 3] & (1 << (i & 7))) rank++;
+  }
+
+  groupAckPending = true;
+  groupAckCmdId = grp.cmdId;
+  // Slots count from our RxDone, which is the gateway's TxDone
+  groupAckAt = (f.at ? f.at : millis()) + (unsigned long)rank * groupAckSlotMs();
 
-  delay(100); // required for gateway RX recovery
+  Serial.printf("[NODE] GROUP CMD %u → %s (slot %u)\n", grp.cmdId, grp.lightOn ? "ON" : "OFF", rank);
+}
 
-  AckPkt ack;
-  ack.pktType = 0x06;
-  ack.cmdId = ctrl.cmdId;
-  strncpy(ack.nodeId, NODE_ID.c_str(), sizeof(ack.nodeId)-1);
+void sendGroupAck() {
+  GroupAckPkt ack;
+  ack.pktType = 0x0A;
+  ack.cmdId = groupAckCmdId;
+  ack.nodeIndex = groupIndex();
+  ack.gwTag = gwTag;
   sendLoRaPacket((uint8_t*)&ack, sizeof(ack));
+  groupAckPending = false;
+
+  Serial.printf("[NODE] GROUP ACK sent for cmdId=%u\n", groupAckCmdId);
+}
+
+/* ------------------------ STATUS SLOTS ------------------------ */
+BeaconPkt lastBeacon = {};
+unsigned long beaconAt = 0;   // RxDone of lastBeacon, 0 = none yet
+uint16_t slotUsedSeq = 0;     // beacon whose slot we already used
+
+void handleBeacon(const RxFrame &f) {
+  BeaconPkt b;
+  if (!readFrame(f, &b, sizeof(b))) return;  // older gateway: no slot plan
+  lastBeacon = b;
+  beaconAt = f.at ? f.at : 1;
+
+  // Trailing wire version byte; gateways without it only speak v1
+  gatewayWire = f.len > sizeof(b) ? f.data[sizeof(b)] : 1;
+  gatewayWireAt = beaconAt;
+  gatewayWireHoldMs = (unsigned long)b.periodMs * SLOT_SYNC_BEACONS;
+}
+
+bool slotPlanValid(unsigned long now) {
+  return beaconAt != 0 && lastBeacon.slotMs != 0 && lastBeacon.slotCount != 0 && lastBeacon.rounds != 0 &&
+         now - beaconAt < (unsigned long)lastBeacon.periodMs * SLOT_SYNC_BEACONS;
+}
 
-  Serial.printf("[NODE] ACK sent for cmdId=%u\n", ctrl.cmdId);
+uint16_t slotIndex() {
+  if (shortAddr == NO_SHORT_ADDR) return 0xFFFF;
+  uint16_t idx = shortAddr - 1;
+  return idx < (uint16_t)lastBeacon.slotCount * lastBeacon.rounds ? idx : 0xFFFF;
+}
+
+// Unslotted traffic stays out of the slot region after a beacon
+bool inSlotRegion(unsigned long now) {
+  if (!slotPlanValid(now)) return false;
+  return now - beaconAt < (unsigned long)lastBeacon.slotMs * lastBeacon.slotCount;
+}
+
+bool statusDue(unsigned long now) {
+  uint16_t idx = slotIndex();
+  if (!slotPlanValid(now) || idx == 0xFFFF) {
+    return now - lastStatus > STATUS_INTERVAL && !inSlotRegion(now);
+  }
+
+  // First own slot once the interval is up, within half a beacon period
+  if (now - lastStatus + lastBeacon.periodMs / 2 < STATUS_INTERVAL) return false;
+  if (lastBeacon.seq % lastBeacon.rounds != idx / lastBeacon.slotCount) return false;
+  if (slotUsedSeq == lastBeacon.seq) return false;
+
+  unsigned long slotAt = beaconAt + (unsigned long)(idx % lastBeacon.slotCount) * lastBeacon.slotMs;
+  if ((long)(now - slotAt) < 0) return false;
+  slotUsedSeq = lastBeacon.seq;
+  return now - slotAt <= SLOT_LATE_MS;  // missed it: wait for the next cycle
+}
+
+/* ------------------------ RADIO PARAMETERS ------------------------ */
+bool loraAtDefaults() {
+  return loraFreq == DEFAULT_LORA_FREQ && loraSf == DEFAULT_LORA_SF && loraBw == DEFAULT_LORA_BW &&
+         loraCr == DEFAULT_LORA_CR && loraTxPower == DEFAULT_LORA_TX_POWER;
+}
+
+void handleLoRaConfig(const RxFrame &f) {
+  LoRaConfigPkt p;
+  if (!readFrame(f, &p, sizeof(p)) || p.gwTag != gwTag) return;
+  if (p.shortAddr != NO_SHORT_ADDR && p.shortAddr != shortAddr) return;
+  if (p.sf < 7 || p.sf > 12 || p.cr < 5 || p.cr > 8 || p.bw == 0 || p.freq == 0) return;
+
+  bool changed = p.freq != loraFreq || p.sf != loraSf || p.bw != loraBw || p.cr != loraCr ||
+                 (p.txPower != 0 && p.txPower != loraTxPower);
+  if (!changed) return;
+
+  loraFreq = p.freq;
+  loraSf = p.sf;
+  loraBw = p.bw;
+  loraCr = p.cr;
+  if (p.txPower != 0) loraTxPower = p.txPower < 2 ? 2 : (p.txPower > 20 ? 20 : p.txPower);
+  loraRetunePending = true;
+
+  Serial.printf("[LORA] Gateway set SF%u BW=%lu CR=4/%u power=%d dBm (seq=%u)\n",
+                loraSf, (unsigned long)loraBw, loraCr, loraTxPower, p.seq);
+}
+
+// Applies the current parameters once the radio is not transmitting, and
+// falls back to the defaults when the gateway has gone quiet
+void serviceLoRaParams() {
+  unsigned long now = millis();
+  if (!loraAtDefaults() && now - lastGatewayHeard > NODE_ADR_FALLBACK_MS) {
+    Serial.println("[LORA] Gateway lost, back to default radio parameters");
+    loraFreq = DEFAULT_LORA_FREQ;
+    loraSf = DEFAULT_LORA_SF;
+    loraBw = DEFAULT_LORA_BW;
+    loraCr = DEFAULT_LORA_CR;
+    loraTxPower = DEFAULT_LORA_TX_POWER;
+    loraRetunePending = true;
+  }
+
+  if (!loraRetunePending || isLoRaBusy) return;
+  loraRetunePending = false;
+  lastGatewayHeard = now;  // give the new parameters a full fallback period
+  LoRa.idle();
+  LoRa.setFrequency(loraFreq);
+  LoRa.setSpreadingFactor(loraSf);
+  LoRa.setSignalBandwidth(loraBw);
+  LoRa.setCodingRate4(loraCr);
+  LoRa.setTxPower(loraTxPower);
+  LoRa.receive();
 }
 
 /* ------------------------ RADIO ------------------------ */
-void handleLoRaReceive() {
-  int size = LoRa.parsePacket();
-  if (size <= 0) return;
+// Frame types only the gateway sends; hearing one means our link is alive
+bool isGatewayFrame(uint8_t type) {
+  switch (type) {
+    case 0x01: case 0x03: case 0x04: case 0x07: case 0x08: case 0x09: case 0x14: case 0x17:
+    case WIRE_V2 | 0x07: case WIRE_V2 | WIRE_SHORT | 0x07:
+      return true;
+    default:
+      return false;
+  }
+}
 
-  uint8_t type = LoRa.read();
+void handleLoRaFrame(const RxFrame &f) {
+  if (f.len == 0) return;
+  uint8_t type = f.data[0];
+  if (isGatewayFrame(type)) {
+    lastGatewayHeard = millis();
+    gatewayTxEndAt = f.at ? f.at : 1;
+  }
+
+  if ((type & WIRE_VER_MASK) == WIRE_V2) {
+    handleV2Frame(f);
+  }
 
-  if (type == 0x04) {
+  else if (type == 0x04) {
     ConfigPkt cfg;
-    cfg.pktType = type;
-    LoRa.readBytes(((uint8_t*)&cfg) + 1, sizeof(cfg) - 1);
-    handleControl;
+    memset(&cfg, 0, sizeof(cfg));
+    // Older gateways send ConfigPkt without nodeIndex
+    memcpy(&cfg, f.data, min((size_t)f.len, sizeof(cfg)));
+    if (f.len < sizeof(cfg)) cfg.nodeIndex = NO_NODE_INDEX;
+
+    cfg.nodeId[sizeof(cfg.nodeId)-1] = '\0';
+    if (strcmp(cfg.nodeId, NODE_ID.c_str()) != 0) return;
+    applyConfig(cfg);
+  }
+
+  else if (type == 0x14) {
+    ShortConfigPkt sc;
+    if (!readFrame(f, &sc, sizeof(sc))) return;
+    if (shortAddr == NO_SHORT_ADDR || sc.shortAddr != shortAddr || sc.gwTag != gwTag) return;
+
+    ConfigPkt cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.pktType = 0x04;
+    copyField(cfg.gatewayId, sizeof(cfg.gatewayId), ASSIGNED_GATEWAY);
+    cfg.onHour = sc.onHour;
+    cfg.onMin = sc.onMin;
+    cfg.offHour = sc.offHour;
+    cfg.offMin = sc.offMin;
+    cfg.cfgVer = sc.cfgVer;
+    cfg.regIntervalMs = sc.regIntervalMs;
+    cfg.statusIntervalMs = sc.statusIntervalMs;
+    cfg.nodeIndex = NO_NODE_INDEX; // keep current address
     applyConfig(cfg);
   }
 
+  else if (type == 0x03) {
+    handleAssign(f);
+  }
+
   else if (type == 0x07) {
-    handleControl(type);
+    handleControl(f);
   }
 
-  else {
-    while (LoRa.available()) LoRa.read();
+  else if (type == 0x17) {
+    handleShortControl(f);
+  }
+
+  else if (type == 0x09) {
+    handleGroupControl(f);
+  }
+
+  else if (type == 0x08) {
+    handleLoRaConfig(f);
+  }
+
+  else if (type == 0x01) {
+    handleBeacon(f);
+  }
+}
+
+void handleLoRaReceive() {
+  static uint32_t reportedOverruns = 0;
+  RxFrame f;
+  while (popRxFrame(f)) handleLoRaFrame(f);
+
+  if (rxOverruns != reportedOverruns) {
+    Serial.printf("[LORA] RX overrun, %lu frames lost so far\n", (unsigned long)rxOverruns);
+    reportedOverruns = rxOverruns;
   }
 }
 
@@ -270,14 +957,17 @@ void updateLightState() {
 void applyLoRaParams() {
   LoRa.end();
   delay(200);
-  if (!LoRa.begin(DEFAULT_LORA_FREQ)) {
+  if (!LoRa.begin(loraFreq)) {
     Serial.println("[LORA] FAIL");
     while (1) delay(1000);
   }
-  LoRa.setSpreadingFactor(DEFAULT_LORA_SF);
-  LoRa.setSignalBandwidth(DEFAULT_LORA_BW);
-  LoRa.setCodingRate4(DEFAULT_LORA_CR);
+  LoRa.setSpreadingFactor(loraSf);
+  LoRa.setSignalBandwidth(loraBw);
+  LoRa.setCodingRate4(loraCr);
+  LoRa.setTxPower(loraTxPower);
   LoRa.enableCrc();
+  isLoRaBusy = false;
+  dio0Pending = false;
   LoRa.receive();
 }
 
@@ -294,25 +984,36 @@ void setup() {
   rtc.begin();
   LoRa.setPins(LORA_SS, LORA_RST, LORA_DIO0);
   applyLoRaParams();
+  pinMode(LORA_DIO0, INPUT);
+  attachInterrupt(digitalPinToInterrupt(LORA_DIO0), onLoRaDio0, RISING);
 
   Serial.printf("[NODE] ID=%s\n", NODE_ID.c_str());
 }
 
 /* ------------------------ MAIN LOOP ------------------------ */
 void loop() {
+  serviceLoRaIrq();
   handleLoRaReceive();
+  serviceLoRaParams();
+  pumpLoRaTx();
   updateLightState();
 
   unsigned long now = millis();
 
-  if (!configured && now - lastRegister > REGISTER_INTERVAL) {
+  if (!configured && now - lastRegister > REGISTER_INTERVAL && !inSlotRegion(now)) {
     lastRegister = now;
     sendRegister();
   }
 
-  if (configured && now - lastStatus > STATUS_INTERVAL) {
+  if (groupAckPending && (long)(now - groupAckAt) >= 0) {
+    sendGroupAck();
+    pumpLoRaTx();  // the slot is short too
+  }
+
+  if (configured && statusDue(now)) {
     lastStatus = now;
     sendStatus();
+    pumpLoRaTx();  // start it now, the slot is short
   }
 
   delay(10);
@@ -0,0 +1,180 @@
+/* ===========================================================
+   CONFIG IMAGE LOAD BENCHMARK (host)
+   Boot-time config load at 50, 500 and 5000 nodes: the binary
+   image as gateway.cpp reads it (header + the MAX_NODES records
+   it keeps, each CRC-checked) against a full scan of the image
+   and, when built with ArduinoJson, the old JSON parse.
+
+   Build & run:
+     g++ -std=c++17 -O2 -o config-image-bench backend/sim/config-image-bench.cpp
+     ./config-image-bench
+   With the JSON baseline (ArduinoJson 6 checkout):
+     g++ -std=c++17 -O2 -DBENCH_ARDUINOJSON -I<ArduinoJson>/src \
+         -o config-image-bench backend/sim/config-image-bench.cpp
+   =========================================================== */
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../config_image.h"
+
+#ifdef BENCH_ARDUINOJSON
+#include <ArduinoJson.h>
+#endif
+
+#define MAX_NODES 50   // gateway.cpp nodeList size
+
+/* ------------------------ FIXTURES ------------------------ */
+// Stands in for a SPIFFS File: sequential reads out of a buffer
+struct MemFile {
+  const std::vector<uint8_t>* data;
+  size_t pos = 0;
+  size_t read(void* dst, size_t n) {
+    size_t left = data->size() - pos;
+    if (n > left) n = left;
+    memcpy(dst, data->data() + pos, n);
+    pos += n;
+    return n;
+  }
+};
+
+void append(std::vector<uint8_t> &v, const void* p, size_t n) {
+  const uint8_t* b = (const uint8_t*)p;
+  v.insert(v.end(), b, b + n);
+}
+
+std::vector<uint8_t> buildImage(uint32_t nodes) {
+  CfgGatewayRec g;
+  memset(&g, 0, sizeof(g));
+  strcpy(g.gatewayId, "GW-4");
+  strcpy(g.apn, "airtelgprs.com");
+  strcpy(g.broker, "broker.example.org");
+  g.port = 1883;
+  g.loraFreq = 433000000UL;
+  g.loraBw = 125000UL;
+  g.loraSf = 7;
+  g.loraCr = 5;
+  g.dutyPermille = 100;
+  CfgImageHeader h;
+  cfgImageSeal(h, g, nodes);
+
+  std::vector<uint8_t> img;
+  append(img, &h, sizeof(h));
+  append(img, &g, sizeof(g));
+  for (uint32_t i = 0; i < nodes; i++) {
+    CfgNodeRec r;
+    memset(&r, 0, sizeof(r));
+    snprintf(r.nodeId, sizeof(r.nodeId), "node%012X", i);
+    r.onHour = 18;
+    r.offHour = 6;
+    r.configVersion = 1;
+    r.regIntervalMs = 600000;
+    r.statusIntervalMs = 60000;
+    cfgNodeSeal(r);
+    append(img, &r, sizeof(r));
+  }
+  return img;
+}
+
+std::string buildJson(uint32_t nodes) {
+  std::string s = "{\"gatewayId\":\"GW-4\",\"apn\":\"airtelgprs.com\",\"configVersion\":1,"
+                  "\"mqtt\":{\"broker\":\"broker.example.org\",\"port\":1883},"
+                  "\"lora\":{\"frequency\":433000000,\"spreadingFactor\":7,\"bandwidth\":125000,\"codingRate\":5},"
+                  "\"nodes\":[";
+  char buf[256];
+  for (uint32_t i = 0; i < nodes; i++) {
+    snprintf(buf, sizeof(buf), "%s{\"nodeId\":\"node%012X\",\"configVersion\":1,"
+             "\"config\":{\"onHour\":18,\"onMin\":0,\"offHour\":6,\"offMin\":0},"
+             "\"intervals\":{\"register\":600000,\"status\":60000}}", i ? "," : "", i);
+    s += buf;
+  }
+  return s + "]}";
+}
+
+/* ------------------------ LOADERS ------------------------ */
+struct Loaded {
+  uint32_t nodes = 0;
+  uint32_t bad = 0;
+};
+
+// What loadConfigFromSPIFFS() does: fixed part, then only the kept records
+Loaded loadBoot(const std::vector<uint8_t> &img) {
+  Loaded out;
+  MemFile f{ &img };
+  CfgImageHeader h;
+  CfgGatewayRec g;
+  if (f.read(&h, sizeof(h)) != sizeof(h) || f.read(&g, sizeof(g)) != sizeof(g)) return out;
+  if (!cfgImageValid(h, g)) return out;
+  for (uint32_t i = 0; i < h.nodeCount && out.nodes < MAX_NODES; i++) {
+    CfgNodeRec r;
+    if (f.read(&r, sizeof(r)) != sizeof(r)) break;
+    if (cfgNodeValid(r)) out.nodes++;
+    else out.bad++;
+  }
+  return out;
+}
+
+// Every record checked, e.g. for an export
+Loaded loadFull(const std::vector<uint8_t> &img) {
+  Loaded out;
+  MemFile f{ &img };
+  CfgImageHeader h;
+  CfgGatewayRec g;
+  if (f.read(&h, sizeof(h)) != sizeof(h) || f.read(&g, sizeof(g)) != sizeof(g)) return out;
+  if (!cfgImageValid(h, g)) return out;
+  for (uint32_t i = 0; i < h.nodeCount; i++) {
+    CfgNodeRec r;
+    if (f.read(&r, sizeof(r)) != sizeof(r)) break;
+    if (cfgNodeValid(r)) out.nodes++;
+    else out.bad++;
+  }
+  return out;
+}
+
+template <typename F>
+double timeUs(F fn, int iterations) {
+  auto t0 = std::chrono::steady_clock::now();
+  volatile uint32_t sink = 0;
+  for (int i = 0; i < iterations; i++) sink = sink + fn().nodes;
+  auto t1 = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::micro>(t1 - t0).count() / iterations;
+}
+
+int main() {
+  const uint32_t counts[] = { 50, 500, 5000 };
+  const size_t bootState = sizeof(CfgImageHeader) + sizeof(CfgGatewayRec) + sizeof(CfgNodeRec);
+
+  printf("%-6s %-10s %-10s %-10s %-10s %-10s %-10s %-12s\n", "nodes", "image_B", "json_B",
+         "boot_us", "boot_B", "full_us", "json_us", "json_doc_B");
+  for (uint32_t n : counts) {
+    std::vector<uint8_t> img = buildImage(n);
+    std::string json = buildJson(n);
+    int iters = n >= 5000 ? 200 : 2000;
+
+    double bootUs = timeUs([&] { return loadBoot(img); }, iters);
+    double fullUs = timeUs([&] { return loadFull(img); }, iters);
+
+    double jsonUs = -1;
+    long jsonDoc = -1;
+#ifdef BENCH_ARDUINOJSON
+    const size_t cap = JSON_OBJECT_SIZE(7) + 3 * JSON_OBJECT_SIZE(4) + JSON_ARRAY_SIZE(n) +
+                       n * (JSON_OBJECT_SIZE(4) + 2 * JSON_OBJECT_SIZE(4)) + json.size();
+    jsonDoc = (long)cap;
+    jsonUs = timeUs([&] {
+      DynamicJsonDocument doc(cap);
+      Loaded l;
+      if (!deserializeJson(doc, json.c_str())) l.nodes = doc["nodes"].size();
+      return l;
+    }, n >= 5000 ? 20 : 200);
+#endif
+
+    printf("%-6u %-10zu %-10zu %-10.2f %-10zu %-10.2f %-10.2f %-12ld\n", n, img.size(), json.size(),
+           bootUs, bootState, fullUs, jsonUs, jsonDoc);
+  }
+  printf("# boot_B: bytes of config state held at once while booting from the image;\n"
+         "# json_us/json_doc_B are -1 unless built with -DBENCH_ARDUINOJSON\n");
+  return 0;
+}
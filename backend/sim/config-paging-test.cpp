@@ -0,0 +1,245 @@
+/* ===========================================================
+   CONFIG PAGING TEST (host)
+   gateway.cpp's paged device_config import, driven through the
+   downlink path the way the backend sends it: a transfer run to
+   completion, an out-of-order page, a restart from page 0, the
+   idle timeout, and the gatewayId check (page 0 only). Every
+   page's config_page_ack is read back from the uplink queue.
+
+   Each case prints PASS/FAIL; the exit code is the number of
+   failed checks.
+
+   Build & run (from the repo root):
+     g++ -std=gnu++17 -O2 -Ibackend/sim/shim \
+         -o config-paging-test backend/sim/config-paging-test.cpp
+     ./config-paging-test [-v]     # -v: firmware Serial output
+   =========================================================== */
+
+#include "lora-sim.h"
+
+#define SIM_STRING_CAP 160
+#define SIM_PREFS_CAP  160
+
+/* ------------------------ HOST CORE ------------------------ */
+// Only the clock, the log and the (in-memory) SPIFFS matter here
+uint64_t nowUs = 1000000;
+bool verbose = false;
+
+uint64_t simNowUs() { return nowUs; }
+void simDelayMs(unsigned long ms) { nowUs += (uint64_t)ms * 1000; }
+uint32_t simWallClockS() { return (uint32_t)((19 * 3600 + nowUs / 1000000) % 86400); }
+uint64_t simChipId() { return 0x30AEA4000001ULL; }
+long simRandom(long lo, long hi) { return lo < hi ? lo : hi; }
+void simLog(const char* fmt, va_list ap) { if (verbose) vprintf(fmt, ap); }
+void simLogText(const char* s, size_t n) { if (verbose) fwrite(s, 1, n, stdout); }
+
+void simRadioSet(int, long) {}
+void simRadioMode(int) {}
+bool simRadioTx(const uint8_t*, size_t) { return true; }
+void simRadioCallbacks(void (*)(int), void (*)()) {}
+void simRadioIrq(void (*)()) {}
+int simRadioParse() { return 0; }
+void simWakeTask() {}
+int simRadioAvailable() { return 0; }
+int simRadioRead() { return -1; }
+int simRadioRssi() { return -90; }
+float simRadioSnr() { return 7.5f; }
+
+/* ------------------------ GATEWAY ------------------------ */
+#include "../gateway.cpp"
+
+HardwareSerial Serial(0);
+EspClass ESP;
+LoRaClass LoRa;
+FSImpl SPIFFS;
+
+/* ------------------------ HARNESS ------------------------ */
+struct PageAck {
+  uint32_t id;
+  uint16_t seq;
+  bool ok;
+  uint16_t next;
+  uint16_t total;
+};
+
+// What one device_config message left in the uplink queue
+struct Reply {
+  std::vector<PageAck> acks;
+  int applied = 0;   // EVT_CONFIG_APPLIED: the image was installed and loaded
+};
+
+// Starts each case from an empty flash and no transfer in progress
+void reset() {
+  SPIFFS = FSImpl();
+  paging = {};
+  nodeCount = 0;
+  while (uplinkQueue.peek()) uplinkQueue.pop();
+}
+
+std::string nodeId(int n) {
+  char id[sizeof(NodeInfo::nodeId)];
+  snprintf(id, sizeof(id), "nodeA4CF1200%04X", n);
+  return id;
+}
+
+// Page seq of transfer id, carrying nodes [first, first+count); page 0 also
+// carries the gateway settings unless gatewayId is null
+std::string pageJson(uint32_t id, uint16_t seq, uint16_t total, int first, int count,
+                     const char* gatewayId = "gw-page") {
+  std::string s = "{\"type\":\"device_config\",\"page\":{\"id\":" + std::to_string(id) +
+                  ",\"seq\":" + std::to_string(seq) + ",\"total\":" + std::to_string(total) + "}";
+  if (seq == 0 && gatewayId) {
+    s += ",\"gatewayId\":\"" + std::string(gatewayId) + "\",\"lora\":{\"spreadingFactor\":9}";
+  }
+  s += ",\"nodes\":[";
+  for (int i = 0; i < count; i++) {
+    if (i) s += ",";
+    s += "{\"nodeId\":\"" + nodeId(first + i) +
+         "\",\"configVersion\":3,\"config\":{\"onHour\":18,\"offHour\":6}}";
+  }
+  return s + "]}";
+}
+
+Reply send(const std::string& json) {
+  static DownlinkMsg m;
+  snprintf(m.topic, sizeof(m.topic), "%s", "iot/device/30AEA4000001/config");
+  m.len = (uint16_t)json.size();
+  memcpy(m.payload, json.data(), json.size());
+  handleDownlinkMessage(m);
+
+  Reply r;
+  while (UplinkEvent* e = uplinkQueue.peek()) {
+    if (e->kind == EVT_CONFIG_PAGE) {
+      r.acks.push_back({e->pageId, e->cmdId, e->success, e->pageNext, e->pageTotal});
+    } else if (e->kind == EVT_CONFIG_APPLIED) {
+      r.applied++;
+    }
+    uplinkQueue.pop();
+  }
+  return r;
+}
+
+bool acked(const Reply& r, uint32_t id, uint16_t seq, bool ok, uint16_t next) {
+  return r.acks.size() == 1 && r.acks[0].id == id && r.acks[0].seq == seq &&
+         r.acks[0].ok == ok && r.acks[0].next == next;
+}
+
+// The node table holds exactly nodes [first, first+count)
+bool nodesAre(int first, int count) {
+  if (nodeCount != (size_t)count) return false;
+  for (int i = 0; i < count; i++) {
+    if (nodeId(first + i) != nodeList[i].nodeId) return false;
+  }
+  return true;
+}
+
+int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { printf("  FAIL %s:%d: %s\n", __func__, __LINE__, #cond); failures++; } \
+  } while (0)
+
+/* ------------------------ CASES ------------------------ */
+void testComplete() {
+  reset();
+  Reply r = send(pageJson(7, 0, 3, 0, 8));
+  CHECK(acked(r, 7, 0, true, 1) && r.acks[0].total == 3 && r.applied == 0);
+
+  // Later pages carry only nodes, no gatewayId
+  r = send(pageJson(7, 1, 3, 8, 8));
+  CHECK(acked(r, 7, 1, true, 2) && r.applied == 0);
+  CHECK(nodeCount == 0);  // nothing applied before the last page
+
+  r = send(pageJson(7, 2, 3, 16, 4));
+  CHECK(acked(r, 7, 2, true, 3) && r.applied == 1);
+  CHECK(nodesAre(0, 20));
+  CHECK(strcmp(nodeGatewayId, "gw-page") == 0 && LORA_SF == 9);
+  CHECK(nodeList[19].configVersion == 3 && nodeList[19].onHour == 18);
+  CHECK(!paging.active && !SPIFFS.exists(CONFIG_PART_PATH));
+}
+
+void testOutOfOrder() {
+  reset();
+  send(pageJson(8, 0, 3, 0, 5));
+
+  // Page 2 before page 1: refused, the ACK names the page expected
+  Reply r = send(pageJson(8, 2, 3, 10, 5));
+  CHECK(acked(r, 8, 2, false, 1) && r.applied == 0);
+
+  // A page of another transfer is refused the same way
+  r = send(pageJson(9, 1, 3, 5, 5));
+  CHECK(acked(r, 9, 1, false, 1));
+
+  // The transfer picks up where it was
+  r = send(pageJson(8, 1, 3, 5, 5));
+  CHECK(acked(r, 8, 1, true, 2));
+  r = send(pageJson(8, 2, 3, 10, 5));
+  CHECK(acked(r, 8, 2, true, 3) && r.applied == 1);
+  CHECK(nodesAre(0, 15));
+}
+
+void testRestart() {
+  reset();
+  send(pageJson(10, 0, 3, 0, 6));
+  send(pageJson(10, 1, 3, 6, 6));
+
+  // Page 0 again starts over: the nodes already written are discarded
+  Reply r = send(pageJson(11, 0, 2, 100, 6));
+  CHECK(acked(r, 11, 0, true, 1) && r.acks[0].total == 2);
+  r = send(pageJson(10, 2, 3, 12, 6));
+  CHECK(acked(r, 10, 2, false, 1));
+  r = send(pageJson(11, 1, 2, 106, 3));
+  CHECK(acked(r, 11, 1, true, 2) && r.applied == 1);
+  CHECK(nodesAre(100, 9));
+}
+
+void testTimeout() {
+  reset();
+  send(pageJson(12, 0, 2, 0, 4));
+  simDelayMs(CONFIG_PAGE_TIMEOUT_MS + 1000);
+
+  Reply r = send(pageJson(12, 1, 2, 4, 4));
+  CHECK(r.acks.size() == 1 && !r.acks[0].ok && r.applied == 0);
+  CHECK(!paging.active && nodeCount == 0);
+}
+
+void testGatewayId() {
+  reset();
+
+  // Page 0 without a gatewayId is refused with an ACK
+  Reply r = send(pageJson(13, 0, 2, 0, 4, nullptr));
+  CHECK(acked(r, 13, 0, false, 0) && !paging.active);
+
+  // A single-message config without one is ignored
+  r = send("{\"type\":\"device_config\",\"nodes\":[{\"nodeId\":\"" + nodeId(1) + "\"}]}");
+  CHECK(r.acks.empty() && r.applied == 0);
+  CHECK(!SPIFFS.exists(CONFIG_IMAGE_PATH));
+}
+
+/* ------------------------ MAIN ------------------------ */
+struct TestCase {
+  const char* name;
+  void (*fn)();
+};
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-v") == 0) verbose = true;
+  }
+
+  const TestCase cases[] = {
+    {"complete",     testComplete},
+    {"out_of_order", testOutOfOrder},
+    {"restart",      testRestart},
+    {"timeout",      testTimeout},
+    {"gateway_id",   testGatewayId},
+  };
+
+  for (const TestCase& c : cases) {
+    int before = failures;
+    c.fn();
+    printf("%-14s %s\n", c.name, failures == before ? "PASS" : "FAIL");
+  }
+  printf("%d check(s) failed\n", failures);
+  return failures;
+}
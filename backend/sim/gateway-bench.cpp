@@ -0,0 +1,677 @@
+/* ===========================================================
+   GATEWAY MICROBENCHMARKS (host)
+   The radio and uplink tasks' per-message work, run through
+   gateway.cpp itself (compiled against sim/shim/, provisioned
+   with 50 nodes): LoRa frame decode and dispatch, command queue
+   enqueue/ACK with the queue full, the task hand-off rings, and
+   the backend JSON paths. The last node is swapped for a new one
+   at setup, which waits on its predecessor's held short address,
+   so the group case covers a member without one. The node index
+   cases also build the
+   gateway's NodeHash for 500 and 5000 nodes, next to the linear
+   name scan it replaced. Each backend message type is timed in
+   both wire encodings (json.* / msgpack.*: the gateway's encode
+   and decode paths, plus a plain decode of what it sent), and
+   its size in each is printed after the timings.
+
+   Every case times single operations; state a case needs (a
+   command in flight, an empty ring) is restored between them,
+   outside the timed region. Results are ns per operation with
+   the timer's own cost subtracted. Serial logging is a no-op
+   here, so the numbers leave out UART time.
+
+   --json writes one record per case so runs can be kept and
+   compared across firmware versions; --baseline compares the
+   run against such a file and exits 1 if a case got slower
+   than --threshold percent.
+
+   Build & run (from the repo root):
+     g++ -std=gnu++17 -O2 -Ibackend/sim/shim -DBENCH_FW_VERSION="\"$(git describe --always --dirty)\"" \
+         -o gateway-bench backend/sim/gateway-bench.cpp
+     ./gateway-bench --json > bench-$(git rev-parse --short HEAD).json
+     ./gateway-bench --baseline bench-<older>.json
+   The json.* and msgpack.* cases run on the ArduinoJson shim,
+   which writes the same bytes as ArduinoJson 6, so the sizes hold
+   but the times are the shim's. For times of the library itself,
+   put it ahead of the shims:
+     g++ -std=gnu++17 -O2 -DBENCH_ARDUINOJSON -I<ArduinoJson>/src -Ibackend/sim/shim \
+         -o gateway-bench backend/sim/gateway-bench.cpp
+   =========================================================== */
+
+#include "lora-sim.h"
+
+#include <chrono>
+
+#ifdef BENCH_ARDUINOJSON
+// ArduinoJson's Arduino String/Stream/Print support, bound to the shims
+#define ARDUINOJSON_ENABLE_ARDUINO_STRING 1
+#define ARDUINOJSON_ENABLE_ARDUINO_STREAM 1
+#define ARDUINOJSON_ENABLE_ARDUINO_PRINT  1
+#define ARDUINOJSON_ENABLE_PROGMEM        0
+#endif
+
+#ifndef BENCH_FW_VERSION
+#define BENCH_FW_VERSION "unknown"
+#endif
+
+#define SIM_STRING_CAP 160
+#define SIM_PREFS_CAP  160
+
+/* ------------------------ HOST CORE ------------------------ */
+// What sim/shim/ calls into: a clock that moves only when told to, a
+// radio that accepts every frame, no log output
+uint64_t benchUs = 1000000;
+uint64_t rngState = 0x9E3779B97F4A7C15ULL;
+
+uint64_t simNowUs() { return benchUs; }
+void simDelayMs(unsigned long ms) { benchUs += (uint64_t)ms * 1000; }
+uint32_t simWallClockS() { return (uint32_t)((19 * 3600 + benchUs / 1000000) % 86400); }
+uint64_t simChipId() { return 0x30AEA4000001ULL; }
+void simLog(const char*, va_list) {}
+void simLogText(const char*, size_t) {}
+
+long simRandom(long lo, long hi) {
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 7;
+  rngState ^= rngState << 17;
+  return hi <= lo ? lo : lo + (long)(rngState % (uint64_t)(hi - lo));
+}
+
+void simRadioSet(int, long) {}
+void simRadioMode(int) {}
+bool simRadioTx(const uint8_t*, size_t) { return true; }
+void simRadioCallbacks(void (*)(int), void (*)()) {}
+void simRadioIrq(void (*)()) {}
+int simRadioParse() { return 0; }
+void simWakeTask() {}
+int simRadioAvailable() { return 0; }
+int simRadioRead() { return -1; }
+int simRadioRssi() { return -90; }
+float simRadioSnr() { return 7.5f; }
+
+/* ------------------------ GATEWAY ------------------------ */
+#include "../gateway.cpp"
+
+HardwareSerial Serial(0);
+EspClass ESP;
+LoRaClass LoRa;
+FSImpl SPIFFS;
+
+#include "gw-provision.h"
+
+/* ------------------------ HARNESS ------------------------ */
+#define SAMPLES_DEFAULT 20000   // per round
+#define ROUNDS_DEFAULT  5
+#define WARMUP_OPS      1000
+
+struct Case {
+  const char* name;
+  void (*prep)();   // untimed, before every op
+  void (*op)();
+};
+
+struct Result {
+  const char* name;
+  uint32_t samples;
+  double minNs, medianNs, p90Ns, p99Ns, meanNs;
+};
+
+using Clock = std::chrono::steady_clock;
+double timerNs = 0;   // median cost of an empty timed region
+
+void noop() {}
+
+std::vector<double> sample(const Case& c, uint32_t n) {
+  std::vector<double> t;
+  t.reserve(n);
+  for (uint32_t i = 0; i < WARMUP_OPS + n; i++) {
+    if (c.prep) c.prep();
+    auto a = Clock::now();
+    c.op();
+    auto b = Clock::now();
+    if (i >= WARMUP_OPS) t.push_back(std::chrono::duration<double, std::nano>(b - a).count());
+  }
+  std::sort(t.begin(), t.end());
+  return t;
+}
+
+double percentileNs(const std::vector<double>& t, double p) {
+  size_t k = (size_t)(p / 100 * (t.size() - 1));
+  return std::max(t[k] - timerNs, 0.0);
+}
+
+// Median is the median of per-round medians, so one disturbed round
+// (another process, a frequency change) doesn't move it
+Result measure(const Case& c, uint32_t n, uint32_t rounds) {
+  Result r = {c.name, n * rounds, 0, 0, 0, 0, 0};
+  std::vector<double> all, medians;
+  for (uint32_t k = 0; k < rounds; k++) {
+    std::vector<double> t = sample(c, n);
+    medians.push_back(percentileNs(t, 50));
+    all.insert(all.end(), t.begin(), t.end());
+  }
+  std::sort(all.begin(), all.end());
+  std::sort(medians.begin(), medians.end());
+  double sum = 0;
+  for (double v : all) sum += v;
+  r.minNs = percentileNs(all, 0);
+  r.medianNs = medians[medians.size() / 2];
+  r.p90Ns = percentileNs(all, 90);
+  r.p99Ns = percentileNs(all, 99);
+  r.meanNs = std::max(sum / all.size() - timerNs, 0.0);
+  return r;
+}
+
+/* ------------------------ FIXTURES ------------------------ */
+std::vector<std::string> nodeIds;
+RxFrame frameLong, frameShort, frameAckStale, frameAck, frameV2Long, frameV2Short;
+int ackNode = 0;
+uint16_t benchCmdId = 1;
+const char* controlTopic = "iot/gateway/gw-sim/node/nodeA4CF12001F3D/control";
+char controlMsg[160];
+const char* groupTopic = "iot/gateway/gw-sim/control";
+const char* groupMsg = "{\"type\":\"node_control\",\"gatewayId\":\"gw-sim\",\"nodeId\":\"*\",\"action\":\"ON\",\"cmdId\":9}";
+
+void setupGateway() {
+  for (int i = 1; i <= MAX_NODES; i++) {
+    char id[24];
+    snprintf(id, sizeof(id), "node%012llX", 0xA4CF12000000ULL + (unsigned long long)i * 0x1F3D);
+    nodeIds.push_back(id);
+  }
+  provisionConfigImage(nodeIds, DEFAULT_DUTY_CYCLE_PERMILLE);
+  setup();
+
+  // Replaced node: the only free address is the old node's, still held
+  nodeIds.back() = "nodeA4CFFFFFFFFF";
+  provisionConfigImage(nodeIds, DEFAULT_DUTY_CYCLE_PERMILLE);
+  loadConfigFromSPIFFS(CFG_RADIO);
+  markConfigApplied();
+  for (size_t i = 0; i < nodeCount; i++) nodeList[i].shortConfirmed = nodeList[i].shortAddr != NO_SHORT_ADDR;
+  snprintf(controlMsg, sizeof(controlMsg),
+           "{\"type\":\"node_control\",\"gatewayId\":\"gw-sim\",\"nodeId\":\"%s\",\"action\":\"ON\",\"cmdId\":7}",
+           nodeIds[0].c_str());
+}
+
+void makeFrame(RxFrame& f, const void* pkt, size_t len) {
+  memset(&f, 0, sizeof(f));
+  memcpy(f.data, pkt, len);
+  f.len = (uint8_t)len;
+  f.rssi = -97;
+  f.snr = 6.25f;
+}
+
+void setupFrames() {
+  uint8_t buf[1 + sizeof(PolePacket)] = {0x05};
+  PolePacket pole = {};
+  strncpy(pole.nodeId, nodeIds[7].c_str(), sizeof(pole.nodeId) - 1);
+  strncpy(pole.gatewayId, "gw-sim", sizeof(pole.gatewayId) - 1);
+  pole.lightState = true;
+  pole.hour = 19;
+  pole.minute = 42;
+  memcpy(buf + 1, &pole, sizeof(pole));
+  makeFrame(frameLong, buf, sizeof(buf));
+
+  ShortStatusPkt st = {0x15, nodeList[7].shortAddr, gwTag, 0x01, 19, 42};
+  makeFrame(frameShort, &st, sizeof(st));
+
+  AckPkt ack = {0x06, 0xBEEF, {}};
+  strncpy(ack.nodeId, nodeIds[9].c_str(), sizeof(ack.nodeId) - 1);
+  makeFrame(frameAckStale, &ack, sizeof(ack));
+
+  uint8_t v2[WIRE_V2_MAX];
+  V2StatusBody body = {(uint16_t)((19 * 60 + 42) | V2_LIGHT)};
+  uint64_t chip = 0;
+  nodeIdChip(nodeIds[7].c_str(), chip);
+  size_t n = beginV2(v2, 0x05, false, NO_SHORT_ADDR, chip, 0);
+  memcpy(v2 + n, &body, sizeof(body));
+  makeFrame(frameV2Long, v2, n + sizeof(body));
+  n = beginV2(v2, 0x05, true, nodeList[7].shortAddr, 0, 0);
+  memcpy(v2 + n, &body, sizeof(body));
+  makeFrame(frameV2Short, v2, n + sizeof(body));
+}
+
+void drainUplink() {
+  while (uplinkQueue.peek()) uplinkQueue.pop();
+}
+
+void clearTx() {
+  for (int i = 0; i < TX_QUEUE_SIZE; i++) txQueue[i].used = false;
+}
+
+void clearOutbox() {
+  obHead = obUsed = 0;
+  obRamCount = 0;
+}
+
+// Every slot taken, by commands for nodes [first, first + MAX_PENDING)
+void fillCommandQueue(int first) {
+  for (int i = 0; i < MAX_PENDING; i++) {
+    if (cmdQueue[i].active && cmdQueue[i].inFlight) unlinkInFlightCommand(i);
+    cmdQueue[i].active = false;
+  }
+  for (int i = 0; i < MAX_PENDING; i++) {
+    const char* id = nodeIds[first + i].c_str();
+    nodeList[findNodeIndex(id)].ackedLight = LIGHT_UNKNOWN;
+    enqueueCommand(benchCmdId++, id, true);
+  }
+  clearTx();
+  drainUplink();
+}
+
+// Node index for N names, sized by the gateway's rule; the scan is the
+// strcmp walk over nodeList that findNodeIndex() used to do
+template <uint16_t N>
+struct IndexFixture {
+  NodeHash<nextPow2(2 * (N + MAX_PENDING))> hash;
+  std::vector<std::string> names;
+  uint32_t next = 0;
+  const char* target = "";
+
+  void build() {
+    hash.clear();
+    for (uint32_t i = 0; i < N; i++) {
+      char id[24];
+      snprintf(id, sizeof(id), "node%012llX", 0xA4CF12000000ULL + (unsigned long long)(i + 1) * 0x1F3D);
+      names.push_back(id);
+      int slot = hash.insert(nodeKey(id));
+      if (slot >= 0) hash[slot].node = (int16_t)i;
+    }
+  }
+};
+
+IndexFixture<50> index50;
+IndexFixture<500> index500;
+IndexFixture<5000> index5000;
+volatile int indexSink;
+
+/* ------------------------ CASES ------------------------ */
+// LoRa RX: decode + dispatch of one frame as handleLoRaReceive() does
+void prepRx() { drainUplink(); clearTx(); }
+void opRxLong() { handleLoRaFrame(frameLong); }
+void opRxShort() { handleLoRaFrame(frameShort); }
+void opRxAckStale() { handleLoRaFrame(frameAckStale); }
+// v2 frames carry a sequence number; a repeat would be dropped as a duplicate
+void opRxV2Long() { frameV2Long.data[1 + WIRE_CHIP_BYTES]++; handleLoRaFrame(frameV2Long); }
+void opRxV2Short() { frameV2Short.data[3]++; handleLoRaFrame(frameV2Short); }
+
+// Command queue full: a command for a node not in it is refused
+void prepEnqueueFull() { drainUplink(); }
+void opEnqueueFull() { enqueueCommand(benchCmdId, nodeIds[MAX_PENDING + 5].c_str(), true); }
+
+// Command queue full, CMD_WINDOW in flight: ACK for one of them. The prep
+// re-fills the freed slot and sends it, so every op sees the same queue
+void prepAckFull() {
+  drainUplink();
+  clearTx();
+  ackNode = (ackNode + 1) % CMD_WINDOW;
+  const char* id = nodeIds[ackNode].c_str();
+  int i = findInFlightCommand(id);
+  if (i < 0) {
+    for (int k = 0; k < MAX_PENDING && i < 0; k++) {
+      if (cmdQueue[k].active && strcmp(cmdQueue[k].nodeId, id) == 0) i = k;
+    }
+    if (i < 0) {
+      int n = findNodeIndex(id);
+      nodeList[n].ackedLight = LIGHT_UNKNOWN;
+      enqueueCommand(benchCmdId++, id, true);
+      for (int k = 0; k < MAX_PENDING && i < 0; k++) {
+        if (cmdQueue[k].active && strcmp(cmdQueue[k].nodeId, id) == 0) i = k;
+      }
+    }
+    sendCommand(cmdQueue[i]);
+    clearTx();
+  }
+  cmdQueue[i].txEnd = millis();
+  AckPkt ack = {0x06, cmdQueue[i].cmdId, {}};
+  strncpy(ack.nodeId, id, sizeof(ack.nodeId) - 1);
+  makeFrame(frameAck, &ack, sizeof(ack));
+  benchUs += 150000;  // an RTT sample each time
+  frameAck.at = millis();
+}
+void opAckFull() { handleLoRaFrame(frameAck); }
+
+// Node index: one lookup by name, a different node each op
+template <class F> void prepIndex(F& f) { f.target = f.names[f.next++ % f.names.size()].c_str(); }
+template <class F> void opIndexFind(F& f) {
+  int slot = f.hash.find(nodeKey(f.target));
+  int idx = slot < 0 ? -1 : f.hash[slot].node;
+  indexSink = (idx >= 0 && strcmp(f.names[idx].c_str(), f.target) == 0) ? idx : -1;
+}
+template <class F> void opIndexScan(F& f) {
+  int idx = -1;
+  for (size_t i = 0; i < f.names.size() && idx < 0; i++) {
+    if (strcmp(f.names[i].c_str(), f.target) == 0) idx = (int)i;
+  }
+  indexSink = idx;
+}
+void prepIndex50() { prepIndex(index50); }
+void prepIndex500() { prepIndex(index500); }
+void prepIndex5000() { prepIndex(index5000); }
+void opIndexFind50() { opIndexFind(index50); }
+void opIndexFind500() { opIndexFind(index500); }
+void opIndexFind5000() { opIndexFind(index5000); }
+void opIndexScan50() { opIndexScan(index50); }
+void opIndexScan500() { opIndexScan(index500); }
+void opIndexScan5000() { opIndexScan(index5000); }
+
+// Loop profiler, per phase boundary (LOOP_PROFILE)
+void opProfLap() {
+  uint32_t mark = profMark();
+  profLap(PROF_RX, mark);
+}
+
+// Radio -> uplink ring (ACK events): one producer push, one consumer pop
+UplinkEvent ringEvent;
+void opUplinkRing() {
+  uplinkQueue.push(ringEvent);
+  uplinkQueue.peek();
+  uplinkQueue.pop();
+}
+
+// PubSubClient callback: copy into the downlink ring for the radio task
+void prepOnMessage() {
+  while (downlinkQueue.peek()) downlinkQueue.pop();
+}
+void opOnMessage() {
+  onMqttMessage((char*)controlTopic, (byte*)controlMsg, (unsigned)strlen(controlMsg));
+}
+
+// Radio task: decode + dispatch of that message, down to enqueueCommand()
+DownlinkMsg controlDownlink;
+void prepDownlink(const std::string& payload) {
+  drainUplink();
+  for (int i = 0; i < MAX_PENDING; i++) {
+    if (cmdQueue[i].active && cmdQueue[i].inFlight) unlinkInFlightCommand(i);
+    cmdQueue[i].active = false;
+  }
+  nodeList[0].ackedLight = LIGHT_UNKNOWN;
+  strcpy(controlDownlink.topic, controlTopic);
+  controlDownlink.len = (uint16_t)payload.size();
+  memcpy(controlDownlink.payload, payload.data(), controlDownlink.len);
+}
+void opDownlink() { handleDownlinkMessage(controlDownlink); }
+
+// Group control for every node, one of them without a short address
+DownlinkMsg groupDownlink;
+void prepGroupHeld() {
+  prepDownlink(groupMsg);
+  groupCmd.active = false;
+  for (size_t i = 0; i < nodeCount; i++) nodeList[i].ackedLight = LIGHT_UNKNOWN;
+  groupDownlink = controlDownlink;
+  strcpy(groupDownlink.topic, groupTopic);
+}
+void opGroupHeld() { handleDownlinkMessage(groupDownlink); }
+
+// Every addressed node in the mask, the other one queued for unicast
+bool checkGroupHeld() {
+  const NodeInfo& held = nodeList[nodeCount - 1];
+  if (held.shortAddr != NO_SHORT_ADDR) return false;
+  prepGroupHeld();
+  opGroupHeld();
+  bool unicast = false;
+  for (int i = 0; i < MAX_PENDING; i++) unicast |= cmdQueue[i].active && strcmp(cmdQueue[i].nodeId, held.nodeId) == 0;
+  return unicast && groupCmd.active && maskCount(groupCmd.pending) == nodeCount - 1;
+}
+
+// Uplink task, offline: build the message, encode, store in the outbox
+UplinkEvent ackEvent;
+void prepPublish() { clearOutbox(); }
+void opPublishAck() { publishAckEvent(ackEvent); }
+// Per-node status topic; with batching on, publishNodeStatus() only queues
+void prepStatus() {
+  clearOutbox();
+  STATUS_BATCH_ENABLED = false;
+  STATUS_PER_NODE_TOPICS = true;
+}
+void opPublishStatus() { publishNodeStatus(nodeIds[3].c_str(), true, false, 19, 42, -97, 6); }
+// A full batch, queued without reaching the size that flushes it
+void prepBatch() {
+  clearOutbox();
+  STATUS_BATCH_ENABLED = true;
+  STATUS_PER_NODE_TOPICS = false;
+  STATUS_BATCH_SIZE = STATUS_BATCH_MAX + 1;
+  for (int i = 0; i < STATUS_BATCH_MAX; i++) queueNodeStatus(nodeIds[i].c_str(), true, false, 19, 42, -97, 6);
+  STATUS_BATCH_SIZE = STATUS_BATCH_MAX;
+}
+void opBatch() { flushStatusBatch(); }
+
+// One message per backend message type, as sent in each encoding: the
+// control command as the backend would send it, the rest as the
+// uplink cases above leave them in the outbox
+struct WireSample {
+  const char* name;
+  void (*prep)();
+  void (*publish)();
+  std::string json, msgpack;
+};
+WireSample WIRE[] = {
+  {"control",      nullptr,     nullptr,         "", ""},
+  {"ack_event",    prepPublish, opPublishAck,    "", ""},
+  {"node_status",  prepStatus,  opPublishStatus, "", ""},
+  {"status_batch", prepBatch,   opBatch,         "", ""},
+};
+enum { WIRE_CONTROL, WIRE_ACK, WIRE_STATUS, WIRE_BATCH };
+
+// Payload of the first record in the RAM outbox
+std::string outboxPayload() {
+  OutboxHdr h;
+  memcpy(&h, outboxRam, sizeof(h));
+  return std::string((const char*)outboxRam + sizeof(h) + h.topicLen, h.payloadLen);
+}
+
+void setupWire() {
+  StaticJsonDocument<256> doc;
+  deserializeJson(doc, controlMsg);
+  WIRE[WIRE_CONTROL].json = controlMsg;
+  serializeMsgPack(doc, WIRE[WIRE_CONTROL].msgpack);
+  for (WireSample& w : WIRE) {
+    if (!w.publish) continue;
+    for (WireEncoding enc : {ENC_JSON, ENC_MSGPACK}) {
+      WIRE_ENCODING = enc;
+      w.prep();
+      w.publish();
+      (enc == ENC_JSON ? w.json : w.msgpack) = obRamCount == 1 ? outboxPayload() : "";
+    }
+  }
+  WIRE_ENCODING = ENC_JSON;
+  clearOutbox();
+}
+
+void prepDownlinkJson() { prepDownlink(WIRE[WIRE_CONTROL].json); }
+void prepDownlinkMsgPack() { prepDownlink(WIRE[WIRE_CONTROL].msgpack); }
+
+void prepPublishJson() { WIRE_ENCODING = ENC_JSON; prepPublish(); }
+void prepPublishMsgPack() { WIRE_ENCODING = ENC_MSGPACK; prepPublish(); }
+void prepStatusJson() { WIRE_ENCODING = ENC_JSON; prepStatus(); }
+void prepStatusMsgPack() { WIRE_ENCODING = ENC_MSGPACK; prepStatus(); }
+void prepBatchJson() { WIRE_ENCODING = ENC_JSON; prepBatch(); }
+void prepBatchMsgPack() { WIRE_ENCODING = ENC_MSGPACK; prepBatch(); }
+
+// Plain decode of a sent message, as the backend's first step
+StaticJsonDocument<4096> decodeTarget;
+template <int W, bool MSGPACK> void opDecode() {
+  const std::string& p = MSGPACK ? WIRE[W].msgpack : WIRE[W].json;
+  decodeDoc(decodeTarget, (const byte*)p.data(), (unsigned)p.size());
+}
+
+// A codec that quietly decodes nothing would time a no-op
+bool checkWire() {
+  for (const std::string* p : {&WIRE[WIRE_CONTROL].json, &WIRE[WIRE_CONTROL].msgpack}) {
+    prepDownlink(*p);
+    opDownlink();
+    bool queued = false;
+    for (int i = 0; i < MAX_PENDING; i++) queued |= cmdQueue[i].active && strcmp(cmdQueue[i].nodeId, nodeIds[0].c_str()) == 0;
+    if (!queued) return false;
+  }
+  for (const WireSample& w : WIRE) {
+    for (const std::string* p : {&w.json, &w.msgpack}) {
+      if (p->empty() || decodeDoc(decodeTarget, (const byte*)p->data(), (unsigned)p->size())) return false;
+    }
+  }
+  return true;
+}
+
+const Case CASES[] = {
+  {"timer.empty",                  nullptr,             noop},
+  {"lora.rx.status_long",          prepRx,              opRxLong},
+  {"lora.rx.status_short",         prepRx,              opRxShort},
+  {"lora.rx.ack_stale",            prepRx,              opRxAckStale},
+  {"lora.rx.v2_status_long",       prepRx,              opRxV2Long},
+  {"lora.rx.v2_status_short",      prepRx,              opRxV2Short},
+  {"cmd.enqueue.full",             prepEnqueueFull,     opEnqueueFull},
+  {"cmd.ack.full",                 prepAckFull,         opAckFull},
+  {"index.find.50",                prepIndex50,         opIndexFind50},
+  {"index.find.500",               prepIndex500,        opIndexFind500},
+  {"index.find.5000",              prepIndex5000,       opIndexFind5000},
+  {"index.scan.50",                prepIndex50,         opIndexScan50},
+  {"index.scan.500",               prepIndex500,        opIndexScan500},
+  {"index.scan.5000",              prepIndex5000,       opIndexScan5000},
+  {"ring.uplink.push_pop",         nullptr,             opUplinkRing},
+  {"prof.lap",                     nullptr,             opProfLap},
+  {"mqtt.on_message",              prepOnMessage,       opOnMessage},
+  {"json.downlink.control",        prepDownlinkJson,    opDownlink},
+  {"msgpack.downlink.control",     prepDownlinkMsgPack, opDownlink},
+  {"json.downlink.group_held",     prepGroupHeld,       opGroupHeld},
+  {"json.uplink.ack_event",        prepPublishJson,     opPublishAck},
+  {"msgpack.uplink.ack_event",     prepPublishMsgPack,  opPublishAck},
+  {"json.uplink.node_status",      prepStatusJson,      opPublishStatus},
+  {"msgpack.uplink.node_status",   prepStatusMsgPack,   opPublishStatus},
+  {"json.uplink.status_batch",     prepBatchJson,       opBatch},
+  {"msgpack.uplink.status_batch",  prepBatchMsgPack,    opBatch},
+  {"json.decode.control",          nullptr,             opDecode<WIRE_CONTROL, false>},
+  {"msgpack.decode.control",       nullptr,             opDecode<WIRE_CONTROL, true>},
+  {"json.decode.ack_event",        nullptr,             opDecode<WIRE_ACK, false>},
+  {"msgpack.decode.ack_event",     nullptr,             opDecode<WIRE_ACK, true>},
+  {"json.decode.node_status",      nullptr,             opDecode<WIRE_STATUS, false>},
+  {"msgpack.decode.node_status",   nullptr,             opDecode<WIRE_STATUS, true>},
+  {"json.decode.status_batch",     nullptr,             opDecode<WIRE_BATCH, false>},
+  {"msgpack.decode.status_batch",  nullptr,             opDecode<WIRE_BATCH, true>},
+};
+
+/* ------------------------ OUTPUT ------------------------ */
+void printText(const std::vector<Result>& rs) {
+  printf("gateway-bench %s, %s\n", BENCH_FW_VERSION, __VERSION__);
+  printf("%-28s %9s %9s %9s %9s %9s\n", "case", "min_ns", "median_ns", "p90_ns", "p99_ns", "mean_ns");
+  for (const Result& r : rs) {
+    printf("%-28s %9.0f %9.0f %9.0f %9.0f %9.0f\n", r.name, r.minNs, r.medianNs, r.p90Ns, r.p99Ns, r.meanNs);
+  }
+  printf("\n%-28s %9s %9s %9s\n", "message", "json_B", "msgpack_B", "saved");
+  for (const WireSample& w : WIRE) {
+    double saved = 100.0 * ((double)w.json.size() - (double)w.msgpack.size()) / (double)w.json.size();
+    printf("%-28s %9zu %9zu %8.1f%%\n", w.name, w.json.size(), w.msgpack.size(), saved);
+  }
+}
+
+// One case per line, so --baseline (and grep/diff) can read it back
+void printJson(const std::vector<Result>& rs) {
+  printf("{\"suite\":\"gateway-bench\",\"firmware\":\"%s\",\"compiler\":\"%s\",\"timerNs\":%.1f,\"results\":[\n",
+         BENCH_FW_VERSION, __VERSION__, timerNs);
+  for (size_t i = 0; i < rs.size(); i++) {
+    const Result& r = rs[i];
+    const char* sep = i + 1 < rs.size() ? "," : "";
+    printf("{\"name\":\"%s\",\"samples\":%u,\"minNs\":%.1f,\"medianNs\":%.1f,\"p90Ns\":%.1f,\"p99Ns\":%.1f,"
+           "\"meanNs\":%.1f}%s\n",
+           r.name, r.samples, r.minNs, r.medianNs, r.p90Ns, r.p99Ns, r.meanNs, sep);
+  }
+  printf("],\"sizes\":[\n");
+  size_t n = sizeof(WIRE) / sizeof(WIRE[0]);
+  for (size_t i = 0; i < n; i++) {
+    printf("{\"message\":\"%s\",\"jsonBytes\":%zu,\"msgpackBytes\":%zu}%s\n",
+           WIRE[i].name, WIRE[i].json.size(), WIRE[i].msgpack.size(), i + 1 < n ? "," : "");
+  }
+  printf("]}\n");
+}
+
+// Median of each case against a file written by --json; true if none regressed
+bool compareBaseline(const char* path, const std::vector<Result>& rs, double thresholdPct) {
+  FILE* f = fopen(path, "r");
+  if (!f) {
+    fprintf(stderr, "cannot read %s\n", path);
+    return false;
+  }
+  std::map<std::string, double> base;
+  char line[512];
+  while (fgets(line, sizeof(line), f)) {
+    char name[64];
+    const char* m = strstr(line, "\"medianNs\":");
+    if (sscanf(line, "{\"name\":\"%63[^\"]\"", name) == 1 && m) base[name] = atof(m + 11);
+  }
+  fclose(f);
+
+  bool ok = true;
+  fprintf(stderr, "%-28s %11s %11s %8s\n", "case", "base_ns", "now_ns", "change");
+  for (const Result& r : rs) {
+    auto b = base.find(r.name);
+    if (b == base.end() || !strcmp(r.name, "timer.empty")) continue;
+    double pct = b->second > 0 ? (r.medianNs - b->second) * 100 / b->second : 0;
+    bool slower = pct > thresholdPct && r.medianNs - b->second > 5;  // ignore sub-timer noise
+    if (slower) ok = false;
+    fprintf(stderr, "%-28s %11.0f %11.0f %+7.1f%%%s\n", r.name, b->second, r.medianNs, pct, slower ? "  SLOWER" : "");
+  }
+  return ok;
+}
+
+void usage() {
+  printf("usage: gateway-bench [--json] [--samples N] [--rounds N] [--filter SUBSTR] [--baseline FILE] [--threshold PCT]\n");
+}
+
+int main(int argc, char** argv) {
+  bool json = false;
+  uint32_t samples = SAMPLES_DEFAULT;
+  uint32_t rounds = ROUNDS_DEFAULT;
+  const char* filter = nullptr;
+  const char* baseline = nullptr;
+  double threshold = 15;
+  for (int i = 1; i < argc; i++) {
+    const char* a = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (!strcmp(a, "--json")) json = true;
+    else if (!strcmp(a, "--samples") && hasValue) samples = (uint32_t)atoi(argv[++i]);
+    else if (!strcmp(a, "--rounds") && hasValue) rounds = (uint32_t)atoi(argv[++i]);
+    else if (!strcmp(a, "--filter") && hasValue) filter = argv[++i];
+    else if (!strcmp(a, "--baseline") && hasValue) baseline = argv[++i];
+    else if (!strcmp(a, "--threshold") && hasValue) threshold = atof(argv[++i]);
+    else { usage(); return 2; }
+  }
+  if (samples < 100) samples = 100;
+  if (rounds < 1) rounds = 1;
+
+  setupGateway();
+  setupFrames();
+  index50.build();
+  index500.build();
+  index5000.build();
+  ringEvent.kind = EVT_ACK;
+  ackEvent.kind = EVT_ACK;
+  ackEvent.cmdId = 4711;
+  ackEvent.success = true;
+  ackEvent.rttMs = 412;
+  ackEvent.srttMs = 398;
+  ackEvent.rtoMs = 1200;
+  strncpy(ackEvent.nodeId, nodeIds[2].c_str(), sizeof(ackEvent.nodeId) - 1);
+  setupWire();
+  if (!checkWire()) {
+    fprintf(stderr, "wire samples do not decode; check the ArduinoJson shim\n");
+    return 1;
+  }
+  if (!checkGroupHeld()) {
+    fprintf(stderr, "group command mishandled a node without a short address\n");
+    return 1;
+  }
+  fillCommandQueue(0);
+
+  timerNs = 0;
+  std::vector<double> t = sample(CASES[0], samples);
+  timerNs = t[t.size() / 2];
+
+  std::vector<Result> results;
+  for (const Case& c : CASES) {
+    if (filter && !strstr(c.name, filter)) continue;
+    results.push_back(measure(c, samples, rounds));
+  }
+
+  if (json) printJson(results);
+  else printText(results);
+  if (baseline && !compareBaseline(baseline, results, threshold)) return 1;
+  return 0;
+}
@@ -0,0 +1,56 @@
+/* ===========================================================
+   HOST FIXTURE: provisioned gateway
+   The bootstrap config as the backend would send it, written
+   straight into the binary image (the JSON import path needs
+   ArduinoJson). Included after gateway.cpp, in the same scope.
+   =========================================================== */
+#pragma once
+
+// Gateway "gw-sim" with default radio settings; one record per node (up to
+// MAX_NODES), schedule 18:00-06:00, config version 1
+void provisionConfigImage(const std::vector<std::string>& nodeIds, uint16_t dutyPermille) {
+  CfgGatewayRec g;
+  memset(&g, 0, sizeof(g));
+  copyField(g.gatewayId, sizeof(g.gatewayId), "gw-sim");
+  copyField(g.apn, sizeof(g.apn), DEFAULT_APN);
+  copyField(g.broker, sizeof(g.broker), DEFAULT_BROKER);
+  g.port = DEFAULT_PORT;
+  g.configVersion = 1;
+  g.encoding = ENC_JSON;
+  g.statusBatch = true;
+  g.batchWindowMs = 5000;
+  g.batchSize = STATUS_BATCH_MAX;
+  g.loraFreq = DEFAULT_LORA_FREQ;
+  g.loraSf = DEFAULT_LORA_SF;
+  g.loraBw = DEFAULT_LORA_BW;
+  g.loraCr = DEFAULT_LORA_CR;
+  g.dutyPermille = dutyPermille;
+
+  uint32_t count = (uint32_t)std::min(nodeIds.size(), (size_t)MAX_NODES);
+  CfgImageHeader h;
+  cfgImageSeal(h, g, count);
+  File f = SPIFFS.open(CONFIG_IMAGE_PATH, FILE_WRITE);
+  f.write((const uint8_t*)&h, sizeof(h));
+  f.write((const uint8_t*)&g, sizeof(g));
+  for (uint32_t i = 0; i < count; i++) {
+    CfgNodeRec r;
+    memset(&r, 0, sizeof(r));
+    copyField(r.nodeId, sizeof(r.nodeId), nodeIds[i].c_str());
+    r.onHour = 18;
+    r.offHour = 6;
+    r.configVersion = 1;
+    r.regIntervalMs = 30000;
+    r.statusIntervalMs = 60000;
+    cfgNodeSeal(r);
+    f.write((const uint8_t*)&r, sizeof(r));
+  }
+  f.close();
+}
+
+// Warm start: every node already runs the config in the image
+void markConfigApplied() {
+  for (size_t i = 0; i < nodeCount; i++) {
+    nodeList[i].appliedVersion = nodeList[i].configVersion;
+    nodeList[i].versionKnown = true;
+  }
+}
@@ -0,0 +1,80 @@
+/* ===========================================================
+   LORA NETWORK SIMULATOR — gateway unit
+   gateway.cpp compiled unmodified against sim/shim/, wrapped in
+   its own namespace, plus the entry points lora-sim.cpp uses.
+   The radio task runs as radioStep(); the uplink task (modem,
+   MQTT) is not run, its event queue is read directly.
+   =========================================================== */
+#include "lora-sim.h"
+
+#define SIM_STRING_CAP 160
+#define SIM_PREFS_CAP  160   // "saddr" + "cfgver" per node
+
+namespace simgw {
+#include "../gateway.cpp"
+
+HardwareSerial Serial(0);
+EspClass ESP;
+LoRaClass LoRa;
+FSImpl SPIFFS;
+
+#include "gw-provision.h"
+}  // namespace simgw
+
+using namespace simgw;
+
+void simGwProvision(const std::vector<std::string>& nodeIds, uint16_t dutyPermille) {
+  provisionConfigImage(nodeIds, dutyPermille);
+}
+
+void simGwSetup() { setup(); }
+void simGwMarkConfigApplied() { markConfigApplied(); }
+
+uint16_t simGwShortAddr(const char* nodeId) {
+  int i = findNodeIndex(nodeId);
+  return i >= 0 ? nodeList[i].shortAddr : NO_SHORT_ADDR;
+}
+
+void simGwStep() { radioStep(); }
+
+bool simGwCommand(uint16_t cmdId, const char* nodeId, bool lightOn) {
+  return enqueueCommand(cmdId, nodeId, lightOn);
+}
+
+void simGwGroupCommand(uint16_t cmdId, bool lightOn, const std::vector<std::string>& nodeIds) {
+  beginGroupCommand(cmdId, lightOn);
+  for (const std::string& id : nodeIds) addGroupTarget(id.c_str());
+  commitGroupCommand();
+}
+
+int simGwMaxNodes() { return MAX_NODES; }
+
+int simGwQueueFree() {
+  int n = 0;
+  for (int i = 0; i < MAX_PENDING; i++) if (!cmdQueue[i].active) n++;
+  return n;
+}
+
+bool simGwPollEvent(SimGwEvent& out) {
+  UplinkEvent* e = uplinkQueue.peek();
+  if (!e) return false;
+  memset(&out, 0, sizeof(out));
+  out.kind = e->kind == EVT_ACK ? SIM_EVT_ACK : (e->kind == EVT_NODE_STATUS ? SIM_EVT_STATUS : SIM_EVT_OTHER);
+  memcpy(out.nodeId, e->nodeId, sizeof(out.nodeId));
+  out.cmdId = e->cmdId;
+  out.success = e->success;
+  out.outcome = e->outcome;
+  uplinkQueue.pop();
+  return true;
+}
+
+SimGwCounters simGwCounters() {
+  SimGwCounters c;
+  c.txDeferred = txDeferred;
+  c.txDrops = txDrops;
+  c.ackTimeouts = ackTimeouts;
+  c.coalesced = coalescedCmds;
+  c.rxOverruns = rxOverruns;
+  c.txAirtimeMs = txAirtimeMs;
+  return c;
+}
@@ -0,0 +1,52 @@
+/* ===========================================================
+   LORA NETWORK SIMULATOR — node unit
+   node.cpp compiled unmodified against sim/shim/, wrapped in
+   its own namespace. There is one copy of its globals; after
+   compiling, this object's .data/.bss are renamed so the linker
+   keeps them in one region (simnode_data / simnode_bss), and
+   lora-sim.cpp swaps a per-node snapshot of that region in
+   before running a node. See lora-sim.cpp for the build line.
+   =========================================================== */
+#include "lora-sim.h"
+
+#define SIM_STRING_CAP 32
+#define SIM_PREFS_CAP  8
+
+namespace simnode {
+#include "../node.cpp"
+
+HardwareSerial Serial(0);
+EspClass ESP;
+LoRaClass LoRa;
+}  // namespace simnode
+
+using namespace simnode;
+
+// NVS as a provisioned node would have it
+void simNodeSeed(bool isConfigured, uint16_t addr, const char* gatewayId) {
+  preferences.begin("nodecfg", false);
+  preferences.putBool("configured", isConfigured);
+  preferences.putString("gw", gatewayId);
+  preferences.putUShort("saddr", addr);
+  preferences.putInt("mode", AUTO);
+  preferences.putBool("lightState", false);
+  preferences.end();
+}
+
+void simNodeSetup() { setup(); }
+void simNodeLoop() { loop(); }
+bool simNodeLight() { return lightState; }
+
+static bool inRegion(const void* p, size_t n) {
+  const char* c = (const char*)p;
+  return (c >= __start_simnode_data && c + n <= __stop_simnode_data) ||
+         (c >= __start_simnode_bss && c + n <= __stop_simnode_bss);
+}
+
+bool simNodeRegionCheck() {
+  return inRegion(&preferences, sizeof(preferences)) && inRegion(&NODE_ID, sizeof(NODE_ID)) &&
+         inRegion(&lightState, sizeof(lightState)) && inRegion(&controlMode, sizeof(controlMode)) &&
+         inRegion(&txQueue, sizeof(txQueue)) && inRegion(&rxRing, sizeof(rxRing)) &&
+         inRegion(&lastBeacon, sizeof(lastBeacon)) && inRegion(&loraSf, sizeof(loraSf)) &&
+         inRegion(&REGISTER_INTERVAL, sizeof(REGISTER_INTERVAL)) && inRegion(&LoRa, sizeof(LoRa));
+}
@@ -0,0 +1,709 @@
+/* ===========================================================
+   LORA NETWORK SIMULATOR (host)
+   Discrete-event simulation of one gateway and N nodes running
+   the real gateway.cpp / node.cpp protocol code (compiled
+   against the fakes in sim/shim/) over a modelled channel:
+
+   - airtime from SF/BW/CR (same formula as the gateway)
+   - log-distance path loss with per-link shadowing, per-frame
+     fading, SNR demodulation floor per SF
+   - collisions between overlapping same-SF frames, with capture
+     when the wanted frame is CAPTURE_DB stronger
+   - half duplex: a radio only receives frames whose preamble
+     it was listening for
+   - optional extra random loss per link (--loss)
+
+   Nodes run loop() every 10 ms of virtual time (their delay(10)),
+   the gateway its radio task every 5 ms, or GW_WAKE_US after its
+   DIO0 interrupt notifies the task. The backend is ideal:
+   commands reach the gateway queue as soon as it has room, and
+   ACKs are read off the gateway's uplink event queue, so the
+   MQTT/GPRS leg is not in the latencies.
+
+   One copy of node.cpp's globals exists; each node keeps a
+   snapshot and it is swapped in before that node runs (see
+   lora-sim-node.cpp), hence the objcopy step.
+
+   Build & run (from the repo root):
+     g++ -std=gnu++17 -O2 -Ibackend/sim/shim -c backend/sim/lora-sim-node.cpp -o lora-sim-node.o
+     objcopy --rename-section .data=simnode_data --rename-section .data.rel.local=simnode_data \
+             --rename-section .bss=simnode_bss lora-sim-node.o
+     g++ -std=gnu++17 -O2 -Ibackend/sim/shim -o lora-sim backend/sim/lora-sim.cpp \
+         backend/sim/lora-sim-gw.cpp lora-sim-node.o
+     ./lora-sim --scenario dusk --nodes 50
+     ./lora-sim --help
+   =========================================================== */
+
+#include "lora-sim.h"
+
+#include <chrono>
+#include <deque>
+#include <queue>
+#include <random>
+
+/* ------------------------ MODEL ------------------------ */
+#define GW_STEP_US        5000ULL     // gateway RADIO_TASK_PERIOD_MS
+#define GW_WAKE_US        50ULL       // ISR notify to radio task running
+#define MIN_LOOP_US       1000ULL
+#define BOOT_SPREAD_US    2000000ULL  // nodes power up within this window
+#define PATHLOSS_1M_DB    25.2        // free space at 1 m, 433 MHz
+#define PATHLOSS_EXP      2.9         // urban, poles at similar height
+#define SHADOW_SIGMA_DB   6.0         // per link, fixed for the run
+#define FADING_SIGMA_DB   3.0         // per frame
+#define NOISE_FIGURE_DB   6.0
+#define CAPTURE_DB        6.0
+#define MIN_DISTANCE_M    20.0
+#define FRAME_KEEP_US     6000000ULL  // longer than any frame: overlap checks
+#define DEFAULT_TX_POWER  17
+
+/* ------------------------ OPTIONS ------------------------ */
+struct Options {
+  const char* scenario = "dusk";
+  int nodes = 50;
+  double hours = -1;       // after warm-up; default per scenario
+  double warmupS = 90;
+  double radiusM = 1500;
+  double lossPct = 0;
+  double ratePerMin = 2;   // steady: operator commands per minute
+  bool unicast = false;    // dusk: one command per node instead of a group frame
+  uint16_t dutyPermille = 100;
+  uint32_t clockStartS = 17 * 3600;
+  uint64_t seed = 1;
+  bool verbose = false;
+};
+
+Options opt;
+
+/* ------------------------ STATE ------------------------ */
+struct Radio {
+  double x = 0, y = 0;
+  uint64_t chipId = 0;
+  long freq = 433000000;
+  int sf = 7;
+  long bw = 125000;
+  int cr = 5;
+  int power = DEFAULT_TX_POWER;
+  int mode = SIM_MODE_IDLE;
+  uint64_t rxSince = 0;       // listening without a break since
+  void (*onRx)(int) = nullptr;
+  void (*onTxDone)() = nullptr;
+  void (*onIrq)() = nullptr;  // DIO0 interrupt, instead of the two above
+  bool rxUnread = false;      // frame in the FIFO not yet taken by parsePacket()
+  uint8_t rx[64];
+  int rxLen = 0, rxPos = 0;
+  int rssi = 0;
+  float snr = 0;
+  double gwLoss = 0;          // path loss to the gateway (dB)
+  std::vector<char> image;    // node: swapped-out globals
+};
+
+struct Frame {
+  uint64_t id;
+  int src;
+  uint64_t start, end;
+  long freq, bw;
+  int sf, power;
+  uint8_t len;
+  uint8_t data[64];
+};
+
+enum EvKind { EV_GW_STEP, EV_NODE_BOOT, EV_NODE_LOOP, EV_TX_END, EV_OPERATOR };
+
+struct Event {
+  uint64_t t;
+  uint64_t seq;
+  int kind;
+  uint64_t arg;
+  bool operator>(const Event& o) const { return t != o.t ? t > o.t : seq > o.seq; }
+};
+
+std::vector<Radio> radios;                   // 0 = gateway, 1..N nodes
+std::vector<std::string> nodeIds;            // index i = radio i + 1
+std::map<std::string, int> radioOf;
+std::deque<Frame> frames;
+uint64_t frameBase = 0;                      // id of frames.front()
+std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+uint64_t eventSeq = 0;
+std::mt19937_64 rng;
+
+uint64_t curUs = 0;     // time of the event being handled
+uint64_t delayUs = 0;   // delay()s of the running call
+int running = 0;        // radio whose code runs
+uint64_t gwStepGen = 0; // EV_GW_STEP events of older generations are stale
+int resident = -1;      // node whose globals are in the region
+bool logLineStart = true;
+
+/* ------------------------ STATS ------------------------ */
+struct LinkStats {
+  uint64_t attempts = 0, delivered = 0;
+  uint64_t notListening = 0, params = 0, weak = 0, collision = 0, random = 0;
+};
+
+struct Cmd {
+  uint16_t cmdId;
+  int radio;
+  bool on;
+  uint64_t issuedUs;
+  uint64_t ackUs = 0;
+  int outcome = -1;   // -1 open, 0 acked, 1 superseded, 2 unchanged
+};
+
+LinkStats uplink, downlink;
+LinkStats acks;                              // node ACK frames, a subset of uplink
+uint64_t gwAirUs = 0, nodeAirUs = 0;
+uint64_t statusSent = 0, statusDelivered = 0;
+uint64_t measureFromUs = 0;
+std::vector<Cmd> cmds;
+std::map<std::pair<int, uint16_t>, size_t> cmdIndex;
+std::deque<size_t> backendQueue;             // unicast commands waiting for gateway queue space
+uint16_t nextCmdId = 1;
+
+/* ------------------------ CORE API ------------------------ */
+uint64_t simNowUs() { return curUs + delayUs; }
+void simDelayMs(unsigned long ms) { delayUs += (uint64_t)ms * 1000; }
+uint32_t simWallClockS() { return (uint32_t)((opt.clockStartS + simNowUs() / 1000000) % 86400); }
+uint64_t simChipId() { return radios[running].chipId; }
+
+long simRandom(long lo, long hi) {
+  if (hi <= lo) return lo;
+  return lo + (long)(rng() % (uint64_t)(hi - lo));
+}
+
+void simLogText(const char* s, size_t n) {
+  if (!opt.verbose) return;
+  for (const char* end = s + n; s < end;) {
+    if (logLineStart) {
+      if (running == 0) printf("%12.3f gw     ", simNowUs() / 1e6);
+      else printf("%12.3f n%-5d ", simNowUs() / 1e6, running);
+      logLineStart = false;
+    }
+    const char* nl = (const char*)memchr(s, '\n', end - s);
+    size_t k = nl ? (size_t)(nl - s + 1) : (size_t)(end - s);
+    fwrite(s, 1, k, stdout);
+    if (nl) logLineStart = true;
+    s += k;
+  }
+}
+
+void simLog(const char* fmt, va_list ap) {
+  if (!opt.verbose) return;
+  char buf[512];
+  int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+  if (n > 0) simLogText(buf, std::min((size_t)n, sizeof(buf) - 1));
+}
+
+Radio& cur() { return radios[running]; }
+
+void schedule(uint64_t t, int kind, uint64_t arg = 0) { events.push(Event{t, eventSeq++, kind, arg}); }
+
+// Same formula as gateway.cpp airtimeUs(): explicit header, CRC on,
+// 8-symbol preamble, low data rate optimisation from 16 ms symbols
+uint64_t airtimeUs(size_t len, int sf, long bw, int cr) {
+  double tsym = (double)(1 << sf) * 1e6 / bw;
+  int de = tsym >= 16000 ? 1 : 0;
+  double num = 8.0 * len - 4.0 * sf + 28 + 16;
+  double n = std::ceil(num / (4.0 * (sf - 2 * de)));
+  double payload = 8 + std::max(n * cr, 0.0);
+  return (uint64_t)((8 + 4.25 + payload) * tsym);
+}
+
+void simRadioSet(int param, long v) {
+  Radio& r = cur();
+  switch (param) {
+    case SIM_FREQ:  r.freq = v; break;
+    case SIM_SF:    r.sf = (int)v; break;
+    case SIM_BW:    r.bw = v; break;
+    case SIM_CR:    r.cr = (int)v; break;
+    case SIM_POWER: r.power = (int)v; break;
+  }
+  if (r.mode == SIM_MODE_RX) r.rxSince = simNowUs();  // retune drops a reception in progress
+}
+
+void simRadioMode(int mode) {
+  Radio& r = cur();
+  if (r.mode == SIM_MODE_TX) return;  // busy until TxDone
+  if (mode == SIM_MODE_RX && r.mode != SIM_MODE_RX) r.rxSince = simNowUs();
+  r.mode = mode;
+}
+
+bool simRadioTx(const uint8_t* data, size_t len) {
+  Radio& r = cur();
+  if (r.mode == SIM_MODE_TX || len == 0 || len > sizeof(Frame::data)) return false;
+  Frame f;
+  f.id = frameBase + frames.size();
+  f.src = running;
+  f.start = simNowUs();
+  f.end = f.start + airtimeUs(len, r.sf, r.bw, r.cr);
+  f.freq = r.freq;
+  f.bw = r.bw;
+  f.sf = r.sf;
+  f.power = r.power;
+  f.len = (uint8_t)len;
+  memcpy(f.data, data, len);
+  frames.push_back(f);
+  r.mode = SIM_MODE_TX;
+  schedule(f.end, EV_TX_END, f.id);
+
+  if (f.start >= measureFromUs) {
+    if (running == 0) gwAirUs += f.end - f.start;
+    else nodeAirUs += f.end - f.start;
+    if (running != 0 && (data[0] == 0x05 || data[0] == 0x15 || data[0] == 0x45 || data[0] == 0x55)) statusSent++;
+  }
+  return true;
+}
+
+void simRadioCallbacks(void (*onRx)(int), void (*onTxDone)()) {
+  cur().onRx = onRx;
+  cur().onTxDone = onTxDone;
+}
+
+void simRadioIrq(void (*isr)()) { cur().onIrq = isr; }
+
+// The library goes idle once it has a frame; the caller re-arms RX
+int simRadioParse() {
+  Radio& r = cur();
+  if (!r.rxUnread) return 0;
+  r.rxUnread = false;
+  r.rxPos = 0;
+  if (r.mode == SIM_MODE_RX) r.mode = SIM_MODE_IDLE;
+  return r.rxLen;
+}
+
+// The notified task runs next; its periodic wait starts over from there
+void simWakeTask() {
+  if (running != 0) return;
+  schedule(simNowUs() + GW_WAKE_US, EV_GW_STEP, ++gwStepGen);
+}
+
+int simRadioAvailable() { return cur().rxLen - cur().rxPos; }
+int simRadioRead() { return simRadioAvailable() > 0 ? cur().rx[cur().rxPos++] : -1; }
+int simRadioRssi() { return cur().rssi; }
+float simRadioSnr() { return cur().snr; }
+
+/* ------------------------ NODE CONTEXTS ------------------------ */
+size_t dataSize() { return __stop_simnode_data - __start_simnode_data; }
+size_t bssSize() { return __stop_simnode_bss - __start_simnode_bss; }
+
+void saveNode(int id) {
+  std::vector<char>& img = radios[id].image;
+  memcpy(img.data(), __start_simnode_data, dataSize());
+  memcpy(img.data() + dataSize(), __start_simnode_bss, bssSize());
+}
+
+void loadNode(int id) {
+  const std::vector<char>& img = radios[id].image;
+  memcpy(__start_simnode_data, img.data(), dataSize());
+  memcpy(__start_simnode_bss, img.data() + dataSize(), bssSize());
+}
+
+// Makes radio id the running one at time t
+void enter(int id, uint64_t t) {
+  if (id != 0 && resident != id) {
+    if (resident > 0) saveNode(resident);
+    loadNode(id);
+    resident = id;
+  }
+  running = id;
+  curUs = t;
+  delayUs = 0;
+}
+
+/* ------------------------ CHANNEL ------------------------ */
+uint64_t mix(uint64_t x) {
+  x += 0x9E3779B97F4A7C15ULL;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+// Deterministic per unordered pair
+double linkUniform(int a, int b, uint64_t salt) {
+  if (a > b) std::swap(a, b);
+  return (mix(opt.seed ^ mix(((uint64_t)a << 32 | (uint32_t)b) ^ salt)) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+double linkLoss(int a, int b) {
+  double d = std::max(std::hypot(radios[a].x - radios[b].x, radios[a].y - radios[b].y), MIN_DISTANCE_M);
+  double u1 = std::max(linkUniform(a, b, 1), 1e-12), u2 = linkUniform(a, b, 2);
+  double shadow = SHADOW_SIGMA_DB * std::sqrt(-2 * std::log(u1)) * std::cos(2 * M_PI * u2);
+  return PATHLOSS_1M_DB + 10 * PATHLOSS_EXP * std::log10(d) + shadow;
+}
+
+double pathLoss(int a, int b) {
+  if (a == 0) return radios[b].gwLoss;
+  if (b == 0) return radios[a].gwLoss;
+  return linkLoss(a, b);
+}
+
+double noiseFloor(long bw) { return -174 + 10 * std::log10((double)bw) + NOISE_FIGURE_DB; }
+double demodSnr(int sf) { return -7.5 - 2.5 * (sf - 7); }
+
+void receive(const Frame& f, int rid, LinkStats& st) {
+  Radio& r = radios[rid];
+  st.attempts++;
+  if (r.mode != SIM_MODE_RX || r.rxSince > f.start) { st.notListening++; return; }
+  if (r.freq != f.freq || r.sf != f.sf || r.bw != f.bw) { st.params++; return; }
+
+  double mean = f.power - pathLoss(f.src, rid);
+  double rssi = mean + std::normal_distribution<double>(0, FADING_SIGMA_DB)(rng);
+  double snr = rssi - noiseFloor(f.bw);
+  if (snr < demodSnr(f.sf)) { st.weak++; return; }
+
+  for (const Frame& g : frames) {
+    if (g.id == f.id || g.end <= f.start || g.start >= f.end) continue;
+    if (g.freq != f.freq || g.sf != f.sf || g.src == rid) continue;
+    if (mean - (g.power - pathLoss(g.src, rid)) < CAPTURE_DB) { st.collision++; return; }
+  }
+
+  if (opt.lossPct > 0) {
+    double p = opt.lossPct / 100 * (0.5 + linkUniform(f.src, rid, 3));
+    if (std::uniform_real_distribution<double>(0, 1)(rng) < p) { st.random++; return; }
+  }
+
+  st.delivered++;
+  enter(rid, f.end);
+  memcpy(r.rx, f.data, f.len);
+  r.rxLen = f.len;
+  r.rxPos = 0;
+  r.rssi = (int)std::lround(rssi);
+  r.snr = (float)snr;
+  if (r.onIrq) {
+    r.rxUnread = true;  // a second frame before parsePacket() replaces it, as the FIFO would
+    r.onIrq();
+  } else if (r.onRx) {
+    r.onRx(f.len);
+  }
+}
+
+// Unicast (v1 long/short, v2) and group ACKs
+bool isAckFrame(uint8_t type) { return (type & 0x0F) == 0x06 || type == 0x0A; }
+
+void addLink(LinkStats& to, const LinkStats& d) {
+  to.attempts += d.attempts;
+  to.delivered += d.delivered;
+  to.notListening += d.notListening;
+  to.params += d.params;
+  to.weak += d.weak;
+  to.collision += d.collision;
+  to.random += d.random;
+}
+
+void txEnd(uint64_t id) {
+  const Frame f = frames[id - frameBase];
+  enter(f.src, f.end);
+  radios[f.src].mode = SIM_MODE_IDLE;
+  if (radios[f.src].onIrq) radios[f.src].onIrq();
+  else if (radios[f.src].onTxDone) radios[f.src].onTxDone();
+
+  bool measured = f.start >= measureFromUs;
+  LinkStats scratch;
+  if (f.src == 0) {
+    for (size_t i = 1; i < radios.size(); i++) receive(f, (int)i, measured ? downlink : scratch);
+  } else {
+    LinkStats one;
+    receive(f, 0, one);
+    if (measured) {
+      addLink(uplink, one);
+      if (isAckFrame(f.data[0])) addLink(acks, one);
+    }
+  }
+
+  while (!frames.empty() && frames.front().end + FRAME_KEEP_US < f.end) {
+    frames.pop_front();
+    frameBase++;
+  }
+}
+
+/* ------------------------ BACKEND ------------------------ */
+size_t issue(int radio, uint16_t cmdId, bool on) {
+  Cmd c;
+  c.cmdId = cmdId;
+  c.radio = radio;
+  c.on = on;
+  c.issuedUs = simNowUs();
+  cmds.push_back(c);
+  cmdIndex[{radio, cmdId}] = cmds.size() - 1;
+  return cmds.size() - 1;
+}
+
+void issueUnicast(int radio, bool on) {
+  backendQueue.push_back(issue(radio, nextCmdId++, on));
+}
+
+void issueGroup(const std::vector<int>& members, bool on) {
+  uint16_t cmdId = nextCmdId++;
+  std::vector<std::string> ids;
+  for (int r : members) {
+    issue(r, cmdId, on);
+    ids.push_back(nodeIds[r - 1]);
+  }
+  enter(0, curUs);
+  simGwGroupCommand(cmdId, on, ids);
+}
+
+// Runs in the gateway context right after a radio step
+void serviceBackend() {
+  SimGwEvent e;
+  while (simGwPollEvent(e)) {
+    if (e.kind == SIM_EVT_STATUS) {
+      if (simNowUs() >= measureFromUs) statusDelivered++;
+      continue;
+    }
+    if (e.kind != SIM_EVT_ACK) continue;
+    auto r = radioOf.find(e.nodeId);
+    if (r == radioOf.end()) continue;
+    auto it = cmdIndex.find({r->second, e.cmdId});
+    if (it == cmdIndex.end()) continue;
+    Cmd& c = cmds[it->second];
+    if (c.outcome >= 0) continue;
+    if (e.outcome != 0) c.outcome = e.outcome;
+    else if (e.success) c.outcome = 0;
+    else continue;  // stale ACK
+    c.ackUs = simNowUs();
+  }
+
+  while (!backendQueue.empty() && simGwQueueFree() > 0) {
+    const Cmd& c = cmds[backendQueue.front()];
+    if (!simGwCommand(c.cmdId, nodeIds[c.radio - 1].c_str(), c.on)) break;
+    backendQueue.pop_front();
+  }
+}
+
+/* ------------------------ SETUP ------------------------ */
+void placeNodes() {
+  std::uniform_real_distribution<double> u(0, 1);
+  radios.resize(opt.nodes + 1);
+  for (int i = 1; i <= opt.nodes; i++) {
+    Radio& r = radios[i];
+    double d = std::max(opt.radiusM * std::sqrt(u(rng)), MIN_DISTANCE_M);
+    double a = 2 * M_PI * u(rng);
+    r.x = d * std::cos(a);
+    r.y = d * std::sin(a);
+    r.chipId = 0xA4CF12000000ULL + (uint64_t)i * 0x1F3D;
+  }
+  // The gateway sits at the origin; its links are looked up on every frame
+  for (int i = 1; i <= opt.nodes; i++) radios[i].gwLoss = linkLoss(0, i);
+}
+
+void bootNetwork() {
+  radios[0].chipId = 0x30AEA4000001ULL;
+  for (int i = 1; i <= opt.nodes; i++) {
+    char id[24];
+    snprintf(id, sizeof(id), "node%012llX", (unsigned long long)radios[i].chipId);
+    nodeIds.push_back(id);
+    radioOf[id] = i;
+  }
+
+  enter(0, 0);
+  simGwProvision(nodeIds, opt.dutyPermille);
+  simGwSetup();
+  simGwMarkConfigApplied();
+  schedule(GW_STEP_US, EV_GW_STEP, gwStepGen);
+
+  // Pristine node globals, then each node's NVS as provisioning left it
+  std::vector<char> pristine(dataSize() + bssSize());
+  memcpy(pristine.data(), __start_simnode_data, dataSize());
+  memcpy(pristine.data() + dataSize(), __start_simnode_bss, bssSize());
+  for (int i = 1; i <= opt.nodes; i++) {
+    radios[i].image = pristine;
+    enter(i, 0);
+    uint16_t addr = simGwShortAddr(nodeIds[i - 1].c_str());
+    simNodeSeed(addr != 0, addr, "gw-sim");
+    schedule(std::uniform_int_distribution<uint64_t>(0, BOOT_SPREAD_US)(rng), EV_NODE_BOOT, i);
+  }
+}
+
+/* ------------------------ RUN ------------------------ */
+void scheduleOperator(uint64_t after) {
+  if (opt.ratePerMin <= 0) return;
+  double gapS = std::exponential_distribution<double>(opt.ratePerMin / 60.0)(rng);
+  schedule(after + (uint64_t)(gapS * 1e6), EV_OPERATOR);
+}
+
+void run(uint64_t untilUs) {
+  while (!events.empty() && events.top().t <= untilUs) {
+    Event e = events.top();
+    events.pop();
+    switch (e.kind) {
+      case EV_GW_STEP:
+        if (e.arg != gwStepGen) break;
+        enter(0, e.t);
+        simGwStep();
+        serviceBackend();
+        schedule(e.t + delayUs + GW_STEP_US, EV_GW_STEP, gwStepGen);
+        break;
+      case EV_NODE_BOOT:
+        enter((int)e.arg, e.t);
+        simNodeSetup();
+        schedule(e.t + std::max<uint64_t>(delayUs, MIN_LOOP_US), EV_NODE_LOOP, e.arg);
+        break;
+      case EV_NODE_LOOP:
+        enter((int)e.arg, e.t);
+        simNodeLoop();
+        schedule(e.t + std::max<uint64_t>(delayUs, MIN_LOOP_US), EV_NODE_LOOP, e.arg);
+        break;
+      case EV_TX_END:
+        txEnd(e.arg);
+        break;
+      case EV_OPERATOR: {
+        enter(0, e.t);
+        int r = 1 + (int)(rng() % (uint64_t)opt.nodes);
+        issueUnicast(r, rng() & 1);
+        scheduleOperator(e.t);
+        break;
+      }
+    }
+  }
+  curUs = untilUs;
+}
+
+double percentile(std::vector<double>& v, double p) {
+  if (v.empty()) return 0;
+  size_t k = (size_t)std::ceil(p / 100 * v.size());
+  return v[std::min(std::max(k, (size_t)1), v.size()) - 1];
+}
+
+void printLink(const char* name, const LinkStats& s) {
+  printf("%-9s frames %llu delivered %llu (%.3f)  lost: collision %llu, weak %llu, not listening %llu,"
+         " params %llu, random %llu\n",
+         name, (unsigned long long)s.attempts, (unsigned long long)s.delivered,
+         s.attempts ? (double)s.delivered / s.attempts : 0.0, (unsigned long long)s.collision,
+         (unsigned long long)s.weak, (unsigned long long)s.notListening, (unsigned long long)s.params,
+         (unsigned long long)s.random);
+}
+
+void report(uint64_t endUs, double wallS) {
+  double spanS = (endUs - measureFromUs) / 1e6;
+  int inTable = 0;
+  enter(0, endUs);
+  for (const std::string& id : nodeIds) if (simGwShortAddr(id.c_str())) inTable++;
+
+  printf("scenario %s: %d nodes (%d in the gateway table), radius %.0f m, loss %.1f %%, seed %llu\n",
+         opt.scenario, opt.nodes, inTable, opt.radiusM, opt.lossPct, (unsigned long long)opt.seed);
+
+  std::vector<double> lat;
+  size_t acked = 0, superseded = 0, unchanged = 0, open = 0;
+  for (const Cmd& c : cmds) {
+    if (c.outcome == 0) {
+      acked++;
+      lat.push_back((c.ackUs - c.issuedUs) / 1000.0);
+    } else if (c.outcome == 1) superseded++;
+    else if (c.outcome == 2) unchanged++;
+    else open++;
+  }
+  std::sort(lat.begin(), lat.end());
+  size_t expected = cmds.size() - superseded - unchanged;
+  printf("commands  issued %zu acked %zu superseded %zu unchanged %zu unanswered %zu  delivery %.3f\n",
+         cmds.size(), acked, superseded, unchanged, open, expected ? (double)acked / expected : 0.0);
+  // Latencies cover acked commands only; unanswered ones are repeated here
+  // so a low p99 is not read without them
+  printf("latency   ms p50 %.0f  p90 %.0f  p99 %.0f  max %.0f  (%zu acked, %zu unanswered)\n",
+         percentile(lat, 50), percentile(lat, 90), percentile(lat, 99), lat.empty() ? 0.0 : lat.back(), acked,
+         open);
+
+  if (strcmp(opt.scenario, "dusk") == 0) {
+    int lit = 0;
+    for (int i = 1; i <= opt.nodes; i++) {
+      enter(i, endUs);
+      if (simNodeLight()) lit++;
+    }
+    printf("lights    on %d/%d\n", lit, opt.nodes);
+  }
+
+  printf("status    sent %llu delivered %llu (%.3f)\n", (unsigned long long)statusSent,
+         (unsigned long long)statusDelivered, statusSent ? (double)statusDelivered / statusSent : 0.0);
+  printf("airtime   gateway %.1f s (%.2f %%), nodes %.1f s (%.2f %% channel load)\n", gwAirUs / 1e6,
+         spanS > 0 ? gwAirUs / 1e4 / spanS : 0.0, nodeAirUs / 1e6, spanS > 0 ? nodeAirUs / 1e4 / spanS : 0.0);
+  printLink("uplink", uplink);
+  printLink("  acks", acks);
+  printLink("downlink", downlink);
+  SimGwCounters g = simGwCounters();
+  printf("gateway   ackTimeouts %u txDeferred %u txDrops %u coalesced %u rxOverruns %u\n", g.ackTimeouts,
+         g.txDeferred, g.txDrops, g.coalesced, g.rxOverruns);
+  printf("run       %.2f h simulated in %.2f s (%.0fx)\n", (endUs / 3.6e9), wallS, wallS > 0 ? endUs / 1e6 / wallS : 0.0);
+}
+
+void usage() {
+  printf("usage: lora-sim [options]\n"
+         "  --scenario dusk|steady  dusk: switch every node ON once; steady: random operator commands\n"
+         "  --nodes N               nodes, at most the gateway table size (default 50)\n"
+         "  --hours H               simulated time after warm-up (dusk 0.25, steady 2)\n"
+         "  --warmup S              seconds before measuring (default 90)\n"
+         "  --radius M              nodes spread over a disc of this radius (default 1500)\n"
+         "  --loss PCT              extra random loss per link, mean (default 0)\n"
+         "  --rate N                steady: operator commands per minute (default 2)\n"
+         "  --unicast               dusk: one command per node instead of a group frame\n"
+         "  --duty PERMILLE         gateway duty-cycle limit (default 100 = 10 %%)\n"
+         "  --clock HH:MM           RTC time at power-up (default 17:00)\n"
+         "  --seed N                random seed (default 1)\n"
+         "  --verbose               firmware Serial output with virtual timestamps\n");
+}
+
+bool parseArgs(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    const char* a = argv[i];
+    const char* v = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!strcmp(a, "--unicast")) opt.unicast = true;
+    else if (!strcmp(a, "--verbose")) opt.verbose = true;
+    else if (!v) { usage(); return false; }
+    else if (!strcmp(a, "--scenario")) opt.scenario = argv[++i];
+    else if (!strcmp(a, "--nodes")) opt.nodes = atoi(argv[++i]);
+    else if (!strcmp(a, "--hours")) opt.hours = atof(argv[++i]);
+    else if (!strcmp(a, "--warmup")) opt.warmupS = atof(argv[++i]);
+    else if (!strcmp(a, "--radius")) opt.radiusM = atof(argv[++i]);
+    else if (!strcmp(a, "--loss")) opt.lossPct = atof(argv[++i]);
+    else if (!strcmp(a, "--rate")) opt.ratePerMin = atof(argv[++i]);
+    else if (!strcmp(a, "--duty")) opt.dutyPermille = (uint16_t)atoi(argv[++i]);
+    else if (!strcmp(a, "--seed")) opt.seed = strtoull(argv[++i], nullptr, 10);
+    else if (!strcmp(a, "--clock")) {
+      int h = 0, m = 0;
+      sscanf(argv[++i], "%d:%d", &h, &m);
+      opt.clockStartS = (uint32_t)(h * 3600 + m * 60);
+    } else { usage(); return false; }
+  }
+  bool dusk = !strcmp(opt.scenario, "dusk");
+  if ((!dusk && strcmp(opt.scenario, "steady")) || opt.nodes < 1) { usage(); return false; }
+  // Nodes beyond the table never get a record: they keep registering and
+  // only add channel load, which reads like a protocol result
+  if (opt.nodes > simGwMaxNodes()) {
+    fprintf(stderr, "--nodes %d: the gateway table holds %d nodes (MAX_NODES)\n", opt.nodes, simGwMaxNodes());
+    return false;
+  }
+  if (opt.hours < 0) opt.hours = dusk ? 0.25 : 2;
+  return true;
+}
+
+int main(int argc, char** argv) {
+  if (!parseArgs(argc, argv)) return 1;
+  if (!simNodeRegionCheck()) {
+    fprintf(stderr, "node globals are not in the swapped region; rebuild with the objcopy step\n");
+    return 1;
+  }
+  rng.seed(opt.seed);
+  auto wall0 = std::chrono::steady_clock::now();
+
+  placeNodes();
+  bootNetwork();
+
+  measureFromUs = (uint64_t)(opt.warmupS * 1e6);
+  run(measureFromUs);
+
+  enter(0, measureFromUs);
+  if (!strcmp(opt.scenario, "dusk")) {
+    std::vector<int> members;
+    for (int i = 1; i <= opt.nodes; i++) {
+      if (!opt.unicast && simGwShortAddr(nodeIds[i - 1].c_str())) members.push_back(i);
+      else issueUnicast(i, true);
+    }
+    if (!members.empty()) issueGroup(members, true);
+  } else {
+    scheduleOperator(measureFromUs);
+  }
+
+  uint64_t endUs = measureFromUs + (uint64_t)(opt.hours * 3.6e9);
+  run(endUs);
+
+  double wallS = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall0).count();
+  report(endUs, wallS);
+  return 0;
+}
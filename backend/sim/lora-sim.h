@@ -0,0 +1,90 @@
+/* ===========================================================
+   LORA NETWORK SIMULATOR — core interface
+   What the shims in sim/shim/ and the firmware units
+   (lora-sim-gw.cpp, lora-sim-node.cpp) call into. Everything
+   here acts on the radio whose code is running right now:
+   the gateway (id 0) or node id 1..N.
+   Must be included at global scope before any shim.
+   =========================================================== */
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <strings.h>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/* ------------------------ TIME ------------------------ */
+uint64_t simNowUs();                // virtual time, including delay()s of the running call
+void     simDelayMs(unsigned long ms);
+uint32_t simWallClockS();           // RTC: seconds since midnight
+long     simRandom(long lo, long hi);
+uint64_t simChipId();               // efuse MAC of the running radio
+void     simLog(const char* fmt, va_list ap);
+void     simLogText(const char* s, size_t n);  // unformatted, e.g. Serial.print()
+
+/* ------------------------ RADIO ------------------------ */
+enum SimRadioParam { SIM_FREQ, SIM_SF, SIM_BW, SIM_CR, SIM_POWER };
+enum SimRadioMode  { SIM_MODE_IDLE, SIM_MODE_RX, SIM_MODE_TX };
+
+void  simRadioSet(int param, long value);
+void  simRadioMode(int mode);
+bool  simRadioTx(const uint8_t* data, size_t len);  // async, TxDone callback at the end
+void  simRadioCallbacks(void (*onRx)(int), void (*onTxDone)());  // LoRa.onReceive()/onTxDone()
+void  simRadioIrq(void (*isr)());    // attachInterrupt() on DIO0: RxDone / TxDone, FIFO read later
+int   simRadioParse();               // LoRa.parsePacket(): length of an unread frame, else 0
+void  simWakeTask();                 // task notification from an ISR (gateway radio task)
+int   simRadioAvailable();
+int   simRadioRead();
+int   simRadioRssi();
+float simRadioSnr();
+
+/* ------------------------ FIRMWARE UNITS ------------------------ */
+// Gateway (lora-sim-gw.cpp)
+void     simGwProvision(const std::vector<std::string>& nodeIds, uint16_t dutyPermille);
+void     simGwSetup();
+void     simGwMarkConfigApplied();
+uint16_t simGwShortAddr(const char* nodeId);
+void     simGwStep();
+bool     simGwCommand(uint16_t cmdId, const char* nodeId, bool lightOn);
+void     simGwGroupCommand(uint16_t cmdId, bool lightOn, const std::vector<std::string>& nodeIds);
+int      simGwQueueFree();
+int      simGwMaxNodes();
+
+enum SimGwEventKind { SIM_EVT_ACK, SIM_EVT_STATUS, SIM_EVT_OTHER };
+struct SimGwEvent {
+  int      kind;
+  char     nodeId[24];
+  uint16_t cmdId;
+  bool     success;
+  uint8_t  outcome;     // gateway CmdOutcome: 0 acked, 1 superseded, 2 unchanged
+};
+bool     simGwPollEvent(SimGwEvent& e);
+
+struct SimGwCounters {
+  uint32_t txDeferred, txDrops, ackTimeouts, coalesced, rxOverruns;
+  uint32_t txAirtimeMs;
+};
+SimGwCounters simGwCounters();
+
+// Node (lora-sim-node.cpp); state lives in the swapped region, so these act
+// on whichever node is resident
+void simNodeSeed(bool configured, uint16_t shortAddr, const char* gatewayId);
+void simNodeSetup();
+void simNodeLoop();
+bool simNodeLight();
+extern "C" char __start_simnode_data[], __stop_simnode_data[];
+extern "C" char __start_simnode_bss[], __stop_simnode_bss[];
+bool simNodeRegionCheck();  // every node global sits in the swapped region
@@ -0,0 +1,348 @@
+/* ===========================================================
+   MODEM LINK TEST (host)
+   gateway.cpp's SIM900 state machine (ModemLink) driven by a
+   scripted fake modem on a virtual clock: bring-up from reset,
+   CREG/CGATT answers and URCs, +PDP: DEACT, command timeouts,
+   the CFUN reset after repeated failures, and the hand-back of
+   socket URCs to TinyGSM while the link is up.
+
+   Each case prints PASS/FAIL; the exit code is the number of
+   failed checks.
+
+   Build & run (from the repo root):
+     g++ -std=gnu++17 -O2 -Ibackend/sim/shim \
+         -o modem-link-test backend/sim/modem-link-test.cpp
+     ./modem-link-test [-v]     # -v: firmware Serial output
+   =========================================================== */
+
+#include "lora-sim.h"
+
+#include <deque>
+
+#define SIM_STRING_CAP 160
+#define SIM_PREFS_CAP  160
+
+/* ------------------------ HOST CORE ------------------------ */
+// Only the clock and the log matter here; the radio is never used
+uint64_t nowUs = 1000000;
+bool verbose = false;
+
+uint64_t simNowUs() { return nowUs; }
+void simDelayMs(unsigned long ms) { nowUs += (uint64_t)ms * 1000; }
+uint32_t simWallClockS() { return (uint32_t)((19 * 3600 + nowUs / 1000000) % 86400); }
+uint64_t simChipId() { return 0x30AEA4000001ULL; }
+long simRandom(long lo, long hi) { return lo < hi ? lo : hi; }
+void simLog(const char* fmt, va_list ap) { if (verbose) vprintf(fmt, ap); }
+void simLogText(const char* s, size_t n) { if (verbose) fwrite(s, 1, n, stdout); }
+
+void simRadioSet(int, long) {}
+void simRadioMode(int) {}
+bool simRadioTx(const uint8_t*, size_t) { return true; }
+void simRadioCallbacks(void (*)(int), void (*)()) {}
+void simRadioIrq(void (*)()) {}
+int simRadioParse() { return 0; }
+void simWakeTask() {}
+int simRadioAvailable() { return 0; }
+int simRadioRead() { return -1; }
+int simRadioRssi() { return -90; }
+float simRadioSnr() { return 7.5f; }
+
+/* ------------------------ GATEWAY ------------------------ */
+#include "../gateway.cpp"
+
+HardwareSerial Serial(0);
+EspClass ESP;
+LoRaClass LoRa;
+FSImpl SPIFFS;
+
+/* ------------------------ FAKE MODEM ------------------------ */
+// Collects "AT...\r" commands and answers each from a script, "OK" by
+// default. A silent command (or a dead modem) gets no answer at all.
+struct FakeModem : public Stream {
+  std::string cmd;
+  std::deque<char> rx;
+  std::vector<std::string> sent;
+  std::map<std::string, std::string> answers;
+  std::map<std::string, bool> silent;
+  bool dead = false;
+
+  void inject(const std::string& s) { rx.insert(rx.end(), s.begin(), s.end()); }
+
+  size_t write(uint8_t c) override {
+    if (c != '\r') { cmd += (char)c; return 1; }
+    sent.push_back(cmd);
+    if (!dead && !silent[cmd]) inject("\r\n" + (answers.count(cmd) ? answers[cmd] : "OK") + "\r\n");
+    cmd.clear();
+    return 1;
+  }
+  int available() override { return (int)rx.size(); }
+  int peek() override { return rx.empty() ? -1 : (uint8_t)rx.front(); }
+  int read() override {
+    if (rx.empty()) return -1;
+    uint8_t c = (uint8_t)rx.front();
+    rx.pop_front();
+    return c;
+  }
+
+  size_t count(const std::string& c, size_t from = 0) const {
+    size_t n = 0;
+    for (size_t i = from; i < sent.size(); i++) n += sent[i] == c;
+    return n;
+  }
+};
+
+// A modem that registers on the first poll and attaches
+void scriptHealthy(FakeModem& fm) {
+  fm.answers["AT+CPIN?"] = "+CPIN: READY\r\n\r\nOK";
+  fm.answers["AT+CREG?"] = "+CREG: 0,1\r\n\r\nOK";
+  fm.answers["AT+CIPSHUT"] = "SHUT OK";
+  fm.answers["AT+CIFSR;E0"] = "10.64.12.7";
+  fm.answers["AT+CGATT?"] = "+CGATT: 1\r\n\r\nOK";
+}
+
+/* ------------------------ HARNESS ------------------------ */
+#define STEP_MS 10
+
+struct Rig {
+  FakeModem fm;
+  ModemPort port{fm};
+  ModemLink link;
+  int ups = 0, downs = 0;
+};
+
+Rig* rig = nullptr;
+
+void onEvent(uint8_t evt) {
+  if (evt == MODEM_EVT_UP) rig->ups++;
+  else rig->downs++;
+}
+
+void start(Rig& r, bool reset) {
+  rig = &r;
+  r.link.setApn("apn.test");
+  r.link.begin(r.port, onEvent, reset);
+}
+
+// Steps the link every STEP_MS for ms of virtual time; stops early once
+// done() holds
+template <class F>
+bool runUntil(Rig& r, unsigned long ms, F done) {
+  for (unsigned long t = 0; t < ms; t += STEP_MS) {
+    r.link.step();
+    if (done()) return true;
+    simDelayMs(STEP_MS);
+  }
+  return done();
+}
+
+void run(Rig& r, unsigned long ms) {
+  runUntil(r, ms, [] { return false; });
+}
+
+bool bringUp(Rig& r) {
+  return runUntil(r, 60000, [&] { return r.link.isUp(); });
+}
+
+std::string drainPort(ModemPort& p) {
+  std::string s;
+  for (int c; (c = p.read()) >= 0;) s += (char)c;
+  return s;
+}
+
+int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { printf("  FAIL %s:%d: %s\n", __func__, __LINE__, #cond); failures++; } \
+  } while (0)
+
+/* ------------------------ CASES ------------------------ */
+void testBringUp() {
+  Rig r;
+  scriptHealthy(r.fm);
+  start(r, true);
+  CHECK(bringUp(r));
+  CHECK(r.ups == 1 && r.downs == 0);
+
+  const char* expect[] = {
+    "AT+CFUN=1,1", "ATE0", "AT+CPIN?", "AT+CREG?", "AT+CIPSHUT", "AT+CGATT=1",
+    "AT+CIPMUX=1", "AT+CIPQSEND=1", "AT+CIPRXGET=1", "AT+CSTT=\"apn.test\",\"\",\"\"",
+    "AT+CIICR", "AT+CIFSR;E0", "AT+CDNSCFG=\"8.8.8.8\",\"8.8.4.4\"",
+  };
+  size_t n = sizeof(expect) / sizeof(expect[0]);
+  CHECK(r.fm.sent.size() == n);
+  for (size_t i = 0; i < n && i < r.fm.sent.size(); i++) CHECK(r.fm.sent[i] == expect[i]);
+
+  // Up: only the periodic CGATT? probe, which keeps it up
+  size_t mark = r.fm.sent.size();
+  run(r, 3 * MODEM_PROBE_INTERVAL_MS);
+  CHECK(r.link.isUp() && r.downs == 0);
+  CHECK(r.fm.count("AT+CGATT?", mark) == r.fm.sent.size() - mark);
+  CHECK(r.fm.count("AT+CGATT?", mark) >= 2);
+}
+
+void testRegistrationUrcs() {
+  Rig r;
+  scriptHealthy(r.fm);
+  r.fm.answers["AT+CREG?"] = "+CREG: 0,2\r\n\r\nOK";  // searching
+  start(r, false);
+  run(r, 10000);
+  CHECK(r.link.state == LINK_REGISTER && r.link.regStat == 2);
+
+  // Unsolicited "+CREG: <stat>" is parsed too
+  r.fm.inject("\r\n+CREG: 5\r\n");
+  r.fm.answers["AT+CREG?"] = "+CREG: 0,5\r\n\r\nOK";
+  run(r, MODEM_REG_POLL_MS / 2);
+  CHECK(r.link.regStat == 5);
+  CHECK(bringUp(r));
+
+  // Probe answered "+CGATT: 0": detached, the link drops and comes back
+  r.fm.answers["AT+CGATT?"] = "+CGATT: 0\r\n\r\nOK";
+  CHECK(runUntil(r, 2 * MODEM_PROBE_INTERVAL_MS, [&] { return r.downs == 1; }));
+  CHECK(!r.link.isUp() && r.link.attached == 0 && r.link.linkDrops == 1);
+  r.fm.answers["AT+CGATT?"] = "+CGATT: 1\r\n\r\nOK";
+  CHECK(bringUp(r));
+  CHECK(r.ups == 2);
+}
+
+void testRegistrationTimeout() {
+  Rig r;
+  scriptHealthy(r.fm);
+  r.fm.answers["AT+CREG?"] = "+CREG: 0,3\r\n\r\nOK";  // denied
+  start(r, false);
+  CHECK(runUntil(r, MODEM_REG_TIMEOUT_MS + 10000, [&] { return r.link.state == LINK_BACKOFF; }));
+  CHECK(r.link.fails == 1 && r.ups == 0);
+}
+
+void testPdpDeact() {
+  Rig r;
+  scriptHealthy(r.fm);
+  start(r, false);
+  CHECK(bringUp(r));
+
+  // The URC arrives between probes; the next probe sees it
+  r.fm.inject("\r\n+PDP: DEACT\r\n");
+  CHECK(runUntil(r, MODEM_PROBE_INTERVAL_MS + AT_TIMEOUT_MS, [&] { return r.downs == 1; }));
+  CHECK(r.link.state == LINK_SYNC && r.link.linkDrops == 1);
+  CHECK(r.port.backLen == 0);  // ours, not handed back
+  CHECK(bringUp(r));
+  CHECK(r.ups == 2 && !r.link.linkFault);
+}
+
+void testProbeTimeout() {
+  Rig r;
+  scriptHealthy(r.fm);
+  start(r, false);
+  CHECK(bringUp(r));
+
+  r.fm.silent["AT+CGATT?"] = true;
+  size_t mark = r.fm.sent.size();
+  CHECK(runUntil(r, MODEM_PROBE_INTERVAL_MS + MODEM_PROBE_MAX_MISSES * (AT_TIMEOUT_MS + MODEM_SYNC_GAP_MS),
+                 [&] { return r.downs == 1; }));
+  CHECK(r.fm.count("AT+CGATT?", mark) == MODEM_PROBE_MAX_MISSES);
+
+  // One answered probe in between resets the miss count
+  r.fm.silent["AT+CGATT?"] = false;
+  CHECK(bringUp(r));
+  r.fm.silent["AT+CGATT?"] = true;
+  run(r, MODEM_PROBE_INTERVAL_MS + AT_TIMEOUT_MS + MODEM_SYNC_GAP_MS);
+  r.fm.silent["AT+CGATT?"] = false;
+  run(r, 2 * MODEM_PROBE_INTERVAL_MS);
+  CHECK(r.link.isUp() && r.link.probeMisses == 0 && r.downs == 1);
+}
+
+void testCommandTimeout() {
+  Rig r;
+  scriptHealthy(r.fm);
+  r.fm.silent["AT+CIICR"] = true;
+  start(r, false);
+  CHECK(runUntil(r, 90000, [&] { return r.link.state == LINK_BACKOFF; }));
+  CHECK(r.link.fails == 1 && r.fm.sent.back() == "AT+CIICR");
+
+  // The retry starts over from sync, and succeeds once CIICR answers
+  r.fm.silent["AT+CIICR"] = false;
+  CHECK(bringUp(r));
+  CHECK(r.link.fails == 0 && r.ups == 1);
+}
+
+void testResetAfterFailures() {
+  Rig r;
+  r.fm.dead = true;
+  start(r, false);
+
+  // Every bring-up dies in sync; the MODEM_MAX_FAILS-th one resets the modem
+  unsigned long perFail = MODEM_SYNC_TRIES * (1000UL + MODEM_SYNC_GAP_MS) + MODEM_RETRY_DELAY_MS;
+  CHECK(runUntil(r, (MODEM_MAX_FAILS + 1) * perFail, [&] { return r.link.state == LINK_RESET && r.link.cmdActive; }));
+  CHECK(r.link.fails == MODEM_MAX_FAILS);
+  CHECK(r.fm.count("ATE0") == MODEM_MAX_FAILS * MODEM_SYNC_TRIES);
+  CHECK(r.fm.sent.back() == "AT+CFUN=1,1");
+
+  // The modem comes back after the reset: fail count cleared, link up
+  r.fm.dead = false;
+  scriptHealthy(r.fm);
+  // CFUN was sent to the dead modem; its timeout still counts as done
+  CHECK(runUntil(r, 11000, [&] { return r.link.state == LINK_SYNC; }));
+  CHECK(r.link.fails == 0);
+  CHECK(bringUp(r));
+}
+
+void testHandBack() {
+  Rig r;
+  scriptHealthy(r.fm);
+  start(r, false);
+  CHECK(bringUp(r));
+
+  // Between probes the link leaves the UART alone
+  r.fm.inject("\r\n0, CLOSED\r\n");
+  run(r, MODEM_PROBE_INTERVAL_MS / 2);
+  CHECK(r.fm.available() == 13 && r.port.backLen == 0);
+  CHECK(drainPort(r.port) == "\r\n0, CLOSED\r\n");
+
+  // A URC that arrives with the probe's answer is handed back, and the
+  // bytes after the final OK stay in the UART, in order
+  r.fm.answers["AT+CGATT?"] = "+CIPRXGET: 1,0\r\n\r\n+CGATT: 1\r\n\r\nOK\r\n\r\n0, CLOSED";
+  size_t mark = r.fm.sent.size();
+  CHECK(runUntil(r, 2 * MODEM_PROBE_INTERVAL_MS, [&] { return r.fm.count("AT+CGATT?", mark) == 1 && !r.link.cmdActive; }));
+  CHECK(r.link.isUp());
+  std::string seen = drainPort(r.port);
+  CHECK(seen == "+CIPRXGET: 1,0\r\n\r\n0, CLOSED\r\n");
+
+  // A full hand-back buffer drops (and counts) the line, never overflows
+  std::string burst;
+  for (int i = 0; i < 16; i++) burst += "+CIPRXGET: 1,0\r\n";
+  r.fm.answers["AT+CGATT?"] = burst + "+CGATT: 1\r\n\r\nOK";
+  mark = r.fm.sent.size();
+  CHECK(runUntil(r, 2 * MODEM_PROBE_INTERVAL_MS, [&] { return r.fm.count("AT+CGATT?", mark) == 1 && !r.link.cmdActive; }));
+  CHECK(r.port.backDrops > 0 && r.port.backLen <= MODEM_HANDBACK_SIZE);
+  CHECK(r.link.isUp());
+}
+
+/* ------------------------ MAIN ------------------------ */
+struct TestCase {
+  const char* name;
+  void (*fn)();
+};
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-v") == 0) verbose = true;
+  }
+
+  const TestCase cases[] = {
+    {"bring_up",             testBringUp},
+    {"registration_urcs",    testRegistrationUrcs},
+    {"registration_timeout", testRegistrationTimeout},
+    {"pdp_deact",            testPdpDeact},
+    {"probe_timeout",        testProbeTimeout},
+    {"command_timeout",      testCommandTimeout},
+    {"reset_after_failures", testResetAfterFailures},
+    {"hand_back",            testHandBack},
+  };
+
+  for (const TestCase& c : cases) {
+    int before = failures;
+    c.fn();
+    printf("%-22s %s\n", c.name, failures == before ? "PASS" : "FAIL");
+  }
+  printf("%d check(s) failed\n", failures);
+  return failures;
+}
@@ -0,0 +1,223 @@
+/* ===========================================================
+   HOST SHIM: Arduino core (ESP32 flavour)
+   Included inside a firmware unit's namespace (see
+   lora-sim-gw.cpp / lora-sim-node.cpp), after lora-sim.h at
+   global scope, so it includes no system headers itself.
+   Time, randomness and the chip id come from the simulator.
+
+   Objects here must stay byte-copyable: the node unit's
+   globals are swapped in and out of one memory region per
+   node, so String keeps its text inline.
+   =========================================================== */
+#pragma once
+
+#define IRAM_ATTR
+#define HIGH   1
+#define LOW    0
+#define OUTPUT 1
+#define INPUT  0
+#define RISING 1
+#define SERIAL_8N1 0
+
+typedef uint8_t byte;
+using std::min;
+using std::max;
+
+inline unsigned long millis() { return (unsigned long)(simNowUs() / 1000); }
+inline unsigned long micros() { return (unsigned long)simNowUs(); }
+inline void delay(unsigned long ms) { simDelayMs(ms); }
+inline void yield() {}
+inline void digitalWrite(int, int) {}
+inline void pinMode(int, int) {}
+inline int digitalPinToInterrupt(int pin) { return pin; }
+inline void attachInterrupt(int, void (*isr)(), int) { simRadioIrq(isr); }  // only DIO0 is wired
+inline long random(long hi) { return simRandom(0, hi); }
+inline long random(long lo, long hi) { return simRandom(lo, hi); }
+
+/* ------------------------ String ------------------------ */
+#ifndef SIM_STRING_CAP
+#define SIM_STRING_CAP 64
+#endif
+
+class String {
+  char buf[SIM_STRING_CAP];
+
+  void set(const char* s) { snprintf(buf, sizeof(buf), "%s", s ? s : ""); }
+  void append(const char* s) {
+    size_t n = strlen(buf);
+    snprintf(buf + n, sizeof(buf) - n, "%s", s ? s : "");
+  }
+
+public:
+  constexpr String() : buf{} {}
+  String(const char* s) { set(s); }
+  String(char c) { buf[0] = c; buf[1] = '\0'; }
+  String(int v) { snprintf(buf, sizeof(buf), "%d", v); }
+  String(unsigned v) { snprintf(buf, sizeof(buf), "%u", v); }
+  String(long v) { snprintf(buf, sizeof(buf), "%ld", v); }
+  String(unsigned long v) { snprintf(buf, sizeof(buf), "%lu", v); }
+
+  const char* c_str() const { return buf; }
+  unsigned length() const { return (unsigned)strlen(buf); }
+  bool reserve(unsigned) { return true; }
+  int indexOf(const char* s, unsigned from = 0) const {
+    if (from > length()) return -1;
+    const char* p = strstr(buf + from, s);
+    return p ? (int)(p - buf) : -1;
+  }
+  int indexOf(char c, unsigned from = 0) const {
+    if (from > length()) return -1;
+    const char* p = strchr(buf + from, c);
+    return p ? (int)(p - buf) : -1;
+  }
+  String substring(unsigned from, unsigned to) const {
+    String r;
+    unsigned n = length();
+    if (to > n) to = n;
+    if (from < to) {
+      memcpy(r.buf, buf + from, to - from);
+      r.buf[to - from] = '\0';
+    }
+    return r;
+  }
+  String substring(unsigned from) const { return substring(from, length()); }
+  bool startsWith(const char* p) const { return strncmp(buf, p, strlen(p)) == 0; }
+  bool endsWith(const char* p) const {
+    size_t n = strlen(p), l = length();
+    return l >= n && strcmp(buf + l - n, p) == 0;
+  }
+  void trim() {
+    size_t l = length();
+    while (l > 0 && (buf[l - 1] == ' ' || buf[l - 1] == '\r' || buf[l - 1] == '\n' || buf[l - 1] == '\t')) buf[--l] = '\0';
+    size_t s = 0;
+    while (buf[s] == ' ' || buf[s] == '\r' || buf[s] == '\n' || buf[s] == '\t') s++;
+    if (s) memmove(buf, buf + s, l - s + 1);
+  }
+  int toInt() const { return atoi(buf); }
+  char operator[](unsigned i) const { return i < length() ? buf[i] : '\0'; }
+
+  bool operator==(const String& o) const { return strcmp(buf, o.buf) == 0; }
+  bool operator==(const char* o) const { return strcmp(buf, o ? o : "") == 0; }
+  bool operator!=(const String& o) const { return !(*this == o); }
+  bool operator!=(const char* o) const { return !(*this == o); }
+  String& operator+=(const String& o) { append(o.buf); return *this; }
+  String& operator+=(const char* o) { append(o); return *this; }
+  String& operator+=(char c) { char s[2] = {c, '\0'}; append(s); return *this; }
+  friend String operator+(String a, const String& b) { a += b; return a; }
+  friend String operator+(String a, const char* b) { a += b; return a; }
+  friend String operator+(const char* a, const String& b) { String r(a); r += b; return r; }
+};
+typedef String StringSumHelper;  // ArduinoJson's String support names it
+
+/* ------------------------ Print / Stream ------------------------ */
+class Print {
+public:
+  virtual size_t write(uint8_t) { return 1; }
+  virtual size_t write(const uint8_t* b, size_t n) {
+    size_t k = 0;
+    while (k < n && write(b[k])) k++;
+    return k;
+  }
+  size_t write(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+  size_t print(const char* s) { return write(s); }
+  size_t print(const String& s) { return write(s.c_str()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int v) { return printf("%d", v); }
+  size_t print(unsigned v) { return printf("%u", v); }
+  size_t print(long v) { return printf("%ld", v); }
+  size_t print(unsigned long v) { return printf("%lu", v); }
+  size_t println() { return write("\r\n"); }
+  template <class T> size_t println(const T& v) { return print(v) + println(); }
+  size_t printf(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+    char tmp[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+    va_end(ap);
+    if (n < 0) return 0;
+    return write((const uint8_t*)tmp, std::min((size_t)n, sizeof(tmp) - 1));
+  }
+};
+
+class Stream : public Print {
+public:
+  virtual int available() { return 0; }
+  virtual int read() { return -1; }
+  virtual int peek() { return -1; }
+  virtual void flush() {}
+  void setTimeout(unsigned long) {}
+  size_t readBytes(uint8_t* b, size_t n) {
+    size_t k = 0;
+    for (int c; k < n && (c = read()) >= 0;) b[k++] = (uint8_t)c;
+    return k;
+  }
+  size_t readBytes(char* b, size_t n) { return readBytes((uint8_t*)b, n); }
+  String readStringUntil(char end) {
+    String s;
+    for (int c; (c = read()) >= 0 && c != end;) s += (char)c;
+    return s;
+  }
+};
+
+// Serial goes to the simulator log (off unless --verbose); other UARTs
+// (the modem) are silent and never answer
+class HardwareSerial : public Stream {
+  bool console;
+
+public:
+  HardwareSerial(int port = 0) : console(port == 0) {}
+  void begin(unsigned long, int = 0, int = 0, int = 0) {}
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* b, size_t n) override {
+    if (console) simLogText((const char*)b, n);
+    return n;
+  }
+  using Print::write;
+  size_t printf(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+    if (!console) return 0;
+    va_list ap;
+    va_start(ap, fmt);
+    simLog(fmt, ap);
+    va_end(ap);
+    return 1;
+  }
+};
+extern HardwareSerial Serial;
+
+class EspClass {
+public:
+  uint64_t getEfuseMac() { return simChipId(); }
+  uint32_t getFreeHeap() { return 200000; }
+  uint32_t getMinFreeHeap() { return 180000; }
+  uint32_t getMaxAllocHeap() { return 110000; }
+  uint32_t getHeapSize() { return 320000; }
+  uint32_t getCpuFreqMHz() { return 240; }
+  uint32_t getCycleCount() { return (uint32_t)(simNowUs() * 240); }  // virtual time: phases between delay()s take 0
+  void restart() {}
+};
+extern EspClass ESP;
+
+/* ------------------------ FreeRTOS ------------------------ */
+// The simulator calls the task bodies' step functions itself; a task
+// notification from an ISR is an early radio step
+typedef void* TaskHandle_t;
+typedef int BaseType_t;
+typedef uint32_t UBaseType_t;
+typedef uint32_t TickType_t;
+#define pdPASS 1
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdMS_TO_TICKS(x) (x)
+#define portYIELD_FROM_ISR() do {} while (0)
+inline BaseType_t xTaskCreatePinnedToCore(void (*)(void*), const char*, uint32_t, void*,
+                                          UBaseType_t, TaskHandle_t* h, BaseType_t) {
+  if (h) *h = (TaskHandle_t)h;  // any non-null handle
+  return pdPASS;
+}
+inline void vTaskNotifyGiveFromISR(TaskHandle_t, BaseType_t*) { simWakeTask(); }
+inline uint32_t ulTaskNotifyTake(BaseType_t, TickType_t ms) {
+  simDelayMs(ms);
+  return 0;
+}
+inline void vTaskDelay(TickType_t ms) { simDelayMs(ms); }
+inline void vTaskDelete(TaskHandle_t) {}
@@ -0,0 +1,938 @@
+/* ===========================================================
+   HOST SHIM: ArduinoJson 6 (the subset gateway.cpp uses)
+   A small document tree behind ArduinoJson's handle API, with
+   JSON and MessagePack codecs that write what ArduinoJson 6
+   writes for the same document: compact JSON, integers in their
+   smallest MessagePack form, floats as float32 when that is
+   exact. gateway-bench reads wire sizes off it; its timings are
+   this shim's, not the library's (see the bench for building
+   against the real one).
+
+   Not modelled: capacity (documents never overflow), JsonPair
+   (iterating an object yields its values), comments and
+   single quotes in JSON input.
+   =========================================================== */
+#pragma once
+#include <Arduino.h>
+
+struct DeserializationError {
+  enum Code { Ok, NoMemory, InvalidInput, IncompleteInput, EmptyInput, TooDeep };
+  Code c = Ok;
+  DeserializationError() {}
+  DeserializationError(Code x) : c(x) {}
+  explicit operator bool() const { return c != Ok; }
+  bool operator==(Code x) const { return c == x; }
+  bool operator!=(Code x) const { return c != x; }
+  const char* c_str() const {
+    static const char* const names[] = {"Ok", "NoMemory", "InvalidInput", "IncompleteInput", "EmptyInput", "TooDeep"};
+    return names[c];
+  }
+  Code code() const { return c; }
+};
+
+/* ------------------------ TREE ------------------------ */
+struct JsonNode {
+  enum Type : uint8_t { Null, Bool, Int, UInt, Float, Str, Arr, Obj };
+  Type type = Null;
+  bool b = false;
+  int64_t i = 0;     // Int: negative values only
+  uint64_t u = 0;
+  double f = 0;
+  std::string s;
+  std::vector<std::string> keys;                    // Obj
+  std::vector<std::unique_ptr<JsonNode>> items;     // Arr elements, Obj values
+
+  void reset() {
+    type = Null;
+    s.clear();
+    keys.clear();
+    items.clear();
+  }
+  void become(Type t) {
+    reset();
+    type = t;
+  }
+  JsonNode* member(const char* k) const {
+    for (size_t n = 0; n < keys.size(); n++) if (keys[n] == k) return items[n].get();
+    return nullptr;
+  }
+  JsonNode* addMember(const char* k) {
+    keys.push_back(k);
+    items.emplace_back(new JsonNode);
+    return items.back().get();
+  }
+  JsonNode* addItem() {
+    items.emplace_back(new JsonNode);
+    return items.back().get();
+  }
+  void copyFrom(const JsonNode& o) {
+    if (&o == this) return;
+    type = o.type; b = o.b; i = o.i; u = o.u; f = o.f; s = o.s; keys = o.keys;
+    items.clear();
+    for (const auto& c : o.items) {
+      items.emplace_back(new JsonNode);
+      items.back()->copyFrom(*c);
+    }
+  }
+  void setSigned(int64_t v) {
+    become(v < 0 ? Int : UInt);
+    i = v;
+    u = (uint64_t)v;
+  }
+  void setUnsigned(uint64_t v) {
+    become(UInt);
+    u = v;
+    i = (int64_t)v;
+  }
+  double number() const {
+    return type == Int ? (double)i : type == UInt ? (double)u : type == Float ? f : 0;
+  }
+};
+
+/* ------------------------ HANDLES ------------------------ */
+// A handle names a node, or a member/element that may not exist yet:
+// reads through it never create anything, the first write does
+class JsonVar;
+class JsonVariant;
+class JsonVariantConst;
+class JsonObject;
+class JsonObjectConst;
+class JsonArray;
+class JsonArrayConst;
+
+template <class T>
+constexpr bool jsonIsHandle = std::is_base_of<JsonVar, std::decay_t<T>>::value;
+template <class T>
+constexpr bool jsonIsText = std::is_convertible<std::decay_t<T>, const char*>::value ||
+                            std::is_same<std::decay_t<T>, String>::value ||
+                            std::is_same<std::decay_t<T>, std::string>::value;
+template <class T>
+constexpr bool jsonIsScalar = std::is_arithmetic<T>::value || std::is_enum<T>::value || jsonIsText<T>;
+
+struct JsonIter {
+  const JsonNode* p;
+  size_t k;
+  bool operator!=(const JsonIter& o) const { return k != o.k; }
+  void operator++() { k++; }
+  JsonVar operator*() const;
+};
+
+class JsonVar {
+protected:
+  mutable JsonNode* n = nullptr;   // resolved node, once it exists
+  JsonNode* parent = nullptr;      // existing container, or ...
+  std::shared_ptr<JsonVar> up;     // ... a handle that may not exist yet
+  std::string key;
+  int index = -1;                  // element index instead of key
+
+  JsonNode* container() const { return parent ? parent : (up ? up->resolve() : nullptr); }
+  JsonNode* makeContainer() const { return parent ? parent : (up ? up->make() : nullptr); }
+
+  JsonVar child() const {
+    JsonVar v;
+    v.parent = resolve();
+    if (!v.parent) v.up = std::make_shared<JsonVar>(*this);
+    return v;
+  }
+
+  static const char* textOf(const char* s) { return s ? s : ""; }
+  static const char* textOf(const String& s) { return s.c_str(); }
+  static const char* textOf(const std::string& s) { return s.c_str(); }
+
+public:
+  JsonVar() = default;
+  JsonVar(const JsonVar&) = default;
+  explicit JsonVar(JsonNode* node) : n(node) {}
+
+  JsonNode* resolve() const {
+    if (n) return n;
+    JsonNode* p = container();
+    if (!p) return nullptr;
+    if (index >= 0) return (p->type == JsonNode::Arr && (size_t)index < p->items.size()) ? p->items[index].get() : nullptr;
+    return p->type == JsonNode::Obj ? p->member(key.c_str()) : nullptr;
+  }
+
+  JsonNode* make() const {
+    if (n) return n;
+    JsonNode* p = makeContainer();
+    if (!p) return nullptr;
+    if (index >= 0) {
+      if (p->type == JsonNode::Null) p->type = JsonNode::Arr;
+      if (p->type != JsonNode::Arr) return nullptr;
+      while (p->items.size() <= (size_t)index) p->addItem();
+      n = p->items[index].get();
+    } else {
+      if (p->type == JsonNode::Null) p->type = JsonNode::Obj;
+      if (p->type != JsonNode::Obj) return nullptr;
+      n = p->member(key.c_str());
+      if (!n) n = p->addMember(key.c_str());
+    }
+    return n;
+  }
+
+  /* --- members and elements --- */
+  JsonVar operator[](const char* k) const {
+    JsonVar v = child();
+    v.key = textOf(k);
+    return v;
+  }
+  JsonVar operator[](const String& k) const { return (*this)[k.c_str()]; }
+  JsonVar operator[](const std::string& k) const { return (*this)[k.c_str()]; }
+  template <class I, std::enable_if_t<std::is_integral<I>::value, int> = 0>
+  JsonVar operator[](I i) const {
+    JsonVar v = child();
+    v.index = (int)i;
+    return v;
+  }
+
+  template <class K> bool containsKey(const K& k) const {
+    const JsonNode* p = resolve();
+    return p && p->type == JsonNode::Obj && p->member(textOf(k));
+  }
+  template <class K> void remove(const K& k) {
+    JsonNode* p = resolve();
+    if (!p) return;
+    if constexpr (std::is_integral<K>::value) {
+      if (p->type == JsonNode::Arr && (size_t)k < p->items.size()) p->items.erase(p->items.begin() + k);
+    } else if (p->type == JsonNode::Obj) {
+      for (size_t m = 0; m < p->keys.size(); m++) {
+        if (p->keys[m] == textOf(k)) {
+          p->keys.erase(p->keys.begin() + m);
+          p->items.erase(p->items.begin() + m);
+          return;
+        }
+      }
+    }
+  }
+
+  size_t size() const {
+    const JsonNode* p = resolve();
+    return (p && (p->type == JsonNode::Arr || p->type == JsonNode::Obj)) ? p->items.size() : 0;
+  }
+  bool isNull() const {
+    const JsonNode* p = resolve();
+    return !p || p->type == JsonNode::Null;
+  }
+  JsonIter begin() const {
+    const JsonNode* p = resolve();
+    bool seq = p && (p->type == JsonNode::Arr || p->type == JsonNode::Obj);
+    return JsonIter{seq ? p : nullptr, 0};
+  }
+  JsonIter end() const {
+    const JsonNode* p = resolve();
+    bool seq = p && (p->type == JsonNode::Arr || p->type == JsonNode::Obj);
+    return JsonIter{seq ? p : nullptr, seq ? p->items.size() : 0};
+  }
+
+  /* --- writes --- */
+  template <class T> bool set(const T& v) {
+    JsonNode* p = make();
+    if (!p) return false;
+    using U = std::remove_cv_t<std::decay_t<T>>;
+    if constexpr (jsonIsHandle<T>) {
+      const JsonNode* src = v.resolve();
+      if (src) p->copyFrom(*src);
+      else p->reset();
+    } else if constexpr (std::is_same<U, std::nullptr_t>::value) {
+      p->reset();
+    } else if constexpr (std::is_same<U, bool>::value) {
+      p->become(JsonNode::Bool);
+      p->b = v;
+    } else if constexpr (std::is_floating_point<U>::value) {
+      p->become(JsonNode::Float);
+      p->f = (double)v;
+    } else if constexpr (std::is_enum<U>::value) {
+      p->setSigned((int64_t)v);
+    } else if constexpr (std::is_integral<U>::value && std::is_signed<U>::value) {
+      p->setSigned((int64_t)v);
+    } else if constexpr (std::is_integral<U>::value) {
+      p->setUnsigned((uint64_t)v);
+    } else {
+      static_assert(jsonIsText<T>, "unsupported JSON value type");
+      const char* s = textOf(v);
+      p->become(JsonNode::Str);
+      p->s = s;
+    }
+    return true;
+  }
+  template <class T> JsonVar& operator=(const T& v) {
+    set(v);
+    return *this;
+  }
+  JsonVar& operator=(const JsonVar& v) {
+    if (&v != this) set(v);
+    return *this;
+  }
+
+  template <class T = JsonVar> T add() const {
+    JsonNode* p = make();
+    if (!p) return T();
+    if (p->type == JsonNode::Null) p->type = JsonNode::Arr;
+    if (p->type != JsonNode::Arr) return T();
+    JsonNode* c = p->addItem();
+    if (std::is_same<T, JsonObject>::value) c->type = JsonNode::Obj;
+    if (std::is_same<T, JsonArray>::value) c->type = JsonNode::Arr;
+    return T(JsonVar(c));
+  }
+  template <class T> bool add(const T& v) const {
+    JsonVar c = add<JsonVar>();
+    return c.resolve() && c.set(v);
+  }
+
+  JsonObject createNestedObject() const;
+  JsonArray createNestedArray() const;
+  template <class K> JsonObject createNestedObject(const K& k) const;
+  template <class K> JsonArray createNestedArray(const K& k) const;
+  template <class T> T to() {
+    JsonNode* p = make();
+    if (p) p->become(std::is_same<T, JsonArray>::value ? JsonNode::Arr : JsonNode::Obj);
+    return T(JsonVar(p));
+  }
+  void clear() {
+    JsonNode* p = resolve();
+    if (p) p->reset();
+  }
+
+  /* --- reads --- */
+  template <class T> bool is() const {
+    const JsonNode* p = resolve();
+    if (!p) return false;
+    using U = std::remove_cv_t<T>;
+    if constexpr (std::is_same<U, bool>::value) return p->type == JsonNode::Bool;
+    else if constexpr (std::is_floating_point<U>::value) return p->type == JsonNode::Float || p->type == JsonNode::Int || p->type == JsonNode::UInt;
+    else if constexpr (std::is_integral<U>::value) return p->type == JsonNode::Int || p->type == JsonNode::UInt;
+    else if constexpr (jsonIsText<U>) return p->type == JsonNode::Str;
+    else if constexpr (std::is_same<U, JsonArray>::value || std::is_same<U, JsonArrayConst>::value) return p->type == JsonNode::Arr;
+    else if constexpr (std::is_same<U, JsonObject>::value || std::is_same<U, JsonObjectConst>::value) return p->type == JsonNode::Obj;
+    else return true;
+  }
+
+  template <class T> T as() const {
+    const JsonNode* p = resolve();
+    using U = std::remove_cv_t<T>;
+    if constexpr (jsonIsHandle<U>) {
+      if constexpr (std::is_same<U, JsonArray>::value || std::is_same<U, JsonArrayConst>::value) {
+        if (!p || p->type != JsonNode::Arr) return U();
+      } else if constexpr (std::is_same<U, JsonObject>::value || std::is_same<U, JsonObjectConst>::value) {
+        if (!p || p->type != JsonNode::Obj) return U();
+      }
+      return U(*this);
+    } else if constexpr (std::is_same<U, bool>::value) {
+      if (!p) return false;
+      return p->type == JsonNode::Bool ? p->b : (p->type == JsonNode::Int || p->type == JsonNode::UInt) ? p->u != 0 : false;
+    } else if constexpr (std::is_floating_point<U>::value) {
+      return p ? (U)p->number() : 0;
+    } else if constexpr (std::is_integral<U>::value || std::is_enum<U>::value) {
+      if (!p) return U();
+      if (p->type == JsonNode::Int) return (U)p->i;
+      if (p->type == JsonNode::UInt) return (U)p->u;
+      if (p->type == JsonNode::Float) return (U)(int64_t)p->f;
+      if (p->type == JsonNode::Bool) return (U)p->b;
+      return U();
+    } else if constexpr (std::is_same<U, String>::value) {
+      return String(p && p->type == JsonNode::Str ? p->s.c_str() : "null");
+    } else {
+      static_assert(std::is_convertible<const char*, U>::value, "unsupported JSON value type");
+      return p && p->type == JsonNode::Str ? p->s.c_str() : nullptr;
+    }
+  }
+
+  template <class T, std::enable_if_t<jsonIsScalar<T>, int> = 0>
+  operator T() const { return as<T>(); }
+
+  const char* operator|(const char* d) const {
+    const char* s = as<const char*>();
+    return s ? s : d;
+  }
+  template <class T, std::enable_if_t<!std::is_convertible<T, const char*>::value, int> = 0>
+  T operator|(const T& d) const { return is<T>() ? as<T>() : d; }
+};
+
+#define JSON_SHIM_HANDLE(Name)                          \
+  class Name : public JsonVar {                         \
+  public:                                               \
+    Name() = default;                                   \
+    Name(const JsonVar& v) : JsonVar(v) {}              \
+    using JsonVar::operator=;                           \
+  };
+JSON_SHIM_HANDLE(JsonVariant)
+JSON_SHIM_HANDLE(JsonVariantConst)
+JSON_SHIM_HANDLE(JsonObject)
+JSON_SHIM_HANDLE(JsonObjectConst)
+JSON_SHIM_HANDLE(JsonArray)
+JSON_SHIM_HANDLE(JsonArrayConst)
+#undef JSON_SHIM_HANDLE
+
+inline JsonVar JsonIter::operator*() const { return JsonVar(p->items[k].get()); }
+
+inline JsonObject JsonVar::createNestedObject() const { return add<JsonObject>(); }
+inline JsonArray JsonVar::createNestedArray() const { return add<JsonArray>(); }
+template <class K> JsonObject JsonVar::createNestedObject(const K& k) const {
+  JsonNode* c = (*this)[k].make();
+  if (c) c->become(JsonNode::Obj);
+  return JsonObject(JsonVar(c));
+}
+template <class K> JsonArray JsonVar::createNestedArray(const K& k) const {
+  JsonNode* c = (*this)[k].make();
+  if (c) c->become(JsonNode::Arr);
+  return JsonArray(JsonVar(c));
+}
+
+/* ------------------------ DOCUMENTS ------------------------ */
+class JsonDocument : public JsonVar {
+  std::unique_ptr<JsonNode> root;
+  size_t cap;
+
+public:
+  explicit JsonDocument(size_t capacity = 0) : root(new JsonNode), cap(capacity) { n = root.get(); }
+  JsonDocument(const JsonDocument& o) : JsonDocument(o.cap) { root->copyFrom(*o.root); }
+  JsonDocument& operator=(const JsonDocument& o) {
+    root->copyFrom(*o.root);
+    return *this;
+  }
+  using JsonVar::operator=;
+  void clear() { root->reset(); }
+  bool overflowed() const { return false; }
+  size_t memoryUsage() const { return 0; }
+  size_t capacity() const { return cap; }
+};
+
+template <size_t N> class StaticJsonDocument : public JsonDocument {
+public:
+  StaticJsonDocument() : JsonDocument(N) {}
+  using JsonDocument::operator=;
+};
+
+class DynamicJsonDocument : public JsonDocument {
+public:
+  explicit DynamicJsonDocument(size_t capacity) : JsonDocument(capacity) {}
+  using JsonDocument::operator=;
+};
+
+namespace DeserializationOption {
+struct Filter {
+  const JsonNode* f;
+  Filter(const JsonVar& v) : f(v.resolve()) {}
+};
+struct NestingLimit {
+  int depth;
+  NestingLimit(int d = 10) : depth(d) {}
+};
+}  // namespace DeserializationOption
+
+/* ------------------------ CODECS ------------------------ */
+namespace jsonshim {
+
+inline void writeJsonString(const std::string& s, std::string& out) {
+  out += '"';
+  for (unsigned char c : s) {
+    switch (c) {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\b': out += "\\b"; break;
+      case '\f': out += "\\f"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      default:
+        if (c < 0x20) {
+          char esc[8];
+          snprintf(esc, sizeof(esc), "\\u%04x", c);
+          out += esc;
+        } else {
+          out += (char)c;
+        }
+    }
+  }
+  out += '"';
+}
+
+// Shortest form that reads back to the same value, within the 9
+// significant digits ArduinoJson prints; NaN and infinities as null
+inline void writeJsonFloat(double v, std::string& out) {
+  if (v != v || v - v != 0) {
+    out += "null";
+    return;
+  }
+  char buf[32];
+  for (int prec = 1; prec <= 9; prec++) {
+    snprintf(buf, sizeof(buf), "%.*g", prec, v);
+    if (strtod(buf, nullptr) == v || prec == 9) break;
+  }
+  out += buf;
+}
+
+inline void writeJson(const JsonNode* p, std::string& out) {
+  if (!p) {
+    out += "null";
+    return;
+  }
+  char num[24];
+  switch (p->type) {
+    case JsonNode::Null: out += "null"; break;
+    case JsonNode::Bool: out += p->b ? "true" : "false"; break;
+    case JsonNode::Int: snprintf(num, sizeof(num), "%lld", (long long)p->i); out += num; break;
+    case JsonNode::UInt: snprintf(num, sizeof(num), "%llu", (unsigned long long)p->u); out += num; break;
+    case JsonNode::Float: writeJsonFloat(p->f, out); break;
+    case JsonNode::Str: writeJsonString(p->s, out); break;
+    case JsonNode::Arr:
+      out += '[';
+      for (size_t k = 0; k < p->items.size(); k++) {
+        if (k) out += ',';
+        writeJson(p->items[k].get(), out);
+      }
+      out += ']';
+      break;
+    case JsonNode::Obj:
+      out += '{';
+      for (size_t k = 0; k < p->items.size(); k++) {
+        if (k) out += ',';
+        writeJsonString(p->keys[k], out);
+        out += ':';
+        writeJson(p->items[k].get(), out);
+      }
+      out += '}';
+      break;
+  }
+}
+
+inline void putBE(std::string& out, uint64_t v, int bytes) {
+  for (int k = bytes - 1; k >= 0; k--) out += (char)(uint8_t)(v >> (8 * k));
+}
+
+inline void writeMsgPackUnsigned(uint64_t v, std::string& out) {
+  if (v <= 0x7F) putBE(out, v, 1);
+  else if (v <= 0xFF) { out += (char)0xCC; putBE(out, v, 1); }
+  else if (v <= 0xFFFF) { out += (char)0xCD; putBE(out, v, 2); }
+  else if (v <= 0xFFFFFFFFULL) { out += (char)0xCE; putBE(out, v, 4); }
+  else { out += (char)0xCF; putBE(out, v, 8); }
+}
+
+inline void writeMsgPackString(const std::string& s, std::string& out) {
+  size_t len = s.size();
+  if (len < 0x20) putBE(out, 0xA0 | len, 1);
+  else if (len < 0x100) { out += (char)0xD9; putBE(out, len, 1); }
+  else if (len < 0x10000) { out += (char)0xDA; putBE(out, len, 2); }
+  else { out += (char)0xDB; putBE(out, len, 4); }
+  out += s;
+}
+
+inline void writeMsgPackHeader(size_t count, uint8_t fix, uint8_t m16, std::string& out) {
+  if (count < 0x10) putBE(out, fix | count, 1);
+  else if (count < 0x10000) { out += (char)m16; putBE(out, count, 2); }
+  else { out += (char)(m16 + 1); putBE(out, count, 4); }
+}
+
+inline void writeMsgPack(const JsonNode* p, std::string& out) {
+  if (!p) {
+    out += (char)0xC0;
+    return;
+  }
+  switch (p->type) {
+    case JsonNode::Null: out += (char)0xC0; break;
+    case JsonNode::Bool: out += (char)(p->b ? 0xC3 : 0xC2); break;
+    case JsonNode::UInt: writeMsgPackUnsigned(p->u, out); break;
+    case JsonNode::Int: {
+      int64_t v = p->i;
+      if (v >= -0x20) putBE(out, (uint64_t)v, 1);
+      else if (v >= -0x80) { out += (char)0xD0; putBE(out, (uint64_t)v, 1); }
+      else if (v >= -0x8000) { out += (char)0xD1; putBE(out, (uint64_t)v, 2); }
+      else if (v >= -0x80000000LL) { out += (char)0xD2; putBE(out, (uint64_t)v, 4); }
+      else { out += (char)0xD3; putBE(out, (uint64_t)v, 8); }
+      break;
+    }
+    case JsonNode::Float: {
+      float f32 = (float)p->f;
+      if ((double)f32 == p->f) {
+        uint32_t bits;
+        memcpy(&bits, &f32, sizeof(bits));
+        out += (char)0xCA;
+        putBE(out, bits, 4);
+      } else {
+        uint64_t bits;
+        memcpy(&bits, &p->f, sizeof(bits));
+        out += (char)0xCB;
+        putBE(out, bits, 8);
+      }
+      break;
+    }
+    case JsonNode::Str: writeMsgPackString(p->s, out); break;
+    case JsonNode::Arr:
+      writeMsgPackHeader(p->items.size(), 0x90, 0xDC, out);
+      for (const auto& c : p->items) writeMsgPack(c.get(), out);
+      break;
+    case JsonNode::Obj:
+      writeMsgPackHeader(p->items.size(), 0x80, 0xDE, out);
+      for (size_t k = 0; k < p->items.size(); k++) {
+        writeMsgPackString(p->keys[k], out);
+        writeMsgPack(p->items[k].get(), out);
+      }
+      break;
+  }
+}
+
+/* --- parsers: both read into a node, depth-limited --- */
+struct Reader {
+  const uint8_t* p;
+  const uint8_t* end;
+  int depthLeft;
+  bool more() const { return p < end; }
+};
+
+inline void skipSpace(Reader& r) {
+  while (r.more() && (*r.p == ' ' || *r.p == '\t' || *r.p == '\r' || *r.p == '\n')) r.p++;
+}
+
+inline void appendUtf8(std::string& s, uint32_t cp) {
+  if (cp < 0x80) s += (char)cp;
+  else if (cp < 0x800) { s += (char)(0xC0 | (cp >> 6)); s += (char)(0x80 | (cp & 0x3F)); }
+  else if (cp < 0x10000) { s += (char)(0xE0 | (cp >> 12)); s += (char)(0x80 | ((cp >> 6) & 0x3F)); s += (char)(0x80 | (cp & 0x3F)); }
+  else {
+    s += (char)(0xF0 | (cp >> 18)); s += (char)(0x80 | ((cp >> 12) & 0x3F));
+    s += (char)(0x80 | ((cp >> 6) & 0x3F)); s += (char)(0x80 | (cp & 0x3F));
+  }
+}
+
+inline DeserializationError::Code readHex4(Reader& r, uint32_t& v) {
+  v = 0;
+  for (int k = 0; k < 4; k++) {
+    if (!r.more()) return DeserializationError::IncompleteInput;
+    uint8_t c = *r.p++;
+    v <<= 4;
+    if (c >= '0' && c <= '9') v |= c - '0';
+    else if (c >= 'a' && c <= 'f') v |= c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F') v |= c - 'A' + 10;
+    else return DeserializationError::InvalidInput;
+  }
+  return DeserializationError::Ok;
+}
+
+inline DeserializationError::Code parseJsonString(Reader& r, std::string& s) {
+  r.p++;  // opening quote
+  while (true) {
+    if (!r.more()) return DeserializationError::IncompleteInput;
+    uint8_t c = *r.p++;
+    if (c == '"') return DeserializationError::Ok;
+    if (c != '\\') {
+      s += (char)c;
+      continue;
+    }
+    if (!r.more()) return DeserializationError::IncompleteInput;
+    c = *r.p++;
+    switch (c) {
+      case '"': case '\\': case '/': s += (char)c; break;
+      case 'b': s += '\b'; break;
+      case 'f': s += '\f'; break;
+      case 'n': s += '\n'; break;
+      case 'r': s += '\r'; break;
+      case 't': s += '\t'; break;
+      case 'u': {
+        uint32_t cp;
+        DeserializationError::Code e = readHex4(r, cp);
+        if (e != DeserializationError::Ok) return e;
+        if (cp >= 0xD800 && cp < 0xDC00 && r.end - r.p >= 6 && r.p[0] == '\\' && r.p[1] == 'u') {
+          r.p += 2;
+          uint32_t lo;
+          e = readHex4(r, lo);
+          if (e != DeserializationError::Ok) return e;
+          cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+        }
+        appendUtf8(s, cp);
+        break;
+      }
+      default: return DeserializationError::InvalidInput;
+    }
+  }
+}
+
+inline bool matchWord(Reader& r, const char* w) {
+  size_t len = strlen(w);
+  if ((size_t)(r.end - r.p) < len || memcmp(r.p, w, len) != 0) return false;
+  r.p += len;
+  return true;
+}
+
+inline DeserializationError::Code parseJsonValue(Reader& r, JsonNode& out) {
+  skipSpace(r);
+  if (!r.more()) return DeserializationError::IncompleteInput;
+  uint8_t c = *r.p;
+  if (c == '{' || c == '[') {
+    if (r.depthLeft-- <= 0) return DeserializationError::TooDeep;
+    bool obj = c == '{';
+    out.become(obj ? JsonNode::Obj : JsonNode::Arr);
+    r.p++;
+    skipSpace(r);
+    if (r.more() && *r.p == (obj ? '}' : ']')) {
+      r.p++;
+      r.depthLeft++;
+      return DeserializationError::Ok;
+    }
+    while (true) {
+      JsonNode* item;
+      if (obj) {
+        skipSpace(r);
+        if (!r.more()) return DeserializationError::IncompleteInput;
+        if (*r.p != '"') return DeserializationError::InvalidInput;
+        std::string k;
+        DeserializationError::Code e = parseJsonString(r, k);
+        if (e != DeserializationError::Ok) return e;
+        skipSpace(r);
+        if (!r.more()) return DeserializationError::IncompleteInput;
+        if (*r.p++ != ':') return DeserializationError::InvalidInput;
+        item = out.member(k.c_str());
+        if (item) item->reset();
+        else item = out.addMember(k.c_str());
+      } else {
+        item = out.addItem();
+      }
+      DeserializationError::Code e = parseJsonValue(r, *item);
+      if (e != DeserializationError::Ok) return e;
+      skipSpace(r);
+      if (!r.more()) return DeserializationError::IncompleteInput;
+      uint8_t sep = *r.p++;
+      if (sep == (obj ? '}' : ']')) break;
+      if (sep != ',') return DeserializationError::InvalidInput;
+    }
+    r.depthLeft++;
+    return DeserializationError::Ok;
+  }
+  if (c == '"') {
+    out.become(JsonNode::Str);
+    return parseJsonString(r, out.s);
+  }
+  if (matchWord(r, "true")) { out.become(JsonNode::Bool); out.b = true; return DeserializationError::Ok; }
+  if (matchWord(r, "false")) { out.become(JsonNode::Bool); return DeserializationError::Ok; }
+  if (matchWord(r, "null")) { out.reset(); return DeserializationError::Ok; }
+
+  const uint8_t* start = r.p;
+  bool real = false;
+  while (r.more() && (isdigit(*r.p) || *r.p == '-' || *r.p == '+' || *r.p == '.' || *r.p == 'e' || *r.p == 'E')) {
+    if (*r.p == '.' || *r.p == 'e' || *r.p == 'E') real = true;
+    r.p++;
+  }
+  if (r.p == start) return DeserializationError::InvalidInput;
+  std::string text((const char*)start, r.p - start);
+  char* stop = nullptr;
+  errno = 0;
+  if (!real && text[0] == '-') {
+    long long v = strtoll(text.c_str(), &stop, 10);
+    if (*stop == '\0' && errno == 0) { out.setSigned(v); return DeserializationError::Ok; }
+  } else if (!real) {
+    unsigned long long v = strtoull(text.c_str(), &stop, 10);
+    if (*stop == '\0' && errno == 0) { out.setUnsigned(v); return DeserializationError::Ok; }
+  }
+  double d = strtod(text.c_str(), &stop);
+  if (*stop != '\0') return DeserializationError::InvalidInput;
+  out.become(JsonNode::Float);
+  out.f = d;
+  return DeserializationError::Ok;
+}
+
+inline bool readBE(Reader& r, int bytes, uint64_t& v) {
+  if (r.end - r.p < bytes) return false;
+  v = 0;
+  for (int k = 0; k < bytes; k++) v = (v << 8) | *r.p++;
+  return true;
+}
+
+inline DeserializationError::Code parseMsgPackValue(Reader& r, JsonNode& out);
+
+inline DeserializationError::Code parseMsgPackString(Reader& r, size_t len, std::string& s) {
+  if ((size_t)(r.end - r.p) < len) return DeserializationError::IncompleteInput;
+  s.assign((const char*)r.p, len);
+  r.p += len;
+  return DeserializationError::Ok;
+}
+
+inline DeserializationError::Code parseMsgPackContainer(Reader& r, JsonNode& out, bool obj, size_t count) {
+  if (r.depthLeft-- <= 0) return DeserializationError::TooDeep;
+  out.become(obj ? JsonNode::Obj : JsonNode::Arr);
+  for (size_t k = 0; k < count; k++) {
+    JsonNode* item;
+    if (obj) {
+      JsonNode key;
+      DeserializationError::Code e = parseMsgPackValue(r, key);
+      if (e != DeserializationError::Ok) return e;
+      if (key.type != JsonNode::Str) return DeserializationError::InvalidInput;
+      item = out.member(key.s.c_str());
+      if (item) item->reset();
+      else item = out.addMember(key.s.c_str());
+    } else {
+      item = out.addItem();
+    }
+    DeserializationError::Code e = parseMsgPackValue(r, *item);
+    if (e != DeserializationError::Ok) return e;
+  }
+  r.depthLeft++;
+  return DeserializationError::Ok;
+}
+
+inline DeserializationError::Code parseMsgPackValue(Reader& r, JsonNode& out) {
+  if (!r.more()) return DeserializationError::IncompleteInput;
+  uint8_t c = *r.p++;
+  uint64_t v;
+  const DeserializationError::Code short_ = DeserializationError::IncompleteInput;
+  if (c <= 0x7F) { out.setUnsigned(c); return DeserializationError::Ok; }
+  if (c >= 0xE0) { out.setSigned((int8_t)c); return DeserializationError::Ok; }
+  if ((c & 0xF0) == 0x80) return parseMsgPackContainer(r, out, true, c & 0x0F);
+  if ((c & 0xF0) == 0x90) return parseMsgPackContainer(r, out, false, c & 0x0F);
+  if ((c & 0xE0) == 0xA0) { out.become(JsonNode::Str); return parseMsgPackString(r, c & 0x1F, out.s); }
+  switch (c) {
+    case 0xC0: out.reset(); return DeserializationError::Ok;
+    case 0xC2: case 0xC3: out.become(JsonNode::Bool); out.b = c == 0xC3; return DeserializationError::Ok;
+    case 0xCA: {
+      if (!readBE(r, 4, v)) return short_;
+      uint32_t bits = (uint32_t)v;
+      float f;
+      memcpy(&f, &bits, sizeof(f));
+      out.become(JsonNode::Float);
+      out.f = f;
+      return DeserializationError::Ok;
+    }
+    case 0xCB:
+      if (!readBE(r, 8, v)) return short_;
+      out.become(JsonNode::Float);
+      memcpy(&out.f, &v, sizeof(out.f));
+      return DeserializationError::Ok;
+    case 0xCC: case 0xCD: case 0xCE: case 0xCF:
+      if (!readBE(r, 1 << (c - 0xCC), v)) return short_;
+      out.setUnsigned(v);
+      return DeserializationError::Ok;
+    case 0xD0: if (!readBE(r, 1, v)) return short_; out.setSigned((int8_t)v); return DeserializationError::Ok;
+    case 0xD1: if (!readBE(r, 2, v)) return short_; out.setSigned((int16_t)v); return DeserializationError::Ok;
+    case 0xD2: if (!readBE(r, 4, v)) return short_; out.setSigned((int32_t)v); return DeserializationError::Ok;
+    case 0xD3: if (!readBE(r, 8, v)) return short_; out.setSigned((int64_t)v); return DeserializationError::Ok;
+    case 0xD9: case 0xDA: case 0xDB:
+      if (!readBE(r, 1 << (c - 0xD9), v)) return short_;
+      out.become(JsonNode::Str);
+      return parseMsgPackString(r, (size_t)v, out.s);
+    case 0xDC: case 0xDD:
+      if (!readBE(r, c == 0xDC ? 2 : 4, v)) return short_;
+      return parseMsgPackContainer(r, out, false, (size_t)v);
+    case 0xDE: case 0xDF:
+      if (!readBE(r, c == 0xDE ? 2 : 4, v)) return short_;
+      return parseMsgPackContainer(r, out, true, (size_t)v);
+    default:
+      return DeserializationError::InvalidInput;  // bin, ext: not used on these topics
+  }
+}
+
+// Keeps what the filter marks true; a filter object's "*" stands for any key
+inline void applyFilter(JsonNode& n, const JsonNode* f) {
+  if (!f || f->type == JsonNode::Bool) {
+    if (!f || !f->b) n.reset();
+    return;
+  }
+  if (f->type == JsonNode::Obj && n.type == JsonNode::Obj) {
+    const JsonNode* any = f->member("*");
+    for (size_t k = n.keys.size(); k-- > 0;) {
+      const JsonNode* fk = f->member(n.keys[k].c_str());
+      if (!fk) fk = any;
+      if (!fk || (fk->type == JsonNode::Bool && !fk->b)) {
+        n.keys.erase(n.keys.begin() + k);
+        n.items.erase(n.items.begin() + k);
+      } else {
+        applyFilter(*n.items[k], fk);
+      }
+    }
+  } else if (f->type == JsonNode::Arr && n.type == JsonNode::Arr) {
+    const JsonNode* each = f->items.empty() ? nullptr : f->items[0].get();
+    for (auto& c : n.items) applyFilter(*c, each);
+  } else {
+    n.reset();
+  }
+}
+
+inline DeserializationError run(JsonDocument& doc, const uint8_t* in, size_t len, const JsonNode* filter, bool json) {
+  doc.clear();
+  Reader r = {in, in + len, 10};
+  if (!in || len == 0) return DeserializationError::EmptyInput;
+  if (json) {
+    skipSpace(r);
+    if (!r.more()) return DeserializationError::EmptyInput;
+  }
+  JsonNode& root = *doc.make();
+  DeserializationError::Code e = json ? parseJsonValue(r, root) : parseMsgPackValue(r, root);
+  if (e != DeserializationError::Ok) {
+    root.reset();
+    return e;
+  }
+  if (filter) applyFilter(root, filter);
+  return DeserializationError::Ok;
+}
+
+inline std::string readStream(Stream& s) {
+  std::string all;
+  int c;
+  while ((c = s.read()) >= 0) all += (char)c;
+  return all;
+}
+
+inline size_t emit(const std::string& s, char* buf, size_t size) {
+  size_t n = std::min(s.size(), size);
+  memcpy(buf, s.data(), n);
+  if (n < size) buf[n] = '\0';
+  return n;
+}
+inline size_t emit(const std::string& s, uint8_t* buf, size_t size) { return emit(s, (char*)buf, size); }
+inline size_t emit(const std::string& s, String& out) {
+  out += s.c_str();
+  return s.size();
+}
+inline size_t emit(const std::string& s, std::string& out) {
+  out += s;
+  return s.size();
+}
+inline size_t emit(const std::string& s, Print& out) { return out.write((const uint8_t*)s.data(), s.size()); }
+
+}  // namespace jsonshim
+
+/* ------------------------ ENTRY POINTS ------------------------ */
+#define JSON_SHIM_DESERIALIZE(fn, json)                                                                     \
+  inline DeserializationError fn(JsonDocument& doc, const uint8_t* in, size_t len,                             \
+                                 DeserializationOption::Filter filter,                                         \
+                                 DeserializationOption::NestingLimit = {}) {                                   \
+    return jsonshim::run(doc, in, len, filter.f, json);                                            \
+  }                                                                                                            \
+  inline DeserializationError fn(JsonDocument& doc, const uint8_t* in, size_t len,                             \
+                                 DeserializationOption::NestingLimit = {}) {                                   \
+    return jsonshim::run(doc, in, len, nullptr, json);                                             \
+  }                                                                                                            \
+  inline DeserializationError fn(JsonDocument& doc, const char* in, size_t len,                                \
+                                 DeserializationOption::Filter filter,                                         \
+                                 DeserializationOption::NestingLimit = {}) {                                   \
+    return fn(doc, (const uint8_t*)in, len, filter);                                                           \
+  }                                                                                                            \
+  inline DeserializationError fn(JsonDocument& doc, const char* in, size_t len,                                \
+                                 DeserializationOption::NestingLimit = {}) {                                   \
+    return fn(doc, (const uint8_t*)in, len);                                                                   \
+  }                                                                                                            \
+  inline DeserializationError fn(JsonDocument& doc, const char* in) { return fn(doc, in, in ? strlen(in) : 0); } \
+  inline DeserializationError fn(JsonDocument& doc, const String& in) { return fn(doc, in.c_str()); }          \
+  inline DeserializationError fn(JsonDocument& doc, Stream& in) {                                              \
+    std::string all = jsonshim::readStream(in);                                                                \
+    return fn(doc, all.data(), all.size());                                                                    \
+  }
+JSON_SHIM_DESERIALIZE(deserializeJson, true)
+JSON_SHIM_DESERIALIZE(deserializeMsgPack, false)
+#undef JSON_SHIM_DESERIALIZE
+
+inline std::string jsonShimText(const JsonVar& v) {
+  std::string s;
+  jsonshim::writeJson(v.resolve(), s);
+  return s;
+}
+inline std::string jsonShimMsgPack(const JsonVar& v) {
+  std::string s;
+  jsonshim::writeMsgPack(v.resolve(), s);
+  return s;
+}
+
+template <class Out> size_t serializeJson(const JsonVar& v, Out& out) { return jsonshim::emit(jsonShimText(v), out); }
+template <class Out> size_t serializeMsgPack(const JsonVar& v, Out& out) { return jsonshim::emit(jsonShimMsgPack(v), out); }
+inline size_t serializeJson(const JsonVar& v, char* buf, size_t size) { return jsonshim::emit(jsonShimText(v), buf, size); }
+inline size_t serializeJson(const JsonVar& v, uint8_t* buf, size_t size) { return jsonshim::emit(jsonShimText(v), buf, size); }
+inline size_t serializeMsgPack(const JsonVar& v, char* buf, size_t size) { return jsonshim::emit(jsonShimMsgPack(v), buf, size); }
+inline size_t serializeMsgPack(const JsonVar& v, uint8_t* buf, size_t size) { return jsonshim::emit(jsonShimMsgPack(v), buf, size); }
+inline size_t measureJson(const JsonVar& v) { return jsonShimText(v).size(); }
+inline size_t measureMsgPack(const JsonVar& v) { return jsonShimMsgPack(v).size(); }
@@ -0,0 +1,81 @@
+/* ===========================================================
+   HOST SHIM: ESP32 FS / SPIFFS
+   Files live in memory for the run; gateway unit only (the
+   node firmware has no filesystem).
+   =========================================================== */
+#pragma once
+#include <Arduino.h>
+
+#define FILE_READ   "r"
+#define FILE_WRITE  "w"
+#define FILE_APPEND "a"
+
+typedef std::vector<uint8_t> SimFileData;
+
+class File : public Stream {
+  SimFileData* data = nullptr;
+  size_t pos = 0;
+  bool writable = false;
+
+public:
+  File() {}
+  File(SimFileData* d, size_t at, bool w) : data(d), pos(at), writable(w) {}
+  operator bool() const { return data != nullptr; }
+  void close() { data = nullptr; }
+  size_t size() const { return data ? data->size() : 0; }
+  size_t position() const { return pos; }
+  bool seek(uint32_t at) {
+    if (!data || at > data->size()) return false;
+    pos = at;
+    return true;
+  }
+  int available() override { return data ? (int)(data->size() - pos) : 0; }
+  int read() override { return available() > 0 ? (*data)[pos++] : -1; }
+  int peek() override { return available() > 0 ? (*data)[pos] : -1; }
+  size_t read(uint8_t* b, size_t n) {
+    n = std::min(n, (size_t)std::max(available(), 0));
+    if (n) memcpy(b, data->data() + pos, n);
+    pos += n;
+    return n;
+  }
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* b, size_t n) override {
+    if (!data || !writable) return 0;
+    if (data->size() < pos + n) data->resize(pos + n);
+    memcpy(data->data() + pos, b, n);
+    pos += n;
+    return n;
+  }
+  using Print::write;
+};
+
+class FSImpl {
+  std::map<std::string, SimFileData> files;
+
+public:
+  bool begin(bool = false) { return true; }
+  bool exists(const char* path) { return files.count(path) > 0; }
+  File open(const char* path, const char* mode = FILE_READ) {
+    if (mode[0] == 'r') {
+      auto it = files.find(path);
+      return it == files.end() ? File() : File(&it->second, 0, false);
+    }
+    SimFileData& d = files[path];
+    if (mode[0] == 'w') d.clear();
+    return File(&d, d.size(), true);
+  }
+  bool remove(const char* path) { return files.erase(path) > 0; }
+  bool rename(const char* from, const char* to) {
+    auto it = files.find(from);
+    if (it == files.end()) return false;
+    files[to] = std::move(it->second);
+    files.erase(from);
+    return true;
+  }
+  size_t totalBytes() { return 1441792; }
+  size_t usedBytes() {
+    size_t n = 0;
+    for (auto& f : files) n += f.second.size();
+    return n;
+  }
+};
@@ -0,0 +1,64 @@
+/* ===========================================================
+   HOST SHIM: sandeepmistry LoRa library
+   Forwards to the simulated radio of the running unit; the
+   frame being written is buffered here until endPacket().
+   =========================================================== */
+#pragma once
+#include <Arduino.h>
+
+class LoRaClass : public Stream {
+  uint8_t txBuf[64];
+  uint8_t txLen = 0;
+  void (*rxCb)(int) = nullptr;
+  void (*txCb)() = nullptr;
+
+public:
+  void setPins(int, int, int) {}
+  int begin(long freq) {
+    simRadioSet(SIM_FREQ, freq);
+    simRadioMode(SIM_MODE_IDLE);
+    return 1;
+  }
+  void end() { simRadioMode(SIM_MODE_IDLE); }
+
+  int beginPacket(int = 0) {
+    txLen = 0;
+    return 1;
+  }
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* b, size_t n) override {
+    size_t k = std::min(n, sizeof(txBuf) - txLen);
+    memcpy(txBuf + txLen, b, k);
+    txLen += (uint8_t)k;
+    return k;
+  }
+  using Print::write;
+  int endPacket(bool = false) { return simRadioTx(txBuf, txLen) ? 1 : 0; }
+
+  void onReceive(void (*cb)(int)) {
+    rxCb = cb;
+    simRadioCallbacks(rxCb, txCb);
+  }
+  void onTxDone(void (*cb)()) {
+    txCb = cb;
+    simRadioCallbacks(rxCb, txCb);
+  }
+  void receive(int = 0) { simRadioMode(SIM_MODE_RX); }
+  void idle() { simRadioMode(SIM_MODE_IDLE); }
+  void sleep() { simRadioMode(SIM_MODE_IDLE); }
+  int parsePacket(int = 0) { return simRadioParse(); }
+  int packetRssi() { return simRadioRssi(); }
+  float packetSnr() { return simRadioSnr(); }
+  int available() override { return simRadioAvailable(); }
+  int read() override { return simRadioRead(); }
+
+  void setFrequency(long v) { simRadioSet(SIM_FREQ, v); }
+  void setSpreadingFactor(int v) { simRadioSet(SIM_SF, v); }
+  void setSignalBandwidth(long v) { simRadioSet(SIM_BW, v); }
+  void setCodingRate4(int v) { simRadioSet(SIM_CR, v); }
+  void setTxPower(int v, int = 0) { simRadioSet(SIM_POWER, v); }
+  void setPreambleLength(long) {}
+  void setSyncWord(int) {}
+  void enableCrc() {}
+};
+extern LoRaClass LoRa;
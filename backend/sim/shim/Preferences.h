@@ -0,0 +1,80 @@
+/* ===========================================================
+   HOST SHIM: ESP32 Preferences (NVS)
+   Key/value pairs kept inline in the object, so a node's NVS
+   is part of its swapped state and survives setup() re-runs.
+   =========================================================== */
+#pragma once
+#include <Arduino.h>
+
+#ifndef SIM_PREFS_CAP
+#define SIM_PREFS_CAP 16
+#endif
+
+class Preferences {
+  struct Entry {
+    char    ns[16];
+    char    key[16];
+    uint8_t len;
+    uint8_t val[32];
+  };
+  Entry   entries[SIM_PREFS_CAP] = {};
+  uint8_t used = 0;
+  char    ns[16] = {};
+
+  Entry* find(const char* key, bool create) {
+    for (uint8_t i = 0; i < used; i++) {
+      if (strcmp(entries[i].ns, ns) == 0 && strncmp(entries[i].key, key, 15) == 0) return &entries[i];
+    }
+    if (!create || used == SIM_PREFS_CAP) return nullptr;
+    Entry& e = entries[used++];
+    snprintf(e.ns, sizeof(e.ns), "%s", ns);
+    snprintf(e.key, sizeof(e.key), "%.*s", (int)sizeof(e.key) - 1, key);
+    return &e;
+  }
+  size_t put(const char* key, const void* v, size_t n) {
+    Entry* e = find(key, true);
+    if (!e || n > sizeof(e->val)) return 0;
+    memcpy(e->val, v, n);
+    e->len = (uint8_t)n;
+    return n;
+  }
+  template <class T> T get(const char* key, T d) {
+    Entry* e = find(key, false);
+    if (!e || e->len != sizeof(T)) return d;
+    T v;
+    memcpy(&v, e->val, sizeof(T));
+    return v;
+  }
+
+public:
+  bool begin(const char* name, bool = false) {
+    strncpy(ns, name, sizeof(ns) - 1);
+    return true;
+  }
+  void end() {}
+  bool remove(const char* key) {
+    Entry* e = find(key, false);
+    if (!e) return false;
+    *e = entries[--used];
+    return true;
+  }
+
+  size_t putBool(const char* k, bool v) { return put(k, &v, sizeof(v)); }
+  size_t putUChar(const char* k, uint8_t v) { return put(k, &v, sizeof(v)); }
+  size_t putShort(const char* k, int16_t v) { return put(k, &v, sizeof(v)); }
+  size_t putUShort(const char* k, uint16_t v) { return put(k, &v, sizeof(v)); }
+  size_t putInt(const char* k, int32_t v) { return put(k, &v, sizeof(v)); }
+  size_t putUInt(const char* k, uint32_t v) { return put(k, &v, sizeof(v)); }
+  size_t putString(const char* k, const String& v) { return put(k, v.c_str(), v.length() + 1); }
+
+  bool getBool(const char* k, bool d = false) { return get(k, d); }
+  uint8_t getUChar(const char* k, uint8_t d = 0) { return get(k, d); }
+  int16_t getShort(const char* k, int16_t d = 0) { return get(k, d); }
+  uint16_t getUShort(const char* k, uint16_t d = 0) { return get(k, d); }
+  int32_t getInt(const char* k, int32_t d = 0) { return get(k, d); }
+  uint32_t getUInt(const char* k, uint32_t d = 0) { return get(k, d); }
+  String getString(const char* k, const String& d = String()) {
+    Entry* e = find(k, false);
+    return e ? String((const char*)e->val) : d;
+  }
+};
@@ -0,0 +1,31 @@
+/* ===========================================================
+   HOST SHIM: PubSubClient
+   Never connected in the simulator (see TinyGsmClient.h);
+   uplink events are read straight off the gateway's queue.
+   =========================================================== */
+#pragma once
+#include <Arduino.h>
+
+class PubSubClient : public Print {
+public:
+  PubSubClient(Client&) {}
+  void setServer(const char*, uint16_t) {}
+  void setCallback(void (*)(char*, uint8_t*, unsigned int)) {}
+  bool setBufferSize(uint16_t) { return true; }
+  uint16_t getBufferSize() { return 2048; }
+  void setKeepAlive(uint16_t) {}
+  void setSocketTimeout(uint16_t) {}
+  bool connect(const char*) { return false; }
+  bool connect(const char*, const char*, const char*, const char*, uint8_t, bool, const char*) { return false; }
+  bool connected() { return false; }
+  void disconnect() {}
+  bool loop() { return false; }
+  int state() { return -1; }
+  bool subscribe(const char*, uint8_t = 0) { return false; }
+  bool publish(const char*, const char*, bool = false) { return false; }
+  bool publish(const char*, const uint8_t*, unsigned int, bool = false) { return false; }
+  bool beginPublish(const char*, unsigned int, bool) { return false; }
+  int endPublish() { return 0; }
+  size_t write(uint8_t) override { return 0; }
+  size_t write(const uint8_t*, size_t) override { return 0; }
+};
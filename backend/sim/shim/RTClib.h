@@ -0,0 +1,22 @@
+/* ===========================================================
+   HOST SHIM: RTClib (DS3231)
+   Every node's RTC reads the simulator's wall clock.
+   =========================================================== */
+#pragma once
+#include <Arduino.h>
+
+class DateTime {
+  uint32_t s;
+
+public:
+  DateTime(uint32_t secs = 0) : s(secs) {}
+  uint8_t hour() const { return (uint8_t)(s / 3600 % 24); }
+  uint8_t minute() const { return (uint8_t)(s / 60 % 60); }
+  uint8_t second() const { return (uint8_t)(s % 60); }
+};
+
+class RTC_DS3231 {
+public:
+  bool begin() { return true; }
+  DateTime now() { return DateTime(simWallClockS()); }
+};
@@ -0,0 +1,2 @@
+#pragma once
+// HOST SHIM: nothing to do, the simulated radio is not on a bus
@@ -0,0 +1,32 @@
+/* ===========================================================
+   HOST SHIM: TinyGSM
+   The simulator does not run the uplink task, so the modem
+   never comes up; this only has to compile.
+   =========================================================== */
+#pragma once
+#include <Arduino.h>
+
+class TinyGsm {
+public:
+  TinyGsm(Stream&) {}
+  bool restart() { return false; }
+  bool init() { return false; }
+  bool isNetworkConnected() { return false; }
+  bool waitForNetwork(long = 0) { return false; }
+  bool isGprsConnected() { return false; }
+  bool gprsConnect(const char*, const char* = nullptr, const char* = nullptr) { return false; }
+  bool gprsDisconnect() { return true; }
+  int getSignalQuality() { return 0; }
+};
+
+class Client : public Stream {
+public:
+  virtual int connect(const char*, uint16_t) { return 0; }
+  virtual bool connected() { return false; }
+  virtual void stop() {}
+};
+
+class TinyGsmClient : public Client {
+public:
+  TinyGsmClient(TinyGsm&) {}
+};
@@ -0,0 +1,2 @@
+#pragma once
+// HOST SHIM: WiFi is not used by the firmware
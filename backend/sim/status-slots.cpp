@@ -0,0 +1,187 @@
+/* ===========================================================
+   STATUS SLOT SIMULATION (host)
+   Delivery ratio of periodic node status frames against node
+   count: free-running timers (pure ALOHA, the old behaviour)
+   versus beacon-synchronised slots (gateway "Status slots").
+
+   aloha/slots = delivered / sent, x/n/h = status reports
+   delivered per node per hour, plan = slots x length / rounds.
+
+   Build & run:
+     g++ -std=c++17 -O2 -o status-slots backend/sim/status-slots.cpp
+     ./status-slots [seed]
+   =========================================================== */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+/* ------------------------ MODEL ------------------------ */
+// Mirrors gateway.cpp / node.cpp; keep in sync when those change
+#define BEACON_INTERVAL     8000UL
+#define SLOT_GUARD_MS       30UL
+#define SLOT_CONTENTION_PCT 40
+#define SLOT_LATE_MS        15UL
+#define STATUS_INTERVAL     60000UL
+#define LORA_BW             125000UL
+#define LORA_CR             1        // 4/5
+#define SHORT_STATUS_LEN    7
+#define BEACON_LEN          15
+#define CONTROL_LEN         7        // ShortControlPkt
+#define ACK_LEN             6        // ShortAckPkt
+
+#define SIM_DURATION_MS     (6UL * 3600 * 1000)
+#define BEACON_LOSS_PCT     2        // beacons a node misses
+#define CLOCK_DRIFT_PPM     40       // per-node crystal error, +/-
+#define LOOP_JITTER_MS      10       // node loop() period
+#define CONTROL_PER_MIN     2        // gateway commands, network-wide
+
+struct Tx {
+  double start, end;
+  int node;       // -1 = gateway
+  bool status;
+};
+
+struct Result {
+  uint32_t sent = 0;
+  uint32_t delivered = 0;
+};
+
+double airtimeMs(uint8_t sf, uint8_t len) {
+  double tSym = (double)(1UL << sf) * 1000.0 / LORA_BW;
+  int de = tSym > 16.0 ? 1 : 0;
+  int num = 8 * len - 4 * sf + 28 + 16;
+  int den = 4 * (sf - 2 * de);
+  int nPayload = 8 + (num > 0 ? ((num + den - 1) / den) * (LORA_CR + 4) : 0);
+  return tSym * (8 + 4.25) + nPayload * tSym;
+}
+
+struct SlotPlan {
+  uint16_t slotMs;
+  uint8_t slotCount;
+  uint8_t rounds;
+};
+
+SlotPlan planSlots(uint8_t sf, uint16_t addressed) {
+  SlotPlan p = { 0, 0, 0 };
+  uint32_t slotMs = (uint32_t)airtimeMs(sf, SHORT_STATUS_LEN) + 1 + SLOT_GUARD_MS;
+  uint32_t fit = BEACON_INTERVAL * (100 - SLOT_CONTENTION_PCT) / 100 / slotMs;
+  if (addressed == 0 || fit == 0) return p;
+  if (fit > 255) fit = 255;
+  uint32_t count = addressed < fit ? addressed : fit;
+  uint32_t rounds = (addressed + count - 1) / count;
+  p.slotMs = (uint16_t)slotMs;
+  p.slotCount = (uint8_t)count;
+  p.rounds = (uint8_t)(rounds > 255 ? 255 : rounds);
+  return p;
+}
+
+/* ------------------------ TRAFFIC ------------------------ */
+// Gateway commands at random times, each answered by the node 5 ms later
+void addControlTraffic(std::vector<Tx> &air, uint8_t sf, int nodes, std::mt19937 &rng) {
+  std::exponential_distribution<double> gap(CONTROL_PER_MIN / 60000.0);
+  std::uniform_int_distribution<int> who(0, nodes - 1);
+  double ctl = airtimeMs(sf, CONTROL_LEN), ack = airtimeMs(sf, ACK_LEN);
+  for (double t = gap(rng); t < SIM_DURATION_MS; t += gap(rng)) {
+    air.push_back({ t, t + ctl, -1, false });
+    double a = t + ctl + 5;
+    air.push_back({ a, a + ack, who(rng), false });
+  }
+}
+
+void addAloha(std::vector<Tx> &air, uint8_t sf, int nodes, std::mt19937 &rng) {
+  std::uniform_real_distribution<double> phase(0, STATUS_INTERVAL);
+  std::uniform_real_distribution<double> drift(-CLOCK_DRIFT_PPM * 1e-6, CLOCK_DRIFT_PPM * 1e-6);
+  std::uniform_real_distribution<double> jitter(0, LOOP_JITTER_MS);
+  double len = airtimeMs(sf, SHORT_STATUS_LEN);
+  for (int n = 0; n < nodes; n++) {
+    double period = STATUS_INTERVAL * (1 + drift(rng));
+    for (double t = phase(rng); t < SIM_DURATION_MS; t += period + jitter(rng)) {
+      air.push_back({ t, t + len, n, true });
+    }
+  }
+}
+
+void addSlotted(std::vector<Tx> &air, uint8_t sf, int nodes, std::mt19937 &rng) {
+  std::uniform_int_distribution<int> pct(0, 99);
+  std::uniform_real_distribution<double> latency(0, SLOT_LATE_MS);
+  SlotPlan plan = planSlots(sf, (uint16_t)nodes);
+  double beaconLen = airtimeMs(sf, BEACON_LEN);
+  double len = airtimeMs(sf, SHORT_STATUS_LEN);
+  std::vector<double> lastStatus(nodes, -1e12);
+
+  uint16_t seq = 0;
+  for (double t = 0; t < SIM_DURATION_MS; t += BEACON_INTERVAL) {
+    seq++;
+    air.push_back({ t, t + beaconLen, -1, false });
+    double beaconEnd = t + beaconLen;
+    for (int n = 0; n < nodes; n++) {
+      if (seq % plan.rounds != n / plan.slotCount) continue;
+      if (pct(rng) < BEACON_LOSS_PCT) continue;
+      double slotAt = beaconEnd + (double)(n % plan.slotCount) * plan.slotMs;
+      if (slotAt - lastStatus[n] + BEACON_INTERVAL / 2 < STATUS_INTERVAL) continue;
+      double start = slotAt + latency(rng);
+      lastStatus[n] = start;
+      air.push_back({ start, start + len, n, true });
+    }
+  }
+}
+
+/* ------------------------ CHANNEL ------------------------ */
+// No capture effect: any overlap loses the status frame; the gateway is
+// also deaf while it transmits itself
+Result deliver(std::vector<Tx> &air) {
+  std::sort(air.begin(), air.end(), [](const Tx &a, const Tx &b) { return a.start < b.start; });
+  Result r;
+  std::vector<bool> lost(air.size(), false);
+  for (size_t i = 0; i < air.size(); i++) {
+    for (size_t j = i + 1; j < air.size() && air[j].start < air[i].end; j++) {
+      lost[i] = lost[j] = true;
+    }
+  }
+  for (size_t i = 0; i < air.size(); i++) {
+    if (!air[i].status) continue;
+    r.sent++;
+    if (!lost[i]) r.delivered++;
+  }
+  return r;
+}
+
+int main(int argc, char** argv) {
+  unsigned seed = argc > 1 ? (unsigned)strtoul(argv[1], nullptr, 10) : 1;
+  const uint8_t sfs[] = { 7, 10 };
+  const int counts[] = { 10, 25, 50, 100, 150, 200 };
+
+  printf("# %lu h simulated, status every %lu s, %d commands/min, seed %u\n",
+         SIM_DURATION_MS / 3600000, STATUS_INTERVAL / 1000, CONTROL_PER_MIN, seed);
+  printf("%-3s %-6s %-7s %-10s %-7s %-10s %-10s\n",
+         "sf", "nodes", "aloha", "aloha/n/h", "slots", "slots/n/h", "plan");
+
+  for (uint8_t sf : sfs) {
+    for (int nodes : counts) {
+      std::mt19937 rng(seed * 1000 + sf * 256 + nodes);
+      double hours = SIM_DURATION_MS / 3600000.0;
+
+      std::vector<Tx> aloha;
+      addAloha(aloha, sf, nodes, rng);
+      addControlTraffic(aloha, sf, nodes, rng);
+      Result a = deliver(aloha);
+
+      std::vector<Tx> slotted;
+      addSlotted(slotted, sf, nodes, rng);
+      addControlTraffic(slotted, sf, nodes, rng);
+      Result s = deliver(slotted);
+      SlotPlan plan = planSlots(sf, (uint16_t)nodes);
+
+      char planStr[32];
+      snprintf(planStr, sizeof(planStr), "%ux%ums/%u", plan.slotCount, plan.slotMs, plan.rounds);
+      printf("%-3u %-6d %-7.3f %-10.1f %-7.3f %-10.1f %-10s\n", sf, nodes,
+             a.sent ? (double)a.delivered / a.sent : 0, a.delivered / hours / nodes,
+             s.sent ? (double)s.delivered / s.sent : 0, s.delivered / hours / nodes, planStr);
+    }
+  }
+  return 0;
+}